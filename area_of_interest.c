@@ -0,0 +1,451 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Processing restricted to a window (bounding box in CRS units, -window) and / or
+*     an area of interest polygon (-aoi, any OGR vector file, CRS of the surface)
+*   - Only the window and the halo of the process chain (see chainHaloRadius) are read,
+*     polygons are rasterised into a mask of the window (cell centres inside)
+*   - Window is split in tiles of INCREMENTAL_TILE_SIZE cells, operators are run only on
+*     rectangles of tiles with cells in the mask (with their halo), like in incremental mode
+*   - Result in the mask is identical to processing the whole surface
+*   - Output is the clipped window (cells outside the mask are nodata), or with -patch
+*     the masked cells are written into an existing output of the surface grid
+*
+*   Use examples:
+*
+*       surfacetools inputfile.tiff harbour.tiff -window 385000 6671000 391000 6675000 -rollcoin 13 notrim
+*       surfacetools inputfile.tiff outputfile.tiff -aoi fairway.gpkg -patch -buffer -laplacian 50
+*/
+
+
+/*
+*   Windowed processing of a checked CLI chain (argv[3] onwards, window flags are skipped)
+*   - Exits if the window is empty, the AOI can't be used or the output can't be patched
+*/
+void runWindowedChain(int argc, const char *argv[]) {
+    double bbox[4] = {-HUGE_VAL, -HUGE_VAL, HUGE_VAL, HUGE_VAL};     // minx, miny, maxx, maxy
+    const char *aoifp = NULL;
+    char patch = FALSE;
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-window") == 0) {
+            for (int j = 0; j < 4; j++) {
+                bbox[j] = atof(argv[i+1+j]);
+            }
+        }   else if (strcmp(argv[i], "-aoi") == 0) {
+            aoifp = argv[i+1];
+        }   else if (strcmp(argv[i], "-patch") == 0) {
+            patch = TRUE;
+        }   else if (strcmp(argv[i], "-stats") == 0) {
+            setStatisticsPrinting(TRUE);
+        }
+        const int parameters = windowFlagParameters(argv[i]);
+        if (parameters > 0) {
+            i += parameters;
+        }
+    }
+
+    GDALAllRegister();
+    const char *readpath = inputFilePath(argv[1]);
+    GDALDatasetH input = (readpath != NULL) ? GDALOpen(readpath, GA_ReadOnly) : NULL;
+    if (input == NULL) {
+        printf("File read error. Recheck file path.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Polygons limit the window to their extent:
+    GDALDatasetH aoi = NULL;
+    if (aoifp != NULL) {
+        aoi = openAoi(aoifp, input, bbox);
+        if (aoi == NULL) {
+            printf("Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct WindowOutput out = {NULL, NULL, 0, 0, 0, 0, NULL};
+    if (surfaceWindow(input, bbox, &out) == FALSE) {
+        printf("Window doesn't overlap the surface, or the surface is rotated.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (aoi != NULL) {
+        out.mask = rasterizeAoi(aoi, input, &out);
+        GDALClose(aoi);
+        if (out.mask == NULL) {
+            printf("Area of interest can't be rasterised.\nExiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Output: existing surface grid or new clipped surface:
+    if (patch == TRUE) {
+        out.patch = GDALOpen(argv[2], GA_Update);
+        if (out.patch == NULL || sameSurfaceGrid(input, out.patch) == FALSE) {
+            printf("Patched output must exist and have the size, georeferencing and nodata value of the input: %s\nExiting.\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+    }   else {
+        out.clip = createClippedSurface(input, argv[1], &out);
+    }
+
+    const int tilerows = (out.rows + INCREMENTAL_TILE_SIZE - 1) / INCREMENTAL_TILE_SIZE;
+    const int tilecols = (out.cols + INCREMENTAL_TILE_SIZE - 1) / INCREMENTAL_TILE_SIZE;
+    const int halo = chainHaloRadius(argc, argv, 3);
+    char *tiles = maskedTiles(&out, tilerows, tilecols);
+    int count = 0;
+
+    for (int i = 0; i < tilerows * tilecols; i++) {
+        count += tiles[i];
+    }
+    printf("Window: %d x %d cells from row %d, column %d, processed tiles: %d of %d (halo %d cells)\n",
+           out.rows, out.cols, out.first_row, out.first_col, count, tilerows * tilecols, halo);
+
+    // Rectangles of masked tiles (halo is read once per rectangle):
+    printf("Processing window..");
+    fflush(stdout);
+    struct ProgressReporter saved = progress;
+    progress.callback = ignoreProgress;
+    char success = TRUE;
+    int windows = 0;
+
+    for (int tilerow = 0; tilerow < tilerows && success == TRUE; tilerow++) {
+        for (int tilecol = 0; tilecol < tilecols && success == TRUE; tilecol++) {
+            int last_row, last_col;
+
+            if (nextAffectedRect(tiles, tilerows, tilecols, tilerow, tilecol, &last_row, &last_col) == FALSE) {
+                continue;
+            }
+
+            const int first_row = tilerow * INCREMENTAL_TILE_SIZE;
+            const int first_col = tilecol * INCREMENTAL_TILE_SIZE;
+            const int rows = ((last_row * INCREMENTAL_TILE_SIZE < out.rows) ? last_row * INCREMENTAL_TILE_SIZE : out.rows) - first_row;
+            const int cols = ((last_col * INCREMENTAL_TILE_SIZE < out.cols) ? last_col * INCREMENTAL_TILE_SIZE : out.cols) - first_col;
+
+            success = processWindowRect(input, &out, first_row, first_col, rows, cols, halo, argc, argv);
+            windows++;
+        }
+    }
+    progress = saved;
+    free(tiles);
+    GDALClose(input);
+
+    if (success == FALSE) {
+        printf("Processing was not successful.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("Done, %d windows\n", windows);
+
+    if (out.patch != NULL) {
+        // Statistics of the old cells are stale, recomputed from the patched output:
+        struct SurfaceStatistics statistics;
+        success = recomputeStatistics(GDALGetRasterBand(out.patch, 1), &statistics);
+        GDALClose(out.patch);
+        if (success == FALSE) {
+            free(statistics.histogram);
+            printf("Statistics of the patched output can't be computed: %s\nExiting.\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        printf("Done. Surface patched: %s\n\n", argv[2]);
+        if (statisticsPrinting() == TRUE) {
+            printStatisticsJson(&statistics, argv[2]);
+        }
+        free(statistics.histogram);
+    }   else {
+        writeSurfaceToFile(out.clip, argv[2]);
+        freeFloatSurface(out.clip);
+    }
+    free(out.mask);
+}
+
+
+/*
+*   Builds the clipped output surface of a window (all cells nodata, processed cells are written by processWindowRect)
+*   - Geotransform is moved to the window origin
+*   - Returns pointer to FloatSurface
+*/
+struct FloatSurface *createClippedSurface(GDALDatasetH input, const char *inputfp, const struct WindowOutput *out) {
+    const char *src_projection = GDALGetProjectionRef(input);
+    int success;
+
+    struct FloatSurface *ret = calloc(1, sizeof(struct FloatSurface));
+    ret->inputfp = calloc(strlen(inputfp) + 1, 1);
+    strcpy(ret->inputfp, inputfp);
+    ret->projection = calloc(strlen(src_projection) + 1, 1);
+    strcpy(ret->projection, src_projection);
+
+    ret->geotransform = calloc(6, sizeof(double));
+    GDALGetGeoTransform(input, ret->geotransform);
+    ret->geotransform[0] += out->first_col * ret->geotransform[1];
+    ret->geotransform[3] += out->first_row * ret->geotransform[5];
+
+    ret->nodata = GDALGetRasterNoDataValue(GDALGetRasterBand(input, 1), &success);
+    ret->rows = out->rows;
+    ret->cols = out->cols;
+    ret->array = createFloatArray(ret->cols, ret->rows);
+
+    for (int row = 0; row < ret->rows; row++) {
+        for (int col = 0; col < ret->cols; col++) {
+            ret->array[row][col] = ret->nodata;
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Number of parameters of a window flag (-window: 4, -aoi: 1, -patch: 0), -1 if the argument is not a window flag
+*/
+int windowFlagParameters(const char *arg) {
+    if (strcmp(arg, "-window") == 0) {
+        return 4;
+    }   else if (strcmp(arg, "-aoi") == 0) {
+        return 1;
+    }   else if (strcmp(arg, "-patch") == 0) {
+        return 0;
+    }
+
+    return -1;
+}
+
+
+/*
+*   Checks a window flag and its parameters, starting from argv[i]
+*   - Prints a description of a valid flag
+*   - Returns the index of the last argument used by the flag, -1 if it is faulty
+*/
+int checkWindowFlag(int argc, const char *argv[], int i) {
+    if (strcmp(argv[i], "-window") == 0 && argc > i+4) {
+        double bbox[4];
+        for (int j = 0; j < 4; j++) {
+            char *end;
+            bbox[j] = strtod(argv[i+1+j], &end);
+            if (end == argv[i+1+j] || *end != '\0') {
+                return -1;
+            }
+        }
+        if (bbox[0] < bbox[2] && bbox[1] < bbox[3]) {
+            printf("  -Window: x %s ... %s, y %s ... %s\n", argv[i+1], argv[i+3], argv[i+2], argv[i+4]);
+            return i+4;
+        }
+    }   else if (strcmp(argv[i], "-aoi") == 0 && argc > i+1) {
+        VSIStatBufL info;
+        if (VSIStatL(argv[i+1], &info) == 0) {
+            printf("  -Area of interest: %s\n", argv[i+1]);
+            return i+1;
+        }
+    }   else if (strcmp(argv[i], "-patch") == 0) {
+        printf("  -Patch the window into the existing output\n");
+        return i;
+    }
+
+    return -1;
+}
+
+
+/*
+*   Opens an area of interest (first layer of a vector dataset)
+*   - Layer must be in the coordinate system of the surface (or have none)
+*   - Bounding box is limited to the extent of the layer
+*   - Returns the vector dataset, NULL if it can't be used (reason is printed)
+*/
+GDALDatasetH openAoi(const char *aoifp, GDALDatasetH input, double *bbox) {
+    GDALDatasetH ret = GDALOpenEx(aoifp, GDAL_OF_VECTOR | GDAL_OF_READONLY, NULL, NULL, NULL);
+    OGRLayerH layer = (ret != NULL && GDALDatasetGetLayerCount(ret) > 0) ? GDALDatasetGetLayer(ret, 0) : NULL;
+    OGREnvelope extent;
+
+    if (layer == NULL || OGR_L_GetExtent(layer, &extent, TRUE) != OGRERR_NONE) {
+        printf("Area of interest can't be read: %s\n", aoifp);
+        if (ret != NULL) {
+            GDALClose(ret);
+        }
+        return NULL;
+    }
+
+    OGRSpatialReferenceH layersrs = OGR_L_GetSpatialRef(layer);
+    const char *projection = GDALGetProjectionRef(input);
+    if (layersrs != NULL && projection != NULL && projection[0] != '\0') {
+        OGRSpatialReferenceH surfacesrs = OSRNewSpatialReference(projection);
+        const int same = OSRIsSame(layersrs, surfacesrs);
+        OSRRelease(surfacesrs);
+
+        if (same == FALSE) {
+            printf("Area of interest must be in the coordinate system of the surface: %s\n", aoifp);
+            GDALClose(ret);
+            return NULL;
+        }
+    }
+
+    bbox[0] = (extent.MinX > bbox[0]) ? extent.MinX : bbox[0];
+    bbox[1] = (extent.MinY > bbox[1]) ? extent.MinY : bbox[1];
+    bbox[2] = (extent.MaxX < bbox[2]) ? extent.MaxX : bbox[2];
+    bbox[3] = (extent.MaxY < bbox[3]) ? extent.MaxY : bbox[3];
+
+    return ret;
+}
+
+
+/*
+*   Cells of a bounding box (CRS units) in a surface: cells touched by the box, clipped to the surface
+*   - Sets first row, first column, rows and columns of the window
+*   - Returns FALSE if the window is empty or the surface is rotated (geotransform terms 2 and 4)
+*/
+char surfaceWindow(GDALDatasetH input, const double *bbox, struct WindowOutput *out) {
+    double geotransform[6];
+    GDALGetGeoTransform(input, geotransform);
+
+    if (fabs(geotransform[2]) > EPSILON || fabs(geotransform[4]) > EPSILON) {
+        return FALSE;
+    }
+
+    // Box corners in cell coordinates (north up or south up), limited to the surface:
+    const double surface_rows = GDALGetRasterYSize(input);
+    const double surface_cols = GDALGetRasterXSize(input);
+    double col0 = (bbox[0] - geotransform[0]) / geotransform[1];
+    double col1 = (bbox[2] - geotransform[0]) / geotransform[1];
+    double row0 = (bbox[3] - geotransform[3]) / geotransform[5];
+    double row1 = (bbox[1] - geotransform[3]) / geotransform[5];
+    const double first_col = fmax(floor(fmin(col0, col1)), 0.0);
+    const double first_row = fmax(floor(fmin(row0, row1)), 0.0);
+    const double last_col = fmin(ceil(fmax(col0, col1)), surface_cols);
+    const double last_row = fmin(ceil(fmax(row0, row1)), surface_rows);
+
+    if (!(last_col > first_col) || !(last_row > first_row)) {
+        return FALSE;
+    }
+
+    out->first_row = (int)first_row;
+    out->first_col = (int)first_col;
+    out->rows = (int)(last_row - first_row);
+    out->cols = (int)(last_col - first_col);
+
+    return TRUE;
+}
+
+
+/*
+*   Rasterises the polygons of an area of interest into a mask of the window (cell centres inside: TRUE)
+*   - Returns the mask (rows x cols of the window), NULL on errors
+*/
+char *rasterizeAoi(GDALDatasetH aoi, GDALDatasetH input, const struct WindowOutput *out) {
+    double geotransform[6];
+    GDALGetGeoTransform(input, geotransform);
+    geotransform[0] += out->first_col * geotransform[1];
+    geotransform[3] += out->first_row * geotransform[5];
+
+    GDALDatasetH grid = GDALCreate(GDALGetDriverByName("MEM"), "", out->cols, out->rows, 1, GDT_Byte, NULL);
+    if (grid == NULL) {
+        return NULL;
+    }
+    GDALSetGeoTransform(grid, geotransform);
+    GDALSetProjection(grid, GDALGetProjectionRef(input));
+
+    int bands[1] = {1};
+    double burn[1] = {TRUE};
+    OGRLayerH layer = GDALDatasetGetLayer(aoi, 0);
+    char *ret = calloc((size_t)out->rows * out->cols, 1);
+
+    if (GDALRasterizeLayers(grid, 1, bands, 1, &layer, NULL, NULL, burn, NULL, NULL, NULL) != CE_None
+        || GDALRasterIO(GDALGetRasterBand(grid, 1), GF_Read, 0, 0, out->cols, out->rows, ret, out->cols, out->rows, GDT_Byte, 0, 0) != CE_None) {
+        free(ret);
+        ret = NULL;
+    }
+
+    GDALClose(grid);
+    return ret;
+}
+
+
+/*
+*   Flags of tiles with cells in the mask (all tiles without a mask)
+*   - Returns flags (tilerows x tilecols)
+*/
+char *maskedTiles(const struct WindowOutput *out, const int tilerows, const int tilecols) {
+    char *ret = calloc((size_t)tilerows * tilecols, 1);
+
+    for (int row = 0; row < out->rows; row++) {
+        for (int col = 0; col < out->cols; col++) {
+            if (out->mask == NULL || out->mask[(size_t)row * out->cols + col] == TRUE) {
+                ret[(row / INCREMENTAL_TILE_SIZE) * tilecols + col / INCREMENTAL_TILE_SIZE] = TRUE;
+            }
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Processes a rectangle of the window: reads it and its halo from input, applies
+*   the process steps (argv from index 3, window flags skipped) and writes the masked cells
+*   - Rectangle is given in window cells, halo is clipped at the surface edges
+*   - Returns TRUE if the rectangle was written
+*/
+char processWindowRect(GDALDatasetH input, struct WindowOutput *out, const int first_row, const int first_col, const int rows, const int cols, const int halo, int argc, const char *argv[]) {
+    const int surface_rows = GDALGetRasterYSize(input);
+    const int surface_cols = GDALGetRasterXSize(input);
+    const int row0 = out->first_row + first_row;    // Rectangle in surface cells
+    const int col0 = out->first_col + first_col;
+
+    // Rectangle with halo:
+    const int halo_row = (row0 > halo) ? row0 - halo : 0;
+    const int halo_col = (col0 > halo) ? col0 - halo : 0;
+    const int last_row = (row0 + rows + halo < surface_rows) ? row0 + rows + halo : surface_rows;
+    const int last_col = (col0 + cols + halo < surface_cols) ? col0 + cols + halo : surface_cols;
+
+    struct FloatSurface *surf = inputDepthModelWindow(input, halo_col, halo_row, last_col - halo_col, last_row - halo_row);
+    if (surf == NULL) {
+        return FALSE;
+    }
+
+    for (int i = 3; i < argc; i++) {
+        const int parameters = windowFlagParameters(argv[i]);
+        if (parameters >= 0) {
+            i += parameters;
+            continue;
+        }
+        i = applyProcessStep(surf, argc, argv, i);
+        if (i < 0) {
+            freeFloatSurface(surf);
+            return FALSE;
+        }
+    }
+
+    // Masked cells without the halo, patched rows are merged with the cells already in the output:
+    GDALRasterBandH band = (out->patch != NULL) ? GDALGetRasterBand(out->patch, 1) : NULL;
+    float *line = malloc(cols * sizeof(float));
+    char ret = TRUE;
+
+    for (int row = 0; row < rows && ret == TRUE; row++) {
+        const float *cells = &surf->array[row0 - halo_row + row][col0 - halo_col];
+        const char *mask = (out->mask != NULL) ? &out->mask[(size_t)(first_row + row) * out->cols + first_col] : NULL;
+
+        if (out->patch == NULL) {
+            for (int col = 0; col < cols; col++) {
+                if (mask == NULL || mask[col] == TRUE) {
+                    out->clip->array[first_row + row][first_col + col] = cells[col];
+                }
+            }
+            continue;
+        }
+
+        if (mask != NULL && GDALRasterIO(band, GF_Read, col0, row0 + row, cols, 1, line, cols, 1, GDT_Float32, 0, 0) != CE_None) {
+            ret = FALSE;
+            break;
+        }
+        for (int col = 0; col < cols; col++) {
+            if (mask == NULL || mask[col] == TRUE) {
+                line[col] = cells[col];
+            }
+        }
+        if (GDALRasterIO(band, GF_Write, col0, row0 + row, cols, 1, line, cols, 1, GDT_Float32, 0, 0) != CE_None) {
+            ret = FALSE;
+        }
+    }
+
+    free(line);
+    freeFloatSurface(surf);
+
+    return ret;
+}
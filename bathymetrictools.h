@@ -1,10 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/un.h>
 #include "gdal.h"
 #include "cpl_conv.h"
 #include "cpl_string.h"
+#include "cpl_vsi.h"
+#include "gdal_utils.h"
+#include "gdal_alg.h"
+#include "ogr_api.h"
+#include "ogr_srs_api.h"
+#include "libbathytools.h"
+#ifdef BATHYTOOLS_MPI
+#include <mpi.h>
+#endif
 
 /*
 *   Header file:
@@ -30,13 +49,17 @@
 *   Compilation instructions:
 *   1. Make sure GDAL is installed 
 *   2. Link GDAL on compilation
-*   3. Optimize and check on compilation
+*   3. Optimize and check on compilation (no -march=native, SIMD kernels are selected at runtime)
 *
 *   Compiling:
 *   1. Use either Make and the included makefile or 
 *   2. Compile manually for example like:
 *
-*   gcc -g -O3 -march=native -Wall -Wextra -Wfloat-equal -Werror -std=c17 -o bathytools *.c -lgdal
+*   gcc -g -O3 -Wall -Wextra -Wfloat-equal -Werror -std=c17 -o bathytools *.c -lgdal -pthread
+*
+*   MPI build (domain decomposition over ranks, "make mpi"):
+*
+*   mpicc -O3 -Wall -Wextra -Wfloat-equal -Werror -std=c17 -DBATHYTOOLS_MPI -o bathytools-mpi *.c -lgdal -pthread
 */
 
 
@@ -45,6 +68,107 @@
 #define TRUE        1
 #define FALSE       0
 
+// Range index modes:
+#define RANGE_MIN   0
+#define RANGE_MAX   1
+
+// Smallest row band of indexed Rolling Coin (index is rebuilt per band):
+#define RANGE_BAND_ROWS 64
+
+// Largest coin radius with a specialised Rolling Coin kernel:
+#define MAX_KERNEL_RADIUS 32
+
+// SIMD kernel variants (instruction sets), see simd_kernels.c:
+#define SIMD_GENERIC    0
+#define SIMD_AVX2       1
+#define SIMD_AVX512     2
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86        1
+#define SIMD_LEVELS     3
+#define TARGET_AVX2     __attribute__((target("avx2")))
+#define TARGET_AVX512   __attribute__((target("avx512f")))
+#else
+#define SIMD_X86        0
+#define SIMD_LEVELS     1
+#endif
+
+// Kernel bodies are always inlined, so that every kernel variant gets its own compiled copy:
+#if defined(__GNUC__)
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+#else
+#define KERNEL_INLINE static inline
+#endif
+
+// Compact storage: depth codes (cm) and nodata codes below and above them:
+#define COMPACT_MIN_CODE    -32766
+#define COMPACT_MAX_CODE    32765
+#define COMPACT_LOW         INT16_MIN
+#define COMPACT_HIGH        INT16_MAX
+
+// Smallest row band of compact Laplacian smoothing (bands are decoded with halos):
+#define COMPACT_BAND_ROWS   256
+
+// Maximum number of radii in a Rolling Coin sweep:
+#define MAX_SWEEP_RADII 64
+
+// Pipeline file limits:
+#define MAX_PIPELINE_STAGES 64
+#define MAX_PIPELINE_TOKENS 128
+
+// Memory file holding an input read from standard input (/vsistdin/):
+#define STDIN_MEMORY_PATH "/vsimem/surfacetools_stdin.tif"
+
+// Contour limits: levels per contouring step, minimum square rows of a parallel strip:
+#define MAX_CONTOUR_LEVELS      1000
+#define MIN_CONTOUR_STRIP_ROWS  64
+
+// Maximum number of surfaces resident in daemon mode:
+#define MAX_CACHED_SURFACES 8
+
+// Checkpoint files: format identifier, default interval in seconds (-resume without -checkpoint):
+#define CHECKPOINT_MAGIC            "BTCKPT1"
+#define CHECKPOINT_DEFAULT_INTERVAL 600
+
+// Tile size of change detection in incremental mode (cells):
+#define INCREMENTAL_TILE_SIZE 64
+
+// Memory file holding the mosaic built from a tile list:
+#define MOSAIC_MEMORY_PATH "/vsimem/surfacetools_mosaic.vrt"
+
+// Smallest strip of rows decoded by one input read worker (rounded up to whole block rows):
+#define MIN_READ_STRIP_ROWS 64
+
+// Surface cache files: format identifier, file name suffix, alignment of the cells in the file (bytes, multiple of page sizes):
+#define SURFACE_CACHE_MAGIC     "BTCACH1"
+#define SURFACE_CACHE_SUFFIX    ".btcache"
+#define SURFACE_CACHE_ALIGNMENT 65536
+
+// Number of blocks held by the pool of scratch arrays:
+#define SCRATCH_POOL_BLOCKS 4
+
+// Memory placement of float arrays: huge page size, row alignment (bytes), limits of NUMA topology:
+#define HUGE_PAGE_SIZE      (2 << 20)
+#define ROW_ALIGNMENT       64
+#define MAX_NUMA_NODES      64
+#define MAX_NUMA_CPUS       1024
+
+// Huge page modes of float arrays:
+#define HUGEPAGES_OFF           0
+#define HUGEPAGES_TRANSPARENT   1
+#define HUGEPAGES_EXPLICIT      2
+
+// Row bands of parallel operators: smallest surface split into bands (cells), minimum rows of a band:
+#define MIN_BAND_CELLS  65536
+#define MIN_BAND_ROWS   16
+
+// Output statistics: histogram bins per metre while writing, most buckets stored (bins are merged in pairs until they fit):
+#define STATISTICS_BINS_PER_METRE   10
+#define STATISTICS_MAX_BUCKETS      1024
+
+// Number of worst cells (deepest below the input) reported by a safety audit:
+#define AUDIT_WORST_CELLS 10
+
 
 // Structured datatype to hold bathymetric surface:
 struct FloatSurface {
@@ -61,9 +185,375 @@ struct FloatSurface {
 struct Coin {
     int radius;             // Radius
     int diameter;           // Diameter
+    char trim;              // Trim flag (outer edges trimmed, radius is 1 less than given)
     char **array;           // Array (boolean 2D, char**)
 };
 
+// Structured datatype to hold bathymetric surface in compact storage (int16 centimetre codes):
+struct CompactSurface {
+    char *inputfp;          // Original file path
+    char *projection;       // CRS information in WKT
+    double *geotransform;   // Georeferencing parameters
+    int16_t **array;        // Data array (2D, int16_t**), depth = (basecm + code) / 100 m
+    double nodata;          // Source file nodata value
+    int16_t nodatacode;     // Code of nodata: COMPACT_LOW or COMPACT_HIGH
+    int basecm;             // Base depth of codes (cm)
+    int rows;               // Number of rows
+    int cols;               // Number of columns
+};
+
+// Structured datatype to hold co-registered epochs of a surface, epochs of a cell interleaved:
+struct StackSurface {
+    char **inputfp;         // Epoch file paths
+    char *projection;       // CRS information in WKT
+    double *geotransform;   // Georeferencing parameters (all epochs)
+    float **array;          // Data array (2D, float**), row of cols x bands: cell col, epoch k at col * bands + k
+    double nodata;          // Source file nodata value (all epochs)
+    int rows;               // Number of rows
+    int cols;               // Number of columns
+    int bands;              // Number of epochs
+};
+
+// Structured datatype to hold a row-wise range extreme index (sparse table) of a row band:
+struct RangeIndex {
+    float ***table;         // Index levels (2D, float**), level k holds extremes of 2^k cell ranges
+    int *log2;              // Integer base 2 logarithms of range lengths
+    int levels;             // Number of levels
+    int capacity;           // Number of allocated rows
+    int first_row;          // Surface row of the first band row
+    int rows;               // Number of band rows built
+    int cols;               // Number of columns
+    char mode;              // RANGE_MAX or RANGE_MIN
+};
+
+// Structured datatype to hold the selected SIMD kernel variant:
+struct SimdKernels {
+    char level;             // SIMD_GENERIC, SIMD_AVX2 or SIMD_AVX512
+    const char *name;       // Instruction set name
+    void (*smoothLaplacianRow)(const float *above, const float *row, const float *below, float *out, const int cols, const double xWeight, const double yWeight, const double nodata);
+    void (*maxFilterRow)(const float *above, const float *row, const float *below, float *out, const int cols, const float nodata);
+    void (*offsetRow)(float *row, const int cols, const float offset, const float nodata);
+    void (*offsetGridRow)(float *row, const int cols, const int *index, const float *weight, const float *sum, const float *weightsum, const float offset, const float nodata);
+    int (*auditRow)(const float *input, const float *output, const int cols, const float tolerance, const float nodata, int *checked);
+};
+
+// Selected SIMD kernel variant: (simd_kernels.c)
+extern struct SimdKernels simd;
+
+// Structured datatype to hold the progress reporting of operators:
+struct ProgressReporter {
+    void (*callback)(const char *step, double fraction, void *userdata);   // NULL: print to stdout
+    void *userdata;         // Passed to callback
+    const char *step;       // Name of the current step
+};
+
+// Progress reporting of operators: (infoprinters.c)
+extern _Thread_local struct ProgressReporter progress;
+
+// Structured datatype to hold a parallel read of an input raster (strips of whole block rows):
+struct BlockRead {
+    const char *path;               // Dataset path, every worker opens a handle of its own
+    float **array;                  // Rows of the surface
+    size_t stride;                  // Row stride of the array (floats)
+    int rows;                       // Size of the raster
+    int cols;
+    int striprows;                  // Rows per strip (multiple of the block height)
+    int next;                       // Next strip to read
+    char failed;                    // TRUE if a strip could not be read
+    pthread_mutex_t lock;           // Guards next and failed
+};
+
+// Structured datatype to hold a decimated read of an input into a preview surface (see preview.c):
+struct PreviewRead {
+    const char *path;               // Dataset path, every worker opens a handle of its own
+    struct FloatSurface *surf;      // Preview surface
+    int rows;                       // Size of the input
+    int cols;
+    int factor;                     // Input cells per preview cell (in both directions)
+    int striprows;                  // Preview rows per strip
+    int next;                       // Next strip to read
+    char failed;                    // TRUE if a strip could not be read
+    pthread_mutex_t lock;           // Guards next and failed
+};
+
+// Structured datatype to hold the memory placement of new float arrays (see numa_memory.c):
+struct MemoryPlacement {
+    char firsttouch;        // TRUE: rows are first touched by the workers of their row bands, FALSE: by the allocating thread
+    char pin;               // TRUE: workers are pinned to the processors of the NUMA node of their band
+    char hugepages;         // Huge page mode (HUGEPAGES_OFF, HUGEPAGES_TRANSPARENT or HUGEPAGES_EXPLICIT)
+};
+
+// Memory placement and number of row bands of operators: (numa_memory.c)
+extern struct MemoryPlacement placement;
+extern _Thread_local int operatorThreads;
+
+// Structured datatype to hold the NUMA topology of the machine:
+struct NumaTopology {
+    int nodes;                      // Number of nodes with processors
+    int counts[MAX_NUMA_NODES];     // Number of processors of a node
+    int *cpus[MAX_NUMA_NODES];      // Processors of a node
+};
+
+// Structured datatype to hold the allocation of a float array (stored right before its row pointers):
+struct ArrayAllocation {
+    void *base;             // Start of the allocated or mapped memory
+    size_t size;            // Bytes allocated
+    size_t stride;          // Floats from the start of a row to the next
+    char mapped;            // TRUE: memory mapped, FALSE: allocated
+    char hugepages;         // Huge page mode that was applied
+};
+
+// Structured datatype to hold a block of the scratch pool (memory of a returned scratch array):
+struct ScratchBlock {
+    struct ArrayAllocation allocation;      // Allocation of the block
+    char *data;                             // First cell, allocation record and row pointers are laid out before it
+    unsigned long released;                 // Pool clock when the block was returned
+};
+
+// Structured datatype to hold the bilinear sampling of a separation surface at the cell centres of a surface:
+struct SeparationSampling {
+    const struct FloatSurface *grid;    // Separation surface (coarse grid, same coordinate system)
+    int *index;                         // Left grid column of each surface column, grid->cols: outside the grid
+    float *weight;                      // Weight of the right grid column of each surface column
+};
+
+// Structured datatype to hold statistics of a surface, computed while it is written (see output_statistics.c):
+struct SurfaceStatistics {
+    uint64_t count;                 // Number of cells with data
+    double min;                     // Minimum depth
+    double max;                     // Maximum depth
+    double mean;                    // Mean depth
+    double m2;                      // Sum of squared differences from the mean
+    int64_t first_bin;              // Histogram bin of the first bucket (bins of 1 / STATISTICS_BINS_PER_METRE m)
+    int bins;                       // Bins per bucket
+    int buckets;                    // Number of buckets
+    GUIntBig *histogram;            // Cells per bucket
+};
+
+// Structured datatype to hold a cell of a surface deeper than its input:
+struct AuditCell {
+    int row;                // Row of the cell
+    int col;                // Column of the cell
+    float input;            // Depth of the input
+    float output;           // Depth of the surface
+};
+
+// Structured datatype to hold a navigational safety audit of a surface against its input (see safety_audit.c):
+struct SafetyAudit {
+    const char *path;                       // Input file (workers open their own datasets)
+    struct FloatSurface *surf;              // Audited surface
+    const struct FloatSurface *reference;   // Input mapped from the surface cache, NULL: input rows are read
+    int first_row;                          // Row of the input at the first row of the surface
+    int first_col;                          // Column of the input at the first column of the surface
+    float tolerance;                        // How much deeper than the input a cell may be (m)
+    unsigned char *mask;                    // Violation mask (surface size), NULL: no mask
+    int striprows;                          // Rows in a strip taken by a worker
+    int next;                               // Next strip to take
+    char failed;                            // Input rows couldn't be read
+    uint64_t checked;                       // Cells with data in the input
+    uint64_t violations;                    // Cells deeper than the input
+    uint64_t lost;                          // Cells with data in the input, no data in the surface
+    struct AuditCell worst[AUDIT_WORST_CELLS];  // Deepest cells below the input (deepest first)
+    int worstcount;                         // Number of worst cells
+    pthread_mutex_t lock;                   // Lock of the strip counter and results
+};
+
+// Structured datatype to hold the operands of a row band operator (kernels get their band, see RowBand):
+struct RowBand;
+struct BandOperands {
+    struct FloatSurface *src;       // Surface (modified)
+    float **temp;                   // Temporary array of the operator (surface size)
+    int iterations;                 // Number of iterations (Laplacian smoothing)
+    float value;                    // Operator parameter (offset)
+    void (*kernel)(struct FloatSurface *, float **, struct RowBand *);     // Selected kernel (Rolling Coin)
+    const struct SeparationSampling *separation;                            // Separation surface (offset grid)
+    float *output;                                                          // Contiguous output buffer (file output)
+    struct SurfaceStatistics *statistics;                                   // Statistics of each band, NULL: none (file output)
+    struct StackSurface *stack;                                             // Stacked surface (modified, stacked operators)
+    const struct Coin *coin;                                                // Coin (stacked Rolling Coin)
+    const int *chords;                                                      // Chords of the coin (stacked Rolling Coin)
+    float **bandcells;                                                      // Epochs of a cell, row of each band index (stacked operators)
+};
+
+// Structured datatype to hold the barrier of row band workers:
+struct BandBarrier {
+    pthread_mutex_t lock;
+    pthread_cond_t released;        // Signalled when workers are started and when a barrier is passed
+    int count;                      // Number of bands
+    int waiting;                    // Bands waiting at the barrier
+    unsigned int generation;        // Number of barriers passed
+    char started;                   // TRUE when bands are assigned to the started workers
+};
+
+// Structured datatype to hold a row band of a parallel operator (one per worker thread):
+struct RowBand {
+    int index;                      // Band index, band 0 reports progress
+    int count;                      // Number of bands
+    int first_row;                  // First row of the band
+    int last_row;                   // Row after the band
+    struct BandBarrier *barrier;    // Shared by the bands of the operator
+    void (*operator)(struct RowBand *);
+    struct BandOperands *operands;
+    struct ProgressReporter progress;   // Progress reporting of the calling thread
+};
+
+// Structured datatype to hold a pipeline stage:
+struct PipelineStage {
+    char name[64];                  // Stage name
+    int parent;                     // Index of parent stage (-1: input stage)
+    int argc;                       // Number of process step arguments
+    char **argv;                    // Process step arguments (as in CLI)
+    int uses;                       // Number of child stages and outputs not yet done
+    struct FloatSurface *surf;      // Stage result while it is needed
+};
+
+// Structured datatype to hold a pipeline (stage 0 is the input surface):
+struct Pipeline {
+    char *inputfp;                                      // Input file path
+    struct PipelineStage stages[MAX_PIPELINE_STAGES];   // Stages, parents before children
+    int count;                                          // Number of stages
+    int outputstages[MAX_PIPELINE_STAGES];              // Stage index of each output
+    char *outputfps[MAX_PIPELINE_STAGES];               // Output file paths
+    int outputcount;                                    // Number of outputs
+};
+
+// Structured datatype to hold a contour line fragment (polyline, grown at its tail):
+struct ContourFragment {
+    double *points;         // x, y pairs in cell coordinates (column, row)
+    int count;              // Number of points
+    int capacity;           // Allocated points
+    int level;              // Index of the contour level
+    int64_t seam[2];        // Seam key of head [0] and tail [1] on a strip seam, -1: not on a seam
+    int link[2];            // End (fragment * 2 + end) joined to head and tail, -1: line ends
+};
+
+// Structured datatype to hold contours of a surface strip (contoured by one thread):
+struct ContourStrip {
+    struct FloatSurface *src;           // Surface
+    const double *levels;               // Contour levels
+    int levelcount;                     // Number of levels
+    int first_row;                      // First square row (square row r has cells of rows r and r + 1)
+    int last_row;                       // Last square row + 1
+    struct ContourFragment *fragments;  // Line fragments
+    int count;                          // Number of fragments
+    int capacity;                       // Allocated fragments
+};
+
+// Structured datatype to hold a surface resident in daemon mode:
+struct CachedSurface {
+    char path[1000];                // Input file path
+    time_t mtime;                   // Modification time of the file when it was read
+    struct FloatSurface *surf;      // Surface (read-only, requests work on copies)
+    unsigned long lastuse;          // Cache clock of the last request
+    int users;                      // Number of requests using surface
+    char busy;                      // Surface is being read
+    char stale;                     // File changed or dropped, freed when not used anymore
+};
+
+// Structured datatype to hold the daemon surface cache:
+struct SurfaceCache {
+    pthread_mutex_t lock;                                   // Protects the whole cache
+    pthread_cond_t changed;                                 // Signaled when an entry or request is done
+    struct CachedSurface *entries[MAX_CACHED_SURFACES];     // Cached surfaces
+    int count;                                              // Number of entries
+    int requests;                                           // Number of running connection threads
+    unsigned long clock;                                    // Request counter (least recently used eviction)
+    int listenfd;                                           // Listening socket
+    char stopping;                                          // Shutdown requested
+};
+
+// Structured datatype to hold the header of a checkpoint file (followed by projection and cells):
+struct CheckpointHeader {
+    char magic[8];                  // CHECKPOINT_MAGIC
+    uint64_t signature;             // Hash of the command line (see chainSignature)
+    int32_t rows;                   // Number of rows
+    int32_t cols;                   // Number of columns
+    int32_t step;                   // Position of the next step in the chain (see stepPosition)
+    int32_t iterations;             // Iterations of the next step already done (Laplacian)
+    int32_t projection_length;      // Bytes of projection WKT, terminating zero included
+    int32_t reserved;
+    double nodata;                  // Nodata value
+    double geotransform[6];         // Georeferencing parameters
+};
+
+// Structured datatype to hold the header of a surface cache file (followed by projection and cells):
+struct SurfaceCacheHeader {
+    char magic[8];                  // SURFACE_CACHE_MAGIC
+    uint64_t source_size;           // Bytes of the input file the cache was made from
+    int64_t source_mtime;           // Modification time of the input file (nanoseconds since epoch)
+    uint64_t source_inode;          // Inode of the input file
+    uint64_t stride;                // Floats from the start of a row to the next
+    uint64_t dataoffset;            // Bytes from the start of the file to the first cell (see surfaceCacheDataOffset)
+    int32_t rows;                   // Number of rows
+    int32_t cols;                   // Number of columns
+    int32_t projection_length;      // Bytes of projection WKT, terminating zero included
+    int32_t reserved;
+    double nodata;                  // Nodata value
+    double geotransform[6];         // Georeferencing parameters
+};
+
+// Structured datatype to hold the output of windowed processing (clipped surface or patched output):
+struct WindowOutput {
+    struct FloatSurface *clip;      // Clipped output surface of the window, NULL: patch
+    GDALDatasetH patch;             // Patched output dataset (surface grid), NULL: clip
+    int first_row;                  // First row of the window in the surface
+    int first_col;                  // First column of the window in the surface
+    int rows;                       // Number of rows of the window
+    int cols;                       // Number of columns of the window
+    char *mask;                     // Area of interest mask (rows x cols, TRUE: inside), NULL: whole window
+};
+
+// Structured datatype to hold a tile of a mosaic:
+struct MosaicTile {
+    char *inputfp;              // Tile file path
+    char *outputfp;             // Output file path (output directory + tile file name)
+    double geotransform[6];     // Georeferencing parameters of the tile
+    int first_col;              // First column of the tile in the mosaic
+    int first_row;              // First row of the tile in the mosaic
+    int cols;                   // Number of columns
+    int rows;                   // Number of rows
+};
+
+// Structured datatype to hold a tile mosaic processed by parallel workers:
+struct Mosaic {
+    char *mosaicfp;                 // Mosaic (VRT) path, opened by every worker
+    struct MosaicTile *tiles;       // Tiles
+    int count;                      // Number of tiles
+    int halo;                       // Cells read around a tile (dependency radius of the chain)
+    int argc;                       // Process step arguments (as in CLI)
+    const char **argv;
+    pthread_mutex_t lock;           // Protects next, done and failed
+    int next;                       // Next tile to process
+    int done;                       // Number of finished tiles
+    int failed;                     // Number of failed tiles
+};
+
+
+#ifdef BATHYTOOLS_MPI
+// Structured datatype to hold the block of a rank in MPI domain decomposition:
+struct MpiBlock {
+    MPI_Comm grid;                  // Cartesian communicator of the ranks (2D)
+    int rank;                       // Rank in grid
+    int ranks;                      // Number of ranks
+    int dims[2];                    // Number of blocks in row and column direction
+    int first_row;                  // First row of the block in the surface
+    int first_col;                  // First column of the block in the surface
+    int rows;                       // Number of rows of the block
+    int cols;                       // Number of columns of the block
+    int top;                        // Halo widths around the block (0 on surface edges)
+    int bottom;
+    int left;
+    int right;
+    int north;                      // Neighbour ranks (MPI_PROC_NULL on surface edges)
+    int south;
+    int west;
+    int east;
+    struct FloatSurface *surf;      // Block with halos
+    float *sendbuffer;              // Halo exchange buffers
+    float *recvbuffer;
+};
+#endif
+
 
 // Control functions: (main.c)
 int main(int argc, const char *argv[]);
@@ -75,40 +565,296 @@ int intInput(const int lower, const int upper, const char *text);
 
 // Command line interface functions: (cli.c)
 void cli(int argc, const char *argv[]);
+int checkProcessStep(int argc, const char *argv[], int i);
+int applyProcessStep(struct FloatSurface *surf, int argc, const char *argv[], int i);
+int applyCompactStep(struct CompactSurface *surf, int argc, const char *argv[], int i);
+int parseRadiusList(const char *list, int *radii, const int maxcount);
+void coinSweep(struct FloatSurface *surf, int argc, const char *argv[], int i);
+
+// Pipeline file functions: (pipeline.c)
+void runPipeline(const char *pipelinepath);
+void runPipelineStage(struct Pipeline *pipeline, const int index);
+struct Pipeline *readPipeline(const char *pipelinepath);
+char pipelineStreamsOutput(const char *pipelinepath);
+int findPipelineStage(struct Pipeline *pipeline, const char *name);
+void pipelineError(const int linenumber, const char *text);
+void freePipeline(struct Pipeline *pipeline);
+
+// Depth contours: (contours.c)
+void contourSurface(struct FloatSurface *src, const char *levelarg, const char *outputpath);
+int contourLevels(struct FloatSurface *src, const char *levelarg, double *levels, const int maxcount);
+int parseLevelList(const char *list, double *levels, const int maxcount);
+char checkContourLevels(const char *levelarg);
+void *contourStrip(void *arg);
+void contourStripLevel(struct ContourStrip *strip, const int level, int *top, int *bottom);
+void placeContourEnd(struct ContourStrip *strip, const int row, const int col, const int edge, const int end, int *left, int *bottom);
+void linkContourEnds(struct ContourFragment *fragments, const int a, const int b);
+int newContourFragment(struct ContourStrip *strip, const int level);
+void addContourPoint(struct ContourFragment *fragment, const double x, const double y);
+void stitchContourSeams(struct ContourFragment *fragments, const int count);
+int compareSeamKeys(const void *a, const void *b);
+void writeContours(struct FloatSurface *src, const double *levels, struct ContourFragment *fragments, const int count, const char *outputpath);
+void writeContourLine(OGRLayerH layer, const double *geotransform, const double *levels, struct ContourFragment *fragments, char *visited, int start);
+
+// Daemon mode functions: (daemon.c)
+void runDaemon(const char *socketpath);
+void *daemonConnection(void *arg);
+void handleRequest(const int fd, char *line);
+void processRequest(const int fd, const int argc, const char *argv[]);
+void statusRequest(const int fd);
+struct CachedSurface *acquireCachedSurface(const char *path, char *loaded, char *error);
+void releaseCachedSurface(struct CachedSurface *entry);
+struct CachedSurface *findCachedSurface(const char *path);
+void removeUnusedSurfaces(void);
+char evictCachedSurface(void);
+void freeCachedSurface(struct CachedSurface *entry);
+void finishRequest(void);
+void sendReply(const int fd, const char *format, ...);
+int runClient(int argc, const char *argv[]);
+
+// Checkpoint functions: (checkpoint.c)
+void runCheckpointedChain(int argc, const char *argv[], const int interval, const char resume);
+void replaySettingSteps(int argc, const char *argv[], const int step);
+int stepPosition(int argc, const char *argv[], const int index);
+int stepIndex(int argc, const char *argv[], const int position);
+void saveCheckpoint(const char *checkpointfp, struct FloatSurface *surf, const uint64_t signature, const int step, const int iterations, struct timespec *last);
+char writeCheckpoint(const char *checkpointfp, struct FloatSurface *surf, const uint64_t signature, const int step, const int iterations);
+struct FloatSurface *readCheckpoint(const char *checkpointfp, const char *inputfp, const uint64_t signature, int *step, int *iterations);
+size_t checkpointDataOffset(const size_t projection);
+uint64_t chainSignature(int argc, const char *argv[]);
+double secondsSince(const struct timespec *start);
+
+// Memory placement benchmark: (benchmark.c)
+void runBenchmark(int argc, const char *argv[]);
+double benchmarkPlacement(struct FloatSurface *input, int argc, const char *argv[], const int runs);
+
+// Tile mosaic functions: (mosaic.c)
+void runMosaic(int argc, const char *argv[]);
+struct Mosaic *readMosaic(const char *inputpath, const char *outputdir);
+char **mosaicTileList(const char *inputpath);
+int chainHaloRadius(int argc, const char *argv[], int i);
+int stepHaloRadius(int argc, const char *argv[], int i);
+void *mosaicWorker(void *arg);
+char processMosaicTile(struct Mosaic *mosaic, GDALDatasetH dataset, struct MosaicTile *tile);
+void freeMosaic(struct Mosaic *mosaic);
+
+// Incremental reprocessing functions: (incremental.c)
+void runIncremental(int argc, const char *argv[]);
+char sameSurfaceGrid(GDALDatasetH a, GDALDatasetH b);
+char *findDirtyTiles(GDALDatasetH before, GDALDatasetH after, const int tilerows, const int tilecols);
+char *expandDirtyTiles(const char *dirty, const int tilerows, const int tilecols, const int reach);
+char nextAffectedRect(char *affected, const int tilerows, const int tilecols, const int tilerow, const int tilecol, int *last_row, int *last_col);
+char recomputeWindow(GDALDatasetH input, GDALDatasetH output, const int first_row, const int first_col, const int rows, const int cols, const int halo, int argc, const char *argv[]);
+
+// Window and area of interest processing: (area_of_interest.c)
+void runWindowedChain(int argc, const char *argv[]);
+struct FloatSurface *createClippedSurface(GDALDatasetH input, const char *inputfp, const struct WindowOutput *out);
+int windowFlagParameters(const char *arg);
+int checkWindowFlag(int argc, const char *argv[], int i);
+GDALDatasetH openAoi(const char *aoifp, GDALDatasetH input, double *bbox);
+char surfaceWindow(GDALDatasetH input, const double *bbox, struct WindowOutput *out);
+char *rasterizeAoi(GDALDatasetH aoi, GDALDatasetH input, const struct WindowOutput *out);
+char *maskedTiles(const struct WindowOutput *out, const int tilerows, const int tilecols);
+char processWindowRect(GDALDatasetH input, struct WindowOutput *out, const int first_row, const int first_col, const int rows, const int cols, const int halo, int argc, const char *argv[]);
+
+#ifdef BATHYTOOLS_MPI
+// MPI domain decomposition functions: (domain_decomposition.c)
+int runMpi(int argc, const char *argv[]);
+char checkMpiParameters(int argc, const char *argv[]);
+int mpiHaloWidth(int argc, const char *argv[]);
+char decomposeSurface(struct MpiBlock *block, const int rows, const int cols, const int halo);
+void blockWindow(const int length, const int blocks, const int index, int *first, int *count);
+void exchangeHalos(struct MpiBlock *block, const int width);
+void shiftHalo(struct MpiBlock *block, const int *send, const int *recv, const int dest, const int source);
+void copyHaloRect(struct FloatSurface *surf, const int *rect, float *buffer, const char unpack);
+char writeBlocks(struct MpiBlock *block, GDALDatasetH dataset, const char *outputfp, struct SurfaceStatistics *statistics);
+void mpiStepDone(struct MpiBlock *block, const char *step, double *laptime);
+void freeMpiBlock(struct MpiBlock *block);
+#endif
 
 // File input and memory management functions: (inputandmemory.c)
 struct FloatSurface *inputDepthModel(const char *path);
+const char *inputFilePath(const char *path);
+char readBandParallel(GDALDatasetH dataset, const char *path, float **array, const int rows, const int cols);
+void *blockReadWorker(void *arg);
+struct FloatSurface *inputDepthModelWindow(GDALDatasetH dataset, const int first_col, const int first_row, const int cols, const int rows);
+struct FloatSurface *copyFloatSurface(struct FloatSurface *input);
 struct Coin *createCoin(const int radius, const char trim);
 void freeFloatSurface(struct FloatSurface *input);
 void freeCoin(struct Coin *penny);
-float** createFloatArray(const int cols, const int rows);
-void freeFloatArray(float **array, const int rows);
 char** createBooleanArray(const int cols, const int rows);
 void freeBooleanArray(char **array, const int rows);
 
+// NUMA aware float arrays and parallel row bands: (numa_memory.c)
+float** createFloatArray(const int cols, const int rows);
+float **createFloatArrayBlock(const int cols, const int rows, size_t cells, size_t header);
+float **layoutFloatArray(char *data, const int cols, const int rows, const struct ArrayAllocation *allocation);
+void freeFloatArray(float **array, const int rows);
+void freeArrayAllocation(const struct ArrayAllocation *allocation);
+size_t floatArrayStride(float **array);
+size_t floatRowStride(const int cols);
+char *mapCells(const size_t header, const size_t cells, struct ArrayAllocation *allocation);
+void touchRowBand(struct RowBand *band);
+void runRowBands(const int rows, const int cols, void (*operator)(struct RowBand *), struct BandOperands *operands);
+void *rowBandWorker(void *arg);
+void waitRowBands(struct RowBand *band);
+int rowBandCount(const int rows, const int cols);
+int rowBandFirstRow(const int rows, const int count, const int index);
+void pinToNumaNode(const int index, const int count);
+const struct NumaTopology *numaTopology(void);
+void readNumaTopology(void);
+int parseCpuList(const char *list, int *cpus, const int maxcount);
+char hugePageMode(const char *name);
+int workerThreadCount(void);
+
+// Scratch array pool functions: (scratch_pool.c)
+float **acquireScratchArray(const int cols, const int rows);
+void releaseScratchArray(float **array, const int rows);
+void drainScratchPool(void);
+void readScratchSetting(void);
+size_t scratchSizeClass(const size_t bytes);
+size_t scratchBlockRoom(const struct ScratchBlock *block);
+size_t scratchBlockCapacity(const struct ScratchBlock *block);
+
+// Surface cache functions: (surface_cache.c)
+char surfaceCachePath(const char *inputfp, char *cachefp, const size_t size);
+struct FloatSurface *readSurfaceCache(const char *cachefp, const char *inputfp);
+char writeSurfaceCache(const char *cachefp, const struct FloatSurface *surf);
+size_t surfaceCacheDataOffset(const size_t projection, const size_t rows);
+
 // Rolling Coin surface smoothing (safe for navigation): (rolling_coin_smoothing.c)
-void coinRollSurface(struct FloatSurface *src, struct Coin *penny);
+char coinRollSurface(struct FloatSurface *src, struct Coin *penny);
 float getShoalestDepthOnCoin(struct FloatSurface *src, struct Coin *penny, const int row_index, const int col_index);
 void getCoinIndexRange(const int rows, const int cols, const int current_row, const int current_col, const int coin_radius, int *index_ranges);
+char coinRollSurfaceIndexed(struct FloatSurface *src, struct Coin *penny);
+void getCoinChords(struct Coin *penny, int *chords);
+
+// Rolling Coin kernels specialised for common radii: (coin_kernels.c)
+char rollCoinKernel(struct FloatSurface *src, struct Coin *penny, float **temp);
+void rollCoinKernelBand(struct RowBand *band);
+
+// Compact surface storage and operators: (compact_surface.c)
+float decodeCompactDepth(const int basecm, const int code);
+int16_t encodeCompactDepth(const int basecm, const float depth);
+struct CompactSurface *inputCompactDepthModel(const char *path);
+void writeCompactSurfaceToFile(struct CompactSurface *input, const char *outputpath);
+void decodeCompactRow(struct CompactSurface *src, const int row, float *depths);
+void encodeCompactRow(struct CompactSurface *src, const float *depths, int16_t *codes);
+char maxFilterCompact(struct CompactSurface *src);
+void offsetCompact(struct CompactSurface *src, const float offset);
+char smoothLaplacianCompact(const int iterations, struct CompactSurface *src);
+char coinRollCompact(struct CompactSurface *src, struct Coin *penny);
+int16_t **createCompactArray(const int cols, const int rows);
+void freeCompactArray(int16_t **array, const int rows);
+void freeCompactSurface(struct CompactSurface *input);
+
+// Range extreme index for neighborhood queries: (range_index.c)
+struct RangeIndex *createRangeIndex(const int capacity, const int cols, const int maxlength, const char mode);
+void buildRangeIndex(struct RangeIndex *index, float **array, const int first_row, const int rows, const double nodata);
+void freeRangeIndex(struct RangeIndex *index);
+float getRangeExtreme(struct RangeIndex *index, const int row, const int first_col, const int last_col);
+float getCoinExtreme(struct RangeIndex *index, const int *chords, const int radius, const int row_index, const int col_index);
 
 // Shoal buffering (focal maximum filtering): (focalmaxfilter.c)
-void maxFilterSurface(struct FloatSurface *src);
+char maxFilterSurface(struct FloatSurface *src);
+void maxFilterBand(struct RowBand *band);
+void maxFilterCell(struct FloatSurface *src, float **temp, int row, int col);
 
 // Surface offset: (offset.c)
 void offset(struct FloatSurface *src, const float offset);
+void offsetBand(struct RowBand *band);
+char checkSeparationSurface(const char *path);
+struct FloatSurface *readSeparationSurface(const char *path, const struct FloatSurface *surf);
+void offsetGrid(struct FloatSurface *src, const struct FloatSurface *separation, const float offset);
+void offsetGridBand(struct RowBand *band);
+char separationCoordinate(const double position, const int cells, int *index, float *weight);
 
 // Laplacian surface smoothing (safe for navigation): (laplacian_smoothing.c)
-void smoothLaplacian(const int iterations, struct FloatSurface *src);
+char smoothLaplacian(const int iterations, struct FloatSurface *src);
+void smoothLaplacianBand(struct RowBand *band);
+void smoothLaplacianCell(struct FloatSurface *src, float **smooth_array, int row, int col);
 char isNodata(struct FloatSurface *src, int rowindex, int colindex);
 float getInterpolatedDepth(struct FloatSurface *src, int row, int col);
 float getSafeSmoothDepth(struct FloatSurface *src, int row, int col);
 
 // File output functions: (fileoutput.c)
 void parsePath(char *inputfp, char *addon, char *ret);
-float *convertFloatArray(struct FloatSurface *input);
+void radiusOutputPath(const char *outputpath, const int radius, char *ret);
+float *convertFloatArray(struct FloatSurface *input, struct SurfaceStatistics *statistics);
+void convertBand(struct RowBand *band);
 void writeSurfaceToFile(struct FloatSurface *input, const char *outputpath);
+char exportSurface(struct FloatSurface *input, const char *outputfp, struct SurfaceStatistics *statistics);
+GDALDatasetH createOutputDataset(const char *outputfp, const int cols, const int rows);
+char closeOutputDataset(GDALDatasetH dataset, const char *outputfp);
+char **outputOptions(const char *outputfp);
+const char *compressionOption(const char *name);
+char setOutputCompression(const char *name);
+char isVirtualPath(const char *path);
+char isStreamedPath(const char *path);
+void reserveStdoutForOutput(void);
+size_t writeStreamedOutput(const void *data, size_t size, size_t count, FILE *stream);
+
+// Output statistics: (output_statistics.c)
+void accumulateStatisticsRows(struct SurfaceStatistics *stats, const float *cells, const int rows, const int cols, const float nodata);
+void addHistogramBin(struct SurfaceStatistics *stats, const int64_t bin);
+void mergeStatistics(struct SurfaceStatistics *stats, struct SurfaceStatistics *band);
+void limitHistogramBuckets(struct SurfaceStatistics *stats);
+void storeStatistics(GDALRasterBandH band, const struct SurfaceStatistics *stats, const int rows, const int cols);
+char recomputeStatistics(GDALRasterBandH band, struct SurfaceStatistics *statistics);
+void printStatisticsJson(const struct SurfaceStatistics *stats, const char *outputfp);
+void setStatisticsPrinting(const char enabled);
+char statisticsPrinting(void);
+
+// Quick-look preview on a decimated surface: (preview.c)
+void runPreviewChain(int argc, const char *argv[], const int factor);
+char **previewArguments(int argc, const char *argv[], const int factor);
+struct FloatSurface *inputPreviewDepthModel(const char *path, const int factor);
+GDALRasterBandH previewOverview(GDALRasterBandH band, const int rows, const int cols);
+char decimateBandParallel(const char *path, struct FloatSurface *surf, const int rows, const int cols, const int factor);
+void *decimateWorker(void *arg);
+
+// Stacked processing of co-registered epochs: (stack_surface.c)
+void runStack(int argc, const char *argv[]);
+int applyStackStep(struct StackSurface *stack, int argc, const char *argv[], int i);
+struct StackSurface *inputStackDepthModel(char **epochfps, const int count);
+void interleaveEpochBand(struct RowBand *band);
+void extractEpochBand(struct RowBand *band);
+int writeStackSurfaceToFiles(struct StackSurface *stack, const char **outputfps);
+char maxFilterStack(struct StackSurface *stack);
+void maxFilterStackBand(struct RowBand *band);
+void offsetStack(struct StackSurface *stack, const float offset);
+void offsetStackBand(struct RowBand *band);
+char smoothLaplacianStack(const int iterations, struct StackSurface *stack);
+void smoothLaplacianStackBand(struct RowBand *band);
+void smoothLaplacianStackCell(struct StackSurface *stack, float **smooth_array, const int row, const int col);
+char coinRollStack(struct StackSurface *stack, struct Coin *penny);
+void coinRollStackBand(struct RowBand *band);
+void freeStackSurface(struct StackSurface *stack);
+
+// Navigational safety audit: (safety_audit.c)
+char auditSurface(struct FloatSurface *surf, const float tolerance, const char *maskfp);
+char locateAuditWindow(GDALDatasetH dataset, const struct FloatSurface *surf, int *first_row, int *first_col);
+void *auditWorker(void *arg);
+void recordAuditRow(struct SafetyAudit *audit, const float *input, const int row);
+void addWorstAuditCell(struct SafetyAudit *audit, const struct AuditCell *cell);
+char worseAuditCell(const struct AuditCell *a, const struct AuditCell *b);
+void writeAuditMask(const struct FloatSurface *surf, unsigned char *mask, const char *maskfp);
+void printAuditReport(const struct SafetyAudit *audit);
+char safetyAuditFailed(void);
+
+// Library API surface views: (libbathytools.c)
+int openSurfaceView(struct BathySurfaceView *view, struct FloatSurface *surf, BathyProgress callback, void *userdata);
+void closeSurfaceView(struct FloatSurface *surf);
+void ignoreProgress(const char *step, double fraction, void *userdata);
+void selectBestKernels(void);
+
+// SIMD kernel variant selection: (simd_kernels.c)
+char selectSimdKernels(const char *name);
 
 // Printers for help etc:
 void printHelp(void);
 void printFloatSurfaceInfo(struct FloatSurface *input);
 void printCoin(struct Coin *penny);
+void printStepStart(const char *step);
+void printStepProgress(const double fraction);
+void printStepDone(void);
@@ -0,0 +1,148 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Benchmark of memory placement: a process chain is timed with the surface and
+*     scratch arrays of the operators placed in three ways (see numa_memory.c):
+*       1. First touched by the allocating thread, workers not pinned, 4 kB pages
+*          (all memory on the node of the loading thread)
+*       2. First touched in row bands by workers pinned per NUMA node
+*       3. As 2, backed by huge pages (transparent, or explicit with BATHYTOOLS_HUGEPAGES=explicit)
+*   - Every placement runs the chain N times on a fresh copy of the input, the fastest
+*     time of every step is reported
+*
+*   The gain is seen on multi-socket machines (two or more NUMA nodes), on a single node
+*   only huge pages make a difference:
+*
+*       surfacetools -benchmark [inputfile] [runs] [process steps]
+*/
+
+
+/*
+*   Benchmark mode: checks parameters, reads the input once and times the chain with every placement
+*   - Exits on faulty parameters
+*/
+void runBenchmark(int argc, const char *argv[]) {
+    char inputflag = 1;         // Inputs assumed to be ok
+    const int runs = atoi(argv[3]);
+
+    if (runs < 1) {
+        printf("Number of runs must be at least 1: %s\n", argv[3]);
+        inputflag = 0;
+    }
+
+    // Check input process commands and parameters:
+    printf("Process steps:\n");
+    for (int i = 4; i < argc; i++) {
+        // Steps with outputs or global state would not be the same in every run:
+        const char unavailable = (strcmp(argv[i], "-simd") == 0 || strcmp(argv[i], "-compact") == 0 || strcmp(argv[i], "-compress") == 0 || strcmp(argv[i], "-stats") == 0
+                                  || strcmp(argv[i], "-rollcoin-sweep") == 0 || strcmp(argv[i], "-contours") == 0 || strcmp(argv[i], "-audit") == 0);
+        int last = unavailable ? -1 : checkProcessStep(argc, argv, i);
+
+        if (unavailable) {
+            printf("  -Not available in benchmark mode: %s\n", argv[i]);
+        }
+        if (last < 0) {
+            inputflag = 0;
+            continue;
+        }
+        i = last;
+    }
+
+    if (inputflag != 1) {
+        printf("Faulty parameters detected. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Topology is read (and placement environment variables applied) before placements are changed:
+    const struct NumaTopology *numa = numaTopology();
+    const char hugepages = (placement.hugepages == HUGEPAGES_EXPLICIT) ? HUGEPAGES_EXPLICIT : HUGEPAGES_TRANSPARENT;
+    const struct MemoryPlacement placements[3] = {{FALSE, FALSE, HUGEPAGES_OFF}, {TRUE, TRUE, HUGEPAGES_OFF}, {TRUE, TRUE, hugepages}};
+    const char *names[3] = {"Allocating thread first touch, 4 kB pages", "Row band first touch, pinned workers, 4 kB pages",
+                            (hugepages == HUGEPAGES_EXPLICIT) ? "Row band first touch, pinned workers, explicit huge pages"
+                                                              : "Row band first touch, pinned workers, transparent huge pages"};
+    double totals[3];
+
+    struct FloatSurface *input = inputDepthModel(argv[2]);
+
+    printf("\nNUMA nodes: %d, processors:", numa->nodes);
+    for (int node = 0; node < numa->nodes; node++) {
+        printf(" %d", numa->counts[node]);
+    }
+    printf("\nRow bands: %d, surface: %d x %d cells, fastest of %d runs\n", rowBandCount(input->rows, input->cols), input->rows, input->cols, runs);
+
+    for (int i = 0; i < 3; i++) {
+        drainScratchPool();     // Scratch arrays of the previous placement are not reused
+        placement = placements[i];
+        printf("\n%s:\n", names[i]);
+        fflush(stdout);
+        totals[i] = benchmarkPlacement(input, argc, argv, runs);
+    }
+
+    drainScratchPool();
+    printf("\nSpeedup over allocating thread first touch: %.2f (row bands), %.2f (row bands and huge pages)\n", totals[0] / totals[1], totals[0] / totals[2]);
+    freeFloatSurface(input);
+}
+
+
+/*
+*   Times the process chain with the current placement, prints the fastest time of every step
+*   - Returns the sum of fastest step times (seconds)
+*/
+double benchmarkPlacement(struct FloatSurface *input, int argc, const char *argv[], const int runs) {
+    double *fastest = calloc(argc, sizeof(double));     // Fastest time of the step starting at argv[i]
+    int *lasts = calloc(argc, sizeof(int));             // Last argument of the step starting at argv[i]
+    double ret = 0.0;
+
+    // Operators don't print progress while they are timed:
+    struct ProgressReporter saved = progress;
+    progress.callback = ignoreProgress;
+
+    for (int run = 0; run < runs; run++) {
+        // Surface is allocated (first touched) with the placement:
+        struct FloatSurface *surf = copyFloatSurface(input);
+        if (surf == NULL) {
+            printf("Memory allocation failed.\nExiting.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 4; i < argc; i++) {
+            struct timespec start;
+            timespec_get(&start, TIME_UTC);
+            const int last = applyProcessStep(surf, argc, argv, i);
+            const double seconds = secondsSince(&start);
+
+            if (last < 0) {
+                printf("Exiting.\n");
+                exit(EXIT_FAILURE);
+            }
+            if (run == 0 || seconds < fastest[i]) {
+                fastest[i] = seconds;
+            }
+            lasts[i] = last;
+            i = last;
+        }
+
+        freeFloatSurface(surf);
+    }
+
+    progress = saved;
+
+    for (int i = 4; i < argc; i++) {
+        char step[200] = "";
+
+        for (int j = i; j <= lasts[i]; j++) {
+            strncat(step, argv[j], sizeof(step) - strlen(step) - 2);
+            strcat(step, " ");
+        }
+        printf("  %-40s %9.3f s\n", step, fastest[i]);
+
+        ret += fastest[i];
+        i = lasts[i];
+    }
+    printf("  %-40s %9.3f s\n", "Total", ret);
+
+    free(fastest);
+    free(lasts);
+    return ret;
+}
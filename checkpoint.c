@@ -0,0 +1,378 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Checkpointed processing of a CLI chain (-checkpoint [seconds], -resume)
+*   - Surface, position in the chain (next step) and iterations done of the
+*     current Laplacian step are saved periodically to a binary checkpoint file
+*     ([outputfile].ckpt), written through a memory map (header, projection, cells)
+*   - Laplacian smoothing is run in chunks of iterations sized to the checkpoint
+*     interval, iterations depend only on the previous surface, so the final
+*     result is identical to an uninterrupted run
+*   - Checkpoint is removed when the output is written
+*
+*   Use example (checkpoint every 10 minutes, continue after the job was stopped):
+*
+*       surfacetools inputfile.tiff outputfile.tiff -checkpoint 600 -buffer -laplacian 500
+*       surfacetools inputfile.tiff outputfile.tiff -checkpoint 600 -resume -buffer -laplacian 500
+*/
+
+
+/*
+*   Runs a checked CLI chain with checkpoints
+*   - interval: seconds between checkpoints
+*   - resume: continue from the checkpoint of the output, if it matches the command line
+*/
+void runCheckpointedChain(int argc, const char *argv[], const int interval, const char resume) {
+    char checkpointfp[1000];
+    snprintf(checkpointfp, sizeof(checkpointfp), "%s.ckpt", argv[2]);
+
+    const uint64_t signature = chainSignature(argc, argv);
+    struct timespec last;
+    timespec_get(&last, TIME_UTC);
+
+    struct FloatSurface *surf = NULL;
+    int step = 3;           // Next step (argv index)
+    int done = 0;           // Iterations of the step done
+
+    if (resume == TRUE) {
+        int position;
+        surf = readCheckpoint(checkpointfp, argv[1], signature, &position, &done);
+        step = stepIndex(argc, argv, position);
+
+        if (surf != NULL && step < argc) {
+            printf("Resuming from checkpoint: %s, %d iterations done\n", argv[step], done);
+        }   else if (surf != NULL) {
+            printf("Resuming from checkpoint: all steps done\n");
+        }
+    }
+    if (surf == NULL) {
+        surf = inputDepthModel(argv[1]);
+        step = 3;
+        done = 0;
+    }
+    replaySettingSteps(argc, argv, step);
+
+    for (int i = step; i < argc; i++) {
+        if (strcmp(argv[i], "-checkpoint") == 0) {
+            i++;
+            continue;
+        }   else if (strcmp(argv[i], "-resume") == 0) {
+            continue;
+        }
+
+        if (strcmp(argv[i], "-laplacian") == 0) {
+            const int iterations = atoi(argv[i+1]);
+            double periteration = 0.0;      // Seconds per iteration, 0: not measured yet
+
+            printf("Laplacian smoothing, %d iterations%s:\n", iterations, (done > 0) ? " (resumed)" : "");
+            struct ProgressReporter saved = progress;
+            progress.callback = ignoreProgress;
+
+            while (done < iterations) {
+                // Iterations until the next checkpoint is due (one for measuring first),
+                // clamped before conversion (fast iterations give huge or infinite quotients):
+                int count = 1;
+                if (periteration > 0.0) {
+                    count = (int)fmax(fmin((interval - secondsSince(&last)) / periteration, (double)(iterations - done)), 1.0);
+                }
+
+                struct timespec start;
+                timespec_get(&start, TIME_UTC);
+                if (smoothLaplacian(count, surf) == FALSE) {
+                    printf("Memory allocation failed.\nExiting.\n");
+                    exit(EXIT_FAILURE);
+                }
+                periteration = secondsSince(&start) / count;
+                done += count;
+
+                if (done < iterations && secondsSince(&last) >= interval) {
+                    saveCheckpoint(checkpointfp, surf, signature, stepPosition(argc, argv, i), done, &last);
+                }
+            }
+
+            progress = saved;
+            printf("Done\n");
+            i++;
+        }   else {
+            i = applyProcessStep(surf, argc, argv, i);
+            if (i < 0) {
+                printf("Exiting.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // Step is done, checkpoint continues from the next step:
+        done = 0;
+        if (i + 1 < argc && secondsSince(&last) >= interval) {
+            saveCheckpoint(checkpointfp, surf, signature, stepPosition(argc, argv, i + 1), 0, &last);
+        }
+    }
+
+    writeSurfaceToFile(surf, argv[2]);
+    freeFloatSurface(surf);
+
+    // Finished job doesn't need the checkpoint anymore:
+    unlink(checkpointfp);
+}
+
+
+/*
+*   Applies the setting steps of the chain before a resumed step (argv index), so outputs
+*   are written as in an uninterrupted run: output compression, SIMD kernels, statistics printing
+*   - Settings are global, surface steps before the resumed step are in the checkpoint
+*/
+void replaySettingSteps(int argc, const char *argv[], const int step) {
+    for (int i = 3; i < step && i < argc; i++) {
+        if (strcmp(argv[i], "-compress") == 0 && i + 1 < argc) {
+            setOutputCompression(argv[i+1]);
+            i++;
+        }   else if (strcmp(argv[i], "-simd") == 0 && i + 1 < argc) {
+            selectSimdKernels(argv[i+1]);
+            i++;
+        }   else if (strcmp(argv[i], "-stats") == 0) {
+            setStatisticsPrinting(TRUE);
+        }
+    }
+}
+
+
+/*
+*   Position of argv[index] in the chain: number of arguments before it from argv[3],
+*   checkpoint flags not counted (they may be added or moved when resuming)
+*/
+int stepPosition(int argc, const char *argv[], const int index) {
+    int ret = 0;
+
+    for (int i = 3; i < index && i < argc; i++) {
+        if (strcmp(argv[i], "-checkpoint") == 0) {
+            i++;
+        }   else if (strcmp(argv[i], "-resume") != 0) {
+            ret++;
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Index in argv of a chain position (see stepPosition), argc if the chain is shorter
+*/
+int stepIndex(int argc, const char *argv[], const int position) {
+    int count = 0;
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-checkpoint") == 0) {
+            i++;
+        }   else if (strcmp(argv[i], "-resume") != 0) {
+            if (count == position) {
+                return i;
+            }
+            count++;
+        }
+    }
+
+    return argc;
+}
+
+
+/*
+*   Saves a checkpoint and restarts the interval clock, prints the time it took
+*/
+void saveCheckpoint(const char *checkpointfp, struct FloatSurface *surf, const uint64_t signature, const int step, const int iterations, struct timespec *last) {
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+
+    if (writeCheckpoint(checkpointfp, surf, signature, step, iterations) == TRUE) {
+        if (iterations > 0) {
+            printf("  Checkpoint saved: %d iterations done (%.2f s)\n", iterations, secondsSince(&start));
+        }   else {
+            printf("Checkpoint saved (%.2f s)\n", secondsSince(&start));
+        }
+    }   else {
+        printf("  Checkpoint could not be written: %s\n", checkpointfp);
+    }
+    fflush(stdout);
+
+    timespec_get(last, TIME_UTC);
+}
+
+
+/*
+*   Writes a checkpoint file through a memory map
+*   - Written to [checkpoint].tmp and renamed, so an interrupted write never
+*     replaces the previous checkpoint
+*   - Returns TRUE if the checkpoint was written
+*/
+char writeCheckpoint(const char *checkpointfp, struct FloatSurface *surf, const uint64_t signature, const int step, const int iterations) {
+    char tmpfp[1010];
+    snprintf(tmpfp, sizeof(tmpfp), "%s.tmp", checkpointfp);
+
+    const size_t projection = strlen(surf->projection) + 1;
+    const size_t dataoffset = checkpointDataOffset(projection);
+    const size_t size = dataoffset + (size_t)surf->rows * surf->cols * sizeof(float);
+
+    int fd = open(tmpfp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return FALSE;
+    }
+
+    // File size is set by writing its last byte:
+    if (lseek(fd, size - 1, SEEK_SET) < 0 || write(fd, "", 1) != 1) {
+        close(fd);
+        unlink(tmpfp);
+        return FALSE;
+    }
+
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        unlink(tmpfp);
+        return FALSE;
+    }
+
+    struct CheckpointHeader *header = (struct CheckpointHeader *)map;
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->signature = signature;
+    header->rows = surf->rows;
+    header->cols = surf->cols;
+    header->step = step;
+    header->iterations = iterations;
+    header->projection_length = (int32_t)projection;
+    header->nodata = surf->nodata;
+    memcpy(header->geotransform, surf->geotransform, 6 * sizeof(double));
+    memcpy(map + sizeof(struct CheckpointHeader), surf->projection, projection);
+
+    float *cells = (float *)(map + dataoffset);
+    for (int row = 0; row < surf->rows; row++) {
+        memcpy(&cells[(size_t)row * surf->cols], surf->array[row], surf->cols * sizeof(float));
+    }
+
+    const int synced = msync(map, size, MS_SYNC);
+    munmap(map, size);
+    close(fd);
+
+    if (synced != 0 || rename(tmpfp, checkpointfp) != 0) {
+        unlink(tmpfp);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*
+*   Reads a checkpoint file (memory mapped) into a new surface
+*   - Checkpoint must be made by the same command line (signature)
+*   - Sets the position of the next step (see stepPosition) and iterations done of it
+*   - Returns NULL if there is no usable checkpoint (processing starts from the input)
+*/
+struct FloatSurface *readCheckpoint(const char *checkpointfp, const char *inputfp, const uint64_t signature, int *step, int *iterations) {
+    struct stat st;
+    int fd = open(checkpointfp, O_RDONLY);
+
+    if (fd < 0) {
+        printf("No checkpoint found, starting from the input.\n");
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct CheckpointHeader)) {
+        printf("Checkpoint is not valid, starting from the input.\n");
+        close(fd);
+        return NULL;
+    }
+
+    const size_t size = st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Checkpoint can't be read, starting from the input.\n");
+        return NULL;
+    }
+
+    const struct CheckpointHeader *header = (const struct CheckpointHeader *)map;
+    const size_t dataoffset = checkpointDataOffset(header->projection_length);
+
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 || header->projection_length < 1
+        || header->rows < 1 || header->cols < 1 || size != dataoffset + (size_t)header->rows * header->cols * sizeof(float)
+        || map[sizeof(struct CheckpointHeader) + header->projection_length - 1] != '\0') {
+        printf("Checkpoint is not valid, starting from the input.\n");
+        munmap((void *)map, size);
+        return NULL;
+    }
+    if (header->signature != signature) {
+        printf("Checkpoint was made with other parameters, starting from the input.\n");
+        munmap((void *)map, size);
+        return NULL;
+    }
+
+    struct FloatSurface *ret = calloc(1, sizeof(struct FloatSurface));
+    ret->inputfp = calloc(strlen(inputfp) + 1, 1);
+    strcpy(ret->inputfp, inputfp);
+    ret->projection = calloc(header->projection_length, 1);
+    memcpy(ret->projection, map + sizeof(struct CheckpointHeader), header->projection_length);
+    ret->geotransform = calloc(6, sizeof(double));
+    memcpy(ret->geotransform, header->geotransform, 6 * sizeof(double));
+    ret->nodata = header->nodata;
+    ret->rows = header->rows;
+    ret->cols = header->cols;
+    ret->array = createFloatArray(ret->cols, ret->rows);
+
+    const float *cells = (const float *)(map + dataoffset);
+    for (int row = 0; row < ret->rows; row++) {
+        memcpy(ret->array[row], &cells[(size_t)row * ret->cols], ret->cols * sizeof(float));
+    }
+
+    *step = header->step;
+    *iterations = header->iterations;
+    munmap((void *)map, size);
+
+    return ret;
+}
+
+
+/*
+*   Offset of the cells in a checkpoint file (after header and projection, 64 byte aligned)
+*/
+size_t checkpointDataOffset(const size_t projection) {
+    return (sizeof(struct CheckpointHeader) + projection + 63) / 64 * 64;
+}
+
+
+/*
+*   Signature of a command line: 64-bit FNV-1a hash of input, output and process
+*   steps (checkpoint flags excluded, they don't change the result)
+*/
+uint64_t chainSignature(int argc, const char *argv[]) {
+    uint64_t ret = 14695981039346656037ULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-checkpoint") == 0) {
+            i++;
+            continue;
+        }   else if (strcmp(argv[i], "-resume") == 0) {
+            continue;
+        }
+
+        // Arguments are separated by their terminating zero:
+        for (const char *p = argv[i]; ; p++) {
+            ret = (ret ^ (unsigned char)*p) * 1099511628211ULL;
+            if (*p == '\0') {
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Seconds elapsed since a time
+*/
+double secondsSince(const struct timespec *start) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -13,12 +13,24 @@
 */
 void cli(int argc, const char *argv[]) {
     char inputflag = 1;         // Inputs assumed to be ok
-    char trimflag = 0;          // Coin trim flag
-    char rollingcoin = 0;       // Method flag to be used for freeing coin memory
-    struct Coin *penny;         // Placeholder for Coin
+    char sweeps = 0;            // Number of Rolling Coin sweeps in chain
+    char compact = FALSE;       // Compact (int16) storage of the surface
+    int interval = 0;           // Seconds between checkpoints, 0: no checkpoints
+    char resume = FALSE;        // Continue from checkpoint
+    char windowed = FALSE;      // Window or area of interest processing
+    char patch = FALSE;         // Window is patched into the existing output
+    char contours = FALSE;      // Contours in chain
+    char offsetgrid = FALSE;    // Separation surface offset in chain
+    char audit = FALSE;         // Safety audit in chain
+    int preview = 0;            // Decimation factor of a preview, 0: full resolution
+
+    // Streamed output: standard output is reserved for data, messages go to standard error:
+    if (isStreamedPath(argv[2]) == TRUE) {
+        reserveStdoutForOutput();
+    }
 
     // Check input file existence and permissions:
-    if (access(argv[1], R_OK|W_OK) != 0) {
+    if (inputFilePath(argv[1]) == NULL) {
         printf("File read error. Recheck file path.\nExiting.\n");
         exit(EXIT_FAILURE);
     }
@@ -26,29 +38,99 @@ void cli(int argc, const char *argv[]) {
     // Check input process commands and parameters:
     printf("Process steps:\n");
     for (int i = 3; i < argc; i++) {
-        if (strcmp(argv[i], "-buffer") == 0) {
-            printf("  -Buffer shoals\n");
+        // Checkpoint flags are not process steps (see checkpoint.c):
+        if (strcmp(argv[i], "-checkpoint") == 0 && argc > i+1 && atoi(argv[i+1]) > 0) {
+            interval = atoi(argv[i+1]);
+            printf("  -Checkpoint every %d s to %s.ckpt\n", interval, argv[2]);
+            i++;
             continue;
-        }   else if (strcmp(argv[i], "-offset") == 0 && argc > i+1) {
-            if (fabs(atof(argv[i+1]) - 0.0) > EPSILON) {
-                printf("  -Offset, %.3f m\n", atof(argv[i+1]));
-                i++;
+        }   else if (strcmp(argv[i], "-resume") == 0) {
+            resume = TRUE;
+            printf("  -Resume from checkpoint %s.ckpt\n", argv[2]);
+            continue;
+        }   else if (strcmp(argv[i], "-preview") == 0) {
+            // Preview flag is not a process step (see preview.c):
+            preview = (argc > i+1) ? atoi(argv[i+1]) : 0;
+            if (preview < 2) {
+                inputflag = 0;
+            }   else {
+                printf("  -Preview at 1:%d (parameters in cells are scaled)\n", preview);
             }
-        }   else if (strcmp(argv[i], "-laplacian") == 0 && argc > i+1) {
-            if (atoi(argv[i+1]) > 0) {
-                printf("  -Laplacian smoothing, %d iterations\n", atoi(argv[i+1]));
-                i++;
+            i++;
+            continue;
+        }   else if (windowFlagParameters(argv[i]) >= 0) {
+            // Window flags are not process steps (see area_of_interest.c):
+            const int last = checkWindowFlag(argc, argv, i);
+            if (last < 0) {
+                inputflag = 0;
+                continue;
             }
-        }   else if (strcmp(argv[i], "-rollcoin") == 0 && argc > i+2) {
-            if (atoi(argv[i+1]) > 0) {
-                if (strcmp(argv[i+2], "trim") == 0 || strcmp(argv[i+2], "notrim") == 0) {
-                    printf("  -Rolling Coin: r=%d cells, %s\n", atoi(argv[i+1]), argv[i+2]);
-                    i+=2;
-                }
+            if (strcmp(argv[i], "-patch") == 0) {
+                patch = TRUE;
+            }   else {
+                windowed = TRUE;
             }
-        }   else {
+            i = last;
+            continue;
+        }
+
+        int last = checkProcessStep(argc, argv, i);
+
+        if (last < 0) {
             inputflag = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "-rollcoin-sweep") == 0) {
+            sweeps++;
+        }   else if (strcmp(argv[i], "-compact") == 0) {
+            compact = TRUE;
+        }   else if (strcmp(argv[i], "-contours") == 0) {
+            contours = TRUE;
+        }   else if (strcmp(argv[i], "-offset-grid") == 0) {
+            offsetgrid = TRUE;
+        }   else if (strcmp(argv[i], "-audit") == 0) {
+            audit = TRUE;
         }
+        i = last;
+    }
+
+    // Only one sweep can be used, it splits the chain into several outputs (float32 storage only, not streamed):
+    if (sweeps > 1) {
+        printf("Only one -rollcoin-sweep can be used in a chain.\n");
+        inputflag = 0;
+    }
+    if (sweeps > 0 && compact == TRUE) {
+        printf("Not available with -compact: -rollcoin-sweep\n");
+        inputflag = 0;
+    }
+    if (sweeps > 0 && isStreamedPath(argv[2]) == TRUE) {
+        printf("Not available with streamed output: -rollcoin-sweep (one output file per radius)\n");
+        inputflag = 0;
+    }
+
+    // Separation surface is sampled in float32 storage:
+    if (offsetgrid == TRUE && compact == TRUE) {
+        printf("-offset-grid can't be used with -compact.\n");
+        inputflag = 0;
+    }
+
+    // Checkpoints are written next to the output file, for a single output of float32 storage:
+    if ((interval > 0 || resume == TRUE) && (sweeps > 0 || compact == TRUE || isVirtualPath(argv[2]) == TRUE)) {
+        printf("Checkpoints can't be used with -rollcoin-sweep, -compact or virtual output files.\n");
+        inputflag = 0;
+    }
+
+    // Windowed processing makes a single float32 surface in rectangles, a patch is written into a file on disk:
+    if ((windowed == TRUE || patch == TRUE) && (windowed == FALSE || sweeps > 0 || compact == TRUE || contours == TRUE || audit == TRUE
+                                                || interval > 0 || resume == TRUE || (patch == TRUE && isVirtualPath(argv[2]) == TRUE))) {
+        printf("-window and -aoi can't be used with -rollcoin-sweep, -compact, -contours, -audit or checkpoints, -patch needs -window or -aoi and an output file on disk.\n");
+        inputflag = 0;
+    }
+
+    // Preview runs the whole chain once on a decimated float32 surface, the grid is not the grid of the input:
+    if (preview > 0 && (sweeps > 0 || compact == TRUE || windowed == TRUE || patch == TRUE || audit == TRUE || interval > 0 || resume == TRUE)) {
+        printf("-preview can't be used with -rollcoin-sweep, -compact, -window, -aoi, -patch, -audit or checkpoints.\n");
+        inputflag = 0;
     }
 
     // Terminate process if invalid parameters are given:
@@ -57,55 +139,367 @@ void cli(int argc, const char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // Quick-look preview on a decimated surface:
+    if (preview > 0) {
+        runPreviewChain(argc, argv, preview);
+        return;
+    }
+
+    // Process only a window or area of interest of the surface:
+    if (windowed == TRUE) {
+        runWindowedChain(argc, argv);
+        return;
+    }
+
+    // Process surface in compact storage, float32 storage is used if the depth range doesn't fit:
+    if (compact == TRUE) {
+        struct CompactSurface *csurf = inputCompactDepthModel(argv[1]);
+
+        if (csurf != NULL) {
+            for (int i = 3; i < argc; i++) {
+                i = applyCompactStep(csurf, argc, argv, i);
+                if (i < 0) {
+                    printf("Exiting.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            writeCompactSurfaceToFile(csurf, argv[2]);
+            freeCompactSurface(csurf);
+            return;
+        }
+        printf("Using float32 storage.\n");
+    }
+
+    // Process with checkpoints (-resume without interval checkpoints at default interval):
+    if (interval > 0 || resume == TRUE) {
+        runCheckpointedChain(argc, argv, (interval > 0) ? interval : CHECKPOINT_DEFAULT_INTERVAL, resume);
+        return;
+    }
+
     // Start processing surface:
     // 1. Open surface
     struct FloatSurface *surf = inputDepthModel(argv[1]);
-    
+
     // 2. Perform process steps
     for (int i = 3; i < argc; i++) {
-        if (strcmp(argv[i], "-buffer") == 0) {
-            // Apply 3x3 cell focal maximun filter:
-            maxFilterSurface(surf);
-        }   else if (strcmp(argv[i], "-offset") == 0 && argc > i+1) {
-            if (fabs(atof(argv[i+1]) - 0.0) > EPSILON) {
-                // Apply surface offset:
-                offset(surf, atof(argv[i+1]));
-                i++;
-            }
-        }   else if (strcmp(argv[i], "-laplacian") == 0 && argc > i+1) {
-            if (atoi(argv[i+1]) > 0) {
-                // Apply Laplacian smoothing:
-                smoothLaplacian(atoi(argv[i+1]), surf);
-                i++;
-            }
-        }   else if (strcmp(argv[i], "-rollcoin") == 0 && argc > i+2) {
-            if (atoi(argv[i+1]) > 0) {
-                if (strcmp(argv[i+2], "trim") == 0 || strcmp(argv[i+2], "notrim") == 0) {
-                    // Apply Rolling Coin smoothings
-                    // Set trim flag:
-                    if (strcmp(argv[i+2], "trim") == 0) {
-                        trimflag = 1;
-                    }   else if (strcmp(argv[i+2], "notrim") == 0) {
-                        trimflag = 0;
-                    }
-                    // Set flag to make sure allocated coin is freed
-                    rollingcoin = 1;
-                    // Create Coin:
-                    penny = createCoin(atoi(argv[i+1]), trimflag);
-                    // Apply Rolling Coin smoothing:
-                    coinRollSurface(surf, penny);
-                    i+=2;
-                }
-            }
+        if (strcmp(argv[i], "-rollcoin-sweep") == 0) {
+            // Sweep performs the rest of the chain and writes all outputs:
+            coinSweep(surf, argc, argv, i);
+            freeFloatSurface(surf);
+            return;
+        }
+        i = applyProcessStep(surf, argc, argv, i);
+        if (i < 0) {
+            printf("Exiting.\n");
+            exit(EXIT_FAILURE);
         }
     }
 
     // 3. Write surface to file, path from input parameters:
     writeSurfaceToFile(surf, argv[2]);
 
-    // 4. Free allocated memory of surface & coin objects:
+    // 4. Free allocated memory of surface object:
     freeFloatSurface(surf);
-    if (rollingcoin == 1) {
-        freeCoin(penny);
+}
+
+
+/*
+*   Checks a single process step and its parameters, starting from argv[i]
+*   - Prints a description of a valid step
+*   - Returns the index of the last argument used by the step
+*   - Returns -1 if the step or its parameters are faulty
+*/
+int checkProcessStep(int argc, const char *argv[], int i) {
+    if (strcmp(argv[i], "-buffer") == 0) {
+        printf("  -Buffer shoals\n");
+        return i;
+    }   else if (strcmp(argv[i], "-offset") == 0 && argc > i+1) {
+        if (fabs(atof(argv[i+1]) - 0.0) > EPSILON) {
+            printf("  -Offset, %.3f m\n", atof(argv[i+1]));
+            return i+1;
+        }
+    }   else if (strcmp(argv[i], "-offset-grid") == 0 && argc > i+1) {
+        if (checkSeparationSurface(argv[i+1]) == TRUE) {
+            printf("  -Offset with separation surface %s\n", argv[i+1]);
+            return i+1;
+        }
+        printf("  -Separation surface can't be read or is rotated: %s\n", argv[i+1]);
+    }   else if (strcmp(argv[i], "-laplacian") == 0 && argc > i+1) {
+        if (atoi(argv[i+1]) > 0) {
+            printf("  -Laplacian smoothing, %d iterations\n", atoi(argv[i+1]));
+            return i+1;
+        }
+    }   else if (strcmp(argv[i], "-rollcoin") == 0 && argc > i+2) {
+        if (atoi(argv[i+1]) > 0) {
+            if (strcmp(argv[i+2], "trim") == 0 || strcmp(argv[i+2], "notrim") == 0) {
+                printf("  -Rolling Coin: r=%d cells, %s\n", atoi(argv[i+1]), argv[i+2]);
+                return i+2;
+            }
+        }
+    }   else if (strcmp(argv[i], "-compact") == 0) {
+        printf("  -Compact storage: int16 centimetres, shoal-safe rounding\n");
+        return i;
+    }   else if (strcmp(argv[i], "-contours") == 0 && argc > i+2) {
+        if (checkContourLevels(argv[i+1]) == TRUE) {
+            printf("  -Contours: %s %s, to %s\n", strchr(argv[i+1], ',') ? "levels" : "interval", argv[i+1], argv[i+2]);
+            return i+2;
+        }
+    }   else if (strcmp(argv[i], "-compress") == 0 && argc > i+1) {
+        if (compressionOption(argv[i+1]) != NULL) {
+            printf("  -Output compression: %s\n", argv[i+1]);
+            return i+1;
+        }
+    }   else if (strcmp(argv[i], "-stats") == 0) {
+        printf("  -Print output statistics as JSON\n");
+        return i;
+    }   else if (strcmp(argv[i], "-audit") == 0 && argc > i+1) {
+        char *end;
+        const double tolerance = strtod(argv[i+1], &end);
+        if (end != argv[i+1] && *end == '\0' && tolerance >= 0.0) {
+            if (argc > i+2 && argv[i+2][0] != '-') {     // Optional violation mask
+                printf("  -Safety audit against input, tolerance %.3f m, violation mask to %s\n", tolerance, argv[i+2]);
+                return i+2;
+            }
+            printf("  -Safety audit against input, tolerance %.3f m\n", tolerance);
+            return i+1;
+        }
+    }   else if (strcmp(argv[i], "-simd") == 0 && argc > i+1) {
+        if (selectSimdKernels(argv[i+1]) == TRUE) {
+            printf("  -SIMD kernels: %s\n", simd.name);
+            return i+1;
+        }
+    }   else if (strcmp(argv[i], "-rollcoin-sweep") == 0 && argc > i+2) {
+        int radii[MAX_SWEEP_RADII];
+        if (parseRadiusList(argv[i+1], radii, MAX_SWEEP_RADII) > 0) {
+            if (strcmp(argv[i+2], "trim") == 0 || strcmp(argv[i+2], "notrim") == 0) {
+                printf("  -Rolling Coin sweep: r=%s cells, %s (one output per radius)\n", argv[i+1], argv[i+2]);
+                return i+2;
+            }
+        }
+    }
+
+    return -1;
+}
+
+
+/*
+*   Applies a single (checked) process step to surface, starting from argv[i]
+*   - Returns the index of the last argument used by the step
+*   - Returns -1 if the step can't be applied to the surface (separation surface, memory), the surface is unchanged
+*/
+int applyProcessStep(struct FloatSurface *surf, int argc, const char *argv[], int i) {
+    if (strcmp(argv[i], "-buffer") == 0) {
+        // Apply 3x3 cell focal maximun filter:
+        if (maxFilterSurface(surf) == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+    }   else if (strcmp(argv[i], "-offset") == 0 && argc > i+1) {
+        // Apply surface offset:
+        offset(surf, atof(argv[i+1]));
+        i++;
+    }   else if (strcmp(argv[i], "-offset-grid") == 0 && argc > i+1) {
+        // Apply separation surface, constant offset of a following -offset step is added in the same pass:
+        struct FloatSurface *separation = readSeparationSurface(argv[i+1], surf);
+        if (separation == NULL) {
+            printf("Separation surface can't be read, a surface is rotated or the coordinate systems differ: %s\n", argv[i+1]);
+            return -1;
+        }
+        const char fused = (argc > i+3 && strcmp(argv[i+2], "-offset") == 0) ? TRUE : FALSE;
+        offsetGrid(surf, separation, (fused == TRUE) ? (float)atof(argv[i+3]) : -0.0f);
+        freeFloatSurface(separation);
+        i += (fused == TRUE) ? 3 : 1;
+    }   else if (strcmp(argv[i], "-laplacian") == 0 && argc > i+1) {
+        // Apply Laplacian smoothing:
+        if (smoothLaplacian(atoi(argv[i+1]), surf) == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+        i++;
+    }   else if (strcmp(argv[i], "-contours") == 0 && argc > i+2) {
+        // Write contours of the current surface:
+        contourSurface(surf, argv[i+1], argv[i+2]);
+        i+=2;
+    }   else if (strcmp(argv[i], "-compress") == 0 && argc > i+1) {
+        // Select compression of outputs:
+        setOutputCompression(argv[i+1]);
+        i++;
+    }   else if (strcmp(argv[i], "-stats") == 0) {
+        // Print statistics of outputs written after this:
+        setStatisticsPrinting(TRUE);
+    }   else if (strcmp(argv[i], "-audit") == 0 && argc > i+1) {
+        // Compare the current surface to the input, mask argument is optional:
+        const char *maskfp = (argc > i+2 && argv[i+2][0] != '-') ? argv[i+2] : NULL;
+        auditSurface(surf, (float)atof(argv[i+1]), maskfp);
+        i += (maskfp != NULL) ? 2 : 1;
+    }   else if (strcmp(argv[i], "-simd") == 0 && argc > i+1) {
+        // Select SIMD kernel variant for the following steps:
+        selectSimdKernels(argv[i+1]);
+        i++;
+    }   else if (strcmp(argv[i], "-rollcoin") == 0 && argc > i+2) {
+        // Apply Rolling Coin smoothing (create Coin, roll, free Coin):
+        char trimflag = (strcmp(argv[i+2], "trim") == 0) ? TRUE : FALSE;
+        struct Coin *penny = createCoin(atoi(argv[i+1]), trimflag);
+        const char rolled = (penny != NULL) ? coinRollSurface(surf, penny) : FALSE;
+        if (penny != NULL) {
+            freeCoin(penny);
+        }
+        if (rolled == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+        i+=2;
+    }
+
+    return i;
+}
+
+
+/*
+*   Applies a single (checked) process step to a compact surface, starting from argv[i]
+*   - Returns the index of the last argument used by the step, -1 if memory can't be allocated
+*/
+int applyCompactStep(struct CompactSurface *surf, int argc, const char *argv[], int i) {
+    if (strcmp(argv[i], "-buffer") == 0) {
+        if (maxFilterCompact(surf) == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+    }   else if (strcmp(argv[i], "-offset") == 0 && argc > i+1) {
+        offsetCompact(surf, atof(argv[i+1]));
+        i++;
+    }   else if (strcmp(argv[i], "-laplacian") == 0 && argc > i+1) {
+        if (smoothLaplacianCompact(atoi(argv[i+1]), surf) == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+        i++;
+    }   else if (strcmp(argv[i], "-contours") == 0 && argc > i+2) {
+        // Contours are made from a decoded float32 copy:
+        struct FloatSurface decoded = {surf->inputfp, surf->projection, surf->geotransform, createFloatArray(surf->cols, surf->rows), surf->nodata, surf->rows, surf->cols};
+        if (decoded.array == NULL) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+        for (int row = 0; row < surf->rows; row++) {
+            decodeCompactRow(surf, row, decoded.array[row]);
+        }
+        contourSurface(&decoded, argv[i+1], argv[i+2]);
+        freeFloatArray(decoded.array, decoded.rows);
+        i+=2;
+    }   else if (strcmp(argv[i], "-compress") == 0 && argc > i+1) {
+        setOutputCompression(argv[i+1]);
+        i++;
+    }   else if (strcmp(argv[i], "-stats") == 0) {
+        setStatisticsPrinting(TRUE);
+    }   else if (strcmp(argv[i], "-audit") == 0 && argc > i+1) {
+        // Audit is done on a decoded float32 copy (rounding of the storage is audited too):
+        const char *maskfp = (argc > i+2 && argv[i+2][0] != '-') ? argv[i+2] : NULL;
+        struct FloatSurface decoded = {surf->inputfp, surf->projection, surf->geotransform, createFloatArray(surf->cols, surf->rows), surf->nodata, surf->rows, surf->cols};
+        if (decoded.array == NULL) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+        for (int row = 0; row < surf->rows; row++) {
+            decodeCompactRow(surf, row, decoded.array[row]);
+        }
+        auditSurface(&decoded, (float)atof(argv[i+1]), maskfp);
+        freeFloatArray(decoded.array, decoded.rows);
+        i += (maskfp != NULL) ? 2 : 1;
+    }   else if (strcmp(argv[i], "-simd") == 0 && argc > i+1) {
+        selectSimdKernels(argv[i+1]);
+        i++;
+    }   else if (strcmp(argv[i], "-rollcoin") == 0 && argc > i+2) {
+        char trimflag = (strcmp(argv[i+2], "trim") == 0) ? TRUE : FALSE;
+        struct Coin *penny = createCoin(atoi(argv[i+1]), trimflag);
+        const char rolled = (penny != NULL) ? coinRollCompact(surf, penny) : FALSE;
+        if (penny != NULL) {
+            freeCoin(penny);
+        }
+        if (rolled == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+        i+=2;
+    }
+
+    return i;
+}
+
+
+/*
+*   Parses a comma separated list of coin radii (e.g. "5,8,13")
+*   - Radii are saved to a list passed as a parameter
+*   - Returns number of radii, or 0 if the list is faulty
+*/
+int parseRadiusList(const char *list, int *radii, const int maxcount) {
+    int count = 0;
+    const char *p = list;
+
+    while (*p != '\0') {
+        char *end;
+        long radius = strtol(p, &end, 10);
+
+        if (end == p || radius < 1 || radius > 10000 || count == maxcount) {
+            return 0;
+        }
+        radii[count++] = (int)radius;
+
+        if (*end == ',') {
+            end++;
+        }   else if (*end != '\0') {
+            return 0;
+        }
+        p = end;
+    }
+
+    return count;
+}
+
+
+/*
+*   Rolling Coin sweep: argv[i] is "-rollcoin-sweep r1,r2,... trim/notrim"
+*   - Input is read once, Rolling Coin of every radius uses banded range indexes
+*   - For every radius: rolls a copy of the surface, applies the rest of the
+*     chain and writes the result to the output path with radius added
+*     (e.g. out.tif --> out_r5.tif, out_r8.tif, ...)
+*/
+void coinSweep(struct FloatSurface *surf, int argc, const char *argv[], int i) {
+    int radii[MAX_SWEEP_RADII];
+    const int count = parseRadiusList(argv[i+1], radii, MAX_SWEEP_RADII);
+    const char trimflag = (strcmp(argv[i+2], "trim") == 0) ? TRUE : FALSE;
+    char outputfp[1000];
+
+    for (int j = 0; j < count; j++) {
+        struct FloatSurface *product = copyFloatSurface(surf);
+        struct Coin *penny = (product != NULL) ? createCoin(radii[j], trimflag) : NULL;
+        const char rolled = (penny != NULL) ? coinRollSurfaceIndexed(product, penny) : FALSE;
+        if (penny != NULL) {
+            freeCoin(penny);
+        }
+        if (rolled == FALSE) {
+            printf("Memory allocation failed: -rollcoin-sweep\n");
+            printf("Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // Rest of the chain (contour files are named like output files):
+        for (int k = i+3; k < argc; k++) {
+            if (strcmp(argv[k], "-contours") == 0) {
+                radiusOutputPath(argv[k+2], radii[j], outputfp);
+                contourSurface(product, argv[k+1], outputfp);
+                k+=2;
+                continue;
+            }
+            k = applyProcessStep(product, argc, argv, k);
+            if (k < 0) {
+                printf("Exiting.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        radiusOutputPath(argv[2], radii[j], outputfp);
+        writeSurfaceToFile(product, outputfp);
+        freeFloatSurface(product);
     }
 }
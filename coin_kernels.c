@@ -0,0 +1,268 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Rolling Coin kernels specialised for common coin radii (1 - MAX_KERNEL_RADIUS cells)
+*   - Same result as the generic coinRollSurface, which is used for other radii
+*
+*   Generic Rolling Coin tests every cell of the coin mask (char**) for every surface cell.
+*   Coin rows are continuous, so a coin is fully described by the half widths of its rows
+*   (chords). Kernels are compiled separately for every radius and trim flag, with radius
+*   and chords as compile time constants, and have no mask tests in their inner loops:
+*
+*       r=3:    . . . X . . .       chords (half widths):   0
+*               . X X X X X .                               2
+*               . X X X X X .                               2
+*               X X X X X X X                               3
+*               . X X X X X .                               2
+*               . X X X X X .                               2
+*               . . . X . . .                               0
+*
+*   Kernels are also compiled for each SIMD instruction set (see simd_kernels.c).
+*
+*   Kernels work in two passes:
+*   1. Shoalest depth on the coin of every cell (nodata is masked first)
+*   2. "Press": every cell gets the deepest shoalest depth of the coins covering it
+*/
+
+
+// Number of independent partial results in row maximum / minimum loops:
+#define KERNEL_LANES 8
+
+
+/*
+*   Chords of untrimmed coins, radius r = 1 - 32: half width of coin row dy = floor(sqrt(r^2 - dy^2)),
+*   rows dy = -r ... r. Trimmed coin rows are clipped to half width r - 1.
+*/
+static const unsigned char coinChordTable[MAX_KERNEL_RADIUS][2 * MAX_KERNEL_RADIUS + 1] = {
+    /* r= 1 */ {0, 1, 0},
+    /* r= 2 */ {0, 1, 2, 1, 0},
+    /* r= 3 */ {0, 2, 2, 3, 2, 2, 0},
+    /* r= 4 */ {0, 2, 3, 3, 4, 3, 3, 2, 0},
+    /* r= 5 */ {0, 3, 4, 4, 4, 5, 4, 4, 4, 3, 0},
+    /* r= 6 */ {0, 3, 4, 5, 5, 5, 6, 5, 5, 5, 4, 3, 0},
+    /* r= 7 */ {0, 3, 4, 5, 6, 6, 6, 7, 6, 6, 6, 5, 4, 3, 0},
+    /* r= 8 */ {0, 3, 5, 6, 6, 7, 7, 7, 8, 7, 7, 7, 6, 6, 5, 3, 0},
+    /* r= 9 */ {0, 4, 5, 6, 7, 8, 8, 8, 8, 9, 8, 8, 8, 8, 7, 6, 5, 4, 0},
+    /* r=10 */ {0, 4, 6, 7, 8, 8, 9, 9, 9, 9, 10, 9, 9, 9, 9, 8, 8, 7, 6, 4, 0},
+    /* r=11 */ {0, 4, 6, 7, 8, 9, 9, 10, 10, 10, 10, 11, 10, 10, 10, 10, 9, 9, 8, 7, 6, 4, 0},
+    /* r=12 */ {0, 4, 6, 7, 8, 9, 10, 10, 11, 11, 11, 11, 12, 11, 11, 11, 11, 10, 10, 9, 8, 7, 6, 4, 0},
+    /* r=13 */ {0, 5, 6, 8, 9, 10, 10, 11, 12, 12, 12, 12, 12, 13, 12, 12, 12, 12, 12, 11, 10, 10, 9, 8, 6, 5, 0},
+    /* r=14 */ {0, 5, 7, 8, 9, 10, 11, 12, 12, 13, 13, 13, 13, 13, 14, 13, 13, 13, 13, 13, 12, 12, 11, 10, 9, 8, 7, 5, 0},
+    /* r=15 */ {0, 5, 7, 9, 10, 11, 12, 12, 13, 13, 14, 14, 14, 14, 14, 15, 14, 14, 14, 14, 14, 13, 13, 12, 12, 11, 10, 9, 7, 5, 0},
+    /* r=16 */ {0, 5, 7, 9, 10, 11, 12, 13, 13, 14, 14, 15, 15, 15, 15, 15, 16, 15, 15, 15, 15, 15, 14, 14, 13, 13, 12, 11, 10, 9, 7, 5, 0},
+    /* r=17 */ {0, 5, 8, 9, 10, 12, 12, 13, 14, 15, 15, 15, 16, 16, 16, 16, 16, 17, 16, 16, 16, 16, 16, 15, 15, 15, 14, 13, 12, 12, 10, 9, 8, 5, 0},
+    /* r=18 */ {0, 5, 8, 9, 11, 12, 13, 14, 14, 15, 16, 16, 16, 17, 17, 17, 17, 17, 18, 17, 17, 17, 17, 17, 16, 16, 16, 15, 14, 14, 13, 12, 11, 9, 8, 5, 0},
+    /* r=19 */ {0, 6, 8, 10, 11, 12, 13, 14, 15, 16, 16, 17, 17, 18, 18, 18, 18, 18, 18, 19, 18, 18, 18, 18, 18, 18, 17, 17, 16, 16, 15, 14, 13, 12, 11, 10, 8, 6, 0},
+    /* r=20 */ {0, 6, 8, 10, 12, 13, 14, 15, 16, 16, 17, 17, 18, 18, 19, 19, 19, 19, 19, 19, 20, 19, 19, 19, 19, 19, 19, 18, 18, 17, 17, 16, 16, 15, 14, 13, 12, 10, 8, 6, 0},
+    /* r=21 */ {0, 6, 8, 10, 12, 13, 14, 15, 16, 17, 17, 18, 18, 19, 19, 20, 20, 20, 20, 20, 20, 21, 20, 20, 20, 20, 20, 20, 19, 19, 18, 18, 17, 17, 16, 15, 14, 13, 12, 10, 8, 6, 0},
+    /* r=22 */ {0, 6, 9, 11, 12, 13, 15, 16, 16, 17, 18, 19, 19, 20, 20, 20, 21, 21, 21, 21, 21, 21, 22, 21, 21, 21, 21, 21, 21, 20, 20, 20, 19, 19, 18, 17, 16, 16, 15, 13, 12, 11, 9, 6, 0},
+    /* r=23 */ {0, 6, 9, 11, 12, 14, 15, 16, 17, 18, 18, 19, 20, 20, 21, 21, 21, 22, 22, 22, 22, 22, 22, 23, 22, 22, 22, 22, 22, 22, 21, 21, 21, 20, 20, 19, 18, 18, 17, 16, 15, 14, 12, 11, 9, 6, 0},
+    /* r=24 */ {0, 6, 9, 11, 13, 14, 15, 16, 17, 18, 19, 20, 20, 21, 21, 22, 22, 22, 23, 23, 23, 23, 23, 23, 24, 23, 23, 23, 23, 23, 23, 22, 22, 22, 21, 21, 20, 20, 19, 18, 17, 16, 15, 14, 13, 11, 9, 6, 0},
+    /* r=25 */ {0, 7, 9, 11, 13, 15, 16, 17, 18, 19, 20, 20, 21, 21, 22, 22, 23, 23, 24, 24, 24, 24, 24, 24, 24, 25, 24, 24, 24, 24, 24, 24, 24, 23, 23, 22, 22, 21, 21, 20, 20, 19, 18, 17, 16, 15, 13, 11, 9, 7, 0},
+    /* r=26 */ {0, 7, 10, 12, 13, 15, 16, 17, 18, 19, 20, 21, 21, 22, 23, 23, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 26, 25, 25, 25, 25, 25, 25, 25, 24, 24, 24, 23, 23, 22, 21, 21, 20, 19, 18, 17, 16, 15, 13, 12, 10, 7, 0},
+    /* r=27 */ {0, 7, 10, 12, 14, 15, 16, 18, 19, 20, 20, 21, 22, 23, 23, 24, 24, 25, 25, 25, 26, 26, 26, 26, 26, 26, 26, 27, 26, 26, 26, 26, 26, 26, 26, 25, 25, 25, 24, 24, 23, 23, 22, 21, 20, 20, 19, 18, 16, 15, 14, 12, 10, 7, 0},
+    /* r=28 */ {0, 7, 10, 12, 14, 15, 17, 18, 19, 20, 21, 22, 22, 23, 24, 24, 25, 25, 26, 26, 26, 27, 27, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 27, 27, 26, 26, 26, 25, 25, 24, 24, 23, 22, 22, 21, 20, 19, 18, 17, 15, 14, 12, 10, 7, 0},
+    /* r=29 */ {0, 7, 10, 12, 14, 16, 17, 18, 20, 21, 21, 22, 23, 24, 24, 25, 25, 26, 26, 27, 27, 27, 28, 28, 28, 28, 28, 28, 28, 29, 28, 28, 28, 28, 28, 28, 28, 27, 27, 27, 26, 26, 25, 25, 24, 24, 23, 22, 21, 21, 20, 18, 17, 16, 14, 12, 10, 7, 0},
+    /* r=30 */ {0, 7, 10, 13, 14, 16, 18, 19, 20, 21, 22, 23, 24, 24, 25, 25, 26, 27, 27, 27, 28, 28, 28, 29, 29, 29, 29, 29, 29, 29, 30, 29, 29, 29, 29, 29, 29, 29, 28, 28, 28, 27, 27, 27, 26, 25, 25, 24, 24, 23, 22, 21, 20, 19, 18, 16, 14, 13, 10, 7, 0},
+    /* r=31 */ {0, 7, 10, 13, 15, 16, 18, 19, 20, 21, 22, 23, 24, 25, 25, 26, 27, 27, 28, 28, 28, 29, 29, 29, 30, 30, 30, 30, 30, 30, 30, 31, 30, 30, 30, 30, 30, 30, 30, 29, 29, 29, 28, 28, 28, 27, 27, 26, 25, 25, 24, 23, 22, 21, 20, 19, 18, 16, 15, 13, 10, 7, 0},
+    /* r=32 */ {0, 7, 11, 13, 15, 17, 18, 19, 21, 22, 23, 24, 24, 25, 26, 27, 27, 28, 28, 29, 29, 30, 30, 30, 30, 31, 31, 31, 31, 31, 31, 31, 32, 31, 31, 31, 31, 31, 31, 31, 30, 30, 30, 30, 29, 29, 28, 28, 27, 27, 26, 25, 24, 24, 23, 22, 21, 19, 18, 17, 15, 13, 11, 7, 0},
+};
+
+
+/*
+*   Maximum of cells [first_col, last_col] of a row and initial value
+*   - KERNEL_LANES independent maximums, so that consecutive comparisons
+*     don't wait for each other (and can be vectorised)
+*/
+KERNEL_INLINE float getChordMaximum(const float *cells, const int first_col, const int last_col, float ret) {
+    float lanes[KERNEL_LANES];
+    int col = first_col;
+
+    for (int i = 0; i < KERNEL_LANES; i++) {
+        lanes[i] = ret;
+    }
+    for (; col + KERNEL_LANES - 1 <= last_col; col += KERNEL_LANES) {
+        for (int i = 0; i < KERNEL_LANES; i++) {
+            lanes[i] = (cells[col + i] > lanes[i]) ? cells[col + i] : lanes[i];
+        }
+    }
+    for (; col <= last_col; col++) {
+        ret = (cells[col] > ret) ? cells[col] : ret;
+    }
+    for (int i = 0; i < KERNEL_LANES; i++) {
+        ret = (lanes[i] > ret) ? lanes[i] : ret;
+    }
+
+    return ret;
+}
+
+
+/*
+*   Minimum of cells [first_col, last_col] of a row and initial value
+*/
+KERNEL_INLINE float getChordMinimum(const float *cells, const int first_col, const int last_col, float ret) {
+    float lanes[KERNEL_LANES];
+    int col = first_col;
+
+    for (int i = 0; i < KERNEL_LANES; i++) {
+        lanes[i] = ret;
+    }
+    for (; col + KERNEL_LANES - 1 <= last_col; col += KERNEL_LANES) {
+        for (int i = 0; i < KERNEL_LANES; i++) {
+            lanes[i] = (cells[col + i] < lanes[i]) ? cells[col + i] : lanes[i];
+        }
+    }
+    for (; col <= last_col; col++) {
+        ret = (cells[col] < ret) ? cells[col] : ret;
+    }
+    for (int i = 0; i < KERNEL_LANES; i++) {
+        ret = (lanes[i] < ret) ? lanes[i] : ret;
+    }
+
+    return ret;
+}
+
+
+/*
+*   Kernel body for one coin radius (radius before trimming) and trim flag
+*   - Shoalest: temporary array for shoalest depths
+*   - Runs the rows of a row band, bands wait for each other between passes
+*     (coins of the edge rows of a band reach rows of the neighbouring bands)
+*   - Modifies the surface
+*/
+KERNEL_INLINE void rollCoinRadius(struct FloatSurface *src, float **shoalest, struct RowBand *band, const int radius, const char trim) {
+    const int coin_radius = (trim == TRUE) ? radius - 1 : radius;
+    const float nodata = src->nodata;
+    const float placeholder = -999999.0;        // Masked nodata, never the shoalest depth
+    const float unpressed = 10000.0;            // Cells not on any coin (with depths)
+    int chords[2 * MAX_KERNEL_RADIUS + 1];
+
+    // Chords of the coin (trimmed coin is the inner part of the untrimmed coin):
+    for (int row_coin = -coin_radius; row_coin <= coin_radius; row_coin++) {
+        const int halfwidth = coinChordTable[radius - 1][row_coin + radius];
+        chords[row_coin + coin_radius] = (halfwidth < coin_radius) ? halfwidth : coin_radius;
+    }
+
+    const int bandrows = band->last_row - band->first_row;
+
+    // Mask nodata:
+    for (int row = band->first_row; row < band->last_row; row++) {
+        for (int col = 0; col < src->cols; col++) {
+            if (fabs(src->array[row][col] - nodata) < EPSILON) {    // (value == nodata)
+                src->array[row][col] = placeholder;
+            }
+        }
+    }
+
+    waitRowBands(band);
+
+    // 1. Shoalest depth on coin (maximum elevation):
+    for (int row = band->first_row; row < band->last_row; row++) {
+        for (int col = 0; col < src->cols; col++) {
+            float shoal = placeholder;
+
+            for (int row_coin = -coin_radius; row_coin <= coin_radius; row_coin++) {
+                if (row + row_coin < 0 || row + row_coin >= src->rows) {    // Partial coin on surface edges
+                    continue;
+                }
+                const float *depths = src->array[row + row_coin];
+                const int first_col = (col - chords[row_coin + coin_radius] > 0) ? col - chords[row_coin + coin_radius] : 0;
+                const int last_col = (col + chords[row_coin + coin_radius] < src->cols - 1) ? col + chords[row_coin + coin_radius] : src->cols - 1;
+
+                shoal = getChordMaximum(depths, first_col, last_col, shoal);
+            }
+
+            shoalest[row][col] = (shoal > placeholder) ? shoal : unpressed;     // Coins without depths press nothing
+        }
+        printStepProgress(0.5 * (row + 1.0 - band->first_row) / bandrows);
+    }
+    waitRowBands(band);
+
+    // 2. Press shoalest depths to coin areas, restore nodata (safety first):
+    for (int row = band->first_row; row < band->last_row; row++) {
+        for (int col = 0; col < src->cols; col++) {
+            float pressed = unpressed;
+
+            if (src->array[row][col] <= placeholder) {     // Masked nodata
+                src->array[row][col] = nodata;
+                continue;
+            }
+
+            for (int row_coin = -coin_radius; row_coin <= coin_radius; row_coin++) {
+                if (row + row_coin < 0 || row + row_coin >= src->rows) {    // Partial coin on surface edges
+                    continue;
+                }
+                const float *shoals = shoalest[row + row_coin];
+                const int first_col = (col - chords[row_coin + coin_radius] > 0) ? col - chords[row_coin + coin_radius] : 0;
+                const int last_col = (col + chords[row_coin + coin_radius] < src->cols - 1) ? col + chords[row_coin + coin_radius] : src->cols - 1;
+
+                pressed = getChordMinimum(shoals, first_col, last_col, pressed);
+            }
+
+            src->array[row][col] = pressed;
+        }
+        printStepProgress(0.5 + 0.5 * (row + 1.0 - band->first_row) / bandrows);
+    }
+}
+
+
+// Kernels for every radius, trim flag and instruction set:
+#define COIN_KERNELS_FOR(R, SUFFIX, TARGET) \
+    TARGET static void rollCoinNotrim##R##SUFFIX(struct FloatSurface *src, float **shoalest, struct RowBand *band) { rollCoinRadius(src, shoalest, band, R, FALSE); } \
+    TARGET static void rollCoinTrim##R##SUFFIX(struct FloatSurface *src, float **shoalest, struct RowBand *band) { rollCoinRadius(src, shoalest, band, R, TRUE); }
+
+#if SIMD_X86
+#define COIN_KERNELS(R) COIN_KERNELS_FOR(R, Generic, ) COIN_KERNELS_FOR(R, Avx2, TARGET_AVX2) COIN_KERNELS_FOR(R, Avx512, TARGET_AVX512)
+#else
+#define COIN_KERNELS(R) COIN_KERNELS_FOR(R, Generic, )
+#endif
+
+COIN_KERNELS(1)  COIN_KERNELS(2)  COIN_KERNELS(3)  COIN_KERNELS(4)  COIN_KERNELS(5)  COIN_KERNELS(6)  COIN_KERNELS(7)  COIN_KERNELS(8)
+COIN_KERNELS(9)  COIN_KERNELS(10) COIN_KERNELS(11) COIN_KERNELS(12) COIN_KERNELS(13) COIN_KERNELS(14) COIN_KERNELS(15) COIN_KERNELS(16)
+COIN_KERNELS(17) COIN_KERNELS(18) COIN_KERNELS(19) COIN_KERNELS(20) COIN_KERNELS(21) COIN_KERNELS(22) COIN_KERNELS(23) COIN_KERNELS(24)
+COIN_KERNELS(25) COIN_KERNELS(26) COIN_KERNELS(27) COIN_KERNELS(28) COIN_KERNELS(29) COIN_KERNELS(30) COIN_KERNELS(31) COIN_KERNELS(32)
+
+#define KERNEL_LIST(PREFIX, SUFFIX) { \
+    PREFIX##1##SUFFIX,  PREFIX##2##SUFFIX,  PREFIX##3##SUFFIX,  PREFIX##4##SUFFIX,  PREFIX##5##SUFFIX,  PREFIX##6##SUFFIX,  PREFIX##7##SUFFIX,  PREFIX##8##SUFFIX,  \
+    PREFIX##9##SUFFIX,  PREFIX##10##SUFFIX, PREFIX##11##SUFFIX, PREFIX##12##SUFFIX, PREFIX##13##SUFFIX, PREFIX##14##SUFFIX, PREFIX##15##SUFFIX, PREFIX##16##SUFFIX, \
+    PREFIX##17##SUFFIX, PREFIX##18##SUFFIX, PREFIX##19##SUFFIX, PREFIX##20##SUFFIX, PREFIX##21##SUFFIX, PREFIX##22##SUFFIX, PREFIX##23##SUFFIX, PREFIX##24##SUFFIX, \
+    PREFIX##25##SUFFIX, PREFIX##26##SUFFIX, PREFIX##27##SUFFIX, PREFIX##28##SUFFIX, PREFIX##29##SUFFIX, PREFIX##30##SUFFIX, PREFIX##31##SUFFIX, PREFIX##32##SUFFIX  }
+
+// Dispatch table: [SIMD level][trim flag][radius - 1]
+static void (*const coinKernels[SIMD_LEVELS][2][MAX_KERNEL_RADIUS])(struct FloatSurface *, float **, struct RowBand *) = {
+    {KERNEL_LIST(rollCoinNotrim, Generic), KERNEL_LIST(rollCoinTrim, Generic)},
+#if SIMD_X86
+    {KERNEL_LIST(rollCoinNotrim, Avx2), KERNEL_LIST(rollCoinTrim, Avx2)},
+    {KERNEL_LIST(rollCoinNotrim, Avx512), KERNEL_LIST(rollCoinTrim, Avx512)}
+#endif
+};
+
+
+/*
+*   Rolls a coin over surface with a specialised kernel
+*   - Temp: scratch array of surface size (contents are overwritten)
+*   - Returns TRUE if the coin radius has a kernel and surface was modified
+*   - Returns FALSE if not, generic Rolling Coin must be used
+*/
+char rollCoinKernel(struct FloatSurface *src, struct Coin *penny, float **temp) {
+    const int radius = (penny->trim == TRUE) ? penny->radius + 1 : penny->radius;     // Radius before trimming
+
+    if (radius < 1 || radius > MAX_KERNEL_RADIUS) {
+        return FALSE;
+    }
+
+    // Rows are rolled in parallel row bands:
+    struct BandOperands operands = {src, temp, 0, 0.0, coinKernels[(int)simd.level][penny->trim == TRUE][radius - 1], NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+    runRowBands(src->rows, src->cols, rollCoinKernelBand, &operands);
+
+    return TRUE;
+}
+
+
+/*
+*   Runs the selected kernel on the rows of a row band
+*/
+void rollCoinKernelBand(struct RowBand *band) {
+    band->operands->kernel(band->operands->src, band->operands->temp, band);
+}
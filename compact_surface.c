@@ -0,0 +1,517 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Compact (reduced precision) surface storage: depths as int16 centimetre codes
+*   - File input and output of compact surfaces (one row at a time, no float copy of the surface)
+*   - Surface operators for compact surfaces (shoal buffering, offset, Laplacian, Rolling Coin)
+*
+*   Depth of a cell is (base + code) / 100 m, where base (cm) is chosen per surface
+*   so that all depths of the surface fit into codes -32766 ... 32765 (a range of ~655 m).
+*   Codes take 2 bytes per cell instead of 4, halving memory and bandwidth of every pass.
+*
+*   Rounding is shoal-safe: a depth is always stored as the nearest code that is
+*   shoaler than or equal to it, never deeper. Centimetre precise depths are stored exactly.
+*   Computations are done in float32, only storage is compact.
+*
+*   NoData is a code outside the depth codes: 32767 if nodata is larger than all depths
+*   (e.g. 1 000 000), otherwise -32768. So maximums and minimums of codes behave as
+*   maximums and minimums of the original float values.
+*/
+
+
+/*
+*   Decodes a code to a depth (m)
+*/
+float decodeCompactDepth(const int basecm, const int code) {
+    return (float)((double)(basecm + code) / 100.0);
+}
+
+
+/*
+*   Encodes a depth (m) to a code, rounding to the shoaler code (shoal-safe)
+*   - Depth must be within the depth range of the surface
+*/
+int16_t encodeCompactDepth(const int basecm, const float depth) {
+    const double scaled = (double)depth * 100.0 - basecm;
+    int code = COMPACT_MAX_CODE;
+
+    if (scaled < COMPACT_MAX_CODE) {
+        code = (scaled > COMPACT_MIN_CODE) ? (int)(scaled + 32768.5) - 32768 : COMPACT_MIN_CODE;   // Nearest code (positive before truncation)
+        code += (decodeCompactDepth(basecm, code) < depth && code < COMPACT_MAX_CODE);            // Nearest is deeper: next code is shoaler
+    }
+
+    return (int16_t)code;
+}
+
+
+/*
+*   Builds a compact surface (type "CompactSurface") from input depth model.
+*   - Allocates memory and populates struct, returns pointer to CompactSurface
+*   - Data is read one row at a time: first to get the depth range, then to encode depths
+*   - Returns NULL if depth range of the surface is too large for centimetre codes
+*/
+struct CompactSurface *inputCompactDepthModel(const char *path) {
+    GDALAllRegister();
+    GDALDatasetH dataset = NULL;
+    int success;
+
+    const char *readpath = inputFilePath(path);
+    if (readpath != NULL) {
+        dataset = GDALOpen(readpath, GA_ReadOnly);
+    }
+    if (dataset == NULL) {
+        printf("File read error. Recheck file path.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("File read successful. Building compact surface..");
+    fflush(stdout);
+    GDALRasterBandH band = GDALGetRasterBand(dataset, 1);
+    const double nodata = GDALGetRasterNoDataValue(band, &success);
+    const int rows = GDALGetRasterBandYSize(band);
+    const int cols = GDALGetRasterBandXSize(band);
+    float *line = CPLMalloc(sizeof(float) * cols);
+    float min = INFINITY;
+    float max = -INFINITY;
+
+    // 1. Depth range:
+    for (int row = 0; row < rows; row++) {
+        if (GDALRasterIO(band, GF_Read, 0, row, cols, 1, line, cols, 1, GDT_Float32, 0, 0) != CE_None) {
+            printf("An error occured when reading the input data file: %s\n", CPLGetLastErrorMsg());
+        }
+        for (int col = 0; col < cols; col++) {
+            if (fabs(line[col] - nodata) > EPSILON) {               // != NO DATA
+                min = (line[col] < min) ? line[col] : min;
+                max = (line[col] > max) ? line[col] : max;
+            }
+        }
+    }
+
+    // Base in the middle of the range, check that both ends can be encoded:
+    const int basecm = (min <= max) ? (int)floor(((double)min + (double)max) * 50.0) : 0;
+    if (min <= max && ((int)floor((double)min * 100.0) - basecm < COMPACT_MIN_CODE || (int)ceil((double)max * 100.0) - basecm > COMPACT_MAX_CODE)) {
+        printf("Depth range %.2f ... %.2f m is too large for compact storage.\n", min, max);
+        CPLFree(line);
+        GDALClose(dataset);
+        return NULL;
+    }
+
+    // Allocate and populate struct:
+    struct CompactSurface *ret = calloc(1, sizeof(struct CompactSurface));
+    ret->inputfp = calloc(strlen(path) + 1, 1);
+    strcpy(ret->inputfp, path);
+    const char *src_projection = GDALGetProjectionRef(dataset);
+    ret->projection = calloc(strlen(src_projection) + 1, 1);
+    strcpy(ret->projection, src_projection);
+    ret->geotransform = calloc(6, sizeof(double));
+    GDALGetGeoTransform(dataset, ret->geotransform);
+    ret->nodata = nodata;
+    ret->nodatacode = (min <= max && nodata > max) ? COMPACT_HIGH : COMPACT_LOW;
+    ret->basecm = basecm;
+    ret->rows = rows;
+    ret->cols = cols;
+    ret->array = createCompactArray(cols, rows);
+    if (ret->array == NULL) {
+        printf("Memory allocation failed.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // 2. Encode depths:
+    for (int row = 0; row < rows; row++) {
+        GDALRasterIO(band, GF_Read, 0, row, cols, 1, line, cols, 1, GDT_Float32, 0, 0);
+        encodeCompactRow(ret, line, ret->array[row]);
+    }
+
+    CPLFree(line);
+    GDALClose(dataset);
+    printf("Done\n");
+    return ret;
+}
+
+
+/*
+*   Writes CompactSurface to a GeoTIFF file (float32, one row at a time)
+*   - Uses GDAL for I/O
+*   - Exits if the file (or the stream) can't be written
+*/
+void writeCompactSurfaceToFile(struct CompactSurface *input, const char *outputpath) {
+    printf("Exporting file..");
+    fflush(stdout);
+    GDALDatasetH outdataset = createOutputDataset(outputpath, input->cols, input->rows);
+    if (outdataset == NULL) {
+        printf("Export was not successful.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    GDALRasterBandH outband = GDALGetRasterBand(outdataset, 1);
+    GDALSetGeoTransform(outdataset, input->geotransform);
+    GDALSetProjection(outdataset, input->projection);
+
+    float *line = CPLMalloc(sizeof(float) * input->cols);
+    char ret = 0;
+    struct SurfaceStatistics stats = {0, HUGE_VAL, -HUGE_VAL, 0.0, 0.0, 0, 1, 0, NULL};
+
+    // Statistics are computed from the decoded rows (see output_statistics.c):
+    for (int row = 0; row < input->rows; row++) {
+        decodeCompactRow(input, row, line);
+        accumulateStatisticsRows(&stats, line, 1, input->cols, input->nodata);
+        ret |= GDALRasterIO(outband, GF_Write, 0, row, input->cols, 1, line, input->cols, 1, GDT_Float32, 0, 0);
+    }
+
+    GDALSetRasterNoDataValue(outband, input->nodata);
+    limitHistogramBuckets(&stats);
+    storeStatistics(outband, &stats, input->rows, input->cols);
+
+    CPLFree(line);
+    if (closeOutputDataset(outdataset, outputpath) == FALSE || ret != 0) {
+        printf("Export was not successful.\nExiting.\n");
+        free(stats.histogram);
+        exit(EXIT_FAILURE);
+    }
+    printf("Done. Surface exported to file: %s\n\n", outputpath);
+    if (statisticsPrinting() == TRUE) {
+        printStatisticsJson(&stats, outputpath);
+    }
+    free(stats.histogram);
+    fflush(stdout);
+}
+
+
+/*
+*   Decodes a row of a compact surface to float depths (nodata as the original nodata value)
+*/
+void decodeCompactRow(struct CompactSurface *src, const int row, float *depths) {
+    const int16_t *codes = src->array[row];
+
+    for (int col = 0; col < src->cols; col++) {
+        if (codes[col] == src->nodatacode) {
+            depths[col] = src->nodata;
+        }   else {
+            depths[col] = decodeCompactDepth(src->basecm, codes[col]);
+        }
+    }
+}
+
+
+/*
+*   Encodes float depths to codes of a compact surface (shoal-safe)
+*/
+void encodeCompactRow(struct CompactSurface *src, const float *depths, int16_t *codes) {
+    for (int col = 0; col < src->cols; col++) {
+        if (fabs(depths[col] - src->nodata) < EPSILON) {            // (value == nodata)
+            codes[col] = src->nodatacode;
+        }   else {
+            codes[col] = encodeCompactDepth(src->basecm, depths[col]);
+        }
+    }
+}
+
+
+/*
+*   Shoal buffering (3 x 3 cell focal maximum) of a compact surface
+*   - Same rules as maxFilterSurface, original codes of 3 rows are kept in a row buffer
+*   - Returns FALSE if memory can't be allocated (surface is not changed)
+*/
+char maxFilterCompact(struct CompactSurface *src) {
+    const int rows = src->rows;
+    const int cols = src->cols;
+    const int nodatacode = src->nodatacode;
+    int16_t **original = createCompactArray(cols, 3);      // Original rows: row % 3
+
+    if (original == NULL) {
+        return FALSE;
+    }
+    printStepStart("Buffering shoals (compact)");
+    memcpy(original[0], src->array[0], cols * sizeof(int16_t));
+
+    for (int row = 0; row < rows; row++) {
+        if (row + 1 < rows) {
+            memcpy(original[(row + 1) % 3], src->array[row + 1], cols * sizeof(int16_t));
+        }
+
+        for (int col = 0; col < cols; col++) {
+            const int z = original[row % 3][col];
+            int max_code = INT16_MIN;
+
+            for (int row_n = row - 1; row_n <= row + 1; row_n++) {
+                if (row_n < 0 || row_n >= rows) {
+                    continue;
+                }
+                const int16_t *codes = original[row_n % 3];
+
+                for (int col_n = col - 1; col_n <= col + 1; col_n++) {
+                    if (col_n < 0 || col_n >= cols || (row_n == row && col_n == col)) {
+                        continue;
+                    }
+                    max_code = (codes[col_n] > max_code) ? codes[col_n] : max_code;
+                }
+            }
+
+            // Update if max is shoaler and neither is nodata:
+            if (max_code > z && max_code != nodatacode && z != nodatacode) {
+                src->array[row][col] = max_code;
+            }
+        }
+    }
+
+    freeCompactArray(original, 3);
+    printStepDone();
+    return TRUE;
+}
+
+
+/*
+*   Offset of a compact surface
+*   - Only the base of the codes changes, offset is rounded to centimetres (shoal-safe)
+*/
+void offsetCompact(struct CompactSurface *src, const float offset) {
+    printStepStart("Offsetting surface (compact)");
+    const double offsetcm = (double)offset * 100.0;
+
+    // Centimetre offsets (within float precision of the parameter) are exact, others are rounded up:
+    if (fabs(offsetcm - round(offsetcm)) < 0.01) {
+        src->basecm += (int)round(offsetcm);
+    }   else {
+        src->basecm += (int)ceil(offsetcm);
+        printf("(offset rounded to %.2f m)..", ceil(offsetcm) / 100.0);
+    }
+
+    printStepDone();
+}
+
+
+/*
+*   Laplacian smoothing of a compact surface
+*   - Same computation as smoothLaplacian, all iterations are done in float32 and
+*     depths are encoded (shoal-safe) only once, so rounding doesn't build up
+*   - Surface is smoothed in row bands: a band is decoded with a halo of N rows on both
+*     sides, every iteration is valid on one row less of the halo, after N iterations
+*     the band rows are exact
+*   - Encoded band is written back after the next band is decoded (its halo
+*     reads original rows of the band)
+*   - Returns FALSE if memory can't be allocated, the surface is then unchanged
+*/
+char smoothLaplacianCompact(const int iterations, struct CompactSurface *src) {
+    const int rows = src->rows;
+    const int cols = src->cols;
+    const int band = (4 * iterations > COMPACT_BAND_ROWS) ? 4 * iterations : COMPACT_BAND_ROWS;
+    const int capacity = (band + 2 * iterations < rows) ? band + 2 * iterations : rows;
+    const double xWeight = fabs(src->geotransform[5]) / fabs(src->geotransform[1]);    // Kernel weights, see getInterpolatedDepth
+    const double yWeight = fabs(src->geotransform[1]) / fabs(src->geotransform[5]);
+    float **decoded = acquireScratchArray(cols, capacity);         // Band with halos (float32)
+    float **smoothed = acquireScratchArray(cols, capacity);
+    int16_t **encoded = createCompactArray(cols, (band < rows) ? band : rows);   // Band waiting to be written back
+    int pending_first = 0;
+    int pending_rows = 0;
+
+    if (decoded == NULL || smoothed == NULL || encoded == NULL) {
+        releaseScratchArray(decoded, capacity);
+        releaseScratchArray(smoothed, capacity);
+        freeCompactArray(encoded, (band < rows) ? band : rows);
+        return FALSE;
+    }
+    printStepStart("Laplacian smoothing (compact)");
+
+    // Window of the decoded rows (used as a surface):
+    struct FloatSurface window = {src->inputfp, src->projection, src->geotransform, NULL, src->nodata, 0, cols};
+
+    for (int first = 0; first < rows; first += band) {
+        const int last = (first + band < rows) ? first + band : rows;
+        const int window_first = (first - iterations > 0) ? first - iterations : 0;
+        const int window_last = (last + iterations < rows) ? last + iterations : rows;
+        float **smooth_array = smoothed;
+        float **holder = NULL;          // Pointer placeholder
+
+        window.array = decoded;
+        window.rows = window_last - window_first;
+        for (int k = 0; k < window.rows; k++) {
+            decodeCompactRow(src, window_first + k, decoded[k]);
+        }
+
+        // Previous band is no longer read, swap its encoded rows in:
+        for (int k = 0; k < pending_rows; k++) {
+            int16_t *codes = src->array[pending_first + k];
+            src->array[pending_first + k] = encoded[k];
+            encoded[k] = codes;
+        }
+
+        for (int i = 1; i <= iterations; i++) {
+            // Halo rows lose one valid row per iteration, surface edges don't:
+            const int first_row = (window_first == 0) ? 0 : i;
+            const int last_row = (window_last == rows) ? window.rows : window.rows - i;
+
+            for (int row = first_row; row < last_row; row++) {
+                if (row > 0 && row < window.rows - 1 && cols > 2) {
+                    smoothLaplacianCell(&window, smooth_array, row, 0);
+                    simd.smoothLaplacianRow(&window.array[row - 1][1], &window.array[row][1], &window.array[row + 1][1], &smooth_array[row][1], cols - 2, xWeight, yWeight, src->nodata);
+                    smoothLaplacianCell(&window, smooth_array, row, cols - 1);
+                }   else {
+                    for (int col = 0; col < cols; col++) {
+                        smoothLaplacianCell(&window, smooth_array, row, col);
+                    }
+                }
+            }
+
+            // Swap window data array:
+            holder = window.array;
+            window.array = smooth_array;
+            smooth_array = holder;
+        }
+
+        for (int row = first; row < last; row++) {
+            encodeCompactRow(src, window.array[row - window_first], encoded[row - first]);
+        }
+        pending_first = first;
+        pending_rows = last - first;
+        printStepProgress((double)last / rows);
+    }
+
+    // Last band:
+    for (int k = 0; k < pending_rows; k++) {
+        memcpy(src->array[pending_first + k], encoded[k], cols * sizeof(int16_t));
+    }
+
+    releaseScratchArray(decoded, capacity);
+    releaseScratchArray(smoothed, capacity);
+    freeCompactArray(encoded, (band < rows) ? band : rows);
+    printStepDone();
+    return TRUE;
+}
+
+
+/*
+*   Rolling Coin smoothing of a compact surface (any radius)
+*   - Same two passes as the specialised kernels (coin_kernels.c), with codes:
+*     1. Shoalest code on the coin of every cell
+*     2. "Press": every cell gets the deepest shoalest code of the coins covering it
+*   - Returns FALSE if memory can't be allocated (surface is not changed)
+*/
+char coinRollCompact(struct CompactSurface *src, struct Coin *penny) {
+    const int rows = src->rows;
+    const int cols = src->cols;
+    const int radius = penny->radius;
+    int *chords = calloc(penny->diameter, sizeof(int));
+    int16_t **shoalest = createCompactArray(cols, rows);
+
+    if (chords == NULL || shoalest == NULL) {
+        free(chords);
+        freeCompactArray(shoalest, rows);
+        return FALSE;
+    }
+    printStepStart("Rolling Coin (compact)");
+    getCoinChords(penny, chords);
+
+    // Mask nodata (lowest code never is the shoalest):
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            if (src->array[row][col] == src->nodatacode) {
+                src->array[row][col] = COMPACT_LOW;
+            }
+        }
+    }
+
+    // 1. Shoalest code on coin (coins without depths press nothing):
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            int shoal = COMPACT_LOW;
+
+            for (int row_coin = -radius; row_coin <= radius; row_coin++) {
+                const int halfwidth = chords[row_coin + radius];
+                if (row + row_coin < 0 || row + row_coin >= rows || halfwidth < 0) {   // Partial coin on surface edges
+                    continue;
+                }
+                const int16_t *codes = src->array[row + row_coin];
+                const int first_col = (col - halfwidth > 0) ? col - halfwidth : 0;
+                const int last_col = (col + halfwidth < cols - 1) ? col + halfwidth : cols - 1;
+
+                for (int c = first_col; c <= last_col; c++) {
+                    shoal = (codes[c] > shoal) ? codes[c] : shoal;
+                }
+            }
+
+            shoalest[row][col] = (shoal > COMPACT_LOW) ? shoal : COMPACT_HIGH;
+        }
+    }
+
+    // 2. Press shoalest codes to coin areas, restore nodata (safety first):
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            int pressed = COMPACT_HIGH;
+
+            if (src->array[row][col] == COMPACT_LOW) {      // Masked nodata
+                src->array[row][col] = src->nodatacode;
+                continue;
+            }
+
+            for (int row_coin = -radius; row_coin <= radius; row_coin++) {
+                const int halfwidth = chords[row_coin + radius];
+                if (row + row_coin < 0 || row + row_coin >= rows || halfwidth < 0) {
+                    continue;
+                }
+                const int16_t *shoals = shoalest[row + row_coin];
+                const int first_col = (col - halfwidth > 0) ? col - halfwidth : 0;
+                const int last_col = (col + halfwidth < cols - 1) ? col + halfwidth : cols - 1;
+
+                for (int c = first_col; c <= last_col; c++) {
+                    pressed = (shoals[c] < pressed) ? shoals[c] : pressed;
+                }
+            }
+
+            src->array[row][col] = pressed;
+        }
+    }
+
+    freeCompactArray(shoalest, rows);
+    free(chords);
+    printStepDone();
+    return TRUE;
+}
+
+
+/*
+*   - Allocates memory for (2D) int16_t** array of given size
+*   - Returns a pointer to array, NULL if memory can't be allocated
+*/
+int16_t **createCompactArray(const int cols, const int rows) {
+    int16_t **ret = calloc(rows, sizeof(int16_t *));
+
+    if (ret == NULL) {
+        return NULL;
+    }
+    for (int row = 0; row < rows; row++) {
+        ret[row] = calloc(cols, sizeof(int16_t));
+        if (ret[row] == NULL) {
+            freeCompactArray(ret, row);
+            return NULL;
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Frees allocated memory of 2D int16_t (int16_t**) array
+*/
+void freeCompactArray(int16_t **array, const int rows) {
+    if (array == NULL) {
+        return;
+    }
+    for (int i = 0; i < rows; i++) {
+        free(array[i]);
+    }
+
+    free(array);
+}
+
+
+/*
+*   Frees all allocated memory of parameter CompactSurface
+*/
+void freeCompactSurface(struct CompactSurface *input) {
+    free(input->inputfp);
+    free(input->projection);
+    free(input->geotransform);
+    freeCompactArray(input->array, input->rows);
+    free(input);
+}
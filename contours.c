@@ -0,0 +1,557 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Depth contour generation from a FloatSurface (marching squares on cell centers)
+*   - Surface is split into horizontal strips that are contoured in parallel threads,
+*     line fragments ending on strip seams are stitched together afterwards
+*   - Contours are written to a GeoPackage (OGR), one line feature per contour,
+*     contour level in field "depth"
+*
+*   Squares with a nodata corner are not contoured (lines end at nodata areas).
+*   Crossing points are interpolated on cell edges, always from the upper or left
+*   cell, so squares sharing an edge (also across a seam) get exactly the same point.
+*/
+
+
+// Square edges:
+#define EDGE_TOP    0
+#define EDGE_RIGHT  1
+#define EDGE_BOTTOM 2
+#define EDGE_LEFT   3
+
+
+/*
+*   Contours a surface and writes the contours to a GeoPackage
+*   - levelarg: contour interval ("5") or comma separated list of levels ("-2,-5,-10")
+*   - Surface is not changed
+*/
+void contourSurface(struct FloatSurface *src, const char *levelarg, const char *outputpath) {
+    double *levels = calloc(MAX_CONTOUR_LEVELS, sizeof(double));
+    const int levelcount = contourLevels(src, levelarg, levels, MAX_CONTOUR_LEVELS);
+
+    if (levelcount == 0) {
+        printf("No contour levels (more than %d levels or none within surface depths).\n", MAX_CONTOUR_LEVELS);
+        free(levels);
+        return;
+    }
+
+    printStepStart("Contouring");
+
+    // Strips of at least MIN_CONTOUR_STRIP_ROWS square rows, one per thread:
+    int stripcount = (src->rows - 1) / MIN_CONTOUR_STRIP_ROWS;
+    const int threads = workerThreadCount();
+    if (stripcount > threads) {
+        stripcount = threads;
+    }
+    if (stripcount < 1) {
+        stripcount = 1;
+    }
+
+    struct ContourStrip *strips = calloc(stripcount, sizeof(struct ContourStrip));
+    pthread_t *workers = calloc(stripcount, sizeof(pthread_t));
+
+    for (int i = 0; i < stripcount; i++) {
+        strips[i].src = src;
+        strips[i].levels = levels;
+        strips[i].levelcount = levelcount;
+        strips[i].first_row = (int)((long)(src->rows - 1) * i / stripcount);
+        strips[i].last_row = (int)((long)(src->rows - 1) * (i + 1) / stripcount);
+    }
+
+    // Strip 0 runs on this thread:
+    for (int i = 1; i < stripcount; i++) {
+        if (pthread_create(&workers[i], NULL, contourStrip, &strips[i]) != 0) {
+            contourStrip(&strips[i]);
+            workers[i] = pthread_self();
+        }
+    }
+    contourStrip(&strips[0]);
+    for (int i = 1; i < stripcount; i++) {
+        if (pthread_equal(workers[i], pthread_self()) == 0) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+
+    // All fragments in one list, links of strips shifted to it:
+    int count = 0;
+    for (int i = 0; i < stripcount; i++) {
+        count += strips[i].count;
+    }
+
+    struct ContourFragment *fragments = calloc(count > 0 ? count : 1, sizeof(struct ContourFragment));
+    int first = 0;
+
+    for (int i = 0; i < stripcount; i++) {
+        for (int j = 0; j < strips[i].count; j++) {
+            struct ContourFragment *fragment = &fragments[first + j];
+            *fragment = strips[i].fragments[j];
+
+            for (int end = 0; end < 2; end++) {
+                if (fragment->link[end] >= 0) {
+                    fragment->link[end] += 2 * first;
+                }
+            }
+        }
+        first += strips[i].count;
+        free(strips[i].fragments);
+    }
+
+    stitchContourSeams(fragments, count);
+    printStepDone();
+
+    writeContours(src, levels, fragments, count, outputpath);
+
+    for (int i = 0; i < count; i++) {
+        free(fragments[i].points);
+    }
+    free(fragments);
+    free(workers);
+    free(strips);
+    free(levels);
+}
+
+
+/*
+*   Contour levels from an interval or a comma separated list
+*   - Interval: all multiples of the interval between the shoalest and deepest depth of the surface
+*   - Levels are saved to a list passed as a parameter
+*   - Returns number of levels, 0 if there are none or more than maxcount
+*/
+int contourLevels(struct FloatSurface *src, const char *levelarg, double *levels, const int maxcount) {
+    if (strchr(levelarg, ',') != NULL) {
+        return parseLevelList(levelarg, levels, maxcount);
+    }
+
+    const double interval = atof(levelarg);
+    const float nodata = src->nodata;
+    double min = INFINITY;
+    double max = -INFINITY;
+
+    for (int row = 0; row < src->rows; row++) {
+        for (int col = 0; col < src->cols; col++) {
+            const float depth = src->array[row][col];
+
+            if (fabs(depth - nodata) > EPSILON) {
+                min = fmin(min, depth);
+                max = fmax(max, depth);
+            }
+        }
+    }
+
+    if (!(interval > 0.0) || min > max || floor(max / interval) - ceil(min / interval) >= maxcount) {
+        return 0;
+    }
+
+    int count = 0;
+    for (double k = ceil(min / interval); k <= floor(max / interval); k++) {
+        levels[count++] = k * interval;
+    }
+
+    return count;
+}
+
+
+/*
+*   Parses a comma separated list of contour levels (e.g. "-2,-5,-10")
+*   - Levels are saved to a list passed as a parameter
+*   - Returns number of levels, or 0 if the list is faulty
+*/
+int parseLevelList(const char *list, double *levels, const int maxcount) {
+    int count = 0;
+    const char *p = list;
+
+    while (*p != '\0') {
+        char *end;
+        double level = strtod(p, &end);
+
+        if (end == p || count == maxcount || !isfinite(level)) {
+            return 0;
+        }
+        levels[count++] = level;
+
+        if (*end == ',') {
+            end++;
+        }   else if (*end != '\0') {
+            return 0;
+        }
+        p = end;
+    }
+
+    return count;
+}
+
+
+/*
+*   Checks the level parameter of -contours: positive interval or a list of levels
+*/
+char checkContourLevels(const char *levelarg) {
+    double levels[MAX_CONTOUR_LEVELS];
+
+    if (strchr(levelarg, ',') != NULL) {
+        return (parseLevelList(levelarg, levels, MAX_CONTOUR_LEVELS) > 0) ? TRUE : FALSE;
+    }
+
+    char *end;
+    const double interval = strtod(levelarg, &end);
+    return (end != levelarg && *end == '\0' && interval > 0.0 && isfinite(interval)) ? TRUE : FALSE;
+}
+
+
+/*
+*   Contours all levels of a strip (thread function, arg is a ContourStrip)
+*/
+void *contourStrip(void *arg) {
+    struct ContourStrip *strip = arg;
+    const int cols = strip->src->cols;
+
+    // Fragment ends waiting on the horizontal edges above and below a square row:
+    int *top = malloc(sizeof(int) * cols);
+    int *bottom = malloc(sizeof(int) * cols);
+
+    for (int level = 0; level < strip->levelcount; level++) {
+        contourStripLevel(strip, level, top, bottom);
+    }
+
+    free(top);
+    free(bottom);
+    return NULL;
+}
+
+
+/*
+*   Contours one level of a strip, square rows are scanned from top to bottom
+*   - Fragment ends (fragment * 2 + end) waiting on edges are kept for the
+*     next square (right edge) and the next square row (bottom edges)
+*/
+void contourStripLevel(struct ContourStrip *strip, const int level, int *top, int *bottom) {
+    struct FloatSurface *src = strip->src;
+    const double value = strip->levels[level];
+    const float nodata = src->nodata;
+    const int cols = src->cols;
+    float **array = src->array;
+
+    for (int col = 0; col < cols; col++) {
+        top[col] = -1;
+    }
+
+    for (int row = strip->first_row; row < strip->last_row; row++) {
+        int left = -1;                                  // Fragment end on the left edge of a square
+
+        for (int col = 0; col < cols; col++) {
+            bottom[col] = -1;
+        }
+
+        for (int col = 0; col < cols - 1; col++) {
+            const double corners[4] = {array[row][col], array[row][col+1], array[row+1][col+1], array[row+1][col]};
+            int index = 0;
+            char missing = FALSE;
+
+            for (int i = 0; i < 4; i++) {
+                if (fabs(corners[i] - nodata) < EPSILON) {
+                    missing = TRUE;
+                }
+                index |= (corners[i] >= value) << i;
+            }
+
+            if (missing == TRUE || index == 0 || index == 15) {
+                left = -1;
+                continue;
+            }
+
+            // Crossing points on edges (cell coordinates: column, row):
+            double points[4][2];
+            char crossed[4];
+            crossed[EDGE_TOP] = ((index & 1) != 0) != ((index & 2) != 0);
+            crossed[EDGE_RIGHT] = ((index & 2) != 0) != ((index & 4) != 0);
+            crossed[EDGE_BOTTOM] = ((index & 8) != 0) != ((index & 4) != 0);
+            crossed[EDGE_LEFT] = ((index & 1) != 0) != ((index & 8) != 0);
+
+            points[EDGE_TOP][0] = col + (value - corners[0]) / (corners[1] - corners[0]);
+            points[EDGE_TOP][1] = row;
+            points[EDGE_RIGHT][0] = col + 1;
+            points[EDGE_RIGHT][1] = row + (value - corners[1]) / (corners[2] - corners[1]);
+            points[EDGE_BOTTOM][0] = col + (value - corners[3]) / (corners[2] - corners[3]);
+            points[EDGE_BOTTOM][1] = row + 1;
+            points[EDGE_LEFT][0] = col;
+            points[EDGE_LEFT][1] = row + (value - corners[0]) / (corners[3] - corners[0]);
+
+            // Fragment ends waiting on the edges of this square:
+            int ends[4] = {top[col], -1, -1, left};
+            left = -1;
+
+            // Segments: pairs of crossed edges, saddles are resolved with the square center:
+            int segments[2][2];
+            int count = 0;
+
+            if (index == 5 || index == 10) {
+                const char center = (corners[0] + corners[1] + corners[2] + corners[3]) / 4.0 >= value;
+
+                if ((index == 5) == (center == TRUE)) {
+                    segments[0][0] = EDGE_TOP;      segments[0][1] = EDGE_RIGHT;
+                    segments[1][0] = EDGE_BOTTOM;   segments[1][1] = EDGE_LEFT;
+                }   else {
+                    segments[0][0] = EDGE_LEFT;     segments[0][1] = EDGE_TOP;
+                    segments[1][0] = EDGE_RIGHT;    segments[1][1] = EDGE_BOTTOM;
+                }
+                count = 2;
+            }   else {
+                for (int edge = 0; edge < 4; edge++) {
+                    if (crossed[edge] == TRUE) {
+                        segments[0][count++] = edge;
+                    }
+                }
+                count = 1;
+            }
+
+            for (int i = 0; i < count; i++) {
+                int a = segments[i][0];
+                int b = segments[i][1];
+
+                // Prefer continuing a fragment from its tail:
+                if (!(ends[a] >= 0 && (ends[a] & 1) == 1) && ends[b] >= 0 && (ends[b] & 1) == 1) {
+                    a = segments[i][1];
+                    b = segments[i][0];
+                }
+
+                int end;
+                if (ends[a] >= 0 && (ends[a] & 1) == 1) {
+                    end = ends[a];
+                    addContourPoint(&strip->fragments[end >> 1], points[b][0], points[b][1]);
+                }   else {
+                    const int fragment = newContourFragment(strip, level);
+                    addContourPoint(&strip->fragments[fragment], points[a][0], points[a][1]);
+                    addContourPoint(&strip->fragments[fragment], points[b][0], points[b][1]);
+
+                    if (ends[a] >= 0) {
+                        linkContourEnds(strip->fragments, ends[a], 2 * fragment);
+                    }   else {
+                        placeContourEnd(strip, row, col, a, 2 * fragment, &left, bottom);
+                    }
+                    end = 2 * fragment + 1;
+                }
+
+                if (ends[b] >= 0) {
+                    linkContourEnds(strip->fragments, end, ends[b]);
+                }   else {
+                    placeContourEnd(strip, row, col, b, end, &left, bottom);
+                }
+            }
+        }
+
+        int *swap = top;
+        top = bottom;
+        bottom = swap;
+    }
+}
+
+
+/*
+*   Places a fragment end that has nothing to join on an edge of square (row, col)
+*   - Right and bottom edges: end waits for the next square or square row
+*   - Edges on strip seams: end gets the seam key of the edge
+*   - Other edges: line ends there (surface edge or nodata)
+*/
+void placeContourEnd(struct ContourStrip *strip, const int row, const int col, const int edge, const int end, int *left, int *bottom) {
+    struct ContourFragment *fragment = &strip->fragments[end >> 1];
+    const int rows = strip->src->rows;
+    const int cols = strip->src->cols;
+
+    if (edge == EDGE_RIGHT) {
+        *left = end;
+    }   else if (edge == EDGE_BOTTOM && row == strip->last_row - 1 && strip->last_row < rows - 1) {
+        fragment->seam[end & 1] = ((int64_t)fragment->level * rows + row + 1) * cols + col;
+    }   else if (edge == EDGE_BOTTOM) {
+        bottom[col] = end;
+    }   else if (edge == EDGE_TOP && row == strip->first_row && strip->first_row > 0) {
+        fragment->seam[end & 1] = ((int64_t)fragment->level * rows + row) * cols + col;
+    }
+}
+
+
+/*
+*   Joins two fragment ends (fragment * 2 + end) that have the same point
+*/
+void linkContourEnds(struct ContourFragment *fragments, const int a, const int b) {
+    fragments[a >> 1].link[a & 1] = b;
+    fragments[b >> 1].link[b & 1] = a;
+}
+
+
+/*
+*   Adds an empty fragment to a strip, returns its index
+*/
+int newContourFragment(struct ContourStrip *strip, const int level) {
+    if (strip->count == strip->capacity) {
+        strip->capacity = (strip->capacity > 0) ? 2 * strip->capacity : 256;
+        strip->fragments = realloc(strip->fragments, sizeof(struct ContourFragment) * strip->capacity);
+    }
+
+    struct ContourFragment *fragment = &strip->fragments[strip->count];
+    fragment->points = NULL;
+    fragment->count = 0;
+    fragment->capacity = 0;
+    fragment->level = level;
+    fragment->seam[0] = fragment->seam[1] = -1;
+    fragment->link[0] = fragment->link[1] = -1;
+
+    return strip->count++;
+}
+
+
+/*
+*   Adds a point to the tail of a fragment
+*/
+void addContourPoint(struct ContourFragment *fragment, const double x, const double y) {
+    if (fragment->count == fragment->capacity) {
+        fragment->capacity = (fragment->capacity > 0) ? 2 * fragment->capacity : 8;
+        fragment->points = realloc(fragment->points, sizeof(double) * 2 * fragment->capacity);
+    }
+
+    fragment->points[2 * fragment->count] = x;
+    fragment->points[2 * fragment->count + 1] = y;
+    fragment->count++;
+}
+
+
+/*
+*   Joins fragment ends with the same seam key (same level and edge on both sides of a seam)
+*/
+void stitchContourSeams(struct ContourFragment *fragments, const int count) {
+    int64_t (*keys)[2] = malloc(sizeof(int64_t) * 2 * (2 * count + 1));
+    int seams = 0;
+
+    for (int i = 0; i < count; i++) {
+        for (int end = 0; end < 2; end++) {
+            if (fragments[i].seam[end] >= 0) {
+                keys[seams][0] = fragments[i].seam[end];
+                keys[seams][1] = 2 * i + end;
+                seams++;
+            }
+        }
+    }
+
+    qsort(keys, seams, sizeof(keys[0]), compareSeamKeys);
+
+    for (int i = 0; i + 1 < seams; i++) {
+        if (keys[i][0] == keys[i+1][0]) {
+            linkContourEnds(fragments, (int)keys[i][1], (int)keys[i+1][1]);
+            i++;
+        }
+    }
+
+    free(keys);
+}
+
+
+/*
+*   Compares seam keys (qsort)
+*/
+int compareSeamKeys(const void *a, const void *b) {
+    const int64_t x = *(const int64_t *)a;
+    const int64_t y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/*
+*   Writes contour lines to a GeoPackage: fragments are followed through their links
+*   - Open lines start from a free end, remaining fragments form closed rings
+*/
+void writeContours(struct FloatSurface *src, const double *levels, struct ContourFragment *fragments, const int count, const char *outputpath) {
+    if (progress.callback == NULL) {                                    // Not printed with a progress callback (daemon requests)
+        printf("Exporting contours..");
+        fflush(stdout);
+    }
+    GDALAllRegister();
+
+    GDALDriverH driver = GDALGetDriverByName("GPKG");
+    VSIUnlink(outputpath);                                              // Old contours are replaced
+    GDALDatasetH dataset = (driver != NULL) ? GDALCreate(driver, outputpath, 0, 0, 0, GDT_Unknown, NULL) : NULL;
+
+    if (dataset == NULL) {
+        printf("Export was not successful.\n");
+        return;
+    }
+
+    OGRSpatialReferenceH srs = NULL;
+    if (src->projection != NULL && src->projection[0] != '\0') {
+        srs = OSRNewSpatialReference(src->projection);
+    }
+
+    OGRLayerH layer = GDALDatasetCreateLayer(dataset, "contours", srs, wkbLineString, NULL);
+    OGRFieldDefnH field = OGR_Fld_Create("depth", OFTReal);
+    OGR_L_CreateField(layer, field, TRUE);
+    OGR_Fld_Destroy(field);
+
+    GDALDatasetStartTransaction(dataset, FALSE);
+
+    char *visited = calloc(count > 0 ? count : 1, 1);
+    int lines = 0;
+
+    // Open lines first (from a free end), then closed rings:
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < count; i++) {
+            for (int end = 0; end < 2; end++) {
+                if (visited[i] == FALSE && (pass == 1 || fragments[i].link[end] < 0)) {
+                    writeContourLine(layer, src->geotransform, levels, fragments, visited, 2 * i + end);
+                    lines++;
+                }
+            }
+        }
+    }
+
+    GDALDatasetCommitTransaction(dataset);
+
+    free(visited);
+    if (srs != NULL) {
+        OSRRelease(srs);
+    }
+    GDALClose(dataset);
+    if (progress.callback == NULL) {
+        printf("Done. %d contour lines exported to file: %s\n\n", lines, outputpath);
+        fflush(stdout);
+    }
+}
+
+
+/*
+*   Writes one contour line starting from a fragment end (fragment * 2 + end)
+*   - Shared points of joined fragments are written once
+*/
+void writeContourLine(OGRLayerH layer, const double *geotransform, const double *levels, struct ContourFragment *fragments, char *visited, int start) {
+    OGRFeatureH feature = OGR_F_Create(OGR_L_GetLayerDefn(layer));
+    OGRGeometryH line = OGR_G_CreateGeometry(wkbLineString);
+    char first = TRUE;
+
+    OGR_F_SetFieldDouble(feature, 0, levels[fragments[start >> 1].level]);
+
+    while (1) {
+        struct ContourFragment *fragment = &fragments[start >> 1];
+        const int forward = ((start & 1) == 0);
+        visited[start >> 1] = TRUE;
+
+        for (int i = (first == TRUE) ? 0 : 1; i < fragment->count; i++) {
+            const int index = forward ? i : fragment->count - 1 - i;
+            const double col = fragment->points[2 * index] + 0.5;          // Cell centers
+            const double row = fragment->points[2 * index + 1] + 0.5;
+
+            OGR_G_AddPoint_2D(line, geotransform[0] + col * geotransform[1] + row * geotransform[2],
+                                    geotransform[3] + col * geotransform[4] + row * geotransform[5]);
+        }
+        first = FALSE;
+
+        // Continue from the other end (a ring ends when it returns to the first fragment):
+        const int next = fragment->link[forward ? 1 : 0];
+        if (next < 0 || visited[next >> 1] == TRUE) {
+            break;
+        }
+        start = next;
+    }
+
+    OGR_F_SetGeometryDirectly(feature, line);
+    OGR_L_CreateFeature(layer, feature);
+    OGR_F_Destroy(feature);
+}
+
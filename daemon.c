@@ -0,0 +1,545 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Daemon mode: long running server on a local Unix socket
+*   - Loaded surfaces stay resident in a cache, later requests on the same
+*     input skip reading the file (surface is reloaded if the file changes)
+*   - A chain starting with Rolling Coin uses banded range indexes (see range_index.c)
+*     instead of searching every coin
+*   - Every connection is served by its own thread, requests run concurrently
+*     on private copies of the shared read-only input
+*   - Client mode sends one request and prints the reply
+*
+*   Request format (one line per connection, process steps as in CLI):
+*
+*       process [inputfile] [outputfile] [process steps]
+*       status
+*       drop [inputfile]
+*       shutdown
+*
+*   Reply: progress lines, last line starts with "OK" or "ERROR"
+*/
+
+
+// Surface cache of the daemon, shared by all connection threads:
+static struct SurfaceCache cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER};
+
+
+/*
+*   Runs the daemon on a Unix socket, returns after a shutdown request
+*   - Exits if the socket can't be created
+*/
+void runDaemon(const char *socketpath) {
+    struct sockaddr_un address = {0};
+    address.sun_family = AF_UNIX;
+
+    if (strlen(socketpath) >= sizeof(address.sun_path)) {
+        printf("Socket path is too long.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, socketpath);
+
+    int listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketpath);                                                 // Socket left by an earlier daemon
+
+    if (listenfd < 0 || bind(listenfd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenfd, 16) != 0) {
+        printf("Socket error, can't listen on %s.\nExiting.\n", socketpath);
+        exit(EXIT_FAILURE);
+    }
+
+    // Disconnected clients must not terminate the daemon, GDAL drivers are registered once:
+    signal(SIGPIPE, SIG_IGN);
+    GDALAllRegister();
+
+    cache.listenfd = listenfd;
+    printf("Daemon listening on %s\n", socketpath);
+    fflush(stdout);
+
+    while (1) {
+        int connectionfd = accept(listenfd, NULL, NULL);
+
+        pthread_mutex_lock(&cache.lock);
+        const char stopping = cache.stopping;
+        pthread_mutex_unlock(&cache.lock);
+
+        if (stopping == TRUE) {
+            if (connectionfd >= 0) {
+                close(connectionfd);
+            }
+            break;
+        }
+        if (connectionfd < 0) {
+            continue;
+        }
+
+        int *arg = malloc(sizeof(int));
+        pthread_t thread;
+        *arg = connectionfd;
+
+        pthread_mutex_lock(&cache.lock);
+        cache.requests++;
+        pthread_mutex_unlock(&cache.lock);
+
+        if (pthread_create(&thread, NULL, daemonConnection, arg) != 0) {
+            sendReply(connectionfd, "ERROR Daemon is out of threads\n");
+            close(connectionfd);
+            free(arg);
+            finishRequest();
+        }   else {
+            pthread_detach(thread);
+        }
+    }
+
+    // Wait for running requests, free cached surfaces:
+    pthread_mutex_lock(&cache.lock);
+    while (cache.requests > 0) {
+        pthread_cond_wait(&cache.changed, &cache.lock);
+    }
+    for (int i = 0; i < cache.count; i++) {
+        freeCachedSurface(cache.entries[i]);
+    }
+    cache.count = 0;
+    pthread_mutex_unlock(&cache.lock);
+
+    close(listenfd);
+    unlink(socketpath);
+    printf("Daemon stopped.\n");
+}
+
+
+/*
+*   Connection thread: reads one request line, handles it and closes the connection
+*/
+void *daemonConnection(void *arg) {
+    const int fd = *(int *)arg;
+    char line[8192];
+    int len = 0;
+    free(arg);
+
+    // Operator progress of daemon requests is not printed (requests run concurrently):
+    progress.callback = ignoreProgress;
+
+    while (len < (int)sizeof(line) - 1) {
+        ssize_t count = read(fd, line + len, sizeof(line) - 1 - len);
+        if (count <= 0) {
+            break;
+        }
+        len += count;
+        if (memchr(line + len - count, '\n', count) != NULL) {
+            break;
+        }
+    }
+    line[len] = '\0';
+
+    handleRequest(fd, line);
+
+    close(fd);
+    finishRequest();
+    return NULL;
+}
+
+
+/*
+*   Splits a request line into tokens and handles it, replies to fd
+*/
+void handleRequest(const int fd, char *line) {
+    const char *tokens[MAX_PIPELINE_TOKENS];
+    int count = 0;
+
+    // Split at whitespace (strtok is not thread safe):
+    for (char *p = line; *p != '\0' && count < MAX_PIPELINE_TOKENS; ) {
+        if (strchr(" \t\r\n", *p) != NULL) {
+            *p++ = '\0';
+            continue;
+        }
+        tokens[count++] = p;
+        while (*p != '\0' && strchr(" \t\r\n", *p) == NULL) {
+            p++;
+        }
+    }
+
+    if (count == 0) {
+        sendReply(fd, "ERROR Empty request\n");
+    }   else if (strcmp(tokens[0], "process") == 0 && count >= 4) {
+        processRequest(fd, count, tokens);
+    }   else if (strcmp(tokens[0], "status") == 0 && count == 1) {
+        statusRequest(fd);
+    }   else if (strcmp(tokens[0], "drop") == 0 && count == 2) {
+        pthread_mutex_lock(&cache.lock);
+        struct CachedSurface *entry = findCachedSurface(tokens[1]);
+        if (entry != NULL) {
+            entry->stale = TRUE;
+            removeUnusedSurfaces();
+        }
+        pthread_mutex_unlock(&cache.lock);
+        sendReply(fd, entry != NULL ? "OK Dropped %s\n" : "ERROR Not cached: %s\n", tokens[1]);
+    }   else if (strcmp(tokens[0], "shutdown") == 0 && count == 1) {
+        pthread_mutex_lock(&cache.lock);
+        cache.stopping = TRUE;
+        pthread_mutex_unlock(&cache.lock);
+        shutdown(cache.listenfd, SHUT_RDWR);                            // Wakes up accept()
+        sendReply(fd, "OK Daemon stops after running requests\n");
+    }   else {
+        sendReply(fd, "ERROR Unknown request: %s\n", tokens[0]);
+    }
+}
+
+
+/*
+*   Process request: tokens are "process input output steps..."
+*   - Steps are checked as in CLI, -simd, -compress, -compact and sweeps are not available in daemon mode
+*   - A leading Rolling Coin uses banded range indexes of the input
+*/
+void processRequest(const int fd, const int argc, const char *argv[]) {
+    char indexed = FALSE;               // Leading Rolling Coin uses range indexes
+
+    for (int i = 3; i < argc; i++) {
+        // SIMD selection, output compression, statistics printing and audit results are global (checking would change them for running requests):
+        const char unavailable = (strcmp(argv[i], "-simd") == 0 || strcmp(argv[i], "-compress") == 0 || strcmp(argv[i], "-stats") == 0 || strcmp(argv[i], "-compact") == 0
+                                  || strcmp(argv[i], "-rollcoin-sweep") == 0 || strcmp(argv[i], "-audit") == 0);
+        int last = unavailable ? -1 : checkProcessStep(argc, argv, i);
+
+        if (last < 0) {
+            sendReply(fd, "ERROR Faulty or unavailable process step: %s\n", argv[i]);
+            return;
+        }
+        if (i == 3 && strcmp(argv[i], "-rollcoin") == 0) {
+            indexed = TRUE;
+        }
+        i = last;
+    }
+
+    if (isStreamedPath(argv[2]) == TRUE) {
+        sendReply(fd, "ERROR Output can't be streamed from the daemon: %s\n", argv[2]);
+        return;
+    }
+
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+
+    char loaded;
+    char error[256];
+    struct CachedSurface *entry = acquireCachedSurface(argv[1], &loaded, error);
+
+    if (entry == NULL) {
+        sendReply(fd, "ERROR %s\n", error);
+        return;
+    }
+    sendReply(fd, "Input %s: %s\n", loaded == TRUE ? "loaded" : "cached", argv[1]);
+
+    // Private copy of the shared input:
+    struct FloatSurface *product = copyFloatSurface(entry->surf);
+    int i = 3;
+
+    releaseCachedSurface(entry);
+    if (product == NULL) {
+        sendReply(fd, "ERROR Memory allocation failed\n");
+        return;
+    }
+
+    if (indexed == TRUE) {
+        char trimflag = (strcmp(argv[5], "trim") == 0) ? TRUE : FALSE;
+        struct Coin *penny = createCoin(atoi(argv[4]), trimflag);
+        if (penny == NULL || coinRollSurfaceIndexed(product, penny) == FALSE) {
+            if (penny != NULL) {
+                freeCoin(penny);
+            }
+            freeFloatSurface(product);
+            sendReply(fd, "ERROR Memory allocation failed: -rollcoin\n");
+            return;
+        }
+        freeCoin(penny);
+        i = 6;
+    }
+
+    for (; i < argc; i++) {
+        i = applyProcessStep(product, argc, argv, i);
+        if (i < 0) {
+            freeFloatSurface(product);
+            sendReply(fd, "ERROR Process step can't be applied to the input: %s\n", argv[1]);
+            return;
+        }
+    }
+
+    // Export is not printed (requests run concurrently), the reply reports it:
+    sendReply(fd, "Exporting: %s\n", argv[2]);
+    if (exportSurface(product, argv[2], NULL) == FALSE) {
+        freeFloatSurface(product);
+        sendReply(fd, "ERROR Export failed: %s\n", argv[2]);
+        return;
+    }
+    freeFloatSurface(product);
+
+    timespec_get(&end, TIME_UTC);
+    sendReply(fd, "OK %s (%.2f s)\n", argv[2], (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+
+/*
+*   Status request: lists cached surfaces
+*/
+void statusRequest(const int fd) {
+    pthread_mutex_lock(&cache.lock);
+    for (int i = 0; i < cache.count; i++) {
+        struct CachedSurface *entry = cache.entries[i];
+
+        if (entry->surf != NULL && entry->stale == FALSE) {
+            sendReply(fd, "%s: %d x %d cells, %d users\n", entry->path, entry->surf->rows, entry->surf->cols, entry->users);
+        }
+    }
+    const int count = cache.count;
+    const int requests = cache.requests;
+    pthread_mutex_unlock(&cache.lock);
+
+    sendReply(fd, "OK %d cached surfaces, %d running requests\n", count, requests - 1);
+}
+
+
+/*
+*   Returns a cached surface of a file, loads it if needed (caller must release it)
+*   - Surface is reloaded if the modification time of the file has changed
+*   - loaded is set TRUE if the file was read by this call
+*   - Returns NULL and an error text if the file can't be read or the cache is full
+*/
+struct CachedSurface *acquireCachedSurface(const char *path, char *loaded, char *error) {
+    struct stat info;
+    *loaded = FALSE;
+
+    if (strlen(path) >= sizeof(cache.entries[0]->path)) {
+        sprintf(error, "File path is too long");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+
+    while (1) {
+        if (stat(path, &info) != 0) {
+            pthread_mutex_unlock(&cache.lock);
+            sprintf(error, "File read error: %.200s", path);
+            return NULL;
+        }
+
+        struct CachedSurface *entry = findCachedSurface(path);
+
+        if (entry != NULL && entry->busy == TRUE) {                      // Being loaded by another request
+            pthread_cond_wait(&cache.changed, &cache.lock);
+            continue;
+        }
+
+        if (entry != NULL && entry->mtime != info.st_mtime) {           // File has changed
+            entry->stale = TRUE;
+            removeUnusedSurfaces();
+            entry = NULL;
+        }
+
+        if (entry == NULL) {
+            removeUnusedSurfaces();
+            if (cache.count == MAX_CACHED_SURFACES && evictCachedSurface() == FALSE) {
+                pthread_mutex_unlock(&cache.lock);
+                sprintf(error, "Surface cache is full (%d surfaces in use)", MAX_CACHED_SURFACES);
+                return NULL;
+            }
+
+            entry = calloc(1, sizeof(struct CachedSurface));
+            strcpy(entry->path, path);
+            entry->mtime = info.st_mtime;
+            entry->busy = TRUE;
+            cache.entries[cache.count++] = entry;
+
+            // Read file without holding the lock, inputDepthModel exits on errors so the file is checked first:
+            pthread_mutex_unlock(&cache.lock);
+            struct FloatSurface *surf = NULL;
+            GDALDatasetH dataset = (access(path, R_OK|W_OK) == 0) ? GDALOpen(path, GA_ReadOnly) : NULL;
+            if (dataset != NULL) {
+                GDALClose(dataset);
+                surf = inputDepthModel(path);
+            }
+            pthread_mutex_lock(&cache.lock);
+
+            entry->surf = surf;
+            entry->busy = FALSE;
+            pthread_cond_broadcast(&cache.changed);
+
+            if (entry->surf == NULL) {
+                entry->stale = TRUE;
+                removeUnusedSurfaces();
+                pthread_mutex_unlock(&cache.lock);
+                sprintf(error, "File read error: %.200s", path);
+                return NULL;
+            }
+            *loaded = TRUE;
+        }
+
+        entry->users++;
+        entry->lastuse = ++cache.clock;
+        pthread_mutex_unlock(&cache.lock);
+        return entry;
+    }
+}
+
+
+/*
+*   Releases a cached surface acquired by a request
+*/
+void releaseCachedSurface(struct CachedSurface *entry) {
+    pthread_mutex_lock(&cache.lock);
+    entry->users--;
+    removeUnusedSurfaces();
+    pthread_cond_broadcast(&cache.changed);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+
+/*
+*   Finds the current (not stale) cache entry of a file, cache must be locked
+*/
+struct CachedSurface *findCachedSurface(const char *path) {
+    for (int i = 0; i < cache.count; i++) {
+        if (cache.entries[i]->stale == FALSE && strcmp(cache.entries[i]->path, path) == 0) {
+            return cache.entries[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*
+*   Frees stale cache entries that are no longer used, cache must be locked
+*/
+void removeUnusedSurfaces(void) {
+    for (int i = 0; i < cache.count; i++) {
+        struct CachedSurface *entry = cache.entries[i];
+
+        if (entry->stale == TRUE && entry->users == 0 && entry->busy == FALSE) {
+            freeCachedSurface(entry);
+            cache.entries[i--] = cache.entries[--cache.count];
+        }
+    }
+}
+
+
+/*
+*   Frees the least recently used entry that is not in use, cache must be locked
+*   - Returns TRUE if an entry was freed
+*/
+char evictCachedSurface(void) {
+    int oldest = -1;
+
+    for (int i = 0; i < cache.count; i++) {
+        struct CachedSurface *entry = cache.entries[i];
+
+        if (entry->users == 0 && entry->busy == FALSE && (oldest < 0 || entry->lastuse < cache.entries[oldest]->lastuse)) {
+            oldest = i;
+        }
+    }
+    if (oldest < 0) {
+        return FALSE;
+    }
+
+    freeCachedSurface(cache.entries[oldest]);
+    cache.entries[oldest] = cache.entries[--cache.count];
+    return TRUE;
+}
+
+
+/*
+*   Frees a cache entry with its surface
+*/
+void freeCachedSurface(struct CachedSurface *entry) {
+    if (entry->surf != NULL) {
+        freeFloatSurface(entry->surf);
+    }
+    free(entry);
+}
+
+
+/*
+*   Marks a connection thread done, wakes up a stopping daemon
+*/
+void finishRequest(void) {
+    pthread_mutex_lock(&cache.lock);
+    cache.requests--;
+    pthread_cond_broadcast(&cache.changed);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+
+/*
+*   Sends a formatted reply line to a client (errors of disconnected clients are ignored)
+*/
+void sendReply(const int fd, const char *format, ...) {
+    char text[1200];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+
+    if (len >= (int)sizeof(text)) {
+        len = sizeof(text) - 1;
+    }
+    for (int sent = 0; sent < len; ) {
+        ssize_t count = write(fd, text + sent, len - sent);
+        if (count <= 0) {
+            return;
+        }
+        sent += count;
+    }
+}
+
+
+/*
+*   Client mode: sends argv[3]... as one request to the daemon on socket argv[2], prints the reply
+*   - Returns EXIT_SUCCESS if the reply ends with OK
+*/
+int runClient(int argc, const char *argv[]) {
+    struct sockaddr_un address = {0};
+    char request[8192] = "";
+    char reply[4096];
+    char last[4096] = "";
+    int len = 0;
+
+    address.sun_family = AF_UNIX;
+    if (strlen(argv[2]) >= sizeof(address.sun_path)) {
+        printf("Socket path is too long.\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(address.sun_path, argv[2]);
+
+    for (int i = 3; i < argc; i++) {
+        len += snprintf(request + len, sizeof(request) - len, "%s%s", argv[i], i < argc - 1 ? " " : "\n");
+        if (len >= (int)sizeof(request)) {
+            printf("Request is too long.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        printf("Can't connect to daemon on %s.\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    sendReply(fd, "%s", request);
+
+    // Print reply, remember its last line:
+    ssize_t count;
+    int lastlen = 0;
+    while ((count = read(fd, reply, sizeof(reply) - 1)) > 0) {
+        reply[count] = '\0';
+        fputs(reply, stdout);
+
+        for (int i = 0; i < count; i++) {
+            if (lastlen > 0 && last[lastlen-1] == '\n') {
+                lastlen = 0;                                            // Previous line ended
+            }
+            if (lastlen < (int)sizeof(last) - 1) {
+                last[lastlen++] = reply[i];
+            }
+        }
+    }
+    last[lastlen] = '\0';
+    close(fd);
+
+    return (strncmp(last, "OK", 2) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,423 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - MPI domain decomposition for surfaces too large for one node (MPI build only,
+*     compiled with -DBATHYTOOLS_MPI, see makefile target "mpi")
+*   - Surface is split into a 2D grid of blocks, one block per rank, every rank
+*     reads only its own block and a halo around it
+*   - Halos are exchanged with the neighbouring ranks before every step that reads
+*     neighbouring cells: once per Rolling Coin pass (2 * radius cells), once per
+*     shoal buffering (1 cell) and once per Laplacian iteration (1 cell, or several
+*     iterations per exchange if a wider halo is allocated for other steps)
+*   - Results are identical to processing the whole surface at once
+*   - Blocks are written to the output in rank order by rank 0, one block in memory at a time
+*
+*   Use example (4 ranks on one machine):
+*
+*       mpirun -np 4 surfacetools-mpi -mpi [inputfile] [outputfile] [process steps]
+*/
+
+#ifdef BATHYTOOLS_MPI
+
+
+/*
+*   MPI mode: decomposes the surface, processes blocks on all ranks and writes the output
+*   - Parameters are checked and progress is printed by rank 0
+*   - Returns exit status of the process
+*/
+int runMpi(int argc, const char *argv[]) {
+    struct MpiBlock block = {0};
+    int rank;
+    int ok = FALSE;
+
+    MPI_Init(NULL, NULL);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // Operator progress is not printed, rank 0 prints one line per step:
+    progress.callback = ignoreProgress;
+    operatorThreads = 1;        // One rank per processor, operators are not split further
+
+    if (rank == 0) {
+        ok = checkMpiParameters(argc, argv);
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (ok != TRUE) {
+        MPI_Finalize();
+        return EXIT_FAILURE;
+    }
+
+    const double start = MPI_Wtime();
+    double laptime = start;
+
+    GDALAllRegister();
+    GDALDatasetH dataset = GDALOpen(argv[2], GA_ReadOnly);
+    if (dataset == NULL) {
+        printf("File read error on rank %d. Recheck file path.\nExiting.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    const int halo = mpiHaloWidth(argc, argv);
+    if (decomposeSurface(&block, GDALGetRasterYSize(dataset), GDALGetRasterXSize(dataset), halo) == FALSE) {
+        if (rank == 0) {
+            printf("Blocks of %d ranks are smaller than the halo (%d cells). Use fewer ranks.\nExiting.\n", block.ranks, halo);
+        }
+        GDALClose(dataset);
+        freeMpiBlock(&block);
+        MPI_Finalize();
+        return EXIT_FAILURE;
+    }
+    if (block.rank == 0) {
+        printf("MPI: %d ranks, %d x %d blocks of about %d x %d cells, halo %d cells\n", block.ranks, block.dims[0], block.dims[1], block.rows, block.cols, halo);
+    }
+
+    // Block with halos (halo cells are read too, the first exchange finds them up to date):
+    block.surf = inputDepthModelWindow(dataset, block.first_col - block.left, block.first_row - block.top,
+                                       block.cols + block.left + block.right, block.rows + block.top + block.bottom);
+    if (block.surf == NULL) {
+        printf("File read error on rank %d.\nExiting.\n", block.rank);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    mpiStepDone(&block, "Read blocks", &laptime);
+
+    for (int i = 4; i < argc; i++) {
+        char step[200];
+        const int first = i;
+
+        if (strcmp(argv[i], "-laplacian") == 0 && argc > i+1) {
+            // Halo of k cells is valid for k iterations:
+            const int iterations = atoi(argv[i+1]);
+            for (int done = 0; done < iterations; done += halo) {
+                const int count = (iterations - done < halo) ? iterations - done : halo;
+                exchangeHalos(&block, count);
+                if (smoothLaplacian(count, block.surf) == FALSE) {
+                    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+                }
+            }
+            i++;
+        }   else {
+            exchangeHalos(&block, stepHaloRadius(argc, argv, i));
+            i = applyProcessStep(block.surf, argc, argv, i);
+            if (i < 0) {
+                MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+            }
+        }
+
+        // Step with its parameters:
+        int length = 0;
+        for (int j = first; j <= i && length < (int)sizeof(step); j++) {
+            length += snprintf(step + length, sizeof(step) - length, (j == first) ? "%s" : " %s", argv[j]);
+        }
+        mpiStepDone(&block, step, &laptime);
+    }
+
+    struct SurfaceStatistics statistics;
+    const char written = writeBlocks(&block, dataset, argv[3], &statistics);
+    mpiStepDone(&block, "Write blocks", &laptime);
+    GDALClose(dataset);
+
+    if (block.rank == 0) {
+        if (written == FALSE) {
+            printf("Export was not successful.\nExiting.\n");
+        }   else {
+            printf("Done. Surface exported to file: %s (%.2f s)\n\n", argv[3], MPI_Wtime() - start);
+            if (statisticsPrinting() == TRUE) {
+                printStatisticsJson(&statistics, argv[3]);
+            }
+        }
+        fflush(stdout);
+    }
+    free(statistics.histogram);
+
+    freeMpiBlock(&block);
+    MPI_Finalize();
+    return (written == TRUE) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/*
+*   Checks process steps, input and output of MPI mode (rank 0)
+*   - Every rank opens the input and rank 0 writes the output, so standard
+*     input, standard output and memory files of one process can't be used
+*   - Returns TRUE if the parameters are ok
+*/
+char checkMpiParameters(int argc, const char *argv[]) {
+    char inputflag = TRUE;
+
+    if (strncmp(argv[2], "/vsistdin/", 10) == 0 || strncmp(argv[2], "/vsimem/", 8) == 0 || inputFilePath(argv[2]) == NULL) {
+        printf("File read error. Recheck file path (standard input and memory files can't be used in MPI mode).\n");
+        inputflag = FALSE;
+    }
+    if (isStreamedPath(argv[3]) == TRUE || strncmp(argv[3], "/vsimem/", 8) == 0) {
+        printf("Output can't be streamed or kept in memory in MPI mode: %s\n", argv[3]);
+        inputflag = FALSE;
+    }
+
+    printf("Process steps:\n");
+    for (int i = 4; i < argc; i++) {
+        // Steps with outputs of their own or other storage are not available for blocks:
+        const char unavailable = (strcmp(argv[i], "-compact") == 0 || strcmp(argv[i], "-rollcoin-sweep") == 0 || strcmp(argv[i], "-contours") == 0
+                                  || strcmp(argv[i], "-audit") == 0);
+        int last = unavailable ? -1 : checkProcessStep(argc, argv, i);
+
+        if (unavailable) {
+            printf("  -Not available in MPI mode: %s\n", argv[i]);
+        }
+        if (last < 0) {
+            inputflag = FALSE;
+            continue;
+        }
+        i = last;
+    }
+
+    if (inputflag != TRUE) {
+        printf("Faulty parameters detected. Exiting.\n");
+    }
+    fflush(stdout);
+
+    return inputflag;
+}
+
+
+/*
+*   Halo width allocated around blocks: the widest halo a single exchange needs
+*   - Laplacian smoothing needs 1 cell per iteration, wider halos (allocated
+*     for other steps) are used for several iterations per exchange
+*/
+int mpiHaloWidth(int argc, const char *argv[]) {
+    int ret = 0;
+
+    for (int i = 4; i < argc; i++) {
+        const int width = (strcmp(argv[i], "-laplacian") == 0) ? 1 : stepHaloRadius(argc, argv, i);
+        if (width > ret) {
+            ret = width;
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Splits the surface into a 2D grid of blocks (more blocks along the longer side)
+*   and sets the block, neighbours and halo widths of this rank
+*   - Returns FALSE if blocks are smaller than the halo (halos would come from
+*     ranks beyond the neighbours)
+*/
+char decomposeSurface(struct MpiBlock *block, const int rows, const int cols, const int halo) {
+    int periods[2] = {0, 0};
+    int coords[2];
+
+    MPI_Comm_size(MPI_COMM_WORLD, &block->ranks);
+    MPI_Dims_create(block->ranks, 2, block->dims);
+    if (cols > rows) {
+        const int holder = block->dims[0];
+        block->dims[0] = block->dims[1];
+        block->dims[1] = holder;
+    }
+
+    MPI_Cart_create(MPI_COMM_WORLD, 2, block->dims, periods, 0, &block->grid);
+    MPI_Comm_rank(block->grid, &block->rank);
+    MPI_Cart_coords(block->grid, block->rank, 2, coords);
+    MPI_Cart_shift(block->grid, 0, 1, &block->north, &block->south);
+    MPI_Cart_shift(block->grid, 1, 1, &block->west, &block->east);
+
+    blockWindow(rows, block->dims[0], coords[0], &block->first_row, &block->rows);
+    blockWindow(cols, block->dims[1], coords[1], &block->first_col, &block->cols);
+
+    block->top = (block->north != MPI_PROC_NULL) ? halo : 0;
+    block->bottom = (block->south != MPI_PROC_NULL) ? halo : 0;
+    block->left = (block->west != MPI_PROC_NULL) ? halo : 0;
+    block->right = (block->east != MPI_PROC_NULL) ? halo : 0;
+
+    // Smallest blocks:
+    const int minrows = rows / block->dims[0];
+    const int mincols = cols / block->dims[1];
+    if (minrows < 1 || mincols < 1 || (block->dims[0] > 1 && minrows < halo) || (block->dims[1] > 1 && mincols < halo)) {
+        return FALSE;
+    }
+
+    // Exchange buffers for the longest halo strip (block side with both halos):
+    const size_t length = (size_t)halo * ((block->rows > block->cols) ? block->rows : block->cols) + 2 * (size_t)halo * halo;
+    block->sendbuffer = calloc(length + 1, sizeof(float));
+    block->recvbuffer = calloc(length + 1, sizeof(float));
+
+    return TRUE;
+}
+
+
+/*
+*   Block of index in a split of length into blocks (sizes differ by at most 1)
+*/
+void blockWindow(const int length, const int blocks, const int index, int *first, int *count) {
+    *first = (int)((long)length * index / blocks);
+    *count = (int)((long)length * (index + 1) / blocks) - *first;
+}
+
+
+/*
+*   Exchanges halos of width cells with the neighbouring ranks
+*   - East and west first (block rows), then north and south including the
+*     received east and west halos, so corner cells come from diagonal ranks
+*/
+void exchangeHalos(struct MpiBlock *block, const int width) {
+    if (width <= 0) {
+        return;
+    }
+
+    const int row = block->top;
+    const int col = block->left;
+    const int rows = block->rows;
+    const int cols = block->cols;
+
+    // Rectangles: first row, first column, rows, columns (in the block with halos):
+    const int westedge[4] = {row, col, rows, width};
+    const int easthalo[4] = {row, col + cols, rows, width};
+    const int eastedge[4] = {row, col + cols - width, rows, width};
+    const int westhalo[4] = {row, col - width, rows, width};
+    shiftHalo(block, westedge, easthalo, block->west, block->east);
+    shiftHalo(block, eastedge, westhalo, block->east, block->west);
+
+    const int first_col = col - ((block->west != MPI_PROC_NULL) ? width : 0);
+    const int count = cols + ((block->west != MPI_PROC_NULL) ? width : 0) + ((block->east != MPI_PROC_NULL) ? width : 0);
+
+    const int northedge[4] = {row, first_col, width, count};
+    const int southhalo[4] = {row + rows, first_col, width, count};
+    const int southedge[4] = {row + rows - width, first_col, width, count};
+    const int northhalo[4] = {row - width, first_col, width, count};
+    shiftHalo(block, northedge, southhalo, block->north, block->south);
+    shiftHalo(block, southedge, northhalo, block->south, block->north);
+}
+
+
+/*
+*   Sends rectangle send to rank dest and receives rectangle recv from rank source
+*   - Missing neighbours are MPI_PROC_NULL (nothing is sent or received)
+*/
+void shiftHalo(struct MpiBlock *block, const int *send, const int *recv, const int dest, const int source) {
+    const int count = send[2] * send[3];
+
+    if (dest != MPI_PROC_NULL) {
+        copyHaloRect(block->surf, send, block->sendbuffer, FALSE);
+    }
+    MPI_Sendrecv(block->sendbuffer, count, MPI_FLOAT, dest, 0, block->recvbuffer, count, MPI_FLOAT, source, 0, block->grid, MPI_STATUS_IGNORE);
+    if (source != MPI_PROC_NULL) {
+        copyHaloRect(block->surf, recv, block->recvbuffer, TRUE);
+    }
+}
+
+
+/*
+*   Copies a rectangle (first row, first column, rows, columns) of surface to
+*   a contiguous buffer, or from buffer to surface if unpack is TRUE
+*/
+void copyHaloRect(struct FloatSurface *surf, const int *rect, float *buffer, const char unpack) {
+    for (int row = 0; row < rect[2]; row++) {
+        float *cells = &surf->array[rect[0] + row][rect[1]];
+
+        if (unpack == TRUE) {
+            memcpy(cells, &buffer[(size_t)row * rect[3]], rect[3] * sizeof(float));
+        }   else {
+            memcpy(&buffer[(size_t)row * rect[3]], cells, rect[3] * sizeof(float));
+        }
+    }
+}
+
+
+/*
+*   Writes the blocks of all ranks to the output file
+*   - Rank 0 creates the output and writes the blocks in rank order, other ranks
+*     send their block to rank 0 (one block is in memory of rank 0 at a time)
+*   - Rank 0 computes statistics of the blocks while they are written, stores them in
+*     the output and returns them in statistics (caller frees the histogram)
+*   - Aborts all ranks if the output can't be created
+*   - Returns FALSE on rank 0 if a block or the streamed copy can't be written
+*/
+char writeBlocks(struct MpiBlock *block, GDALDatasetH dataset, const char *outputfp, struct SurfaceStatistics *statistics) {
+    const int own[4] = {block->top, block->left, block->rows, block->cols};
+
+    *statistics = (struct SurfaceStatistics){0, HUGE_VAL, -HUGE_VAL, 0.0, 0.0, 0, 1, 0, NULL};
+    if (block->rank != 0) {
+        float *buffer = malloc((size_t)block->rows * block->cols * sizeof(float));
+        copyHaloRect(block->surf, own, buffer, FALSE);
+        MPI_Send(buffer, block->rows * block->cols, MPI_FLOAT, 0, 1, block->grid);
+        free(buffer);
+        return TRUE;
+    }
+
+    const int rows = GDALGetRasterYSize(dataset);
+    const int cols = GDALGetRasterXSize(dataset);
+    double geotransform[6];
+    GDALGetGeoTransform(dataset, geotransform);
+
+    GDALDatasetH outdataset = createOutputDataset(outputfp, cols, rows);
+    if (outdataset == NULL) {
+        printf("Export was not successful.\nExiting.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    GDALRasterBandH outband = GDALGetRasterBand(outdataset, 1);
+    GDALSetGeoTransform(outdataset, geotransform);
+    GDALSetProjection(outdataset, block->surf->projection);
+
+    // Largest block:
+    float *buffer = malloc(((size_t)rows / block->dims[0] + 1) * ((size_t)cols / block->dims[1] + 1) * sizeof(float));
+    char success = TRUE;
+
+    for (int rank = 0; rank < block->ranks; rank++) {
+        int coords[2];
+        int first_row, first_col, block_rows, block_cols;
+
+        MPI_Cart_coords(block->grid, rank, 2, coords);
+        blockWindow(rows, block->dims[0], coords[0], &first_row, &block_rows);
+        blockWindow(cols, block->dims[1], coords[1], &first_col, &block_cols);
+
+        if (rank == 0) {
+            copyHaloRect(block->surf, own, buffer, FALSE);
+        }   else {
+            MPI_Recv(buffer, block_rows * block_cols, MPI_FLOAT, rank, 1, block->grid, MPI_STATUS_IGNORE);
+        }
+
+        if (GDALRasterIO(outband, GF_Write, first_col, first_row, block_cols, block_rows, buffer, block_cols, block_rows, GDT_Float32, 0, 0) != CE_None) {
+            success = FALSE;
+        }
+        accumulateStatisticsRows(statistics, buffer, block_rows, block_cols, block->surf->nodata);
+    }
+
+    GDALSetRasterNoDataValue(outband, block->surf->nodata);
+    limitHistogramBuckets(statistics);
+    storeStatistics(outband, statistics, rows, cols);
+    free(buffer);
+    const char closed = closeOutputDataset(outdataset, outputfp);
+
+    return (success == TRUE && closed == TRUE) ? TRUE : FALSE;
+}
+
+
+/*
+*   Waits for all ranks to finish a step, rank 0 prints the step and its time
+*/
+void mpiStepDone(struct MpiBlock *block, const char *step, double *laptime) {
+    MPI_Barrier(block->grid);
+
+    if (block->rank == 0) {
+        const double now = MPI_Wtime();
+        printf("  %s: %.2f s\n", step, now - *laptime);
+        fflush(stdout);
+        *laptime = now;
+    }
+}
+
+
+/*
+*   Frees all allocated memory of a block (the block struct itself is not freed)
+*/
+void freeMpiBlock(struct MpiBlock *block) {
+    if (block->surf != NULL) {
+        freeFloatSurface(block->surf);
+    }
+    MPI_Comm_free(&block->grid);
+    free(block->sendbuffer);
+    free(block->recvbuffer);
+}
+
+#endif
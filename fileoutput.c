@@ -3,9 +3,20 @@
 /*
 *   This file contains:
 *   - File output related functions
+*   - Outputs to GDAL virtual file systems: /vsimem/ (memory) and /vsistdout/
+*     (streamed to standard output, messages are then printed to standard error)
+*   - Output compression option
+*   - Statistics of the output are computed while it is converted for writing (see output_statistics.c)
 */
 
 
+// Output compression (GTiff COMPRESS value), NULL: DEFLATE for files, NONE for virtual and streamed outputs:
+static const char *compression = NULL;
+
+// Original standard output while it is reserved for a streamed output (-1: not reserved):
+static int streamfd = -1;
+
+
 /*
 *   Simple output filepath parser
 */
@@ -26,37 +37,72 @@ void parsePath(char *inputfp, char *addon, char *ret) {
 }
 
 
+/*
+*   Output filepath for one radius of a Rolling Coin sweep
+*   - Adds radius before file extension: out.tif --> out_r10.tif
+*/
+void radiusOutputPath(const char *outputpath, const int radius, char *ret) {
+    const char *filename = strrchr(outputpath, '/');                // Extension is searched from filename only
+    const char *extension = strrchr(filename ? filename : outputpath, '.');
+    int len = extension ? (int)(extension - outputpath) : (int)strlen(outputpath);
+
+    sprintf(ret, "%.*s_r%d%s", len, outputpath, radius, extension ? extension : "");
+}
+
+
 /*
 *   Converts FloatSurface 2D float** arrays to (1D) float* arrays
 *   for file output
+*   - Rows are converted in parallel row bands, every band adds its rows to statistics of its own
+*   - Statistics of the bands are merged into statistics (histogram buckets limited)
 */
-float *convertFloatArray(struct FloatSurface *input) {
-    int index = 0;
-
+float *convertFloatArray(struct FloatSurface *input, struct SurfaceStatistics *statistics) {
+    const int count = rowBandCount(input->rows, input->cols);
+    struct SurfaceStatistics *bands = calloc(count, sizeof(struct SurfaceStatistics));
     float *ret = CPLMalloc(sizeof(float) * input->rows * input->cols);
 
-    for (int row = 0; row < input->rows; row++) {
-        for (int col = 0; col < input->cols; col++) {
-            ret[index] = input->array[row][col];
-            index++;
-        }
+    for (int i = 0; i < count; i++) {
+        bands[i] = (struct SurfaceStatistics){0, HUGE_VAL, -HUGE_VAL, 0.0, 0.0, 0, 1, 0, NULL};
     }
+    struct BandOperands operands = {input, NULL, 0, 0.0, NULL, NULL, ret, bands, NULL, NULL, NULL, NULL};
+    runRowBands(input->rows, input->cols, convertBand, &operands);
+
+    *statistics = (struct SurfaceStatistics){0, HUGE_VAL, -HUGE_VAL, 0.0, 0.0, 0, 1, 0, NULL};
+    for (int i = 0; i < count; i++) {
+        mergeStatistics(statistics, &bands[i]);
+        free(bands[i].histogram);
+    }
+    limitHistogramBuckets(statistics);
+    free(bands);
 
     return ret;
 }
 
 
+/*
+*   Copies the rows of a row band to the output buffer, adds them to the statistics of the band
+*   - Rows are added right after they are copied (while they are in cache)
+*/
+void convertBand(struct RowBand *band) {
+    struct FloatSurface *src = band->operands->src;
+    struct SurfaceStatistics *stats = &band->operands->statistics[band->index];
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        float *line = &band->operands->output[(size_t)row * src->cols];
+        memcpy(line, src->array[row], src->cols * sizeof(float));
+        accumulateStatisticsRows(stats, line, 1, src->cols, src->nodata);
+    }
+}
+
+
 /*
 *   Writes FloatSurface to a GeoTIFF file
 *   - Uses GDAL for I/O
+*   - Exits if the file (or the stream) can't be written
 */
 void writeSurfaceToFile(struct FloatSurface *input, const char *outputpath) {
     printf("Exporting file..");
     fflush(stdout);
-    GDALAllRegister();
-    const char *format = "GTiff";
-    GDALDriverH driver = GDALGetDriverByName(format);
-    char **papszOptions = NULL;
     char outputfp[1000];
 
     // Parse output filename if NULL was passed as parameter
@@ -66,24 +112,209 @@ void writeSurfaceToFile(struct FloatSurface *input, const char *outputpath) {
         strcpy(outputfp, outputpath);
     }
 
-    papszOptions = CSLSetNameValue(papszOptions, "COMPRESS", "DEFLATE" );
-    GDALDatasetH outdataset = GDALCreate(driver, outputfp, input->cols, input->rows, 1, GDT_Float32, papszOptions);
+    struct SurfaceStatistics statistics;
+    if (exportSurface(input, outputfp, &statistics) == FALSE) {
+        printf("Export was not successful.\nExiting.\n");
+        free(statistics.histogram);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Done. Surface exported to file: %s\n\n", outputfp);
+    if (statisticsPrinting() == TRUE) {
+        printStatisticsJson(&statistics, outputfp);
+    }
+    free(statistics.histogram);
+    fflush(stdout);
+}
+
+
+/*
+*   Writes FloatSurface to a GeoTIFF file without printing (parallel writers)
+*   - Statistics of the surface are stored in the file and returned in statistics
+*     (NULL: not returned), caller frees the histogram
+*   - Returns TRUE if the file was written (and streamed, /vsistdout/)
+*/
+char exportSurface(struct FloatSurface *input, const char *outputfp, struct SurfaceStatistics *statistics) {
+    struct SurfaceStatistics stats = {0, HUGE_VAL, -HUGE_VAL, 0.0, 0.0, 0, 1, 0, NULL};
+    GDALDatasetH outdataset = createOutputDataset(outputfp, input->cols, input->rows);
+    if (outdataset == NULL) {
+        if (statistics != NULL) {
+            *statistics = stats;
+        }
+        return FALSE;
+    }
     GDALRasterBandH outband = GDALGetRasterBand(outdataset, 1);
     GDALSetGeoTransform(outdataset, input->geotransform);
     GDALSetProjection(outdataset, input->projection);
 
-    float *datalist = convertFloatArray(input);
+    float *datalist = convertFloatArray(input, &stats);
 
-    char ret = GDALRasterIO(outband, GF_Write, 0, 0, input->cols, input->rows, datalist, input->cols, input->rows, GDT_Float32, 0, 0);
+    CPLErr ret = GDALRasterIO(outband, GF_Write, 0, 0, input->cols, input->rows, datalist, input->cols, input->rows, GDT_Float32, 0, 0);
+
+    GDALSetRasterNoDataValue(outband, input->nodata);
+    storeStatistics(outband, &stats, input->rows, input->cols);
 
-    if (ret != 0) {
-        printf("Export was not successful.\n");
-    }
-    
-    GDALSetRasterNoDataValue(outband, input->nodata);       
-    
     free(datalist);
-    GDALClose(outdataset);
-    printf("Done. Surface exported to file: %s\n\n", outputfp);
+    const char closed = closeOutputDataset(outdataset, outputfp);
+
+    if (statistics != NULL) {
+        *statistics = stats;
+    }   else {
+        free(stats.histogram);
+    }
+
+    return (ret == CE_None && closed == TRUE) ? TRUE : FALSE;
+}
+
+
+/*
+*   Creates the output dataset of a surface (float32, 1 band)
+*   - Files and /vsimem/ outputs are GeoTIFFs written directly
+*   - Streamed output (/vsistdout/) is assembled in memory, GeoTIFF can be streamed
+*     only as a copy of a finished dataset (see closeOutputDataset)
+*   - Returns NULL if the dataset can't be created
+*/
+GDALDatasetH createOutputDataset(const char *outputfp, const int cols, const int rows) {
+    GDALAllRegister();
+
+    if (isStreamedPath(outputfp) == TRUE) {
+        return GDALCreate(GDALGetDriverByName("MEM"), "", cols, rows, 1, GDT_Float32, NULL);
+    }
+
+    char **options = outputOptions(outputfp);
+    GDALDatasetH ret = GDALCreate(GDALGetDriverByName("GTiff"), outputfp, cols, rows, 1, GDT_Float32, options);
+    CSLDestroy(options);
+
+    return ret;
+}
+
+
+/*
+*   Closes an output dataset, streams it first if the output is /vsistdout/
+*   - Returns FALSE if the streamed copy can't be written
+*/
+char closeOutputDataset(GDALDatasetH dataset, const char *outputfp) {
+    char ret = TRUE;
+
+    if (isStreamedPath(outputfp) == TRUE) {
+        char **options = outputOptions(outputfp);
+        options = CSLSetNameValue(options, "STREAMABLE_OUTPUT", "YES");
+
+        GDALDatasetH streamed = GDALCreateCopy(GDALGetDriverByName("GTiff"), outputfp, dataset, FALSE, options, NULL, NULL);
+        if (streamed == NULL) {
+            ret = FALSE;
+        }   else {
+            GDALClose(streamed);
+        }
+        CSLDestroy(options);
+    }
+
+    GDALClose(dataset);
+    return ret;
+}
+
+
+/*
+*   GeoTIFF creation options of an output (compression)
+*   - Default is DEFLATE for files, NONE for /vsimem/ and /vsistdout/ (chained tools
+*     would only decompress it again)
+*/
+char **outputOptions(const char *outputfp) {
+    char **ret = NULL;
+
+    if (compression != NULL) {
+        ret = CSLSetNameValue(ret, "COMPRESS", compression);
+        if (strcmp(compression, "ZSTD") == 0) {
+            ret = CSLSetNameValue(ret, "ZSTD_LEVEL", "1");              // Fast compression for streaming
+        }
+    }   else {
+        ret = CSLSetNameValue(ret, "COMPRESS", isVirtualPath(outputfp) == TRUE ? "NONE" : "DEFLATE");
+    }
+
+    return ret;
+}
+
+
+/*
+*   Returns the GTiff COMPRESS value of a compression name (none, deflate, lzw, zstd), NULL if unknown
+*/
+const char *compressionOption(const char *name) {
+    const char *names[] = {"none", "deflate", "lzw", "zstd"};
+    const char *options[] = {"NONE", "DEFLATE", "LZW", "ZSTD"};
+
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return options[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+*   Selects the compression of outputs written after this (see compressionOption)
+*   - Returns TRUE if the compression name is known
+*/
+char setOutputCompression(const char *name) {
+    const char *option = compressionOption(name);
+
+    if (option == NULL) {
+        return FALSE;
+    }
+    compression = option;
+    return TRUE;
+}
+
+
+/*
+*   Checks if a path is on a GDAL virtual file system (/vsimem/, /vsistdout/, /vsizip/, ...)
+*/
+char isVirtualPath(const char *path) {
+    return (strncmp(path, "/vsi", 4) == 0) ? TRUE : FALSE;
+}
+
+
+/*
+*   Checks if a path is the standard output stream (/vsistdout/)
+*/
+char isStreamedPath(const char *path) {
+    return (strncmp(path, "/vsistdout/", 11) == 0) ? TRUE : FALSE;
+}
+
+
+/*
+*   Reserves standard output for a streamed output (/vsistdout/)
+*   - Messages printed after this go to standard error, GDAL writes the
+*     output to the original standard output
+*/
+void reserveStdoutForOutput(void) {
+    if (streamfd >= 0) {
+        return;
+    }
+
     fflush(stdout);
+    streamfd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    VSIStdoutSetRedirection(writeStreamedOutput, NULL);
+}
+
+
+/*
+*   Writes streamed output data to the original standard output (GDAL /vsistdout/ redirection)
+*/
+size_t writeStreamedOutput(const void *data, size_t size, size_t count, FILE *stream) {
+    const char *bytes = data;
+    size_t written = 0;
+    (void)stream;
+
+    while (written < size * count) {
+        ssize_t ret = write(streamfd, bytes + written, size * count - written);
+        if (ret <= 0) {
+            break;
+        }
+        written += ret;
+    }
+
+    return (size > 0) ? written / size : 0;
 }
@@ -19,129 +19,162 @@
 *   - Cell X gets the shoalest value of neighborhood
 *   - Neighborhood is marked with "+"
 *       - If X is shoalest, cell value doesn't change
+*   - Returns FALSE if memory can't be allocated (surface is not changed)
 */
-void maxFilterSurface(struct FloatSurface *src) {
-    printf("Buffering shoals..");
-    fflush(stdout);
-    float nodata = src->nodata;
-    float max_elev = -15000.0;  // Placeholder for shoalest depth
-    const float placeholder = max_elev;
-    int lenlist = 8;
-    float neighborhood[lenlist];
+char maxFilterSurface(struct FloatSurface *src) {
+    // Scratch float** (2D) array for a copy of the original depths, rows are filtered in parallel row bands:
+    struct BandOperands operands = {src, acquireScratchArray(src->cols, src->rows), 0, 0.0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+
+    if (operands.temp == NULL) {
+        return FALSE;
+    }
+    printStepStart("Buffering shoals");
+    runRowBands(src->rows, src->cols, maxFilterBand, &operands);
+
+    // Return temporary data array to the scratch pool:
+    releaseScratchArray(operands.temp, src->rows);
+    printStepDone();
+    return TRUE;
+}
+
 
-    // Create new float** (2D) array:
-    float **temp = createFloatArray(src->cols, src->rows);
+/*
+*   Filters the rows of a row band
+*   - Original depths of the band are copied first, bands wait for each other
+*     before filtering (edge rows of a band read rows of the neighbouring bands)
+*/
+void maxFilterBand(struct RowBand *band) {
+    struct FloatSurface *src = band->operands->src;
+    float **temp = band->operands->temp;
+    const float nodata = src->nodata;
 
     // Make a temporary copy of the original data array:
-    for (int row = 0; row < src->rows; row++) {
+    for (int row = band->first_row; row < band->last_row; row++) {
         for (int col = 0; col < src->cols; col++) {
             temp[row][col] = src->array[row][col];
         }
     }
+    waitRowBands(band);
 
     // Iterate over cells and filter surface:
-    for (int row = 0; row < src->rows; row++) {
-        for (int col = 0; col < src->cols; col++) {
+    for (int row = band->first_row; row < band->last_row; row++) {
+        if (row > 0 && row < src->rows - 1 && src->cols > 2) {
+            // Cells between edges with a row kernel (simd_kernels.c), edge cells one by one:
+            maxFilterCell(src, temp, row, 0);
+            simd.maxFilterRow(&temp[row - 1][1], &temp[row][1], &temp[row + 1][1], &src->array[row][1], src->cols - 2, nodata);
+            maxFilterCell(src, temp, row, src->cols - 1);
+        }   else {
+            for (int col = 0; col < src->cols; col++) {
+                maxFilterCell(src, temp, row, col);
+            }
+        }
+    }
+}
 
-            // Reset max_elev to placeholder value:
-            max_elev = placeholder;
 
-            // Initialize / reset neighborhood array:
-            lenlist = 8;
-            for (int i = 0; i < lenlist; i++) {
-                neighborhood[i] = placeholder;
-            }
+/*
+*   Filters a single cell using the original depths (temp)
+*   - Used for surface edges, see simd_kernels.c for cells between edges
+*/
+void maxFilterCell(struct FloatSurface *src, float **temp, int row, int col) {
+    float nodata = src->nodata;
+    float max_elev = -15000.0;  // Placeholder for shoalest depth
+    const float placeholder = max_elev;
+    int lenlist = 8;
+    float neighborhood[lenlist];
 
-            if (row == 0) {                                 // Top row
-                if (col == 0) {                                 // Top-left
-                    neighborhood[0] = temp[row][col + 1];
-                    neighborhood[1] = temp[row + 1][col];
-                    neighborhood[2] = temp[row + 1][col + 1];
-                    lenlist = 3;
-
-                }   else if (col == src->cols - 1) {            // Top-right
-                    neighborhood[0] = temp[row][col - 1];
-                    neighborhood[1] = temp[row + 1][col];
-                    neighborhood[2] = temp[row + 1][col -1];
-                    lenlist = 3;
-
-                }   else {                                      // Between corners
-                    neighborhood[0] = temp[row][col - 1];
-                    neighborhood[1] = temp[row][col + 1];
-                    neighborhood[2] = temp[row + 1][col];
-                    neighborhood[3] = temp[row + 1][col - 1];
-                    neighborhood[4] = temp[row + 1][col + 1];
-                    lenlist = 5;
-                }
-
-            }   else if (row == src->rows - 1) {            // Bottom row
-                if (col == 0) {                                 // Bottom-left
-                    neighborhood[0] = temp[row][col + 1];
-                    neighborhood[1] = temp[row - 1][col];
-                    neighborhood[2] = temp[row - 1][col + 1];
-                    lenlist = 3;
-
-                }   else if (col == src->cols - 1) {            // Bottom-right
-                    neighborhood[0] = temp[row][col - 1];
-                    neighborhood[1] = temp[row - 1][col];
-                    neighborhood[2] = temp[row - 1][col - 1];
-                    lenlist = 3;
-                
-                }   else {                                      // Between corners
-                    neighborhood[0] = temp[row][col - 1];
-                    neighborhood[1] = temp[row][col + 1];
-                    neighborhood[2] = temp[row - 1][col];
-                    neighborhood[3] = temp[row - 1][col - 1];
-                    neighborhood[4] = temp[row - 1][col + 1];
-                    lenlist = 5;
-                }
-
-            }   else {                                      // Rows in between top and bottom
-                if (col == 0) {                                 // Left edge
-                    neighborhood[0] = temp[row][col + 1];
-                    neighborhood[1] = temp[row + 1][col];
-                    neighborhood[2] = temp[row - 1][col];
-                    neighborhood[3] = temp[row - 1][col + 1];
-                    neighborhood[4] = temp[row + 1][col + 1];
-                    lenlist = 5;
-
-                }   else if (col == src->cols - 1) {            // Right edge
-                    neighborhood[0] = temp[row][col - 1];
-                    neighborhood[1] = temp[row + 1][col];
-                    neighborhood[2] = temp[row - 1][col];
-                    neighborhood[3] = temp[row - 1][col - 1];
-                    neighborhood[4] = temp[row + 1][col - 1];
-                    lenlist = 5;
-
-                }   else {                                      // Between edges
-                    neighborhood[0] = temp[row - 1][col - 1];
-                    neighborhood[1] = temp[row - 1][col];
-                    neighborhood[2] = temp[row - 1][col + 1];
-                    neighborhood[3] = temp[row][col - 1];
-                    neighborhood[4] = temp[row][col + 1];
-                    neighborhood[5] = temp[row + 1][col - 1];
-                    neighborhood[6] = temp[row + 1][col];
-                    neighborhood[7] = temp[row + 1][col + 1];
-                    lenlist = 8;
-                }
-            }
+    // Reset max_elev to placeholder value:
+    max_elev = placeholder;
 
-            // Get max elevation (shoalest depth):
-            for (int i = 0; i < lenlist; i++) {
-                if (neighborhood[i] > max_elev) {
-                    max_elev = neighborhood[i];
-                }
-            }
+    // Initialize / reset neighborhood array:
+    lenlist = 8;
+    for (int i = 0; i < lenlist; i++) {
+        neighborhood[i] = placeholder;
+    }
 
-            // Update source array cell values if max_elev is shoaler and max_elev is not nodata:
-            if (max_elev > src->array[row][col] && fabs(max_elev - nodata) > EPSILON && fabs(src->array[row][col] - nodata) > EPSILON) {
-                src->array[row][col] = max_elev;
-            }
+    if (row == 0) {                                 // Top row
+        if (col == 0) {                                 // Top-left
+            neighborhood[0] = temp[row][col + 1];
+            neighborhood[1] = temp[row + 1][col];
+            neighborhood[2] = temp[row + 1][col + 1];
+            lenlist = 3;
+
+        }   else if (col == src->cols - 1) {            // Top-right
+            neighborhood[0] = temp[row][col - 1];
+            neighborhood[1] = temp[row + 1][col];
+            neighborhood[2] = temp[row + 1][col -1];
+            lenlist = 3;
+
+        }   else {                                      // Between corners
+            neighborhood[0] = temp[row][col - 1];
+            neighborhood[1] = temp[row][col + 1];
+            neighborhood[2] = temp[row + 1][col];
+            neighborhood[3] = temp[row + 1][col - 1];
+            neighborhood[4] = temp[row + 1][col + 1];
+            lenlist = 5;
+        }
+
+    }   else if (row == src->rows - 1) {            // Bottom row
+        if (col == 0) {                                 // Bottom-left
+            neighborhood[0] = temp[row][col + 1];
+            neighborhood[1] = temp[row - 1][col];
+            neighborhood[2] = temp[row - 1][col + 1];
+            lenlist = 3;
+
+        }   else if (col == src->cols - 1) {            // Bottom-right
+            neighborhood[0] = temp[row][col - 1];
+            neighborhood[1] = temp[row - 1][col];
+            neighborhood[2] = temp[row - 1][col - 1];
+            lenlist = 3;
+        
+        }   else {                                      // Between corners
+            neighborhood[0] = temp[row][col - 1];
+            neighborhood[1] = temp[row][col + 1];
+            neighborhood[2] = temp[row - 1][col];
+            neighborhood[3] = temp[row - 1][col - 1];
+            neighborhood[4] = temp[row - 1][col + 1];
+            lenlist = 5;
+        }
+
+    }   else {                                      // Rows in between top and bottom
+        if (col == 0) {                                 // Left edge
+            neighborhood[0] = temp[row][col + 1];
+            neighborhood[1] = temp[row + 1][col];
+            neighborhood[2] = temp[row - 1][col];
+            neighborhood[3] = temp[row - 1][col + 1];
+            neighborhood[4] = temp[row + 1][col + 1];
+            lenlist = 5;
+
+        }   else if (col == src->cols - 1) {            // Right edge
+            neighborhood[0] = temp[row][col - 1];
+            neighborhood[1] = temp[row + 1][col];
+            neighborhood[2] = temp[row - 1][col];
+            neighborhood[3] = temp[row - 1][col - 1];
+            neighborhood[4] = temp[row + 1][col - 1];
+            lenlist = 5;
+
+        }   else {                                      // Between edges
+            neighborhood[0] = temp[row - 1][col - 1];
+            neighborhood[1] = temp[row - 1][col];
+            neighborhood[2] = temp[row - 1][col + 1];
+            neighborhood[3] = temp[row][col - 1];
+            neighborhood[4] = temp[row][col + 1];
+            neighborhood[5] = temp[row + 1][col - 1];
+            neighborhood[6] = temp[row + 1][col];
+            neighborhood[7] = temp[row + 1][col + 1];
+            lenlist = 8;
         }
     }
 
-    // Free temporary data array
-    freeFloatArray(temp, src->rows);
-    printf("Done\n");
-    fflush(stdout);
+    // Get max elevation (shoalest depth):
+    for (int i = 0; i < lenlist; i++) {
+        if (neighborhood[i] > max_elev) {
+            max_elev = neighborhood[i];
+        }
+    }
+
+    // Update source array cell values if max_elev is shoaler and max_elev is not nodata:
+    if (max_elev > src->array[row][col] && fabs(max_elev - nodata) > EPSILON && fabs(src->array[row][col] - nodata) > EPSILON) {
+        src->array[row][col] = max_elev;
+    }
 }
@@ -0,0 +1,373 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Incremental mode: a surface updated with a new survey patch is reprocessed
+*     only where the update can change the result
+*   - Previous and new input are compared in tiles of INCREMENTAL_TILE_SIZE cells,
+*     changed (dirty) tiles are expanded by the influence radius of the process
+*     chain (see chainHaloRadius) and only the expanded tiles are recomputed
+*   - Recomputed tiles are merged into rectangles, read with a halo of the influence
+*     radius and patched into the previous output, other cells of the previous
+*     output are kept
+*   - Result is identical to processing the whole new input, if the previous
+*     output was made from the previous input with the same process steps
+*
+*       surfacetools -incremental [previousinput] [previousoutput] [newinput] [newoutput] [process steps]
+*
+*   Previous output is updated in place if new output is the same file.
+*/
+
+
+/*
+*   Incremental mode: finds changed tiles, recomputes them and patches the output
+*   - Exits on faulty parameters or if the inputs don't share the same grid
+*/
+void runIncremental(int argc, const char *argv[]) {
+    char inputflag = 1;         // Inputs assumed to be ok
+
+    // Check input files:
+    for (int i = 2; i <= 4; i++) {
+        if (strncmp(argv[i], "/vsistdin/", 10) == 0 || inputFilePath(argv[i]) == NULL) {
+            printf("File read error: %s. Recheck file path.\n", argv[i]);
+            inputflag = 0;
+        }
+    }
+    if (isStreamedPath(argv[5]) == TRUE) {
+        printf("Output can't be streamed in incremental mode, it is patched: %s\n", argv[5]);
+        inputflag = 0;
+    }
+
+    // Check input process commands and parameters:
+    printf("Process steps:\n");
+    for (int i = 6; i < argc; i++) {
+        // Steps with outputs of their own or other storage can't be patched:
+        const char unavailable = (strcmp(argv[i], "-compact") == 0 || strcmp(argv[i], "-rollcoin-sweep") == 0 || strcmp(argv[i], "-contours") == 0
+                                  || strcmp(argv[i], "-audit") == 0);
+        int last = unavailable ? -1 : checkProcessStep(argc, argv, i);
+
+        if (unavailable) {
+            printf("  -Not available in incremental mode: %s\n", argv[i]);
+        }
+        if (last < 0) {
+            inputflag = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "-compress") == 0) {
+            // Compression of a new output file (copy of the previous output):
+            setOutputCompression(argv[i+1]);
+        }
+        if (strcmp(argv[i], "-stats") == 0) {
+            setStatisticsPrinting(TRUE);
+        }
+        i = last;
+    }
+
+    if (inputflag != 1) {
+        printf("Faulty parameters detected. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    GDALAllRegister();
+    GDALDatasetH before = GDALOpen(argv[2], GA_ReadOnly);
+    GDALDatasetH after = GDALOpen(argv[4], GA_ReadOnly);
+    GDALDatasetH previous = GDALOpen(argv[3], GA_ReadOnly);
+
+    if (before == NULL || after == NULL || previous == NULL) {
+        printf("File read error. Recheck file paths.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (sameSurfaceGrid(before, after) == FALSE || sameSurfaceGrid(before, previous) == FALSE) {
+        printf("Inputs and previous output must have the same size, georeferencing and nodata value.\nProcess the whole new input instead.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const int rows = GDALGetRasterYSize(after);
+    const int cols = GDALGetRasterXSize(after);
+    const int tilerows = (rows + INCREMENTAL_TILE_SIZE - 1) / INCREMENTAL_TILE_SIZE;
+    const int tilecols = (cols + INCREMENTAL_TILE_SIZE - 1) / INCREMENTAL_TILE_SIZE;
+    const int halo = chainHaloRadius(argc, argv, 6);
+
+    // 1. Dirty tiles:
+    printf("Comparing inputs..");
+    fflush(stdout);
+    char *dirty = findDirtyTiles(before, after, tilerows, tilecols);
+    if (dirty == NULL) {
+        printf("File read error.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("Done\n");
+    GDALClose(before);
+
+    // 2. Tiles within influence radius of dirty tiles:
+    const int reach = (halo + INCREMENTAL_TILE_SIZE - 1) / INCREMENTAL_TILE_SIZE;
+    char *affected = expandDirtyTiles(dirty, tilerows, tilecols, reach);
+    int dirtycount = 0;
+    int affectedcount = 0;
+
+    for (int i = 0; i < tilerows * tilecols; i++) {
+        dirtycount += dirty[i];
+        affectedcount += affected[i];
+    }
+    printf("Changed tiles: %d of %d (%d x %d cells), recomputed tiles: %d (influence radius %d cells)\n",
+           dirtycount, tilerows * tilecols, INCREMENTAL_TILE_SIZE, INCREMENTAL_TILE_SIZE, affectedcount, halo);
+
+    // 3. Output: previous output updated in place or copied to the new output first:
+    GDALDatasetH output;
+    if (strcmp(argv[3], argv[5]) == 0) {
+        GDALClose(previous);
+        output = GDALOpen(argv[5], GA_Update);
+    }   else {
+        char **options = outputOptions(argv[5]);
+        GDALDatasetH copy = GDALCreateCopy(GDALGetDriverByName("GTiff"), argv[5], previous, FALSE, options, NULL, NULL);
+        CSLDestroy(options);
+        GDALClose(previous);
+
+        output = NULL;
+        if (copy != NULL) {
+            GDALClose(copy);
+            output = GDALOpen(argv[5], GA_Update);
+        }
+    }
+    if (output == NULL) {
+        printf("Export was not successful.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // 4. Recompute rectangles of affected tiles (halo is read once per rectangle):
+    printf("Recomputing changed regions..");
+    fflush(stdout);
+    struct ProgressReporter saved = progress;
+    progress.callback = ignoreProgress;
+    char success = TRUE;
+    int windows = 0;
+
+    for (int tilerow = 0; tilerow < tilerows && success == TRUE; tilerow++) {
+        for (int tilecol = 0; tilecol < tilecols && success == TRUE; tilecol++) {
+            int last_row, last_col;
+
+            if (nextAffectedRect(affected, tilerows, tilecols, tilerow, tilecol, &last_row, &last_col) == FALSE) {
+                continue;
+            }
+
+            const int first_row = tilerow * INCREMENTAL_TILE_SIZE;
+            const int first_col = tilecol * INCREMENTAL_TILE_SIZE;
+            const int window_rows = ((last_row * INCREMENTAL_TILE_SIZE < rows) ? last_row * INCREMENTAL_TILE_SIZE : rows) - first_row;
+            const int window_cols = ((last_col * INCREMENTAL_TILE_SIZE < cols) ? last_col * INCREMENTAL_TILE_SIZE : cols) - first_col;
+
+            success = recomputeWindow(after, output, first_row, first_col, window_rows, window_cols, halo, argc, argv);
+            windows++;
+        }
+    }
+    progress = saved;
+
+    // 5. Statistics of the previous output are stale, recomputed from the patched output:
+    struct SurfaceStatistics statistics = {0, HUGE_VAL, -HUGE_VAL, 0.0, 0.0, 0, 1, 0, NULL};
+    if (success == TRUE) {
+        success = recomputeStatistics(GDALGetRasterBand(output, 1), &statistics);
+    }
+
+    GDALClose(after);
+    GDALClose(output);
+    free(dirty);
+    free(affected);
+
+    if (success == FALSE) {
+        free(statistics.histogram);
+        printf("Export was not successful.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("Done, %d windows\n", windows);
+    printf("Done. Surface exported to file: %s\n\n", argv[5]);
+    if (statisticsPrinting() == TRUE) {
+        printStatisticsJson(&statistics, argv[5]);
+    }
+    free(statistics.histogram);
+}
+
+
+/*
+*   Checks that two datasets have the same size, geotransform and nodata value (band 1)
+*/
+char sameSurfaceGrid(GDALDatasetH a, GDALDatasetH b) {
+    double agt[6];
+    double bgt[6];
+    int success;
+
+    if (GDALGetRasterXSize(a) != GDALGetRasterXSize(b) || GDALGetRasterYSize(a) != GDALGetRasterYSize(b)) {
+        return FALSE;
+    }
+
+    GDALGetGeoTransform(a, agt);
+    GDALGetGeoTransform(b, bgt);
+    for (int i = 0; i < 6; i++) {
+        if (fabs(agt[i] - bgt[i]) > EPSILON) {
+            return FALSE;
+        }
+    }
+
+    const double anodata = GDALGetRasterNoDataValue(GDALGetRasterBand(a, 1), &success);
+    const double bnodata = GDALGetRasterNoDataValue(GDALGetRasterBand(b, 1), &success);
+
+    return (fabs(anodata - bnodata) > EPSILON) ? FALSE : TRUE;
+}
+
+
+/*
+*   Compares two inputs in tiles of INCREMENTAL_TILE_SIZE x INCREMENTAL_TILE_SIZE cells
+*   - Inputs are read one tile row at a time
+*   - Cells are compared bit by bit (any change, also to or from nodata, is a change)
+*   - Returns flags of changed tiles (tilerows x tilecols), NULL on read errors
+*/
+char *findDirtyTiles(GDALDatasetH before, GDALDatasetH after, const int tilerows, const int tilecols) {
+    GDALRasterBandH beforeband = GDALGetRasterBand(before, 1);
+    GDALRasterBandH afterband = GDALGetRasterBand(after, 1);
+    const int rows = GDALGetRasterYSize(after);
+    const int cols = GDALGetRasterXSize(after);
+
+    char *ret = calloc((size_t)tilerows * tilecols, 1);
+    float *beforestrip = malloc((size_t)INCREMENTAL_TILE_SIZE * cols * sizeof(float));
+    float *afterstrip = malloc((size_t)INCREMENTAL_TILE_SIZE * cols * sizeof(float));
+
+    for (int tilerow = 0; tilerow < tilerows; tilerow++) {
+        const int first_row = tilerow * INCREMENTAL_TILE_SIZE;
+        const int count = (first_row + INCREMENTAL_TILE_SIZE < rows) ? INCREMENTAL_TILE_SIZE : rows - first_row;
+
+        if (GDALRasterIO(beforeband, GF_Read, 0, first_row, cols, count, beforestrip, cols, count, GDT_Float32, 0, 0) != CE_None
+            || GDALRasterIO(afterband, GF_Read, 0, first_row, cols, count, afterstrip, cols, count, GDT_Float32, 0, 0) != CE_None) {
+            free(ret);
+            ret = NULL;
+            break;
+        }
+
+        for (int tilecol = 0; tilecol < tilecols; tilecol++) {
+            const int first_col = tilecol * INCREMENTAL_TILE_SIZE;
+            const int width = (first_col + INCREMENTAL_TILE_SIZE < cols) ? INCREMENTAL_TILE_SIZE : cols - first_col;
+
+            for (int row = 0; row < count; row++) {
+                const size_t start = (size_t)row * cols + first_col;
+                if (memcmp(&beforestrip[start], &afterstrip[start], width * sizeof(float)) != 0) {
+                    ret[tilerow * tilecols + tilecol] = TRUE;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(beforestrip);
+    free(afterstrip);
+
+    return ret;
+}
+
+
+/*
+*   Expands dirty tiles by reach tiles in every direction (square neighbourhood)
+*   - Returns flags of affected tiles (tilerows x tilecols)
+*/
+char *expandDirtyTiles(const char *dirty, const int tilerows, const int tilecols, const int reach) {
+    char *ret = calloc((size_t)tilerows * tilecols, 1);
+
+    for (int tilerow = 0; tilerow < tilerows; tilerow++) {
+        for (int tilecol = 0; tilecol < tilecols; tilecol++) {
+            if (dirty[tilerow * tilecols + tilecol] == FALSE) {
+                continue;
+            }
+            for (int row = tilerow - reach; row <= tilerow + reach; row++) {
+                for (int col = tilecol - reach; col <= tilecol + reach; col++) {
+                    if (row >= 0 && row < tilerows && col >= 0 && col < tilecols) {
+                        ret[row * tilecols + col] = TRUE;
+                    }
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Takes a rectangle of affected tiles starting from tile (tilerow, tilecol) if it is affected
+*   - Rectangle is grown right along the tile row, then down while whole rows of it are affected
+*   - Tiles of the rectangle are cleared from affected, last_row and last_col are exclusive
+*   - Returns FALSE if the tile is not affected (or already taken)
+*/
+char nextAffectedRect(char *affected, const int tilerows, const int tilecols, const int tilerow, const int tilecol, int *last_row, int *last_col) {
+    if (affected[tilerow * tilecols + tilecol] == FALSE) {
+        return FALSE;
+    }
+
+    *last_col = tilecol;
+    while (*last_col < tilecols && affected[tilerow * tilecols + *last_col] == TRUE) {
+        (*last_col)++;
+    }
+
+    *last_row = tilerow + 1;
+    while (*last_row < tilerows) {
+        char whole = TRUE;
+        for (int col = tilecol; col < *last_col; col++) {
+            if (affected[*last_row * tilecols + col] == FALSE) {
+                whole = FALSE;
+                break;
+            }
+        }
+        if (whole == FALSE) {
+            break;
+        }
+        (*last_row)++;
+    }
+
+    for (int row = tilerow; row < *last_row; row++) {
+        memset(&affected[row * tilecols + tilecol], FALSE, *last_col - tilecol);
+    }
+
+    return TRUE;
+}
+
+
+/*
+*   Recomputes a window of the surface: reads the window and its halo from input,
+*   applies the process steps (argv from index 6) and writes the window to output
+*   - Halo is clipped at the surface edges, where the whole surface has its edges too
+*   - Returns TRUE if the window was written
+*/
+char recomputeWindow(GDALDatasetH input, GDALDatasetH output, const int first_row, const int first_col, const int rows, const int cols, const int halo, int argc, const char *argv[]) {
+    const int surface_rows = GDALGetRasterYSize(input);
+    const int surface_cols = GDALGetRasterXSize(input);
+
+    // Window with halo:
+    const int halo_row = (first_row > halo) ? first_row - halo : 0;
+    const int halo_col = (first_col > halo) ? first_col - halo : 0;
+    const int last_row = (first_row + rows + halo < surface_rows) ? first_row + rows + halo : surface_rows;
+    const int last_col = (first_col + cols + halo < surface_cols) ? first_col + cols + halo : surface_cols;
+
+    struct FloatSurface *surf = inputDepthModelWindow(input, halo_col, halo_row, last_col - halo_col, last_row - halo_row);
+    if (surf == NULL) {
+        return FALSE;
+    }
+
+    for (int i = 6; i < argc; i++) {
+        i = applyProcessStep(surf, argc, argv, i);
+        if (i < 0) {
+            freeFloatSurface(surf);
+            return FALSE;
+        }
+    }
+
+    // Window cells without the halo:
+    GDALRasterBandH band = GDALGetRasterBand(output, 1);
+    char ret = TRUE;
+
+    for (int row = 0; row < rows; row++) {
+        float *cells = &surf->array[first_row - halo_row + row][first_col - halo_col];
+        if (GDALRasterIO(band, GF_Write, first_col, first_row + row, cols, 1, cells, cols, 1, GDT_Float32, 0, 0) != CE_None) {
+            ret = FALSE;
+            break;
+        }
+    }
+
+    freeFloatSurface(surf);
+
+    return ret;
+}
@@ -4,8 +4,13 @@
 *   This file contains:
 *   - Printer functions for structured data types sto help with development
 *   - Help
+*   - Progress reports of surface operators (printed, or passed to a callback in library use)
 */
 
+
+// Progress reporting of operators, no callback: print to stdout (one per thread, library calls may run in parallel)
+_Thread_local struct ProgressReporter progress = {NULL, NULL, NULL};
+
 /*
 *   Prints help
 */
@@ -15,9 +20,51 @@ void printHelp(void) {
     printf("\n 2. CLI (use for scripting):\n\n\tsurfacetools [full inputfilepath] [full outputfilepath] -methodflag P -methodflag P -trimflag(Rolling Coin only) \n");
     printf("\n\tMethods:\n\t  -buffer = Buffer shoals (3x3 cell focal max filter)\n\t\t* No parameters\n\t\t* Use example: surfacetools [inputfile] [outputfile] -buffer");
     printf("\n\t  -offset = Vertical surface offset in meters\n\t\t* Parameters: [h] = offset in meters (float), can be positive or negative (addition to cell value)\n\t\t* Use example: surfacetools [inputfile] [outputfile] -offset -0.25");
+    printf("\n\t  -offset-grid = Vertical offset from a separation surface (e.g. chart datum separation model), sampled bilinearly at every cell\n\t\t* Parameters: [separationfile] = raster in the coordinate system of the surface, cells it doesn't cover become nodata");
+    printf("\n\t\t* A following -offset is added in the same pass. Use example: surfacetools [inputfile] [outputfile] -offset-grid separation.tiff -offset 0.3");
     printf("\n\t  -laplacian = Laplacian smoothing\n\t\t* Parameters: [N] = number of iterations (integer)\n\t\t* Use example: surfacetools [inputfile] [outputfile] -laplacian 25");
     printf("\n\t  -rollcoin = Rolling Coin smoothing\n\t\t* Parameters: [R] = coin radius in cells (integer), [trim/notrim] = trim flag (coin edge trimming)");
     printf("\n\t\t* Use example: surfacetools [inputfile] [outputfile] -rollcoin 15 trim");
+    printf("\n\t  -rollcoin-sweep = Rolling Coin smoothing with several radii, one output file per radius\n\t\t* Parameters: [R1,R2,...] = coin radii in cells (comma separated), [trim/notrim] = trim flag");
+    printf("\n\t\t* Steps after the sweep are applied to every radius, output files are named [outputfile]_rR.tif");
+    printf("\n\t\t* Use example: surfacetools [inputfile] [outputfile] -buffer -rollcoin-sweep 5,8,13 notrim");
+    printf("\n\t  -compact = Store surface as int16 centimetres (half the memory), rounding is always shoal-safe\n\t\t* Applies to the whole chain, can't be used with a sweep or in pipeline files");
+    printf("\n\t  -contours = Depth contours of the surface to a GeoPackage (field \"depth\"), contoured in parallel strips\n\t\t* Parameters: [interval or L1,L2,...] = contour interval or list of levels, [contourfile] = GeoPackage path");
+    printf("\n\t\t* Use example: surfacetools [inputfile] [outputfile] -rollcoin 13 notrim -contours -2,-5,-10,-20 contours.gpkg");
+    printf("\n\t  -compress = Output compression\n\t\t* Parameters: [none/deflate/lzw/zstd] = compression, default is deflate for files and none for /vsimem/ and /vsistdout/");
+    printf("\n\t  -stats = Print statistics of the output as a JSON line (count, min, max, mean, stddev, histogram)\n\t\t* Statistics and histogram are always stored in the output (computed while it is written, gdalinfo -stats -hist reads them)");
+    printf("\n\t  -audit = Safety audit: compare the surface to the input, report cells deeper than the input and cells that lost their data\n\t\t* Parameters: [tolerance] = allowed depth below the input (m), [maskfile] = violation mask GeoTIFF (1: deeper, 2: lost data), optional");
+    printf("\n\t\t* Audits the surface at its place in the chain (before -offset), a failed audit makes the exit status 1");
+    printf("\n\t  -checkpoint = Save the surface and position in the chain periodically to [outputfile].ckpt (removed when the output is written)\n\t\t* Parameters: [seconds] = interval, optional, default is 600");
+    printf("\n\t  -resume = Continue from the checkpoint of the same command line, if there is one\n\t\t* Use example: surfacetools [inputfile] [outputfile] -checkpoint 600 -resume -buffer -laplacian 500");
+    printf("\n\t  -window = Process and output only a window of the surface (cells outside it are read only as the halo of the steps)\n\t\t* Parameters: [minx] [miny] [maxx] [maxy] = bounding box in coordinates of the surface");
+    printf("\n\t  -aoi = Process only an area of interest, cells outside the polygons are nodata in the output\n\t\t* Parameters: [vectorfile] = polygons (first layer) in the coordinate system of the surface");
+    printf("\n\t  -patch = Write the processed window or area of interest into the existing output (same grid as the input)\n\t\t* Use example: surfacetools [inputfile] [outputfile] -aoi fairway.gpkg -patch -buffer -rollcoin 13 notrim");
+    printf("\n\t  -preview = Quick-look: run the chain on a decimated surface (overview of the input, or shoalest cell of each block)\n\t\t* Parameters: [factor] = input cells per preview cell in each direction, coin radii and Laplacian iterations are scaled");
+    printf("\n\t  -simd = Force SIMD kernel variant (for benchmarking), applies to the steps after it\n\t\t* Parameters: [sse2/avx2/avx512] = instruction set, default is the best supported by the CPU");
+    printf("\n\n\tInput and output can be GDAL virtual files: /vsistdin/ and /vsistdout/ chain tools through pipes, /vsimem/ is in memory");
+    printf("\n\n 3. Pipeline file (several outputs from one input, shared steps are computed once):\n\n\tsurfacetools -pipeline [pipelinefile]\n");
+    printf("\n\tPipeline file example:\n\t\tinput  inputfile.tiff\n\t\tstage  coin10 input  -buffer -rollcoin 10 notrim\n\t\tstage  final  coin10 -laplacian 20 -offset 0.3");
+    printf("\n\t\toutput coin10 coin10.tiff\n\t\toutput final  final.tiff");
+    printf("\n\n 4. Daemon mode (surfaces stay in memory between requests, requests run concurrently):\n\n\tsurfacetools -daemon [socketpath]\n");
+    printf("\tsurfacetools -client [socketpath] process [inputfile] [outputfile] -methodflag P ...\n");
+    printf("\tsurfacetools -client [socketpath] status | drop [inputfile] | shutdown");
+    printf("\n\t\t* Process steps as in CLI, except -simd, -compress, -compact and -rollcoin-sweep");
+    printf("\n\n 5. Tile mosaic (tiles processed in parallel with halos from their neighbours, seamless outputs per tile):\n\n\tsurfacetools -mosaic [tilelist or VRT] [outputdirectory] -methodflag P ...\n");
+    printf("\t\t* Tile list has one tile path per line, outputs are named as the tiles");
+    printf("\n\t\t* Process steps as in CLI, except -simd, -compact, -rollcoin-sweep and -contours");
+    printf("\n\n 6. Stacked epochs (co-registered surveys of the same grid processed in one pass, outputs per epoch):\n\n\tsurfacetools -stack [epochlist] [outputdirectory] -methodflag P ...\n");
+    printf("\t\t* Epoch list has one epoch path per line, epochs must have the same size, georeferencing and nodata, outputs are named as the epochs");
+    printf("\n\t\t* Process steps as in CLI, except -compact, -rollcoin-sweep, -contours, -offset-grid and -audit");
+    printf("\n\n 7. Incremental update (only regions changed by a new survey patch are recomputed and patched into the previous output):\n\n\tsurfacetools -incremental [previousinput] [previousoutput] [newinput] [newoutput] -methodflag P ...\n");
+    printf("\t\t* Previous output must be made from previous input with the same process steps, it is updated in place if newoutput is the same file");
+    printf("\n\t\t* Process steps as in CLI, except -compact, -rollcoin-sweep and -contours");
+    printf("\n\n 8. MPI mode (surface split into blocks over ranks, build with \"make mpi\"):\n\n\tmpirun -np [ranks] surfacetools-mpi -mpi [inputfile] [outputfile] -methodflag P ...\n");
+    printf("\t\t* Process steps as in CLI, except -compact, -rollcoin-sweep and -contours");
+    printf("\n\n 9. Benchmark of memory placement (chain timed with allocating thread first touch, row band first touch and huge pages):\n\n\tsurfacetools -benchmark [inputfile] [runs] -methodflag P ...\n");
+    printf("\t\t* Process steps as in CLI, except -simd, -compress, -compact, -rollcoin-sweep and -contours");
+    printf("\n\t\t* Environment: BATHYTOOLS_THREADS = row bands, BATHYTOOLS_HUGEPAGES = off/transparent/explicit, BATHYTOOLS_NUMA = off, BATHYTOOLS_SCRATCH = off");
+    printf("\n\t\t* Input cache (all modes): BATHYTOOLS_CACHE = on/[directory], decoded inputs are mapped from [inputfile].btcache");
     printf("\n\n\tExamples:\n");
     printf("\t\tBuffer shoals: surfacetools inputfile.tiff outputfile.tiff -buffer\n");
     printf("\t\tOffset: surfacetools inputfile.tiff outputfile.tiff -offset -0.55\n");
@@ -58,3 +105,42 @@ void printCoin(struct Coin *penny) {
         printf("\n");
     }
 }
+
+
+/*
+*   Reports start of an operator step: prints "Step.." or calls the progress callback
+*/
+void printStepStart(const char *step) {
+    progress.step = step;
+
+    if (progress.callback != NULL) {
+        progress.callback(step, 0.0, progress.userdata);
+    }   else {
+        printf("%s..", step);
+        fflush(stdout);
+    }
+}
+
+
+/*
+*   Reports progress (fraction 0...1) of the current operator step
+*   - Only passed to the progress callback, nothing is printed
+*/
+void printStepProgress(const double fraction) {
+    if (progress.callback != NULL) {
+        progress.callback(progress.step, fraction, progress.userdata);
+    }
+}
+
+
+/*
+*   Reports end of the current operator step: prints "Done" or calls the progress callback
+*/
+void printStepDone(void) {
+    if (progress.callback != NULL) {
+        progress.callback(progress.step, 1.0, progress.userdata);
+    }   else {
+        printf("Done\n");
+        fflush(stdout);
+    }
+}
@@ -2,7 +2,8 @@
 
 /*
 *   This file contains:
-*   - File input functions
+*   - File input functions (input rasters are decoded by parallel workers, or mapped
+*     from a sidecar cache, see surface_cache.c)
 *   - Stuctured datatype builders
 *   - Memory management functions: allocates and frees
 */
@@ -36,8 +37,23 @@ struct FloatSurface *inputDepthModel(const char *path) {
     GDALAllRegister();                                                  // Register all GDAL drivers
     int success;
 
-    if (access(filepath, R_OK|W_OK) != -1) {                            // Check that file exists (read & write permissions ok)
-        dataset = GDALOpen(filepath, GA_ReadOnly);                      // Try to open dataset
+    const char *readpath = inputFilePath(filepath);                     // Check that file exists (read & write permissions ok)
+    char cachefp[1100];                                                 // Sidecar cache of a local input (see surface_cache.c)
+    char cached = (readpath != NULL) ? surfaceCachePath(filepath, cachefp, sizeof(cachefp)) : FALSE;
+
+    // Surface decoded by an earlier run is mapped, input is not read:
+    if (cached == TRUE) {
+        struct FloatSurface *ret = readSurfaceCache(cachefp, filepath);
+        if (ret != NULL) {
+            if (progress.callback == NULL) {                            // Not printed with a progress callback (daemon requests)
+                printf("Surface mapped from cache: %s\n", cachefp);
+            }
+            return ret;
+        }
+    }
+
+    if (readpath != NULL) {
+        dataset = GDALOpen(readpath, GA_ReadOnly);                      // Try to open dataset
     } else {
         printf("File read error. Recheck file path.\nExiting.\n");
         exit(EXIT_FAILURE);
@@ -46,7 +62,7 @@ struct FloatSurface *inputDepthModel(const char *path) {
     if (dataset == NULL) {
         printf("File read error. Recheck file path.\nExiting.\n");
         exit(EXIT_FAILURE);
-    }   else{
+    }   else if (progress.callback == NULL) {
         printf("File read successful. Building surface..");
     }
 
@@ -54,72 +70,274 @@ struct FloatSurface *inputDepthModel(const char *path) {
 
     // Allocate and populate struct:
     struct FloatSurface *ret = calloc(1, sizeof(struct FloatSurface));  // Allocate memory for FloatSurface
+    if (ret == NULL) {
+        printf("Memory allocation failed.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
     len = strlen(filepath);                                             // Get filepath length
     ret->inputfp = calloc(len + 1, 1);                                  // Allocate memory for null character too (+1)
-    ret->inputfp = strcpy(ret->inputfp, filepath);                      // Copy filepath string to struct
 
     const char *src_projection =  GDALGetProjectionRef(dataset);        // Get projection information
     len = strlen(src_projection);
     ret->projection = calloc(len + 1, 1);                               // +1 for null character
-    ret->projection = strcpy(ret->projection, (char*)src_projection);   // Set projection information
-
     ret->geotransform = calloc(6, sizeof(double));                      // Allocate memory for 6 doubles
+    if (ret->inputfp == NULL || ret->projection == NULL || ret->geotransform == NULL) {
+        printf("Memory allocation failed.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ret->inputfp = strcpy(ret->inputfp, filepath);                      // Copy filepath string to struct
+    ret->projection = strcpy(ret->projection, (char*)src_projection);   // Set projection information
     GDALGetGeoTransform(dataset, ret->geotransform);                    // Set geotransform parameters
 
     ret->nodata = GDALGetRasterNoDataValue(band, &success);             // Set nodata value
     ret->rows = GDALGetRasterBandYSize(band);                           // Set row count
     ret->cols = GDALGetRasterBandXSize(band);                           // Set column count
 
-    // Allocate memory & get depth model data as an array (float**):
-    float **array = calloc(ret->rows, sizeof(float *));                 // Allocate memory for rows
-    for (int row = 0; row < ret->rows; row++ ) {
-        array[row] = calloc(ret->cols, sizeof(float));                  // Allocate memory for columns
+    // Allocate memory & get depth model data as an array (float**), rows are first touched by their workers:
+    float **array = createFloatArray(ret->cols, ret->rows);
+    if (array == NULL) {
+        printf("Memory allocation failed.\nExiting.\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Allocate memory for temporary 1D array to read all data at once
-    float *temp = CPLMalloc(sizeof(float) * ret->rows * ret->cols);
-
-    // Read data:
-    CPLErr err = GDALRasterIO(band,
-        GF_Read,
-        0,              // x offset
-        0,              // y offset
-        ret->cols,      // x size
-        ret->rows,      // y size
-        temp,           // data array
-        ret->cols,      // x buffer size
-        ret->rows,      // y buffer size
-        GDT_Float32,    // datatype
-        0,              // pixel space
-        0);             // line space
-
-    if (err != CPLE_None) {
+    // Read data straight into the rows, strips of whole block rows are decoded by parallel workers:
+    if (readBandParallel(dataset, readpath, array, ret->rows, ret->cols) != TRUE) {
         printf("An error occured when reading the input data file: %s\n", CPLGetLastErrorMsg());
+        cached = FALSE;     // Incomplete surface is not cached
     }
 
-    // Convert data to a 2D array:
-    int i = 0;   // 1D array cell index
-    for (int row = 0; row < ret->rows; row++) {
-         for (int col = 0; col < ret->cols; col++) {
-            array[row][col] = temp[i];
-            i++;
+    ret->array = array;     // Store data array pointer to Struct
+
+    GDALClose(dataset);     // Data is now stored in struct, file can be closed
+    if (progress.callback == NULL) {
+        printf("Done\n");
+    }
+
+    // Next loads of the input map the decoded surface:
+    if (cached == TRUE && writeSurfaceCache(cachefp, ret) != TRUE) {
+        printf("Surface cache could not be written: %s\n", cachefp);
+    }
+    return ret;             // Return struct pointer
+}
+
+
+/*
+*   Reads band 1 of a dataset into the rows of an array made by createFloatArray
+*   - Rows are split into strips of whole block rows (native block layout of the
+*     source), workers decode strips concurrently, each through a dataset handle
+*     of its own (path), straight into the final rows (line space is the row stride)
+*   - Small rasters and single worker machines are read with one call
+*   - Returns TRUE if all rows were read
+*/
+char readBandParallel(GDALDatasetH dataset, const char *path, float **array, const int rows, const int cols) {
+    GDALRasterBandH band = GDALGetRasterBand(dataset, 1);
+    int blockcols;
+    int blockrows;
+
+    GDALGetBlockSize(band, &blockcols, &blockrows);
+    if (blockrows < 1) {
+        blockrows = 1;
+    }
+
+    // Strips of at least MIN_READ_STRIP_ROWS rows, rounded up to whole block rows:
+    const int striprows = (MIN_READ_STRIP_ROWS + blockrows - 1) / blockrows * blockrows;
+    struct BlockRead read = {path, array, floatArrayStride(array), rows, cols, striprows, 0, FALSE, PTHREAD_MUTEX_INITIALIZER};
+    const int strips = (rows + striprows - 1) / striprows;
+    int threads = workerThreadCount();
+
+    if (threads > strips) {
+        threads = strips;
+    }
+
+    if (threads > 1) {
+        pthread_t *workers = calloc(threads, sizeof(pthread_t));
+        int started = 0;
+
+        for (int i = 0; i < threads; i++) {
+            if (pthread_create(&workers[started], NULL, blockReadWorker, &read) == 0) {
+                started++;
+            }
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+        pthread_mutex_destroy(&read.lock);
+
+        if (started > 0 && read.failed == FALSE) {
+            return TRUE;
         }
     }
 
-    // Free temp array memory:
-    CPLFree(temp);
+    // One call (or parallel read failed):
+    return GDALRasterIO(band, GF_Read, 0, 0, cols, rows, array[0], cols, rows, GDT_Float32, 0, (int)(read.stride * sizeof(float))) == CE_None;
+}
 
-    ret->array = array;     // Store data array pointer to Struct
 
-    GDALClose(dataset);     // Data is now stored in struct, file can be closed
-    printf("Done\n");
-    return ret;             // Return struct pointer
+/*
+*   Block read worker thread: opens its own dataset handle and reads strips until all are taken
+*/
+void *blockReadWorker(void *arg) {
+    struct BlockRead *read = arg;
+    GDALDatasetH dataset = GDALOpen(read->path, GA_ReadOnly);
+    GDALRasterBandH band = (dataset != NULL) ? GDALGetRasterBand(dataset, 1) : NULL;
+
+    while (1) {
+        pthread_mutex_lock(&read->lock);
+        const int first_row = read->next * read->striprows;
+        read->next++;
+        pthread_mutex_unlock(&read->lock);
+
+        if (first_row >= read->rows) {
+            break;
+        }
+
+        const int rows = (first_row + read->striprows < read->rows) ? read->striprows : read->rows - first_row;
+
+        if (band == NULL || GDALRasterIO(band, GF_Read, 0, first_row, read->cols, rows, read->array[first_row], read->cols, rows,
+                                         GDT_Float32, 0, (int)(read->stride * sizeof(float))) != CE_None) {
+            pthread_mutex_lock(&read->lock);
+            read->failed = TRUE;
+            pthread_mutex_unlock(&read->lock);
+        }
+    }
+
+    if (dataset != NULL) {
+        GDALClose(dataset);
+    }
+
+    return NULL;
+}
+
+
+/*
+*   Builds a FloatSurface from a window of an open dataset (band 1)
+*   - Window must be inside the dataset, geotransform is moved to the window origin
+*   - Nothing is printed (windows are read by parallel workers)
+*   - Returns NULL if the window can't be read
+*/
+struct FloatSurface *inputDepthModelWindow(GDALDatasetH dataset, const int first_col, const int first_row, const int cols, const int rows) {
+    GDALRasterBandH band = GDALGetRasterBand(dataset, 1);
+    const char *src_projection = GDALGetProjectionRef(dataset);
+    double geotransform[6];
+    int success;
+
+    struct FloatSurface *ret = calloc(1, sizeof(struct FloatSurface));
+    ret->inputfp = calloc(strlen(GDALGetDescription(dataset)) + 1, 1);
+    strcpy(ret->inputfp, GDALGetDescription(dataset));
+    ret->projection = calloc(strlen(src_projection) + 1, 1);
+    strcpy(ret->projection, src_projection);
+
+    GDALGetGeoTransform(dataset, geotransform);
+    ret->geotransform = calloc(6, sizeof(double));
+    ret->geotransform[0] = geotransform[0] + first_col * geotransform[1] + first_row * geotransform[2];
+    ret->geotransform[1] = geotransform[1];
+    ret->geotransform[2] = geotransform[2];
+    ret->geotransform[3] = geotransform[3] + first_col * geotransform[4] + first_row * geotransform[5];
+    ret->geotransform[4] = geotransform[4];
+    ret->geotransform[5] = geotransform[5];
+
+    ret->nodata = GDALGetRasterNoDataValue(band, &success);
+    ret->rows = rows;
+    ret->cols = cols;
+    ret->array = createFloatArray(cols, rows);
+
+    // Read one row at a time straight into the rows of the surface:
+    for (int row = 0; row < rows; row++) {
+        if (GDALRasterIO(band, GF_Read, first_col, first_row + row, cols, 1, ret->array[row], cols, 1, GDT_Float32, 0, 0) != CE_None) {
+            freeFloatSurface(ret);
+            return NULL;
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Checks that an input file can be read, returns the path GDAL should open
+*   - Files must have read & write permissions
+*   - Virtual file systems of GDAL (/vsimem/, /vsizip/, ...) are checked with VSIStatL
+*   - Standard input (/vsistdin/) is read to memory (STDIN_MEMORY_PATH) on the first
+*     call, so drivers can seek in it and the surface can be read more than once
+*   - Returns NULL if the file can't be read
+*/
+const char *inputFilePath(const char *path) {
+    static char stdinread = FALSE;
+    VSIStatBufL info;
+
+    if (strncmp(path, "/vsistdin/", 10) == 0) {
+        if (stdinread == FALSE) {
+            VSILFILE *fp = VSIFOpenL(path, "rb");
+            size_t capacity = 1 << 20;
+            size_t size = 0;
+            size_t count;
+            GByte *data = CPLMalloc(capacity);
+
+            while (fp != NULL && (count = VSIFReadL(data + size, 1, capacity - size, fp)) > 0) {
+                size += count;
+                if (size == capacity) {
+                    capacity *= 2;
+                    data = CPLRealloc(data, capacity);
+                }
+            }
+            if (fp != NULL) {
+                VSIFCloseL(fp);
+            }
+
+            // Memory file takes ownership of data:
+            VSIFCloseL(VSIFileFromMemBuffer(STDIN_MEMORY_PATH, data, size, TRUE));
+            stdinread = TRUE;
+        }
+        return STDIN_MEMORY_PATH;
+
+    }   else if (isVirtualPath(path) == TRUE) {
+        return (VSIStatL(path, &info) == 0) ? path : NULL;
+    }
+
+    return (access(path, R_OK|W_OK) != -1) ? path : NULL;
+}
+
+
+/*
+*   Makes a full copy of a FloatSurface (metadata and data array)
+*   - Allocates memory, returns a pointer to the new FloatSurface, NULL if memory can't be allocated
+*   - Used when several products are made from the same surface
+*/
+struct FloatSurface *copyFloatSurface(struct FloatSurface *input) {
+    struct FloatSurface *ret = calloc(1, sizeof(struct FloatSurface));
+
+    if (ret == NULL) {
+        return NULL;
+    }
+    ret->nodata = input->nodata;
+    ret->rows = input->rows;
+    ret->cols = input->cols;
+
+    ret->inputfp = calloc(strlen(input->inputfp) + 1, 1);              // +1 for null character
+    ret->projection = calloc(strlen(input->projection) + 1, 1);
+    ret->geotransform = calloc(6, sizeof(double));
+    ret->array = createFloatArray(ret->cols, ret->rows);
+    if (ret->inputfp == NULL || ret->projection == NULL || ret->geotransform == NULL || ret->array == NULL) {
+        freeFloatSurface(ret);      // Frees what was allocated
+        return NULL;
+    }
+
+    strcpy(ret->inputfp, input->inputfp);
+    strcpy(ret->projection, input->projection);
+    memcpy(ret->geotransform, input->geotransform, 6 * sizeof(double));
+    for (int row = 0; row < ret->rows; row++) {
+        memcpy(ret->array[row], input->array[row], ret->cols * sizeof(float));
+    }
+
+    return ret;
 }
 
 
 /*
 *   Builds Coin
-*   - Allocates memory, returns a pointer to Coin
+*   - Allocates memory, returns a pointer to Coin, NULL if memory can't be allocated
 *   - Input parameters: 
 *       - Coin radius (diameter = 2r+1)
 *       - Trim flag: 
@@ -128,10 +346,16 @@ struct FloatSurface *inputDepthModel(const char *path) {
 */
 struct Coin *createCoin(const int radius, const char trim) {
     struct Coin *ret = calloc(1, sizeof(struct Coin));
-    char **trimmed;
+    char **trimmed = NULL;
     char **untrimmed;
     const int untrimmedDiameter = 2 * radius + 1;
 
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    ret->trim = (trim == TRUE) ? TRUE : FALSE;
+
     // Set coin radius attribute:
     if (trim == TRUE) {
         ret->radius = radius - 1;
@@ -149,7 +373,13 @@ struct Coin *createCoin(const int radius, const char trim) {
     }   else {              // Build only untrimmed array if trim is FALSE
         untrimmed = createBooleanArray(untrimmedDiameter, untrimmedDiameter);
     }
-    
+    if (untrimmed == NULL || (trim == TRUE && trimmed == NULL)) {
+        freeBooleanArray(trimmed, ret->diameter);
+        freeBooleanArray(untrimmed, untrimmedDiameter);
+        free(ret);
+        return NULL;
+    }
+
     // Create coin (untrimmed array):
     for (int i = 0; i < untrimmedDiameter; i++) {
         for (int j = 0; j < untrimmedDiameter; j++) {
@@ -172,7 +402,7 @@ struct Coin *createCoin(const int radius, const char trim) {
             }
         }
 
-        freeBooleanArray(untrimmed, ret->diameter); // Free memory of extra array
+        freeBooleanArray(untrimmed, untrimmedDiameter); // Free memory of extra array
         ret->array = trimmed;
     
     }   else {                                      // No extra arrays to free
@@ -208,44 +438,23 @@ void freeCoin(struct Coin *penny) {
 }
 
 
-/*
-*   - Allocates memory for (2D) float** array of given size
-*   - Returns a pointer to array
-*/
-float** createFloatArray(const int cols, const int rows) {
-    float **ret;                                    // Array pointer to be returned
-    ret = calloc(rows, sizeof(float*));             // Allocate memory for rows
-
-    for (int row = 0; row < rows; row++) {
-        ret[row] = calloc(cols, sizeof(float));     // Allocate memory for columns
-    }
-
-    return ret;
-}
-
-
-/*
-*   Frees allocated memory of 2D float (float**) array
-*/
-void freeFloatArray(float **array, const int rows) {
-    for (int i = 0; i < rows; i++) {
-        free(array[i]);
-    }
-
-    free(array);
-}
-
-
 /*
 *   - Allocates memory for (2D) char** array of given size
-*   - Returns a pointer to array
+*   - Returns a pointer to array, NULL if memory can't be allocated
 */
 char** createBooleanArray(const int cols, const int rows) {
     char **ret;                             // Array pointer to be returned
     ret = calloc(rows, sizeof(char*));      // Allocate memory for rows
 
+    if (ret == NULL) {
+        return NULL;
+    }
     for (int row = 0; row < rows; row++) {
         ret[row] = calloc(cols, 1);         // Allocate memory for columns
+        if (ret[row] == NULL) {
+            freeBooleanArray(ret, row);
+            return NULL;
+        }
     }
 
     return ret;
@@ -256,6 +465,9 @@ char** createBooleanArray(const int cols, const int rows) {
 *   Frees allocated memory of 2D char (char**) array
 */
 void freeBooleanArray(char **array, const int rows) {
+    if (array == NULL) {
+        return;
+    }
     for (int i = 0; i < rows; i++) {
         free(array[i]);
     }
@@ -16,40 +16,84 @@
 
 /*
 *   Controls the iterative smoothing process.
-*   - Iterates over surface cells
-*   - Memory management
+*   - Rows are smoothed in parallel row bands (see numa_memory.c)
+*   - Memory management (temporary array from the scratch pool)
+*   - Returns FALSE if memory can't be allocated (surface is not changed)
 */
-void smoothLaplacian(const int iterations, struct FloatSurface *src) {
-    printf("Laplacian smoothing..");
-    fflush(stdout);
-    const double nodata = src->nodata;
+char smoothLaplacian(const int iterations, struct FloatSurface *src) {
+    // Scratch array to hold smoothed surface (type float**, see scratch_pool.c):
+    struct BandOperands operands = {src, acquireScratchArray(src->cols, src->rows), iterations, 0.0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+
+    if (operands.temp == NULL) {
+        return FALSE;
+    }
+    printStepStart("Laplacian smoothing");
+    runRowBands(src->rows, src->cols, smoothLaplacianBand, &operands);
+
+    // Return the temporary array to the scratch pool:
+    releaseScratchArray(operands.temp, src->rows);
+    printStepDone();
+    return TRUE;
+}
 
-    // Build extra array to hold smoothed surface (type float**):
-    float **smooth_array = createFloatArray(src->cols, src->rows);
-    float **holder = NULL;  // Pointer placeholder
+
+/*
+*   Smooths the rows of a row band N times
+*   - Bands wait for each other after every iteration (next iteration reads rows of the neighbouring bands)
+*   - Data arrays are swapped in a copy of the surface, result is copied to the original data array
+*/
+void smoothLaplacianBand(struct RowBand *band) {
+    struct FloatSurface *src = band->operands->src;
+    struct FloatSurface surf = *src;    // Data array pointer of the band, the original may be owned by the caller
+    const int iterations = band->operands->iterations;
+    const double nodata = src->nodata;
+    const double xWeight = fabs(src->geotransform[5]) / fabs(src->geotransform[1]);    // Kernel weights, see getInterpolatedDepth
+    const double yWeight = fabs(src->geotransform[1]) / fabs(src->geotransform[5]);
+    float **smooth_array = band->operands->temp;
+    float **holder = NULL;          // Pointer placeholder
 
     // Iterate and smooth surface N times:
     for (int i = 0; i < iterations; i++) {
-        for (int row = 0; row < src->rows; row++) {
-            for (int col = 0; col < src->cols; col++) {
-                if (fabs(src->array[row][col] - nodata) > EPSILON) {
-                    smooth_array[row][col] = getSafeSmoothDepth(src, row, col);
-                }   else {
-                    smooth_array[row][col] = nodata;
+        for (int row = band->first_row; row < band->last_row; row++) {
+            if (row > 0 && row < surf.rows - 1 && surf.cols > 2) {
+                // Cells between edges with a row kernel (simd_kernels.c), edge cells one by one:
+                smoothLaplacianCell(&surf, smooth_array, row, 0);
+                simd.smoothLaplacianRow(&surf.array[row - 1][1], &surf.array[row][1], &surf.array[row + 1][1], &smooth_array[row][1], surf.cols - 2, xWeight, yWeight, nodata);
+                smoothLaplacianCell(&surf, smooth_array, row, surf.cols - 1);
+            }   else {
+                for (int col = 0; col < surf.cols; col++) {
+                    smoothLaplacianCell(&surf, smooth_array, row, col);
                 }
             }
         }
+        waitRowBands(band);
 
         // Swap surface data array:
-        holder = src->array;        // Store pointer temporarily
-        src->array = smooth_array;  // Change surface struct data array
+        holder = surf.array;        // Store pointer temporarily
+        surf.array = smooth_array;  // Change surface data array
         smooth_array = holder;      // Use the same temporary array again
+        printStepProgress((i + 1.0) / iterations);
     }
 
-    // Free memory of the temporary array:
-    freeFloatArray(smooth_array, src->rows);
-    printf("Done\n");
-    fflush(stdout);
+    // Result must be in the original data array (odd number of swaps):
+    if (surf.array != src->array) {
+        for (int row = band->first_row; row < band->last_row; row++) {
+            memcpy(src->array[row], surf.array[row], surf.cols * sizeof(float));
+        }
+    }
+}
+
+
+/*
+*   Smooths a single cell, result is written to smooth array
+*   - Used for surface edges, see simd_kernels.c for cells between edges
+*/
+void smoothLaplacianCell(struct FloatSurface *src, float **smooth_array, int row, int col) {
+    if (fabs(src->array[row][col] - src->nodata) > EPSILON) {
+        smooth_array[row][col] = getSafeSmoothDepth(src, row, col);
+    }   else {
+        smooth_array[row][col] = src->nodata;
+    }
 }
 
 
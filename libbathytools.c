@@ -0,0 +1,191 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Library API functions (see libbathytools.h)
+*   - Surface views: FloatSurface whose rows point to a caller owned buffer,
+*     so operators work directly on the caller's data without copies or files
+*/
+
+
+/*
+*   Rolling Coin smoothing of a surface view
+*   - Radius in cells (1 - 10 000), trim: 0 = no trim, 1 = trim outer edges of coin
+*/
+int bathyRollCoin(struct BathySurfaceView *view, const int radius, const int trim, BathyProgress callback, void *userdata) {
+    struct FloatSurface surf;
+
+    if (radius < 1 || radius > 10000 || (trim != FALSE && trim != TRUE)) {
+        return BATHY_ERROR_ARGUMENT;
+    }
+
+    const int status = openSurfaceView(view, &surf, callback, userdata);
+    if (status != BATHY_OK) {
+        return status;
+    }
+
+    // Coin and scratch arrays are checked, surface is not changed if they can't be allocated:
+    struct Coin *penny = createCoin(radius, trim);
+    const char rolled = (penny != NULL) ? coinRollSurface(&surf, penny) : FALSE;
+    if (penny != NULL) {
+        freeCoin(penny);
+    }
+
+    closeSurfaceView(&surf);
+    return (rolled == TRUE) ? BATHY_OK : BATHY_ERROR_MEMORY;
+}
+
+
+/*
+*   Laplacian smoothing of a surface view
+*   - Cell sizes (geotransform[1] and [5]) must not be 0
+*/
+int bathySmoothLaplacian(struct BathySurfaceView *view, const int iterations, BathyProgress callback, void *userdata) {
+    struct FloatSurface surf;
+
+    if (iterations < 0 || view == NULL || !(fabs(view->geotransform[1]) > 0.0) || !(fabs(view->geotransform[5]) > 0.0)) {
+        return BATHY_ERROR_ARGUMENT;
+    }
+
+    const int status = openSurfaceView(view, &surf, callback, userdata);
+    if (status != BATHY_OK) {
+        return status;
+    }
+
+    const char smoothed = smoothLaplacian(iterations, &surf);
+
+    closeSurfaceView(&surf);
+    return (smoothed == TRUE) ? BATHY_OK : BATHY_ERROR_MEMORY;
+}
+
+
+/*
+*   Shoal buffering (3 x 3 cell focal maximum filter) of a surface view
+*/
+int bathyBufferShoals(struct BathySurfaceView *view, BathyProgress callback, void *userdata) {
+    struct FloatSurface surf;
+
+    const int status = openSurfaceView(view, &surf, callback, userdata);
+    if (status != BATHY_OK) {
+        return status;
+    }
+
+    const char buffered = maxFilterSurface(&surf);
+
+    closeSurfaceView(&surf);
+    return (buffered == TRUE) ? BATHY_OK : BATHY_ERROR_MEMORY;
+}
+
+
+/*
+*   Offset of a surface view (nodata cells are not changed)
+*/
+int bathyOffset(struct BathySurfaceView *view, const float depth_offset, BathyProgress callback, void *userdata) {
+    struct FloatSurface surf;
+
+    const int status = openSurfaceView(view, &surf, callback, userdata);
+    if (status != BATHY_OK) {
+        return status;
+    }
+
+    offset(&surf, depth_offset);
+
+    closeSurfaceView(&surf);
+    return BATHY_OK;
+}
+
+
+/*
+*   Frees the scratch arrays pooled by earlier operator calls (memory is given back, later calls allocate again)
+*/
+void bathyReleaseScratch(void) {
+    drainScratchPool();
+}
+
+
+/*
+*   Returns a description of a status code
+*/
+const char *bathyStatusMessage(const int status) {
+    if (status == BATHY_OK) {
+        return "No errors";
+    }   else if (status == BATHY_ERROR_ARGUMENT) {
+        return "Faulty surface view or operator parameter";
+    }   else if (status == BATHY_ERROR_MEMORY) {
+        return "Memory allocation failed";
+    }
+
+    return "Unknown status code";
+}
+
+
+/*
+*   Checks a surface view and builds a FloatSurface on it
+*   - Rows of the FloatSurface point to the caller owned buffer (nothing is copied)
+*   - Sets the progress callback (of this thread) and selects SIMD kernels on first use
+*   - Returns BATHY_OK or an error code
+*/
+int openSurfaceView(struct BathySurfaceView *view, struct FloatSurface *surf, BathyProgress callback, void *userdata) {
+    static pthread_once_t selected = PTHREAD_ONCE_INIT;     // SIMD kernels are selected once, by the first call
+
+    if (view == NULL || view->data == NULL || view->rows < 2 || view->cols < 2 || (view->stride != 0 && view->stride < view->cols)) {
+        return BATHY_ERROR_ARGUMENT;
+    }
+
+    const ptrdiff_t stride = (view->stride != 0) ? view->stride : view->cols;
+
+    surf->inputfp = NULL;
+    surf->projection = NULL;
+    surf->geotransform = view->geotransform;
+    surf->nodata = view->nodata;
+    surf->rows = view->rows;
+    surf->cols = view->cols;
+    surf->array = calloc(view->rows, sizeof(float *));
+
+    if (surf->array == NULL) {
+        return BATHY_ERROR_MEMORY;
+    }
+    for (int row = 0; row < view->rows; row++) {
+        surf->array[row] = view->data + row * stride;
+    }
+
+    pthread_once(&selected, selectBestKernels);
+
+    // Library never prints, progress without a callback is ignored:
+    progress.callback = (callback != NULL) ? callback : ignoreProgress;
+    progress.userdata = userdata;
+
+    // Operators run in the calling thread only (callers run views in parallel threads):
+    operatorThreads = 1;
+    return BATHY_OK;
+}
+
+
+/*
+*   Frees the row pointers of a surface view (not the caller owned buffer), resets progress reporting and row bands
+*/
+void closeSurfaceView(struct FloatSurface *surf) {
+    free(surf->array);
+    surf->array = NULL;
+    progress.callback = NULL;
+    progress.userdata = NULL;
+    operatorThreads = 0;
+}
+
+
+/*
+*   Progress callback that does nothing (library calls without a callback)
+*/
+void ignoreProgress(const char *step, double fraction, void *userdata) {
+    (void)step;
+    (void)fraction;
+    (void)userdata;
+}
+
+
+/*
+*   Selects the best SIMD kernels supported by the CPU (for pthread_once)
+*/
+void selectBestKernels(void) {
+    selectSimdKernels(NULL);
+}
@@ -0,0 +1,58 @@
+#ifndef LIBBATHYTOOLS_H
+#define LIBBATHYTOOLS_H
+
+#include <stddef.h>
+
+/*
+*   Bathymetric surface tools library API (libbathytools.a / libbathytools.so)
+*   - Surface operators on caller owned float32 buffers, no files are read or written
+*   - Operators modify the buffer in place, the caller keeps ownership of it
+*   - Errors are returned as status codes, nothing is printed and the process is never exited
+*   - Optional progress callback is called with the step name and fraction (0...1) of the step
+*   - Calls on different buffers can run in parallel threads (progress state is per thread)
+*
+*   Build with "make lib", link with -lbathytools -lgdal -lm -pthread.
+*
+*   Example:
+*
+*       struct BathySurfaceView view = {grid, rows, cols, 0, -9999.0, {0, 2.0, 0, 0, 0, -2.0}};
+*       int status = bathyRollCoin(&view, 13, 0, NULL, NULL);
+*       if (status != BATHY_OK) {
+*           fprintf(stderr, "%s\n", bathyStatusMessage(status));
+*       }
+*/
+
+
+// Status codes:
+#define BATHY_OK                0
+#define BATHY_ERROR_ARGUMENT    -1      // Faulty surface view or operator parameter
+#define BATHY_ERROR_MEMORY      -2      // Memory allocation failed
+
+
+// Surface view over a caller owned buffer (row-major float32 cells):
+struct BathySurfaceView {
+    float *data;                // First cell (row 0, column 0)
+    int rows;                   // Number of rows (at least 2)
+    int cols;                   // Number of columns (at least 2)
+    ptrdiff_t stride;           // Cells from the start of a row to the next row, 0: same as cols
+    double nodata;              // Nodata value
+    double geotransform[6];     // Georeferencing parameters as in GDAL, cell sizes [1] and [5] are used
+};
+
+// Progress callback: step name, fraction of the step (0...1) and caller data
+typedef void (*BathyProgress)(const char *step, double fraction, void *userdata);
+
+
+// Surface operators:
+int bathyRollCoin(struct BathySurfaceView *view, const int radius, const int trim, BathyProgress callback, void *userdata);
+int bathySmoothLaplacian(struct BathySurfaceView *view, const int iterations, BathyProgress callback, void *userdata);
+int bathyBufferShoals(struct BathySurfaceView *view, BathyProgress callback, void *userdata);
+int bathyOffset(struct BathySurfaceView *view, const float depth_offset, BathyProgress callback, void *userdata);
+
+// Frees the scratch arrays kept for reuse by later operator calls (see scratch_pool.c):
+void bathyReleaseScratch(void);
+
+// Description of a status code:
+const char *bathyStatusMessage(const int status);
+
+#endif
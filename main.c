@@ -14,6 +14,15 @@
 */
 int main(int argc, const char *argv[]) {
 
+    // Select SIMD kernels supported by the CPU, or forced with environment variable BATHYTOOLS_SIMD:
+    const char *forced = getenv("BATHYTOOLS_SIMD");
+    if (forced == NULL || selectSimdKernels(forced) == FALSE) {
+        if (forced != NULL) {
+            printf("BATHYTOOLS_SIMD: unknown or unsupported instruction set, using best available.\n");
+        }
+        selectSimdKernels(NULL);
+    }
+
     if (argc == 2 && strcmp(argv[1], "-ui") == 0) {
         clearScreen();
 
@@ -47,9 +56,45 @@ int main(int argc, const char *argv[]) {
             }
         }
 
+    }   else if (argc == 3 && strcmp(argv[1], "-pipeline") == 0) {
+        runPipeline(argv[2]);
+
+        // Surfaces that failed a safety audit are written, but the run fails:
+        if (safetyAuditFailed() == TRUE) {
+            return EXIT_FAILURE;
+        }
+
+    }   else if (argc == 3 && strcmp(argv[1], "-daemon") == 0) {
+        runDaemon(argv[2]);
+
+    }   else if (argc > 5 && strcmp(argv[1], "-incremental") == 0) {
+        runIncremental(argc, argv);
+
+    }   else if (argc > 4 && strcmp(argv[1], "-benchmark") == 0) {
+        runBenchmark(argc, argv);
+
+    }   else if (argc > 3 && strcmp(argv[1], "-mosaic") == 0) {
+        runMosaic(argc, argv);
+
+    }   else if (argc > 3 && strcmp(argv[1], "-stack") == 0) {
+        runStack(argc, argv);
+
+#ifdef BATHYTOOLS_MPI
+    }   else if (argc > 3 && strcmp(argv[1], "-mpi") == 0) {
+        return runMpi(argc, argv);
+
+#endif
+    }   else if (argc > 3 && strcmp(argv[1], "-client") == 0) {
+        return runClient(argc, argv);
+
     }   else if (argc > 3) {
         cli(argc, argv);
 
+        // Surfaces that failed a safety audit are written, but the run fails:
+        if (safetyAuditFailed() == TRUE) {
+            return EXIT_FAILURE;
+        }
+
     }   else {
         clearScreen();
         printHelp();
@@ -80,14 +125,12 @@ void rollingCoinSmoothing(void) {
     char trim = intInput(0, 1, "Trim coin edges? (0: No trim, 1: Trim outer edges): ");
     struct Coin *penny = createCoin(coin_r, trim);
 
-    // Buffer shoals if buffering is selected:
-    if (buffering == 1) {
-        maxFilterSurface(surf);
+    // Buffer shoals if buffering is selected, generalize/smooth surface:
+    if ((buffering == 1 && maxFilterSurface(surf) == FALSE) || coinRollSurface(surf, penny) == FALSE) {
+        printf("Memory allocation failed.\nExiting.\n");
+        exit(EXIT_FAILURE);
     }
 
-    // Generalize/smooth surface:
-    coinRollSurface(surf, penny);
-
     // Export file (GeoTIFF format):
     // Use default output filename:
     writeSurfaceToFile(surf, NULL);
@@ -115,7 +158,10 @@ void laplacianSmoothing(void) {
     int iterations = intInput(1, 500, "Enter number of smoothing iterations (1 - 500): ");
 
     // Smooth:
-    smoothLaplacian(iterations, surf);
+    if (smoothLaplacian(iterations, surf) == FALSE) {
+        printf("Memory allocation failed.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
 
     // Export file (GeoTIFF format):
     // Use default output filename:
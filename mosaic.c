@@ -0,0 +1,422 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Mosaic mode: a survey delivered as many tile files is processed tile by tile,
+*     outputs are written per tile (output directory, tile file names)
+*   - Every tile is read with a halo of cells from its neighbours, the halo is the
+*     dependency radius of the process chain, so tile outputs are identical to
+*     the same cells of the whole mosaic processed at once (no seams)
+*   - Tiles are processed by parallel workers, only one tile per worker is in memory
+*
+*   Input is a text file with one tile path per line or a GDAL VRT of the tiles:
+*
+*       surfacetools -mosaic [tiles.txt|mosaic.vrt] [outputdirectory] [process steps]
+*/
+
+
+/*
+*   Mosaic mode: reads the tile set, checks process steps and processes all tiles
+*   - Exits on faulty parameters or if a tile can't be processed
+*/
+void runMosaic(int argc, const char *argv[]) {
+    char inputflag = 1;         // Inputs assumed to be ok
+    struct stat st;
+
+    // Check input process commands and parameters:
+    printf("Process steps:\n");
+    for (int i = 4; i < argc; i++) {
+        // Steps with outputs of their own or global state are not available for parallel tiles:
+        const char unavailable = (strcmp(argv[i], "-simd") == 0 || strcmp(argv[i], "-compact") == 0
+                                  || strcmp(argv[i], "-rollcoin-sweep") == 0 || strcmp(argv[i], "-contours") == 0 || strcmp(argv[i], "-audit") == 0);
+        int last = unavailable ? -1 : checkProcessStep(argc, argv, i);
+
+        if (unavailable) {
+            printf("  -Not available in mosaic mode: %s\n", argv[i]);
+        }
+        if (last < 0) {
+            inputflag = 0;
+            continue;
+        }
+        if (strcmp(argv[i], "-compress") == 0) {
+            // Output compression is selected once for all workers:
+            setOutputCompression(argv[i+1]);
+        }
+        i = last;
+    }
+
+    // Output directory is created if it doesn't exist:
+    if (isVirtualPath(argv[3]) == TRUE || (stat(argv[3], &st) != 0 && mkdir(argv[3], 0777) != 0) || stat(argv[3], &st) != 0 || !S_ISDIR(st.st_mode)) {
+        printf("Output directory can't be used: %s\n", argv[3]);
+        inputflag = 0;
+    }
+
+    if (inputflag != 1) {
+        printf("Faulty parameters detected. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct Mosaic *mosaic = readMosaic(argv[2], argv[3]);
+    mosaic->halo = chainHaloRadius(argc, argv, 4);
+    mosaic->argc = argc;
+    mosaic->argv = argv;
+
+    // One worker per processor, but not more than tiles:
+    int threads = workerThreadCount();
+    if (threads > mosaic->count) {
+        threads = mosaic->count;
+    }
+    printf("Processing %d tiles, halo %d cells, %d workers:\n", mosaic->count, mosaic->halo, threads);
+    fflush(stdout);
+
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    int started = 0;
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[started], NULL, mosaicWorker, mosaic) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        // Workers can't be started, tiles are processed on this thread:
+        struct ProgressReporter saved = progress;
+        mosaicWorker(mosaic);
+        progress = saved;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    const int failed = mosaic->failed;
+    printf("Done. %d of %d tiles exported to directory: %s\n\n", mosaic->count - failed, mosaic->count, argv[3]);
+
+    freeMosaic(mosaic);
+
+    if (failed > 0) {
+        printf("Export was not successful.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/*
+*   Reads the tile set of a mosaic and places the tiles in the mosaic grid
+*   - Tile list is built into a VRT (memory file), a VRT input is used as it is
+*   - Tiles must share the cell size of the mosaic and be aligned to its cells
+*   - Exits if a tile can't be read or placed
+*/
+struct Mosaic *readMosaic(const char *inputpath, const char *outputdir) {
+    char **tilefps = mosaicTileList(inputpath);
+    const int count = CSLCount(tilefps);
+
+    if (count == 0) {
+        printf("No tiles found in: %s\nExiting.\n", inputpath);
+        exit(EXIT_FAILURE);
+    }
+
+    struct Mosaic *ret = calloc(1, sizeof(struct Mosaic));
+    ret->tiles = calloc(count, sizeof(struct MosaicTile));
+    ret->count = count;
+    pthread_mutex_init(&ret->lock, NULL);
+
+    GDALAllRegister();
+
+    // Mosaic grid:
+    GDALDatasetH dataset;
+    const size_t length = strlen(inputpath);
+    if (length > 4 && (strcmp(inputpath + length - 4, ".vrt") == 0 || strcmp(inputpath + length - 4, ".VRT") == 0)) {
+        ret->mosaicfp = calloc(length + 1, 1);
+        strcpy(ret->mosaicfp, inputpath);
+    }   else {
+        ret->mosaicfp = calloc(strlen(MOSAIC_MEMORY_PATH) + 1, 1);
+        strcpy(ret->mosaicfp, MOSAIC_MEMORY_PATH);
+
+        dataset = GDALBuildVRT(ret->mosaicfp, count, NULL, (const char *const *)tilefps, NULL, NULL);
+        if (dataset == NULL) {
+            printf("Mosaic of the tiles can't be built: %s\nExiting.\n", CPLGetLastErrorMsg());
+            exit(EXIT_FAILURE);
+        }
+        GDALClose(dataset);
+    }
+
+    dataset = GDALOpen(ret->mosaicfp, GA_ReadOnly);
+    if (dataset == NULL) {
+        printf("File read error. Recheck file path.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    double mosaicgt[6];
+    GDALGetGeoTransform(dataset, mosaicgt);
+    const int mosaic_cols = GDALGetRasterXSize(dataset);
+    const int mosaic_rows = GDALGetRasterYSize(dataset);
+    GDALClose(dataset);
+
+    // Tiles:
+    for (int i = 0; i < count; i++) {
+        struct MosaicTile *tile = &ret->tiles[i];
+
+        dataset = GDALOpen(tilefps[i], GA_ReadOnly);
+        if (dataset == NULL) {
+            printf("File read error: %s\nExiting.\n", tilefps[i]);
+            exit(EXIT_FAILURE);
+        }
+        GDALGetGeoTransform(dataset, tile->geotransform);
+        tile->cols = GDALGetRasterXSize(dataset);
+        tile->rows = GDALGetRasterYSize(dataset);
+        GDALClose(dataset);
+
+        const double col = (tile->geotransform[0] - mosaicgt[0]) / mosaicgt[1];
+        const double row = (tile->geotransform[3] - mosaicgt[3]) / mosaicgt[5];
+        tile->first_col = (int)round(col);
+        tile->first_row = (int)round(row);
+
+        if (fabs(tile->geotransform[1] - mosaicgt[1]) > EPSILON * fabs(mosaicgt[1]) || fabs(tile->geotransform[5] - mosaicgt[5]) > EPSILON * fabs(mosaicgt[5])
+            || fabs(tile->geotransform[2]) > EPSILON || fabs(tile->geotransform[4]) > EPSILON
+            || fabs(col - tile->first_col) > 0.01 || fabs(row - tile->first_row) > 0.01
+            || tile->first_col < 0 || tile->first_row < 0 || tile->first_col + tile->cols > mosaic_cols || tile->first_row + tile->rows > mosaic_rows) {
+            printf("Tile is not aligned to the mosaic grid (cell size and cell edges must match): %s\nExiting.\n", tilefps[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        tile->inputfp = calloc(strlen(tilefps[i]) + 1, 1);
+        strcpy(tile->inputfp, tilefps[i]);
+
+        // Output: tile file name as GeoTIFF in output directory:
+        const char *filename = CPLGetFilename(tilefps[i]);
+        const char *extension = strrchr(filename, '.');
+        const int stem = (extension != NULL) ? (int)(extension - filename) : (int)strlen(filename);
+
+        tile->outputfp = calloc(strlen(outputdir) + stem + 6, 1);
+        sprintf(tile->outputfp, "%s/%.*s.tif", outputdir, stem, filename);
+
+        for (int j = 0; j < i; j++) {
+            if (strcmp(ret->tiles[j].outputfp, tile->outputfp) == 0) {
+                printf("Tiles %s and %s have the same output file name.\nExiting.\n", ret->tiles[j].inputfp, tile->inputfp);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    printf("Mosaic: %d tiles, %d x %d cells\n", count, mosaic_cols, mosaic_rows);
+    CSLDestroy(tilefps);
+
+    return ret;
+}
+
+
+/*
+*   Lists the tile files of a mosaic input
+*   - VRT: source files of the VRT
+*   - Other files: one tile path per line (empty lines and lines starting with # are skipped),
+*     relative paths are relative to the working directory
+*   - Returns a string list (CSLDestroy), exits if the input can't be read
+*/
+char **mosaicTileList(const char *inputpath) {
+    char **ret = NULL;
+    const size_t length = strlen(inputpath);
+
+    if (length > 4 && (strcmp(inputpath + length - 4, ".vrt") == 0 || strcmp(inputpath + length - 4, ".VRT") == 0)) {
+        GDALAllRegister();
+        GDALDatasetH dataset = GDALOpen(inputpath, GA_ReadOnly);
+        if (dataset == NULL) {
+            printf("File read error. Recheck file path.\nExiting.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // File list has the VRT itself first:
+        char **files = GDALGetFileList(dataset);
+        for (int i = 0; files != NULL && files[i] != NULL; i++) {
+            if (strcmp(CPLGetFilename(files[i]), CPLGetFilename(inputpath)) != 0) {
+                ret = CSLAddString(ret, files[i]);
+            }
+        }
+        CSLDestroy(files);
+        GDALClose(dataset);
+        return ret;
+    }
+
+    FILE *fp = fopen(inputpath, "r");
+    if (fp == NULL) {
+        printf("File read error. Recheck file path.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char cwd[1000];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        cwd[0] = '\0';
+    }
+
+    char line[1000];
+    char path[2002];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        // Trim whitespace from both ends:
+        char *start = line;
+        while (*start == ' ' || *start == '\t') {
+            start++;
+        }
+        char *end = start + strlen(start);
+        while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) {
+            *--end = '\0';
+        }
+        if (*start == '\0' || *start == '#') {
+            continue;
+        }
+
+        // Sources of the VRT are referenced with absolute paths:
+        if (*start != '/' && cwd[0] != '\0') {
+            snprintf(path, sizeof(path), "%s/%s", cwd, start);
+        }   else {
+            snprintf(path, sizeof(path), "%s", start);
+        }
+        ret = CSLAddString(ret, path);
+    }
+    fclose(fp);
+
+    return ret;
+}
+
+
+/*
+*   Dependency radius of a process chain starting from argv[i]: distance in cells
+*   from which input cells can change an output cell (sum over the steps)
+*/
+int chainHaloRadius(int argc, const char *argv[], int i) {
+    int ret = 0;
+
+    // Parameters of steps are not steps, their radius is 0:
+    for (; i < argc; i++) {
+        ret += stepHaloRadius(argc, argv, i);
+    }
+
+    return ret;
+}
+
+
+/*
+*   Dependency radius of a single process step at argv[i]
+*   - Shoal buffering (3 x 3 maximum): 1
+*   - Rolling Coin: 2 * radius (maximum over a coin, minimum over the coins on a cell)
+*   - Laplacian smoothing: 1 per iteration
+*   - Other steps: 0
+*/
+int stepHaloRadius(int argc, const char *argv[], int i) {
+    if (strcmp(argv[i], "-buffer") == 0) {
+        return 1;
+    }   else if (strcmp(argv[i], "-laplacian") == 0 && argc > i+1) {
+        return atoi(argv[i+1]);
+    }   else if (strcmp(argv[i], "-rollcoin") == 0 && argc > i+1) {
+        return 2 * atoi(argv[i+1]);
+    }
+
+    return 0;
+}
+
+
+/*
+*   Mosaic worker thread: processes tiles until all tiles are taken
+*   - Every worker reads the mosaic through its own dataset handle
+*   - Operator progress is not printed, one line is printed per finished tile
+*/
+void *mosaicWorker(void *arg) {
+    struct Mosaic *mosaic = arg;
+    GDALDatasetH dataset = GDALOpen(mosaic->mosaicfp, GA_ReadOnly);
+
+    progress.callback = ignoreProgress;
+    operatorThreads = 1;        // Tiles are the parallel work, operators run in this worker only
+
+    while (1) {
+        pthread_mutex_lock(&mosaic->lock);
+        const int index = mosaic->next++;
+        pthread_mutex_unlock(&mosaic->lock);
+
+        if (index >= mosaic->count) {
+            break;
+        }
+
+        struct MosaicTile *tile = &mosaic->tiles[index];
+        const char success = (dataset != NULL) ? processMosaicTile(mosaic, dataset, tile) : FALSE;
+
+        pthread_mutex_lock(&mosaic->lock);
+        mosaic->done++;
+        if (success == FALSE) {
+            mosaic->failed++;
+        }
+        printf("  Tile %d/%d: %s --> %s\n", mosaic->done, mosaic->count, tile->inputfp, (success == TRUE) ? tile->outputfp : "FAILED");
+        fflush(stdout);
+        pthread_mutex_unlock(&mosaic->lock);
+    }
+
+    if (dataset != NULL) {
+        GDALClose(dataset);
+    }
+
+    return NULL;
+}
+
+
+/*
+*   Processes a single tile: reads the tile and its halo from the mosaic, applies
+*   the process steps and writes the tile cells to the output file
+*   - Halo is clipped at the mosaic edges, where the whole mosaic has its edges too
+*   - Returns TRUE if the output was written
+*/
+char processMosaicTile(struct Mosaic *mosaic, GDALDatasetH dataset, struct MosaicTile *tile) {
+    const int mosaic_cols = GDALGetRasterXSize(dataset);
+    const int mosaic_rows = GDALGetRasterYSize(dataset);
+
+    // Tile window with halo:
+    const int first_col = (tile->first_col > mosaic->halo) ? tile->first_col - mosaic->halo : 0;
+    const int first_row = (tile->first_row > mosaic->halo) ? tile->first_row - mosaic->halo : 0;
+    const int last_col = (tile->first_col + tile->cols + mosaic->halo < mosaic_cols) ? tile->first_col + tile->cols + mosaic->halo : mosaic_cols;
+    const int last_row = (tile->first_row + tile->rows + mosaic->halo < mosaic_rows) ? tile->first_row + tile->rows + mosaic->halo : mosaic_rows;
+
+    struct FloatSurface *surf = inputDepthModelWindow(dataset, first_col, first_row, last_col - first_col, last_row - first_row);
+    if (surf == NULL) {
+        return FALSE;
+    }
+
+    for (int i = 4; i < mosaic->argc; i++) {
+        if (strcmp(mosaic->argv[i], "-compress") == 0) {
+            // Selected before workers were started:
+            i++;
+            continue;
+        }
+        i = applyProcessStep(surf, mosaic->argc, mosaic->argv, i);
+        if (i < 0) {
+            freeFloatSurface(surf);
+            return FALSE;
+        }
+    }
+
+    // Tile cells without the halo:
+    float **rows = calloc(tile->rows, sizeof(float *));
+    for (int row = 0; row < tile->rows; row++) {
+        rows[row] = surf->array[tile->first_row - first_row + row] + (tile->first_col - first_col);
+    }
+    struct FloatSurface core = {tile->inputfp, surf->projection, tile->geotransform, rows, surf->nodata, tile->rows, tile->cols};
+
+    const char ret = exportSurface(&core, tile->outputfp, NULL);
+
+    free(rows);
+    freeFloatSurface(surf);
+
+    return ret;
+}
+
+
+/*
+*   Frees all allocated memory of a mosaic, removes the memory file of a built VRT
+*/
+void freeMosaic(struct Mosaic *mosaic) {
+    if (strcmp(mosaic->mosaicfp, MOSAIC_MEMORY_PATH) == 0) {
+        VSIUnlink(MOSAIC_MEMORY_PATH);
+    }
+    for (int i = 0; i < mosaic->count; i++) {
+        free(mosaic->tiles[i].inputfp);
+        free(mosaic->tiles[i].outputfp);
+    }
+    pthread_mutex_destroy(&mosaic->lock);
+    free(mosaic->tiles);
+    free(mosaic->mosaicfp);
+    free(mosaic);
+}
@@ -0,0 +1,506 @@
+#define _GNU_SOURCE     // CPU affinity and anonymous / huge page mappings are not declared in strict C17
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Allocation of float** arrays (surfaces and scratch arrays of operators): cells are one
+*     contiguous block, rows are aligned to ROW_ALIGNMENT bytes, large arrays are memory
+*     mapped and backed by huge pages (transparent by default, explicit on request)
+*   - Row bands: parallel operators split rows into contiguous bands, one worker thread
+*     per band, bands wait for each other at a barrier between passes
+*   - NUMA placement: worker threads are pinned to the processors of a NUMA node (bands
+*     in row order over nodes), and new arrays are first touched (zeroed) in the same
+*     row bands, so every worker finds its rows in the memory of its own node
+*
+*   Placement can be changed with environment variables:
+*       BATHYTOOLS_HUGEPAGES = off / transparent / explicit (explicit needs reserved huge pages, vm.nr_hugepages)
+*       BATHYTOOLS_NUMA = off (arrays are first touched by the allocating thread, workers are not pinned)
+*       BATHYTOOLS_THREADS = number of worker threads (row bands)
+*
+*   Array layout (row pointers are followed by the cells, row stride is a multiple of 16 floats):
+*
+*       [ArrayAllocation][row pointers]...[row 0 | pad][row 1 | pad] ... [row N-1 | pad]
+*/
+
+
+// Memory placement of new arrays (environment variables are applied when the topology is read):
+struct MemoryPlacement placement = {TRUE, TRUE, HUGEPAGES_TRANSPARENT};
+
+// Number of row bands of operators called from this thread, 0: one per processor (workerThreadCount)
+_Thread_local int operatorThreads = 0;
+
+static struct NumaTopology topology = {0};
+static pthread_once_t topologyRead = PTHREAD_ONCE_INIT;
+
+
+/*
+*   - Allocates memory for (2D) float** array of given size (cells are zero)
+*   - Rows are first touched in row bands, see placement
+*   - Returns a pointer to array, NULL if memory can't be allocated
+*/
+float** createFloatArray(const int cols, const int rows) {
+    return createFloatArrayBlock(cols, rows, 0, 0);
+}
+
+
+/*
+*   Allocates a float** array in a block with room for at least N bytes of cells and
+*   a header (allocation record and row pointers) of M bytes (scratch pool size classes)
+*   - Block can be laid out again for any array that fits in it, see layoutFloatArray
+*   - Cells of the array are zero, rows are first touched in row bands
+*   - Returns a pointer to array, NULL if memory can't be allocated
+*/
+float **createFloatArrayBlock(const int cols, const int rows, size_t cells, size_t header) {
+    const size_t stride = floatRowStride(cols);
+    const size_t used = (size_t)rows * stride * sizeof(float);          // Bytes of cells of the array
+    struct ArrayAllocation allocation = {NULL, 0, stride, FALSE, HUGEPAGES_OFF};
+    char *data = NULL;          // First cell
+
+    numaTopology();     // Placement is read from the environment on the first call
+
+    if (cells < used) {
+        cells = used;
+    }
+    if (header < sizeof(struct ArrayAllocation) + (size_t)rows * sizeof(float *)) {
+        header = sizeof(struct ArrayAllocation) + (size_t)rows * sizeof(float *);
+    }
+
+    if (cells >= HUGE_PAGE_SIZE) {
+        data = mapCells(header, cells, &allocation);
+    }
+    if (data == NULL) {
+        // Small arrays (or no mappings): rows are touched by this thread
+        const size_t offset = (header + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+        allocation.size = offset + cells;
+        allocation.base = aligned_alloc(ROW_ALIGNMENT, (allocation.size + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT);
+        if (allocation.base == NULL) {
+            return NULL;
+        }
+        data = (char *)allocation.base + offset;
+        memset(data, 0, used);
+    }
+
+    float **ret = layoutFloatArray(data, cols, rows, &allocation);
+
+    // Mapped pages are placed on first touch: worker of the row band (or this thread):
+    if (allocation.mapped == TRUE) {
+        struct BandOperands operands = {NULL, ret, 0, 0.0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+
+        if (placement.firsttouch == TRUE) {
+            runRowBands(rows, cols, touchRowBand, &operands);
+        }   else {
+            memset(data, 0, used);
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Lays out a float** array in an allocated block: allocation record and row pointers end at the first cell
+*   - Block must have room for them before data (see createFloatArrayBlock), cells are not changed
+*   - Returns a pointer to array
+*/
+float **layoutFloatArray(char *data, const int cols, const int rows, const struct ArrayAllocation *allocation) {
+    const size_t header = sizeof(struct ArrayAllocation) + (size_t)rows * sizeof(float *);
+    struct ArrayAllocation *record = (struct ArrayAllocation *)(data - header);     // See freeFloatArray
+
+    *record = *allocation;
+    record->stride = floatRowStride(cols);
+    float **ret = (float **)(record + 1);
+
+    for (int row = 0; row < rows; row++) {
+        ret[row] = (float *)data + (size_t)row * record->stride;
+    }
+
+    return ret;
+}
+
+
+/*
+*   Frees allocated memory of 2D float (float**) array made by createFloatArray
+*/
+void freeFloatArray(float **array, const int rows) {
+    (void)rows;     // Cells are one block, row count is not needed
+
+    if (array == NULL) {
+        return;
+    }
+
+    freeArrayAllocation((struct ArrayAllocation *)array - 1);
+}
+
+
+/*
+*   Frees the memory of an array allocation (record may be inside the memory)
+*/
+void freeArrayAllocation(const struct ArrayAllocation *allocation) {
+    void *base = allocation->base;
+    const size_t size = allocation->size;
+
+    if (allocation->mapped == TRUE) {
+        munmap(base, size);
+    }   else {
+        free(base);
+    }
+}
+
+
+/*
+*   Row stride of an array made by createFloatArray (floats from the start of a row to the next)
+*/
+size_t floatArrayStride(float **array) {
+    return ((struct ArrayAllocation *)array - 1)->stride;
+}
+
+
+/*
+*   Row stride of an array of N columns: rows are padded to ROW_ALIGNMENT bytes
+*/
+size_t floatRowStride(const int cols) {
+    return ((size_t)cols * sizeof(float) + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT / sizeof(float);
+}
+
+
+/*
+*   Maps memory for the header (allocation record and row pointers) and cells of an array
+*   - Cells start at a huge page boundary (transparent huge pages) or at the first
+*     ROW_ALIGNMENT boundary after the header (explicit huge pages, mapping is made of huge pages)
+*   - Pages are not touched, allocation is filled in
+*   - Returns a pointer to the first cell, NULL if memory can't be mapped
+*/
+char *mapCells(const size_t header, const size_t cells, struct ArrayAllocation *allocation) {
+    char *map = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (placement.hugepages == HUGEPAGES_EXPLICIT) {
+        const size_t offset = (header + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+        const size_t size = (offset + cells + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+        // Fails if there are not enough reserved huge pages, transparent huge pages are used then:
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (map != MAP_FAILED) {
+            allocation->base = map;
+            allocation->size = size;
+            allocation->mapped = TRUE;
+            allocation->hugepages = HUGEPAGES_EXPLICIT;
+            return map + offset;
+        }
+    }
+#endif
+
+    // Cells start at the first huge page boundary after the header:
+    const size_t size = header + HUGE_PAGE_SIZE + cells;
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    char *data = (char *)(((uintptr_t)map + header + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+    allocation->base = map;
+    allocation->size = size;
+    allocation->mapped = TRUE;
+    allocation->hugepages = HUGEPAGES_OFF;
+
+#ifdef MADV_HUGEPAGE
+    if (placement.hugepages != HUGEPAGES_OFF) {
+        if (madvise(data, cells / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE, MADV_HUGEPAGE) == 0) {
+            allocation->hugepages = HUGEPAGES_TRANSPARENT;
+        }
+    }   else {
+        madvise(data, cells / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE, MADV_NOHUGEPAGE);
+    }
+#endif
+
+    return data;
+}
+
+
+/*
+*   Row band operator of createFloatArray: first touch (zero) the rows of the band
+*/
+void touchRowBand(struct RowBand *band) {
+    float **array = band->operands->temp;
+    const size_t stride = floatArrayStride(array);
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        memset(array[row], 0, stride * sizeof(float));
+    }
+}
+
+
+/*
+*   Runs an operator in parallel row bands of a surface (rows x cols), returns when all bands are done
+*   - One worker thread per band (see rowBandCount), small surfaces are one band run by the calling thread
+*   - Band 0 reports progress of the calling thread, other bands report nothing
+*/
+void runRowBands(const int rows, const int cols, void (*operator)(struct RowBand *), struct BandOperands *operands) {
+    int count = rowBandCount(rows, cols);
+    struct BandBarrier barrier = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0, FALSE};
+
+    if (count == 1) {
+        struct RowBand band = {0, 1, 0, rows, &barrier, operator, operands, progress};
+        operator(&band);
+        return;
+    }
+
+    struct RowBand *bands = calloc(count, sizeof(struct RowBand));
+    pthread_t *workers = calloc(count, sizeof(pthread_t));
+    int started = 0;
+
+    for (int i = 0; i < count; i++) {
+        bands[started] = (struct RowBand){started, count, 0, 0, &barrier, operator, operands, progress};
+        if (pthread_create(&workers[started], NULL, rowBandWorker, &bands[started]) == 0) {
+            started++;
+        }
+    }
+
+    // Workers wait for the bands, rows are split over the workers that were started:
+    pthread_mutex_lock(&barrier.lock);
+    for (int i = 0; i < started; i++) {
+        bands[i].count = started;
+        bands[i].first_row = rowBandFirstRow(rows, started, i);
+        bands[i].last_row = rowBandFirstRow(rows, started, i + 1);
+    }
+    barrier.count = started;
+    barrier.started = TRUE;
+    pthread_cond_broadcast(&barrier.released);
+    pthread_mutex_unlock(&barrier.lock);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    // No worker could be started:
+    if (started == 0) {
+        struct RowBand band = {0, 1, 0, rows, &barrier, operator, operands, progress};
+        operator(&band);
+    }
+
+    pthread_mutex_destroy(&barrier.lock);
+    pthread_cond_destroy(&barrier.released);
+    free(workers);
+    free(bands);
+}
+
+
+/*
+*   Worker thread of a row band: waits until all workers are started, pins itself
+*   to the NUMA node of the band and runs the operator
+*/
+void *rowBandWorker(void *arg) {
+    struct RowBand *band = arg;
+    struct BandBarrier *barrier = band->barrier;
+
+    pthread_mutex_lock(&barrier->lock);
+    while (barrier->started == FALSE) {
+        pthread_cond_wait(&barrier->released, &barrier->lock);
+    }
+    pthread_mutex_unlock(&barrier->lock);
+
+    pinToNumaNode(band->index, band->count);
+    operatorThreads = 1;        // Operator runs in this band only
+
+    progress = band->progress;
+    if (band->index != 0) {
+        progress.callback = ignoreProgress;
+    }
+
+    band->operator(band);
+    return NULL;
+}
+
+
+/*
+*   Waits until all bands of an operator have reached the barrier (between passes over rows)
+*/
+void waitRowBands(struct RowBand *band) {
+    struct BandBarrier *barrier = band->barrier;
+
+    if (band->count < 2) {
+        return;
+    }
+
+    pthread_mutex_lock(&barrier->lock);
+    const unsigned int generation = barrier->generation;
+
+    if (++barrier->waiting == barrier->count) {
+        barrier->waiting = 0;
+        barrier->generation++;
+        pthread_cond_broadcast(&barrier->released);
+    }   else {
+        while (generation == barrier->generation) {
+            pthread_cond_wait(&barrier->released, &barrier->lock);
+        }
+    }
+    pthread_mutex_unlock(&barrier->lock);
+}
+
+
+/*
+*   Number of row bands of a surface: one per worker thread (operatorThreads or workerThreadCount),
+*   at least MIN_BAND_ROWS rows per band, surfaces under MIN_BAND_CELLS cells are one band
+*/
+int rowBandCount(const int rows, const int cols) {
+    int ret = (operatorThreads > 0) ? operatorThreads : workerThreadCount();
+
+    if ((size_t)rows * cols < MIN_BAND_CELLS) {
+        return 1;
+    }
+    if (ret > rows / MIN_BAND_ROWS) {
+        ret = rows / MIN_BAND_ROWS;
+    }
+
+    return (ret > 1) ? ret : 1;
+}
+
+
+/*
+*   First row of band index (of count bands), index == count gives the row count
+*/
+int rowBandFirstRow(const int rows, const int count, const int index) {
+    return (int)((long long)rows * index / count);
+}
+
+
+/*
+*   Pins the calling thread to the processors of the NUMA node of a band
+*   - Bands are spread over nodes in row order (band index * nodes / bands)
+*   - Nothing is done on single node machines or if pinning is off
+*/
+void pinToNumaNode(const int index, const int count) {
+#ifdef __linux__
+    const struct NumaTopology *numa = numaTopology();
+
+    if (placement.pin == FALSE || numa->nodes < 2) {
+        return;
+    }
+
+    const int node = (int)((long long)index * numa->nodes / count);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+
+    for (int i = 0; i < numa->counts[node]; i++) {
+        CPU_SET(numa->cpus[node][i], &cpus);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+    (void)index;
+    (void)count;
+#endif
+}
+
+
+/*
+*   NUMA topology of the machine (read once, see readNumaTopology)
+*/
+const struct NumaTopology *numaTopology(void) {
+    pthread_once(&topologyRead, readNumaTopology);
+    return &topology;
+}
+
+
+/*
+*   Reads NUMA nodes and their processors (Linux sysfs), applies placement environment variables
+*   - Machines without NUMA information are one node
+*/
+void readNumaTopology(void) {
+    char path[128];
+    char list[4096];
+
+    for (int node = 0; node < MAX_NUMA_NODES && topology.nodes < MAX_NUMA_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *fp = fopen(path, "r");
+
+        if (fp == NULL) {
+            continue;       // Node numbers may have gaps
+        }
+        if (fgets(list, sizeof(list), fp) != NULL) {
+            int *cpus = calloc(MAX_NUMA_CPUS, sizeof(int));
+            const int count = parseCpuList(list, cpus, MAX_NUMA_CPUS);
+
+            if (count > 0) {        // Memory only nodes have no processors
+                topology.cpus[topology.nodes] = cpus;
+                topology.counts[topology.nodes] = count;
+                topology.nodes++;
+            }   else {
+                free(cpus);
+            }
+        }
+        fclose(fp);
+    }
+
+    if (topology.nodes == 0) {
+        topology.nodes = 1;
+    }
+
+    const char *hugepages = getenv("BATHYTOOLS_HUGEPAGES");
+    if (hugepages != NULL) {
+        placement.hugepages = hugePageMode(hugepages);
+    }
+    const char *numa = getenv("BATHYTOOLS_NUMA");
+    if (numa != NULL && strcmp(numa, "off") == 0) {
+        placement.firsttouch = FALSE;
+        placement.pin = FALSE;
+    }
+}
+
+
+/*
+*   Parses a Linux CPU list (e.g. "0-7,16-23"), processors are saved to a list passed as a parameter
+*   - Returns number of processors
+*/
+int parseCpuList(const char *list, int *cpus, const int maxcount) {
+    int count = 0;
+    const char *p = list;
+
+    while (*p >= '0' && *p <= '9') {
+        char *end;
+        const long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && count < maxcount; cpu++) {
+            cpus[count++] = (int)cpu;
+        }
+
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    return count;
+}
+
+
+/*
+*   Huge page mode of a name: off, transparent or explicit (unknown names: transparent)
+*/
+char hugePageMode(const char *name) {
+    if (strcmp(name, "off") == 0) {
+        return HUGEPAGES_OFF;
+    }   else if (strcmp(name, "explicit") == 0) {
+        return HUGEPAGES_EXPLICIT;
+    }
+
+    return HUGEPAGES_TRANSPARENT;
+}
+
+
+/*
+*   Number of worker threads: processors online, or environment variable BATHYTOOLS_THREADS
+*/
+int workerThreadCount(void) {
+    const char *forced = getenv("BATHYTOOLS_THREADS");
+    long count = (forced != NULL) ? atol(forced) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (count < 1) {
+        count = 1;
+    }   else if (count > 256) {
+        count = 256;
+    }
+
+    return (int)count;
+}
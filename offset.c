@@ -4,31 +4,201 @@
 *   This file contains:
 *   - Surface vertical offset function
 *   - Offset is defined as a local addition of offset value to cell value
+*   - Separation surface offset: a spatially varying offset (e.g. chart datum separation
+*     model) from a separate, usually coarse raster, sampled bilinearly at every cell
 *   - Skips all NoData cells, affects only cells with data
 */
 
 
 /*
 *   Offset
+*   - Rows are offset in parallel row bands
 */
 void offset(struct FloatSurface *src, const float offset) {
-    printf("Offsetting surface..");
-    fflush(stdout);
-    float nodata = src->nodata;
-    float depth;
-
-    // Iterate over cells and offset surface:
-    for (int row = 0; row < src->rows; row++) {
-        for (int col = 0; col < src->cols; col++) {
-            // Only update cells that are not NoData:
-            if (fabs(src->array[row][col] - nodata) < EPSILON) {
-                continue;
-            } 
-            depth = src->array[row][col] + offset;
-            src->array[row][col] = depth;
+    printStepStart("Offsetting surface");
+    struct BandOperands operands = {src, NULL, 0, offset, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+
+    runRowBands(src->rows, src->cols, offsetBand, &operands);
+
+    printStepDone();
+}
+
+
+/*
+*   Offsets the rows of a row band (only cells that are not NoData)
+*/
+void offsetBand(struct RowBand *band) {
+    struct FloatSurface *src = band->operands->src;
+    const float nodata = src->nodata;
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        simd.offsetRow(src->array[row], src->cols, band->operands->value, nodata);
+    }
+}
+
+
+/*
+*   Checks a separation surface before processing: raster can be opened and isn't rotated
+*   - Returns TRUE if the separation surface can be used
+*/
+char checkSeparationSurface(const char *path) {
+    GDALAllRegister();
+    const char *readpath = inputFilePath(path);
+    GDALDatasetH dataset = (readpath != NULL) ? GDALOpen(readpath, GA_ReadOnly) : NULL;
+    double gt[6];
+
+    if (dataset == NULL) {
+        return FALSE;
+    }
+
+    const char ret = (GDALGetRasterCount(dataset) > 0 && GDALGetGeoTransform(dataset, gt) == CE_None
+                      && fabs(gt[2]) < EPSILON && fabs(gt[4]) < EPSILON) ? TRUE : FALSE;
+    GDALClose(dataset);
+
+    return ret;
+}
+
+
+/*
+*   Reads a separation surface for a surface (e.g. chart datum separation model, single band, any resolution)
+*   - Returns pointer to FloatSurface, NULL if it can't be read, either grid is rotated
+*     or the coordinate systems differ (cells outside the separation would become nodata)
+*/
+struct FloatSurface *readSeparationSurface(const char *path, const struct FloatSurface *surf) {
+    const char *readpath = inputFilePath(path);
+    GDALDatasetH dataset = (readpath != NULL) ? GDALOpen(readpath, GA_ReadOnly) : NULL;
+
+    if (dataset == NULL || fabs(surf->geotransform[2]) > EPSILON || fabs(surf->geotransform[4]) > EPSILON) {
+        if (dataset != NULL) {
+            GDALClose(dataset);
         }
+        return NULL;
+    }
+
+    struct FloatSurface *ret = inputDepthModelWindow(dataset, 0, 0, GDALGetRasterXSize(dataset), GDALGetRasterYSize(dataset));
+    GDALClose(dataset);
+
+    if (ret != NULL && (fabs(ret->geotransform[2]) > EPSILON || fabs(ret->geotransform[4]) > EPSILON)) {
+        freeFloatSurface(ret);
+        return NULL;
+    }
+
+    // Coordinate systems are compared if both are known (as area of interest, see openAoi):
+    if (ret != NULL && ret->projection[0] != '\0' && surf->projection != NULL && surf->projection[0] != '\0') {
+        OGRSpatialReferenceH separationsrs = OSRNewSpatialReference(ret->projection);
+        OGRSpatialReferenceH surfacesrs = OSRNewSpatialReference(surf->projection);
+        const int same = (separationsrs != NULL && surfacesrs != NULL) ? OSRIsSame(separationsrs, surfacesrs) : FALSE;
+        OSRRelease(separationsrs);
+        OSRRelease(surfacesrs);
+
+        if (same == FALSE) {
+            freeFloatSurface(ret);
+            return NULL;
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Separation surface offset: separation is sampled bilinearly at every cell centre
+*   (in the geotransform of the surface) and added to cells with data, then the constant offset
+*   - Surface and separation surface must not be rotated and must share the coordinate system (see readSeparationSurface)
+*   - Sampling is done on the fly, row by row (no resampled surface size grid)
+*   - Nodata cells of the separation surface have no weight, cells without separation
+*     (outside the separation surface or no data around them) become NoData
+*   - Separation is clamped to the outermost cell centres within the extent of the grid
+*   - Constant offset of a following -offset step is added in the same pass (-0.0: none)
+*   - Rows are offset in parallel row bands
+*/
+void offsetGrid(struct FloatSurface *src, const struct FloatSurface *separation, const float offset) {
+    printStepStart((fabs(offset) > 0.0f) ? "Offsetting surface with separation surface and constant" : "Offsetting surface with separation surface");
+
+    // Grid columns of the surface columns are the same on every row:
+    struct SeparationSampling sampling = {separation, malloc(src->cols * sizeof(int)), malloc(src->cols * sizeof(float))};
+    const double *gt = src->geotransform;
+    const double *sgt = separation->geotransform;
+
+    for (int col = 0; col < src->cols; col++) {
+        const double x = gt[0] + (col + 0.5) * gt[1];
+        separationCoordinate((x - sgt[0]) / sgt[1] - 0.5, separation->cols, &sampling.index[col], &sampling.weight[col]);
+    }
+
+    struct BandOperands operands = {src, NULL, 0, offset, NULL, &sampling, NULL, NULL, NULL, NULL, NULL, NULL};
+    runRowBands(src->rows, src->cols, offsetGridBand, &operands);
+
+    free(sampling.index);
+    free(sampling.weight);
+    printStepDone();
+}
+
+
+/*
+*   Offsets the rows of a row band with the separation surface (only cells that are not NoData)
+*   - Two grid rows are blended per surface row, grid columns are blended by the row kernel
+*/
+void offsetGridBand(struct RowBand *band) {
+    struct FloatSurface *src = band->operands->src;
+    const struct SeparationSampling *sampling = band->operands->separation;
+    const struct FloatSurface *grid = sampling->grid;
+    const double *gt = src->geotransform;
+    const double *sgt = grid->geotransform;
+    const float nodata = grid->nodata;
+
+    // Blended row and its weights, two cells of zero weight after it (outside the grid):
+    float *sum = calloc(grid->cols + 2, sizeof(float));
+    float *weightsum = calloc(grid->cols + 2, sizeof(float));
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        const double y = gt[3] + (row + 0.5) * gt[5];
+        int top;
+        float weight;
+
+        if (separationCoordinate((y - sgt[3]) / sgt[5] - 0.5, grid->rows, &top, &weight) == FALSE) {
+            memset(sum, 0, grid->cols * sizeof(float));
+            memset(weightsum, 0, grid->cols * sizeof(float));
+        }   else {
+            const float *above = grid->array[top];
+            const float *below = grid->array[(top + 1 < grid->rows) ? top + 1 : top];
+
+            for (int col = 0; col < grid->cols; col++) {
+                const float a = (fabs(above[col] - nodata) > EPSILON) ? 1.0f - weight : 0.0f;
+                const float b = (fabs(below[col] - nodata) > EPSILON) ? weight : 0.0f;
+                sum[col] = ((a > 0.0f) ? above[col] * a : 0.0f) + ((b > 0.0f) ? below[col] * b : 0.0f);
+                weightsum[col] = a + b;
+            }
+        }
+
+        simd.offsetGridRow(src->array[row], src->cols, sampling->index, sampling->weight, sum, weightsum, band->operands->value, src->nodata);
+    }
+
+    free(sum);
+    free(weightsum);
+}
+
+
+/*
+*   Grid cell of a position along one axis (in grid cells from the first cell centre)
+*   - Index is the first of the two cells around the position, weight that of the second
+*   - Positions between the extent and the outermost cell centres are clamped to them
+*   - Returns FALSE if the position is outside the grid (index is set to cells, weight to 0)
+*/
+char separationCoordinate(const double position, const int cells, int *index, float *weight) {
+    if (!(position >= -0.5 && position <= cells - 0.5)) {
+        *index = cells;
+        *weight = 0.0f;
+        return FALSE;
+    }
+
+    const double clamped = (position < 0.0) ? 0.0 : ((position > cells - 1) ? cells - 1 : position);
+    *index = (int)floor(clamped);
+    if (*index >= cells - 1) {
+        *index = cells - 1;
+        *weight = 0.0f;
+    }   else {
+        *weight = (float)(clamped - *index);
     }
 
-    printf("Done\n");
-    fflush(stdout);
+    return TRUE;
 }
@@ -0,0 +1,253 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Statistics of output surfaces, computed while the surface is written (no second
+*     pass over the file): valid cell count, minimum, maximum, mean, standard deviation
+*     and a depth histogram
+*   - Row bands of the write keep partial statistics of their own, partials are merged
+*     when the bands are done (moments with the parallel variance formula)
+*   - Histogram is counted in bins of 1 / STATISTICS_BINS_PER_METRE m, neighbouring bins
+*     are merged until at most STATISTICS_MAX_BUCKETS buckets are left (counts are exact)
+*   - Statistics are stored as GDAL band statistics (STATISTICS_* metadata) and default
+*     histogram, so gdalinfo -stats -hist reports them without reading the cells
+*   - Outputs patched in place (incremental mode, -patch) get their statistics
+*     recomputed from the written band, stale statistics of the old cells are replaced
+*   - Optionally printed as a JSON line (-stats)
+*/
+
+
+// Depths are clamped to +-STATISTICS_DEPTH_LIMIT m in the histogram (junk values don't grow it without bounds):
+#define STATISTICS_DEPTH_LIMIT 20000.0
+
+// Rows read at a time when statistics are recomputed from a written band:
+#define STATISTICS_READ_ROWS 256
+
+// Print statistics of written outputs as JSON:
+static char printing = FALSE;
+
+
+/*
+*   Adds the cells with data of consecutive rows (cells of rows x cols) to statistics
+*   - Sums are taken from the first cell with data (numerically stable variance)
+*/
+void accumulateStatisticsRows(struct SurfaceStatistics *stats, const float *cells, const int rows, const int cols, const float nodata) {
+    struct SurfaceStatistics chunk = {0, HUGE_VAL, -HUGE_VAL, 0.0, 0.0, 0, 1, 0, NULL};
+    double shift = 0.0;
+    double sum = 0.0;
+    double sumsq = 0.0;
+
+    for (size_t i = 0; i < (size_t)rows * cols; i++) {
+        const float z = cells[i];
+        if (fabs(z - nodata) < EPSILON || isnan(z)) {
+            continue;
+        }
+        if (chunk.count == 0) {
+            shift = z;
+        }
+        const double d = z - shift;
+        sum += d;
+        sumsq += d * d;
+        chunk.count++;
+        chunk.min = (z < chunk.min) ? z : chunk.min;
+        chunk.max = (z > chunk.max) ? z : chunk.max;
+
+        // Bin without floor() (truncation corrected below zero), histogram grows only for new bins:
+        const double scaled = fmax(fmin(z, STATISTICS_DEPTH_LIMIT), -STATISTICS_DEPTH_LIMIT) * STATISTICS_BINS_PER_METRE;
+        const int64_t bin = (int64_t)scaled - ((scaled < (int64_t)scaled) ? 1 : 0);
+        const uint64_t bucket = (uint64_t)(bin - stats->first_bin);
+        if (bucket < (uint64_t)stats->buckets) {
+            stats->histogram[bucket]++;
+        }   else {
+            addHistogramBin(stats, bin);
+        }
+    }
+
+    if (chunk.count > 0) {
+        chunk.mean = shift + sum / chunk.count;
+        chunk.m2 = fmax(sumsq - sum * sum / chunk.count, 0.0);
+        mergeStatistics(stats, &chunk);
+    }
+}
+
+
+/*
+*   Counts a cell in a histogram bin (histogram of single bins, grows to hold the bin)
+*/
+void addHistogramBin(struct SurfaceStatistics *stats, const int64_t bin) {
+    if (stats->buckets == 0 || bin < stats->first_bin || bin >= stats->first_bin + stats->buckets) {
+        // New range holds the old one and the bin, with as much room again around it:
+        const int64_t first = (stats->buckets == 0 || bin < stats->first_bin) ? bin : stats->first_bin;
+        const int64_t last = (stats->buckets == 0 || bin >= stats->first_bin + stats->buckets) ? bin : stats->first_bin + stats->buckets - 1;
+        const int64_t buckets = 2 * (last - first + 1) + 64;
+        const int64_t new_first = first - (buckets - (last - first + 1)) / 2;
+        GUIntBig *histogram = calloc(buckets, sizeof(GUIntBig));
+
+        if (stats->buckets > 0) {
+            memcpy(&histogram[stats->first_bin - new_first], stats->histogram, stats->buckets * sizeof(GUIntBig));
+        }
+        free(stats->histogram);
+        stats->histogram = histogram;
+        stats->first_bin = new_first;
+        stats->buckets = (int)buckets;
+    }
+
+    stats->histogram[bin - stats->first_bin]++;
+}
+
+
+/*
+*   Merges statistics of a band (or a chunk of rows) into statistics
+*   - Histograms must have single bins (before limitHistogramBuckets)
+*/
+void mergeStatistics(struct SurfaceStatistics *stats, struct SurfaceStatistics *band) {
+    if (band->count > 0) {
+        const double total = (double)stats->count + band->count;
+        const double delta = band->mean - stats->mean;
+
+        stats->m2 += band->m2 + delta * delta * ((double)stats->count * band->count / total);
+        stats->mean += delta * (band->count / total);
+        stats->count += band->count;
+        stats->min = (band->min < stats->min) ? band->min : stats->min;
+        stats->max = (band->max > stats->max) ? band->max : stats->max;
+    }
+
+    // Bins of the band (the first and last grow the histogram to hold the whole range):
+    for (int i = 0; i < band->buckets; i++) {
+        if (band->histogram[i] > 0) {
+            addHistogramBin(stats, band->first_bin + i);
+            stats->histogram[band->first_bin + i - stats->first_bin] += band->histogram[i] - 1;
+        }
+    }
+}
+
+
+/*
+*   Trims empty buckets from the ends of the histogram and merges neighbouring
+*   buckets until there are at most STATISTICS_MAX_BUCKETS
+*/
+void limitHistogramBuckets(struct SurfaceStatistics *stats) {
+    int first = 0;
+    int last = stats->buckets - 1;
+
+    while (first <= last && stats->histogram[first] == 0) {
+        first++;
+    }
+    while (last >= first && stats->histogram[last] == 0) {
+        last--;
+    }
+
+    stats->first_bin += (int64_t)first * stats->bins;
+    stats->buckets = last - first + 1;
+    memmove(stats->histogram, &stats->histogram[first], stats->buckets * sizeof(GUIntBig));
+
+    while (stats->buckets > STATISTICS_MAX_BUCKETS) {
+        for (int i = 0; i < stats->buckets; i += 2) {
+            stats->histogram[i / 2] = stats->histogram[i] + ((i + 1 < stats->buckets) ? stats->histogram[i + 1] : 0);
+        }
+        stats->buckets = (stats->buckets + 1) / 2;
+        stats->bins *= 2;
+    }
+}
+
+
+/*
+*   Stores statistics as GDAL band statistics and default histogram of an output band
+*   - Surfaces without data cells get no statistics
+*/
+void storeStatistics(GDALRasterBandH band, const struct SurfaceStatistics *stats, const int rows, const int cols) {
+    if (stats->count == 0) {
+        return;
+    }
+
+    char percent[32];
+    snprintf(percent, sizeof(percent), "%.6g", 100.0 * stats->count / ((double)rows * cols));
+
+    GDALSetRasterStatistics(band, stats->min, stats->max, stats->mean, sqrt(stats->m2 / stats->count));
+    GDALSetMetadataItem(band, "STATISTICS_VALID_PERCENT", percent, NULL);
+    GDALSetDefaultHistogramEx(band, (double)stats->first_bin / STATISTICS_BINS_PER_METRE,
+                              (double)(stats->first_bin + (int64_t)stats->buckets * stats->bins) / STATISTICS_BINS_PER_METRE,
+                              stats->buckets, stats->histogram);
+}
+
+
+/*
+*   Recomputes statistics of a written output band from its cells and stores them
+*   - Band is read in blocks of STATISTICS_READ_ROWS rows
+*   - Old statistics are removed first (a patched band without data cells has none)
+*   - Statistics are returned in statistics, caller frees the histogram
+*   - Returns FALSE if the band can't be read (statistics are not stored)
+*/
+char recomputeStatistics(GDALRasterBandH band, struct SurfaceStatistics *statistics) {
+    const char *items[] = {"STATISTICS_MINIMUM", "STATISTICS_MAXIMUM", "STATISTICS_MEAN", "STATISTICS_STDDEV", "STATISTICS_VALID_PERCENT"};
+    const int rows = GDALGetRasterBandYSize(band);
+    const int cols = GDALGetRasterBandXSize(band);
+    int success;
+    const float nodata = (float)GDALGetRasterNoDataValue(band, &success);
+    float *cells = malloc((size_t)cols * STATISTICS_READ_ROWS * sizeof(float));
+
+    *statistics = (struct SurfaceStatistics){0, HUGE_VAL, -HUGE_VAL, 0.0, 0.0, 0, 1, 0, NULL};
+    if (cells == NULL) {
+        return FALSE;
+    }
+
+    for (int row = 0; row < rows; row += STATISTICS_READ_ROWS) {
+        const int count = (rows - row < STATISTICS_READ_ROWS) ? rows - row : STATISTICS_READ_ROWS;
+
+        if (GDALRasterIO(band, GF_Read, 0, row, cols, count, cells, cols, count, GDT_Float32, 0, 0) != CE_None) {
+            free(cells);
+            return FALSE;
+        }
+        accumulateStatisticsRows(statistics, cells, count, cols, nodata);
+    }
+    free(cells);
+
+    for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); i++) {
+        GDALSetMetadataItem(band, items[i], NULL, NULL);
+    }
+    if (statistics->count > 0) {
+        limitHistogramBuckets(statistics);
+    }
+    storeStatistics(band, statistics, rows, cols);
+    return TRUE;
+}
+
+
+/*
+*   Prints statistics of an output as a JSON line (file, count, min, max, mean, stddev, histogram)
+*/
+void printStatisticsJson(const struct SurfaceStatistics *stats, const char *outputfp) {
+    printf("{\"file\": \"");
+    for (const char *c = outputfp; *c != '\0'; c++) {
+        printf((*c == '"' || *c == '\\') ? "\\%c" : "%c", *c);
+    }
+    printf("\", \"count\": %llu", (unsigned long long)stats->count);
+
+    if (stats->count > 0) {
+        printf(", \"min\": %.6f, \"max\": %.6f, \"mean\": %.6f, \"stddev\": %.6f", stats->min, stats->max, stats->mean, sqrt(stats->m2 / stats->count));
+        printf(", \"histogram\": {\"min\": %.6f, \"max\": %.6f, \"buckets\": [", (double)stats->first_bin / STATISTICS_BINS_PER_METRE,
+               (double)(stats->first_bin + (int64_t)stats->buckets * stats->bins) / STATISTICS_BINS_PER_METRE);
+        for (int i = 0; i < stats->buckets; i++) {
+            printf((i == 0) ? "%llu" : ", %llu", (unsigned long long)stats->histogram[i]);
+        }
+        printf("]}");
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+
+/*
+*   Selects printing of output statistics as JSON (statistics are always stored in the output)
+*/
+void setStatisticsPrinting(const char enabled) {
+    printing = enabled;
+}
+
+
+/*
+*   Returns TRUE if output statistics are printed as JSON
+*/
+char statisticsPrinting(void) {
+    return printing;
+}
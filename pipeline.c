@@ -0,0 +1,301 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Pipeline file functions: several products from one input surface
+*   - Pipeline is a tree (DAG) of stages, each stage is a chain of process
+*     steps applied to the result of its parent stage
+*   - Shared stages are computed only once, intermediate surfaces are freed
+*     as soon as nothing depends on them anymore
+*
+*   Pipeline file format (one definition per line, # starts a comment):
+*
+*       input  /data/survey.tif
+*       stage  coin10   input    -buffer -rollcoin 10 notrim
+*       stage  final    coin10   -laplacian 20 -offset 0.3
+*       output coin10   /data/survey_coin10.tif
+*       output final    /data/survey_final.tif
+*
+*   - Stage parameters: name, parent stage (or "input"), process steps (as in CLI)
+*   - Parent stage must be defined before its children
+*   - Output parameters: stage name (or "input"), output file path
+*/
+
+
+/*
+*   Runs a pipeline file.
+*   - Reads and checks the pipeline, exits if it is faulty
+*   - Opens the input surface, computes all stages and writes all outputs
+*/
+void runPipeline(const char *pipelinepath) {
+    // Streamed output: standard output is reserved for data before the pipeline is checked, messages go to standard error:
+    if (pipelineStreamsOutput(pipelinepath) == TRUE) {
+        reserveStdoutForOutput();
+    }
+
+    struct Pipeline *pipeline = readPipeline(pipelinepath);
+
+    // Open surface (stage 0 is the input):
+    pipeline->stages[0].surf = inputDepthModel(pipeline->inputfp);
+
+    // Compute stages depth first, starting from the input:
+    runPipelineStage(pipeline, 0);
+
+    freePipeline(pipeline);
+}
+
+
+/*
+*   Computes children of a stage whose surface is ready, recursively (depth first)
+*   - Writes outputs of the stage
+*   - Surface of the stage is handed over to its last child without copying,
+*     other children get a copy
+*/
+void runPipelineStage(struct Pipeline *pipeline, const int index) {
+    struct PipelineStage *stage = &pipeline->stages[index];
+
+    // Write outputs of this stage:
+    for (int i = 0; i < pipeline->outputcount; i++) {
+        if (pipeline->outputstages[i] == index) {
+            writeSurfaceToFile(stage->surf, pipeline->outputfps[i]);
+            stage->uses--;
+        }
+    }
+
+    // Compute children:
+    for (int child = index + 1; child < pipeline->count; child++) {
+        struct PipelineStage *next = &pipeline->stages[child];
+
+        if (next->parent != index) {
+            continue;
+        }
+
+        if (stage->uses == 1) {         // Last use: hand over surface
+            next->surf = stage->surf;
+            stage->surf = NULL;
+        }   else {
+            next->surf = copyFloatSurface(stage->surf);
+            if (next->surf == NULL) {
+                printf("Memory allocation failed: stage %s\nExiting.\n", next->name);
+                exit(EXIT_FAILURE);
+            }
+        }
+        stage->uses--;
+
+        printf("Stage %s:\n", next->name);
+        for (int i = 0; i < next->argc; i++) {
+            i = applyProcessStep(next->surf, next->argc, (const char **)next->argv, i);
+            if (i < 0) {
+                printf("Exiting.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        runPipelineStage(pipeline, child);
+    }
+
+    // Nothing depends on this stage anymore:
+    if (stage->surf != NULL) {
+        freeFloatSurface(stage->surf);
+        stage->surf = NULL;
+    }
+}
+
+
+/*
+*   Reads and checks a pipeline file
+*   - Allocates memory, returns a pointer to Pipeline
+*   - Prints the reason and exits if the pipeline is faulty
+*/
+struct Pipeline *readPipeline(const char *pipelinepath) {
+    FILE *fp = fopen(pipelinepath, "r");
+    char line[4096];
+    char *tokens[MAX_PIPELINE_TOKENS];
+    int linenumber = 0;
+
+    if (fp == NULL) {
+        printf("Pipeline file read error. Recheck file path.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct Pipeline *ret = calloc(1, sizeof(struct Pipeline));
+
+    // Stage 0 holds the input surface:
+    strcpy(ret->stages[0].name, "input");
+    ret->stages[0].parent = -1;
+    ret->count = 1;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int count = 0;
+        linenumber++;
+
+        // Remove comment and split line into tokens:
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        for (char *token = strtok(line, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n")) {
+            if (count == MAX_PIPELINE_TOKENS) {
+                pipelineError(linenumber, "too many parameters");
+            }
+            tokens[count++] = token;
+        }
+
+        if (count == 0) {                                               // Empty line
+            continue;
+
+        }   else if (strcmp(tokens[0], "input") == 0 && count == 2) {
+            if (ret->inputfp != NULL) {
+                pipelineError(linenumber, "only one input is allowed");
+            }
+            ret->inputfp = calloc(strlen(tokens[1]) + 1, 1);
+            strcpy(ret->inputfp, tokens[1]);
+
+        }   else if (strcmp(tokens[0], "stage") == 0 && count >= 4) {
+            struct PipelineStage *stage = &ret->stages[ret->count];
+
+            if (ret->count == MAX_PIPELINE_STAGES) {
+                pipelineError(linenumber, "too many stages");
+            }
+            if (strlen(tokens[1]) >= sizeof(stage->name) || findPipelineStage(ret, tokens[1]) >= 0) {
+                pipelineError(linenumber, "stage name is too long or already used");
+            }
+            stage->parent = findPipelineStage(ret, tokens[2]);
+            if (stage->parent < 0) {
+                pipelineError(linenumber, "parent stage must be defined before its children");
+            }
+            strcpy(stage->name, tokens[1]);
+
+            // Store process steps:
+            stage->argc = count - 3;
+            stage->argv = calloc(stage->argc, sizeof(char *));
+            for (int i = 0; i < stage->argc; i++) {
+                stage->argv[i] = calloc(strlen(tokens[i + 3]) + 1, 1);
+                strcpy(stage->argv[i], tokens[i + 3]);
+            }
+
+            // Check process steps:
+            printf("Stage %s (from %s):\n", stage->name, tokens[2]);
+            for (int i = 0; i < stage->argc; i++) {
+                const int last = checkProcessStep(stage->argc, (const char **)stage->argv, i);
+                if (last < 0 || strcmp(stage->argv[i], "-rollcoin-sweep") == 0 || strcmp(stage->argv[i], "-compact") == 0) {
+                    pipelineError(linenumber, "faulty process step");
+                }
+                i = last;
+            }
+
+            ret->stages[stage->parent].uses++;
+            ret->count++;
+
+        }   else if (strcmp(tokens[0], "output") == 0 && count == 3) {
+            const int index = findPipelineStage(ret, tokens[1]);
+
+            if (index < 0) {
+                pipelineError(linenumber, "unknown stage");
+            }
+            if (ret->outputcount == MAX_PIPELINE_STAGES) {
+                pipelineError(linenumber, "too many outputs");
+            }
+            ret->outputstages[ret->outputcount] = index;
+            ret->outputfps[ret->outputcount] = calloc(strlen(tokens[2]) + 1, 1);
+            strcpy(ret->outputfps[ret->outputcount], tokens[2]);
+            ret->stages[index].uses++;
+            ret->outputcount++;
+
+        }   else {
+            pipelineError(linenumber, "unknown definition");
+        }
+    }
+
+    fclose(fp);
+
+    if (ret->inputfp == NULL) {
+        pipelineError(linenumber, "input is not defined");
+    }
+
+    // Every stage must lead to an output:
+    for (int i = 0; i < ret->count; i++) {
+        if (ret->stages[i].uses == 0) {
+            printf("Pipeline error: stage %s is not used by any stage or output.\nExiting.\n", ret->stages[i].name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Checks if a pipeline file has a streamed output (/vsistdout/), without checking the pipeline
+*   - Output definitions are scanned before readPipeline prints anything
+*/
+char pipelineStreamsOutput(const char *pipelinepath) {
+    FILE *fp = fopen(pipelinepath, "r");
+    char line[4096];
+    char ret = FALSE;
+
+    if (fp == NULL) {
+        return FALSE;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        // Output definition: output [stage] [path]
+        const char *definition = strtok(line, " \t\r\n");
+        const char *stage = strtok(NULL, " \t\r\n");
+        const char *path = strtok(NULL, " \t\r\n");
+        if (definition != NULL && strcmp(definition, "output") == 0 && stage != NULL && path != NULL && isStreamedPath(path) == TRUE) {
+            ret = TRUE;
+        }
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+
+/*
+*   Returns the index of a named pipeline stage, -1 if not found
+*/
+int findPipelineStage(struct Pipeline *pipeline, const char *name) {
+    for (int i = 0; i < pipeline->count; i++) {
+        if (strcmp(pipeline->stages[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+/*
+*   Prints pipeline file error and exits
+*/
+void pipelineError(const int linenumber, const char *text) {
+    printf("Pipeline error on line %d: %s.\nExiting.\n", linenumber, text);
+    exit(EXIT_FAILURE);
+}
+
+
+/*
+*   Frees all allocated memory of parameter Pipeline
+*/
+void freePipeline(struct Pipeline *pipeline) {
+    for (int i = 0; i < pipeline->count; i++) {
+        for (int j = 0; j < pipeline->stages[i].argc; j++) {
+            free(pipeline->stages[i].argv[j]);
+        }
+        free(pipeline->stages[i].argv);
+    }
+
+    for (int i = 0; i < pipeline->outputcount; i++) {
+        free(pipeline->outputfps[i]);
+    }
+
+    free(pipeline->inputfp);
+    free(pipeline);
+}
@@ -0,0 +1,266 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Quick-look preview of a process chain: the chain is run on a surface decimated by
+*     a factor (cells of factor x factor input cells), so parameters can be tuned in seconds
+*   - Overview of the input with the same size is read if the input has one (GDAL overviews,
+*     resampled as they were built), otherwise the input is decimated while it is read:
+*     shoalest cell with data of each block, so the preview is never deeper than the input
+*   - Decimation strips are read and reduced by parallel workers (dataset handle of their own)
+*   - Parameters in cells are scaled to the coarser cells: coin radius / factor,
+*     Laplacian iterations / factor^2 (smoothing reaches about sqrt(iterations) cells)
+*
+*   Use example (preview at 1:8, the full run is the same command line without -preview):
+*
+*       surfacetools inputfile.tiff preview.tiff -preview 8 -buffer -rollcoin 13 notrim -laplacian 500
+*/
+
+
+/*
+*   Runs the process chain of the command line on a preview of the input, decimated by a factor
+*   - Chain is checked (see cli.c), -preview flag is skipped
+*/
+void runPreviewChain(int argc, const char *argv[], const int factor) {
+    struct FloatSurface *surf = inputPreviewDepthModel(argv[1], factor);
+    char **scaled = previewArguments(argc, argv, factor);
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-preview") == 0) {
+            i++;
+            continue;
+        }
+        i = applyProcessStep(surf, argc, (const char **)scaled, i);
+        if (i < 0) {
+            printf("Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    writeSurfaceToFile(surf, argv[2]);
+    freeFloatSurface(surf);
+
+    for (int i = 0; i < argc; i++) {
+        free(scaled[i]);
+    }
+    free(scaled);
+}
+
+
+/*
+*   Copies command line arguments with parameters in cells scaled to preview cells
+*   - Coin radii are divided by the factor, Laplacian iterations by factor^2 (at least 1)
+*   - Scaled parameters are printed
+*/
+char **previewArguments(int argc, const char *argv[], const int factor) {
+    char **scaled = calloc(argc, sizeof(char *));
+
+    for (int i = 0; i < argc; i++) {
+        scaled[i] = calloc(strlen(argv[i]) + 16, 1);
+        strcpy(scaled[i], argv[i]);
+    }
+
+    for (int i = 3; i < argc - 1; i++) {
+        if (strcmp(argv[i], "-rollcoin") == 0) {
+            const int radius = (int)lround((double)atoi(argv[i+1]) / factor);
+            snprintf(scaled[i+1], strlen(argv[i+1]) + 16, "%d", (radius > 1) ? radius : 1);
+            printf("Preview: -rollcoin r=%s cells (r=%d at full resolution)\n", scaled[i+1], atoi(argv[i+1]));
+        }   else if (strcmp(argv[i], "-laplacian") == 0) {
+            const int iterations = (int)lround((double)atoi(argv[i+1]) / ((double)factor * factor));
+            snprintf(scaled[i+1], strlen(argv[i+1]) + 16, "%d", (iterations > 1) ? iterations : 1);
+            printf("Preview: -laplacian %s iterations (%d at full resolution)\n", scaled[i+1], atoi(argv[i+1]));
+        }
+    }
+
+    return scaled;
+}
+
+
+/*
+*   Builds a preview surface of an input depth model, decimated by a factor
+*   - Size is rounded up (last blocks may be partial), cells are factor times larger
+*   - Overview of the same size is read if there is one, otherwise blocks are decimated
+*     to their shoalest cell with data (blocks without data are NoData)
+*   - Exits if the input can't be read (like inputDepthModel)
+*/
+struct FloatSurface *inputPreviewDepthModel(const char *path, const int factor) {
+    GDALAllRegister();
+    const char *readpath = inputFilePath(path);
+    GDALDatasetH dataset = (readpath != NULL) ? GDALOpen(readpath, GA_ReadOnly) : NULL;
+
+    if (dataset == NULL) {
+        printf("File read error. Recheck file path.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("File read successful. Building preview surface..");
+
+    GDALRasterBandH band = GDALGetRasterBand(dataset, 1);
+    const char *src_projection = GDALGetProjectionRef(dataset);
+    int success;
+
+    struct FloatSurface *ret = calloc(1, sizeof(struct FloatSurface));
+    ret->inputfp = calloc(strlen(path) + 1, 1);
+    strcpy(ret->inputfp, path);
+    ret->projection = calloc(strlen(src_projection) + 1, 1);
+    strcpy(ret->projection, src_projection);
+
+    ret->geotransform = calloc(6, sizeof(double));
+    GDALGetGeoTransform(dataset, ret->geotransform);
+    ret->geotransform[1] *= factor;
+    ret->geotransform[2] *= factor;
+    ret->geotransform[4] *= factor;
+    ret->geotransform[5] *= factor;
+
+    const int rows = GDALGetRasterBandYSize(band);
+    const int cols = GDALGetRasterBandXSize(band);
+    ret->nodata = GDALGetRasterNoDataValue(band, &success);
+    ret->rows = (rows + factor - 1) / factor;
+    ret->cols = (cols + factor - 1) / factor;
+    ret->array = createFloatArray(ret->cols, ret->rows);
+
+    char done = FALSE;
+    GDALRasterBandH overview = previewOverview(band, ret->rows, ret->cols);
+
+    if (overview != NULL) {
+        done = (GDALRasterIO(overview, GF_Read, 0, 0, ret->cols, ret->rows, ret->array[0], ret->cols, ret->rows, GDT_Float32,
+                             0, (int)(floatArrayStride(ret->array) * sizeof(float))) == CE_None) ? TRUE : FALSE;
+    }
+    if (done == FALSE) {
+        done = decimateBandParallel(readpath, ret, rows, cols, factor);
+    }
+
+    GDALClose(dataset);
+
+    if (done == FALSE) {
+        printf("An error occured when reading the input data file: %s\nExiting.\n", CPLGetLastErrorMsg());
+        exit(EXIT_FAILURE);
+    }
+    printf("Done (%s, %d x %d cells)\n", (overview != NULL) ? "overview" : "shoalest cells", ret->cols, ret->rows);
+
+    return ret;
+}
+
+
+/*
+*   Returns the overview of a band with the given size, NULL if there is none
+*/
+GDALRasterBandH previewOverview(GDALRasterBandH band, const int rows, const int cols) {
+    for (int i = 0; i < GDALGetOverviewCount(band); i++) {
+        GDALRasterBandH overview = GDALGetOverview(band, i);
+
+        if (overview != NULL && GDALGetRasterBandYSize(overview) == rows && GDALGetRasterBandXSize(overview) == cols) {
+            return overview;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+*   Decimates band 1 of an input into a preview surface, strips are read by parallel workers
+*   - Rows and cols: size of the input
+*   - Returns TRUE if all strips were read
+*/
+char decimateBandParallel(const char *path, struct FloatSurface *surf, const int rows, const int cols, const int factor) {
+    // Strips of preview rows, about MIN_READ_STRIP_ROWS input rows each:
+    const int striprows = (MIN_READ_STRIP_ROWS + factor - 1) / factor;
+    struct PreviewRead read = {path, surf, rows, cols, factor, striprows, 0, FALSE, PTHREAD_MUTEX_INITIALIZER};
+    const int strips = (surf->rows + striprows - 1) / striprows;
+    int threads = workerThreadCount();
+    int started = 0;
+
+    threads = (threads < strips) ? threads : strips;
+
+    if (threads > 1) {
+        pthread_t *workers = calloc(threads, sizeof(pthread_t));
+        for (int i = 0; i < threads; i++) {
+            if (pthread_create(&workers[started], NULL, decimateWorker, &read) == 0) {
+                started++;
+            }
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+    }
+    if (started == 0) {
+        decimateWorker(&read);
+    }
+    pthread_mutex_destroy(&read.lock);
+
+    return (read.failed == FALSE) ? TRUE : FALSE;
+}
+
+
+/*
+*   Decimation worker thread: opens its own dataset handle, reads strips of input rows
+*   and reduces them to preview rows until all strips are taken
+*   - Columns are reduced first over the rows of a block (shoalest of each column),
+*     then blocks of factor columns; NoData cells take no part
+*/
+void *decimateWorker(void *arg) {
+    struct PreviewRead *read = arg;
+    struct FloatSurface *surf = read->surf;
+    const float nodata = (float)surf->nodata;
+    GDALDatasetH dataset = GDALOpen(read->path, GA_ReadOnly);
+    GDALRasterBandH band = (dataset != NULL) ? GDALGetRasterBand(dataset, 1) : NULL;
+    float *strip = malloc((size_t)read->striprows * read->factor * read->cols * sizeof(float));
+    float *shoalest = malloc((size_t)read->cols * sizeof(float));
+
+    while (1) {
+        pthread_mutex_lock(&read->lock);
+        const int first_row = read->next * read->striprows;
+        read->next++;
+        pthread_mutex_unlock(&read->lock);
+
+        if (first_row >= surf->rows) {
+            break;
+        }
+
+        // Input rows of the strip (last block of the input may be partial):
+        const int last_row = (first_row + read->striprows < surf->rows) ? first_row + read->striprows : surf->rows;
+        const int input_first = first_row * read->factor;
+        const int input_rows = (last_row * read->factor < read->rows) ? (last_row - first_row) * read->factor : read->rows - input_first;
+
+        if (band == NULL || GDALRasterIO(band, GF_Read, 0, input_first, read->cols, input_rows, strip, read->cols, input_rows, GDT_Float32, 0, 0) != CE_None) {
+            pthread_mutex_lock(&read->lock);
+            read->failed = TRUE;
+            pthread_mutex_unlock(&read->lock);
+            continue;
+        }
+
+        for (int row = first_row; row < last_row; row++) {
+            const int block_first = (row - first_row) * read->factor;
+            const int block_rows = (block_first + read->factor < input_rows) ? read->factor : input_rows - block_first;
+
+            for (int col = 0; col < read->cols; col++) {
+                shoalest[col] = -HUGE_VALF;
+            }
+            for (int r = block_first; r < block_first + block_rows; r++) {
+                const float *cells = &strip[(size_t)r * read->cols];
+                for (int col = 0; col < read->cols; col++) {
+                    const float z = (fabs(cells[col] - nodata) < EPSILON) ? -HUGE_VALF : cells[col];
+                    shoalest[col] = (z > shoalest[col]) ? z : shoalest[col];
+                }
+            }
+
+            for (int col = 0; col < surf->cols; col++) {
+                const int last_col = ((col + 1) * read->factor < read->cols) ? (col + 1) * read->factor : read->cols;
+                float z = -HUGE_VALF;
+                for (int c = col * read->factor; c < last_col; c++) {
+                    z = (shoalest[c] > z) ? shoalest[c] : z;
+                }
+                surf->array[row][col] = (z > -HUGE_VALF) ? z : nodata;
+            }
+        }
+    }
+
+    free(shoalest);
+    free(strip);
+    if (dataset != NULL) {
+        GDALClose(dataset);
+    }
+
+    return NULL;
+}
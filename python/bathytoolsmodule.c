@@ -0,0 +1,264 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "libbathytools.h"
+
+/*
+*   This file contains:
+*   - Python extension module "bathytools" (see setup.py), built on the library API (libbathytools.h)
+*   - Operators work in place on 2D float32 arrays (NumPy arrays or any other object
+*     with the buffer protocol), data is never copied
+*   - GIL is released while an operator runs, so several arrays can be processed
+*     at the same time from a thread pool
+*
+*   Example:
+*
+*       import numpy, bathytools
+*       grid = numpy.ascontiguousarray(depths, dtype=numpy.float32)
+*       bathytools.max_filter_surface(grid, nodata=-9999.0)
+*       bathytools.coin_roll_surface(grid, 13, trim=False, nodata=-9999.0)
+*       bathytools.smooth_laplacian(grid, 10, nodata=-9999.0, geotransform=(0, 2.0, 0, 0, 0, -2.0))
+*       bathytools.offset(grid, 0.35, nodata=-9999.0)
+*/
+
+
+/*
+*   Builds a surface view on a writable 2D float32 buffer
+*   - Rows may be padded (row stride), cells of a row must be contiguous
+*   - Returns 0, or -1 with a Python exception set (buffer is released)
+*/
+static int getSurfaceView(PyObject *array, Py_buffer *buffer, struct BathySurfaceView *view, const double nodata, PyObject *geotransform) {
+    if (PyObject_GetBuffer(array, buffer, PyBUF_WRITABLE | PyBUF_STRIDES | PyBUF_FORMAT) != 0) {
+        return -1;
+    }
+
+    const char *format = (buffer->format != NULL) ? buffer->format : "B";
+    if (format[0] == '<' || format[0] == '=' || format[0] == '@') {
+        format++;
+    }
+
+    if (buffer->ndim != 2 || strcmp(format, "f") != 0 || buffer->itemsize != sizeof(float)) {
+        PyErr_SetString(PyExc_TypeError, "surface must be a 2D float32 array");
+        PyBuffer_Release(buffer);
+        return -1;
+    }
+    if (buffer->strides[1] != sizeof(float) || buffer->strides[0] < buffer->shape[1] * (Py_ssize_t)sizeof(float) || buffer->strides[0] % sizeof(float) != 0) {
+        PyErr_SetString(PyExc_ValueError, "surface rows must be C-contiguous (use numpy.ascontiguousarray)");
+        PyBuffer_Release(buffer);
+        return -1;
+    }
+    if (buffer->shape[0] > INT_MAX || buffer->shape[1] > INT_MAX) {
+        PyErr_SetString(PyExc_ValueError, "surface is too large");
+        PyBuffer_Release(buffer);
+        return -1;
+    }
+
+    view->data = buffer->buf;
+    view->rows = (int)buffer->shape[0];
+    view->cols = (int)buffer->shape[1];
+    view->stride = buffer->strides[0] / (Py_ssize_t)sizeof(float);
+    view->nodata = nodata;
+
+    // Cell sizes are needed only by Laplacian smoothing, default 1 x 1:
+    const double defaults[6] = {0.0, 1.0, 0.0, 0.0, 0.0, -1.0};
+    memcpy(view->geotransform, defaults, sizeof(defaults));
+
+    if (geotransform != NULL && geotransform != Py_None) {
+        PyObject *sequence = PySequence_Fast(geotransform, "geotransform must be a sequence of 6 numbers");
+
+        if (sequence == NULL || PySequence_Fast_GET_SIZE(sequence) != 6) {
+            if (sequence != NULL) {
+                PyErr_SetString(PyExc_ValueError, "geotransform must be a sequence of 6 numbers");
+                Py_DECREF(sequence);
+            }
+            PyBuffer_Release(buffer);
+            return -1;
+        }
+        for (int i = 0; i < 6; i++) {
+            view->geotransform[i] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(sequence, i));
+        }
+        Py_DECREF(sequence);
+
+        if (PyErr_Occurred()) {
+            PyBuffer_Release(buffer);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+*   Converts a library status code to a Python exception
+*   - Returns None on success, NULL with an exception set on errors
+*/
+static PyObject *statusResult(const int status) {
+    if (status == BATHY_OK) {
+        Py_RETURN_NONE;
+    }   else if (status == BATHY_ERROR_MEMORY) {
+        return PyErr_NoMemory();
+    }
+
+    PyErr_SetString(PyExc_ValueError, bathyStatusMessage(status));
+    return NULL;
+}
+
+
+/*
+*   coin_roll_surface(surface, radius, trim=False, nodata=-9999.0)
+*/
+static PyObject *pyCoinRollSurface(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"surface", "radius", "trim", "nodata", NULL};
+    PyObject *array;
+    int radius;
+    int trim = 0;
+    double nodata = -9999.0;
+    Py_buffer buffer;
+    struct BathySurfaceView view;
+    int status;
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|pd", keywords, &array, &radius, &trim, &nodata)) {
+        return NULL;
+    }
+    if (getSurfaceView(array, &buffer, &view, nodata, NULL) != 0) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    status = bathyRollCoin(&view, radius, trim, NULL, NULL);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&buffer);
+    return statusResult(status);
+}
+
+
+/*
+*   smooth_laplacian(surface, iterations, nodata=-9999.0, geotransform=None)
+*/
+static PyObject *pySmoothLaplacian(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"surface", "iterations", "nodata", "geotransform", NULL};
+    PyObject *array;
+    PyObject *geotransform = NULL;
+    int iterations;
+    double nodata = -9999.0;
+    Py_buffer buffer;
+    struct BathySurfaceView view;
+    int status;
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Oi|dO", keywords, &array, &iterations, &nodata, &geotransform)) {
+        return NULL;
+    }
+    if (getSurfaceView(array, &buffer, &view, nodata, geotransform) != 0) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    status = bathySmoothLaplacian(&view, iterations, NULL, NULL);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&buffer);
+    return statusResult(status);
+}
+
+
+/*
+*   max_filter_surface(surface, nodata=-9999.0)
+*/
+static PyObject *pyMaxFilterSurface(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"surface", "nodata", NULL};
+    PyObject *array;
+    double nodata = -9999.0;
+    Py_buffer buffer;
+    struct BathySurfaceView view;
+    int status;
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|d", keywords, &array, &nodata)) {
+        return NULL;
+    }
+    if (getSurfaceView(array, &buffer, &view, nodata, NULL) != 0) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    status = bathyBufferShoals(&view, NULL, NULL);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&buffer);
+    return statusResult(status);
+}
+
+
+/*
+*   offset(surface, offset, nodata=-9999.0)
+*/
+static PyObject *pyOffset(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"surface", "offset", "nodata", NULL};
+    PyObject *array;
+    float depth_offset;
+    double nodata = -9999.0;
+    Py_buffer buffer;
+    struct BathySurfaceView view;
+    int status;
+    (void)self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Of|d", keywords, &array, &depth_offset, &nodata)) {
+        return NULL;
+    }
+    if (getSurfaceView(array, &buffer, &view, nodata, NULL) != 0) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    status = bathyOffset(&view, depth_offset, NULL, NULL);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&buffer);
+    return statusResult(status);
+}
+
+
+/*
+*   release_scratch()
+*/
+static PyObject *pyReleaseScratch(PyObject *self, PyObject *args) {
+    (void)self;
+    (void)args;
+
+    Py_BEGIN_ALLOW_THREADS
+    bathyReleaseScratch();
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+
+static PyMethodDef bathytoolsMethods[] = {
+    {"coin_roll_surface", (PyCFunction)(void (*)(void))pyCoinRollSurface, METH_VARARGS | METH_KEYWORDS,
+        "coin_roll_surface(surface, radius, trim=False, nodata=-9999.0)\n\nRolling Coin smoothing of a 2D float32 array, in place."},
+    {"smooth_laplacian", (PyCFunction)(void (*)(void))pySmoothLaplacian, METH_VARARGS | METH_KEYWORDS,
+        "smooth_laplacian(surface, iterations, nodata=-9999.0, geotransform=None)\n\nNavigationally safe Laplacian smoothing of a 2D float32 array, in place.\nCell sizes are taken from the GDAL geotransform (default 1 x 1)."},
+    {"max_filter_surface", (PyCFunction)(void (*)(void))pyMaxFilterSurface, METH_VARARGS | METH_KEYWORDS,
+        "max_filter_surface(surface, nodata=-9999.0)\n\nShoal buffering (3 x 3 cell focal maximum) of a 2D float32 array, in place."},
+    {"offset", (PyCFunction)(void (*)(void))pyOffset, METH_VARARGS | METH_KEYWORDS,
+        "offset(surface, offset, nodata=-9999.0)\n\nAdds offset to all cells with data of a 2D float32 array, in place."},
+    {"release_scratch", pyReleaseScratch, METH_NOARGS,
+        "release_scratch()\n\nFrees the scratch arrays kept for reuse by later calls."},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef bathytoolsModule = {
+    PyModuleDef_HEAD_INIT,
+    "bathytools",
+    "Bathymetric surface tools: navigationally safe surface operators on float32 arrays (in place, GIL released).",
+    -1,
+    bathytoolsMethods,
+    NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit_bathytools(void) {
+    return PyModule_Create(&bathytoolsModule);
+}
@@ -0,0 +1,30 @@
+# Builds the bathytools Python extension (operators of libbathytools on float32 arrays)
+#
+#   cd python && python3 setup.py build_ext --inplace
+#
+# Sources of the library are compiled into the extension, GDAL must be installed
+# (headers are needed by the shared header file, nothing is read or written with it).
+
+from setuptools import setup, Extension
+
+LIBRARY_SOURCES = [
+    "libbathytools.c", "rolling_coin_smoothing.c", "laplacian_smoothing.c", "inputandmemory.c", "fileoutput.c",
+    "focalmaxfilter.c", "offset.c", "range_index.c", "coin_kernels.c", "simd_kernels.c", "infoprinters.c",
+    "numa_memory.c", "surface_cache.c", "scratch_pool.c", "output_statistics.c",
+]
+
+bathytools = Extension(
+    "bathytools",
+    sources=["bathytoolsmodule.c"] + ["../" + source for source in LIBRARY_SOURCES],
+    include_dirs=[".."],
+    libraries=["gdal"],
+    extra_compile_args=["-O3", "-std=c17", "-pthread"],
+    extra_link_args=["-pthread"],
+)
+
+setup(
+    name="bathytools",
+    version="1.21",
+    description="Bathymetric surface tools: navigationally safe surface operators on float32 arrays",
+    ext_modules=[bathytools],
+)
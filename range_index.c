@@ -0,0 +1,178 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Row-wise sparse table (range extreme index) functions
+*   - Index covers a band of rows and answers range maximum (or minimum)
+*     queries over any column range of a band row in constant time
+*   - Index is allocated once for the band height and rebuilt band by band,
+*     so it never holds more than levels x band rows, not whole surface copies
+*   - Rolling Coin uses the index to get extreme values of a coin of any radius
+*     with one query per coin row, instead of checking every coin cell
+*
+*   Index levels are 2D arrays, where level k holds the extreme value of
+*   cells [col, col + 2^k - 1] of each band row:
+*
+*       level 0:  |a|b|c|d|e|
+*       level 1:  |max(a,b)|max(b,c)|max(c,d)|max(d,e)|
+*       level 2:  |max(a..d)|max(b..e)|
+*/
+
+
+/*
+*   Allocates a range extreme index (type "RangeIndex") for bands of a 2D float array.
+*   - Returns a pointer to RangeIndex, NULL if memory can't be allocated
+*   - Input parameters:
+*       - Capacity: most rows of a band (band rows and halo)
+*       - Maxlength: longest column range that will be queried (e.g. coin diameter)
+*       - Mode: RANGE_MAX or RANGE_MIN
+*   - Index is empty until built with buildRangeIndex
+*/
+struct RangeIndex *createRangeIndex(const int capacity, const int cols, const int maxlength, const char mode) {
+    struct RangeIndex *ret = calloc(1, sizeof(struct RangeIndex));
+    const int length = (maxlength < cols) ? maxlength : cols;       // Ranges can't be longer than a row
+
+    if (ret == NULL) {
+        return NULL;
+    }
+    ret->capacity = capacity;
+    ret->cols = cols;
+    ret->mode = mode;
+
+    // Integer base 2 logarithms for all possible range lengths:
+    ret->log2 = calloc(cols + 1, sizeof(int));
+    if (ret->log2 == NULL) {
+        free(ret);
+        return NULL;
+    }
+    for (int i = 2; i <= cols; i++) {
+        ret->log2[i] = ret->log2[i / 2] + 1;
+    }
+
+    ret->levels = ret->log2[length] + 1;
+    ret->table = calloc(ret->levels, sizeof(float **));
+    if (ret->table == NULL) {
+        free(ret->log2);
+        free(ret);
+        return NULL;
+    }
+
+    for (int k = 0; k < ret->levels; k++) {
+        ret->table[k] = acquireScratchArray(cols, capacity);
+        if (ret->table[k] == NULL) {
+            freeRangeIndex(ret);
+            return NULL;
+        }
+    }
+
+    return ret;
+}
+
+
+/*
+*   Builds the index levels for rows [first_row, first_row + rows - 1] of a 2D float array.
+*   - Rows must not exceed the capacity of the index
+*   - Nodata: cells holding nodata never win a query. If all cells of
+*     a range are nodata, RANGE_MAX returns -999999 and RANGE_MIN returns 10 000
+*/
+void buildRangeIndex(struct RangeIndex *index, float **array, const int first_row, const int rows, const double nodata) {
+    const float empty = (index->mode == RANGE_MAX) ? -999999.0 : 10000.0;  // Value that never wins a query
+    const int cols = index->cols;
+
+    index->first_row = first_row;
+    index->rows = rows;
+
+    // Level 0 is a copy of the band with nodata replaced:
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            if (fabs(array[first_row + row][col] - nodata) < EPSILON) {     // (value == nodata)
+                index->table[0][row][col] = empty;
+            }   else {
+                index->table[0][row][col] = array[first_row + row][col];
+            }
+        }
+    }
+
+    // Each level combines two overlapping ranges of the previous level:
+    for (int k = 1; k < index->levels; k++) {
+        const int half = 1 << (k - 1);
+        float **prev = index->table[k - 1];
+        float **level = index->table[k];
+
+        for (int row = 0; row < rows; row++) {
+            for (int col = 0; col + 2 * half <= cols; col++) {
+                const float a = prev[row][col];
+                const float b = prev[row][col + half];
+
+                if (index->mode == RANGE_MAX) {
+                    level[row][col] = (a > b) ? a : b;
+                }   else {
+                    level[row][col] = (a < b) ? a : b;
+                }
+            }
+        }
+    }
+}
+
+
+/*
+*   Frees all allocated memory of parameter RangeIndex
+*/
+void freeRangeIndex(struct RangeIndex *index) {
+    for (int k = 0; k < index->levels; k++) {
+        releaseScratchArray(index->table[k], index->capacity);
+    }
+
+    free(index->table);
+    free(index->log2);
+    free(index);
+}
+
+
+/*
+*   Returns the extreme value of cells [first_col, last_col] on given row.
+*   - Row is a surface row inside the built band
+*   - Two overlapping power of two ranges cover the whole query range
+*/
+float getRangeExtreme(struct RangeIndex *index, const int row, const int first_col, const int last_col) {
+    const int k = index->log2[last_col - first_col + 1];
+    const float a = index->table[k][row - index->first_row][first_col];
+    const float b = index->table[k][row - index->first_row][last_col - (1 << k) + 1];
+    if (index->mode == RANGE_MAX) {
+        return (a > b) ? a : b;
+    }   else {
+        return (a < b) ? a : b;
+    }
+}
+
+
+/*
+*   Returns the extreme value on coin area centered on given cell.
+*   - Coin is described by half widths of its rows (see getCoinChords)
+*   - Edge effects: uses partial coin when necessary, band must cover the coin rows inside the surface
+*/
+float getCoinExtreme(struct RangeIndex *index, const int *chords, const int radius, const int row_index, const int col_index) {
+    float ret = (index->mode == RANGE_MAX) ? -999999.0 : 10000.0;
+
+    for (int row_coin = -radius; row_coin <= radius; row_coin++) {
+        const int row = row_index + row_coin;
+        const int halfwidth = chords[row_coin + radius];
+
+        if (row < index->first_row || row >= index->first_row + index->rows || halfwidth < 0) {     // Coin row outside band (surface) or empty
+            continue;
+        }
+
+        // Clip coin row to surface:
+        const int first_col = (col_index - halfwidth < 0) ? 0 : col_index - halfwidth;
+        const int last_col = (col_index + halfwidth >= index->cols) ? index->cols - 1 : col_index + halfwidth;
+        const float extreme = getRangeExtreme(index, row, first_col, last_col);
+
+        if (index->mode == RANGE_MAX) {
+            ret = (extreme > ret) ? extreme : ret;
+        }   else {
+            ret = (extreme < ret) ? extreme : ret;
+        }
+    }
+
+    return ret;
+}
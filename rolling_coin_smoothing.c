@@ -12,19 +12,33 @@
 *   - Iterates over cells
 *   - Modifies the surface
 *   - Memory management and no data handling
+*   - Returns FALSE if memory can't be allocated (surface is not changed)
 */
-void coinRollSurface(struct FloatSurface *src, struct Coin *penny) {
-    printf("Rolling Coin..");
-    fflush(stdout);
-    const int radius = penny->radius;           // Valid indexes of coin are normally [-radius, radius]
+char coinRollSurface(struct FloatSurface *src, struct Coin *penny) {
+    // Take a temporary float** (2D) array from the scratch pool (scratch_pool.c):
+    float **temp = acquireScratchArray(src->cols, src->rows);
     int *limits = calloc(4, sizeof(int));       // An array to hold valid coin index ranges for special cases
+
+    if (temp == NULL || limits == NULL) {
+        releaseScratchArray(temp, src->rows);
+        free(limits);
+        return FALSE;
+    }
+    printStepStart("Rolling Coin");
+
+    // Use a specialised kernel if there is one for the coin radius (coin_kernels.c):
+    if (rollCoinKernel(src, penny, temp) == TRUE) {
+        releaseScratchArray(temp, src->rows);
+        free(limits);
+        printStepDone();
+        return TRUE;
+    }
+
+    const int radius = penny->radius;           // Valid indexes of coin are normally [-radius, radius]
     const float nodata = src->nodata;
     const float placeholder = -999999.0;
     float shoalest;
 
-    // Create new temporary float** (2D) array:
-    float **temp = createFloatArray(src->cols, src->rows);
-
     // Initialize all cells to an elevation of 10 000 (meters):
     for (int row = 0; row < src->rows; row++) {
         for (int col = 0; col < src->cols; col++) {
@@ -54,24 +68,25 @@ void coinRollSurface(struct FloatSurface *src, struct Coin *penny) {
                 }
             }
         }
+        printStepProgress((row + 1.0) / src->rows);
     }
 
-    // Restore original nodata (safety first):
+    // Copy smoothed data to the original data array, restore original nodata (safety first):
     for (int row = 0; row < src->rows; row++) {
         for (int col = 0; col < src->cols; col++) {
             if ((fabs(src->array[row][col] - nodata) < EPSILON)) {  // (value == nodata)
-                temp[row][col] = nodata;
+                src->array[row][col] = nodata;
+            }   else {
+                src->array[row][col] = temp[row][col];
             }
         }
     }
 
-    // Free memory allocated for temp array:
-    float **destruct = src->array;          // Store original data array pointer
-    src->array = temp;                      // Replace original data array with smoothed data array
-    freeFloatArray(destruct, src->rows);    // Free original data array
+    // Free memory:
+    releaseScratchArray(temp, src->rows);   // Return temp array to the pool
     free(limits);                           // Free index range list memory
-    printf("Done\n");
-    fflush(stdout);
+    printStepDone();
+    return TRUE;
 }
 
 
@@ -150,3 +165,110 @@ void getCoinIndexRange(const int rows, const int cols, const int current_row, co
             index_ranges[3] = coin_radius;
         }
 }
+
+
+/*
+*   Surface manipulation (~smoothing) function using range extreme indexes
+*   - Same result as coinRollSurface, but shoalest depths are queried
+*     one coin row at a time from an index (see range_index.c)
+*   - Indexes are built per row band with a halo of coin radius rows, so they
+*     hold a few band copies instead of whole surface copies per index level
+*   - Modifies the surface
+*   - Returns FALSE if memory can't be allocated, the surface is then unchanged
+*/
+char coinRollSurfaceIndexed(struct FloatSurface *src, struct Coin *penny) {
+    const int radius = penny->radius;
+    const float nodata = src->nodata;
+    const int band = (2 * penny->diameter > RANGE_BAND_ROWS) ? 2 * penny->diameter : RANGE_BAND_ROWS;
+    int *chords = calloc(penny->diameter, sizeof(int));     // Half widths of coin rows
+
+    // Shoalest depth on coin of every cell, nodata if coin has no depths:
+    float **shoalest = acquireScratchArray(src->cols, src->rows);
+
+    // Band indexes are rebuilt for every band (band rows and halos on both sides):
+    struct RangeIndex *depths = createRangeIndex(band + 2 * radius, src->cols, penny->diameter, RANGE_MAX);
+    struct RangeIndex *pressed = createRangeIndex(band + 2 * radius, src->cols, penny->diameter, RANGE_MIN);
+
+    if (chords == NULL || shoalest == NULL || depths == NULL || pressed == NULL) {
+        free(chords);
+        releaseScratchArray(shoalest, src->rows);
+        if (depths != NULL) {
+            freeRangeIndex(depths);
+        }
+        if (pressed != NULL) {
+            freeRangeIndex(pressed);
+        }
+        return FALSE;
+    }
+
+    printStepStart("Rolling Coin (indexed)");
+    getCoinChords(penny, chords);
+
+    for (int first = 0; first < src->rows; first += band) {
+        const int last = (first + band < src->rows) ? first + band : src->rows;
+        const int halo_first = (first - radius > 0) ? first - radius : 0;
+        const int halo_last = (last + radius < src->rows) ? last + radius : src->rows;
+
+        buildRangeIndex(depths, src->array, halo_first, halo_last - halo_first, nodata);
+
+        for (int row = first; row < last; row++) {
+            for (int col = 0; col < src->cols; col++) {
+                const float shoal = getCoinExtreme(depths, chords, radius, row, col);
+
+                if (shoal > -999999.0) {        // Depth values found
+                    shoalest[row][col] = shoal;
+                }   else {
+                    shoalest[row][col] = nodata;
+                }
+            }
+        }
+    }
+
+    // "Press" shoalest depths to coin areas: every cell gets the deepest
+    // shoalest depth of the coins covering it (coin is symmetric):
+    for (int first = 0; first < src->rows; first += band) {
+        const int last = (first + band < src->rows) ? first + band : src->rows;
+        const int halo_first = (first - radius > 0) ? first - radius : 0;
+        const int halo_last = (last + radius < src->rows) ? last + radius : src->rows;
+
+        buildRangeIndex(pressed, shoalest, halo_first, halo_last - halo_first, nodata);
+
+        for (int row = first; row < last; row++) {
+            for (int col = 0; col < src->cols; col++) {
+                if ((fabs(src->array[row][col] - nodata) < EPSILON)) {  // Restore original nodata (safety first)
+                    src->array[row][col] = nodata;
+                }   else {
+                    src->array[row][col] = getCoinExtreme(pressed, chords, radius, row, col);
+                }
+            }
+        }
+    }
+
+    // Free memory:
+    freeRangeIndex(pressed);
+    freeRangeIndex(depths);
+    releaseScratchArray(shoalest, src->rows);
+    free(chords);
+    printStepDone();
+    return TRUE;
+}
+
+
+/*
+*   Calculates half widths of coin rows (chords)
+*   - Coin rows are continuous and symmetric around the coin center column
+*   - Half widths are saved to a list passed as a parameter (length: coin diameter),
+*     -1 marks an empty coin row
+*/
+void getCoinChords(struct Coin *penny, int *chords) {
+    for (int row = 0; row < penny->diameter; row++) {
+        chords[row] = -1;
+
+        for (int col = 0; col < penny->diameter; col++) {
+            if (penny->array[row][col] == TRUE) {
+                chords[row] = penny->radius - col;  // First cell on coin row
+                break;
+            }
+        }
+    }
+}
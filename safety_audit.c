@@ -0,0 +1,310 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Navigational safety audit: the surface is compared to the input it was made from,
+*     a cell deeper than the input (beyond a tolerance) or a cell of the input that lost
+*     its data is a violation (smoothing operators only ever make the surface shoaler)
+*   - Input rows are read again in strips by workers (each through a dataset handle of its
+*     own), a strip is compared right after it is read (no surface size copy of the input).
+*     With the surface cache (BATHYTOOLS_CACHE) the mapped input is compared instead
+*   - Rows are counted with a vectorised row kernel (see simd_kernels.c), only rows with
+*     violations are scanned again for the worst cells and the violation mask
+*   - Surface can be a window of the input (mosaic tiles, windows), it is located by geotransforms
+*   - Violations are reported (counts, worst cells), the process exits with a failure status
+*
+*   Use example (audit before the offset, which moves the surface on purpose):
+*
+*       surfacetools inputfile.tiff outputfile.tiff -buffer -rollcoin 13 notrim -laplacian 10 -audit 0.001 violations.tif -offset 0.35
+*/
+
+
+// Set when an audit finds violations (exit status of the process):
+static char failed = FALSE;
+
+
+/*
+*   Audits a surface against its input (surf->inputfp)
+*   - Tolerance: how much deeper than the input a cell may be (m)
+*   - Mask: GeoTIFF of the surface grid (0: ok, 1: deeper than input, 2: data lost), NULL: none
+*   - Returns TRUE if the surface passed the audit
+*/
+char auditSurface(struct FloatSurface *surf, const float tolerance, const char *maskfp) {
+    printStepStart("Auditing navigational safety");
+    struct SafetyAudit audit = {inputFilePath(surf->inputfp), surf, NULL, 0, 0, tolerance, NULL, MIN_READ_STRIP_ROWS, 0, FALSE,
+                                0, 0, 0, {{0, 0, 0.0f, 0.0f}}, 0, PTHREAD_MUTEX_INITIALIZER};
+    GDALDatasetH dataset = (audit.path != NULL) ? GDALOpen(audit.path, GA_ReadOnly) : NULL;
+
+    if (dataset == NULL || locateAuditWindow(dataset, surf, &audit.first_row, &audit.first_col) == FALSE) {
+        printf("Input of the surface can't be read or the surface is not on its grid, audit was not done.\n");
+        if (dataset != NULL) {
+            GDALClose(dataset);
+        }
+        pthread_mutex_destroy(&audit.lock);
+        failed = TRUE;
+        return FALSE;
+    }
+
+    // Whole input decoded earlier is mapped from the surface cache instead of read again:
+    char cachefp[1100];
+    if (audit.first_row == 0 && audit.first_col == 0 && GDALGetRasterYSize(dataset) == surf->rows && GDALGetRasterXSize(dataset) == surf->cols
+        && surfaceCachePath(surf->inputfp, cachefp, sizeof(cachefp)) == TRUE) {
+        audit.reference = readSurfaceCache(cachefp, surf->inputfp);
+    }
+    GDALClose(dataset);
+
+    if (maskfp != NULL) {
+        audit.mask = calloc((size_t)surf->rows * surf->cols, 1);
+    }
+
+    // Workers take strips until all are audited:
+    const int strips = (surf->rows + audit.striprows - 1) / audit.striprows;
+    int threads = rowBandCount(surf->rows, surf->cols);
+    threads = (threads < strips) ? threads : strips;
+    int started = 0;
+
+    if (threads > 1) {
+        pthread_t *workers = calloc(threads, sizeof(pthread_t));
+        for (int i = 0; i < threads; i++) {
+            if (pthread_create(&workers[started], NULL, auditWorker, &audit) == 0) {
+                started++;
+            }
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+    }
+    if (started == 0) {
+        auditWorker(&audit);
+    }
+    printStepDone();
+
+    if (audit.reference != NULL) {
+        freeFloatSurface((struct FloatSurface *)audit.reference);
+    }
+    if (audit.mask != NULL && audit.failed == FALSE) {
+        writeAuditMask(surf, audit.mask, maskfp);
+    }
+
+    printAuditReport(&audit);
+    const char ret = (audit.failed == FALSE && audit.violations == 0 && audit.lost == 0) ? TRUE : FALSE;
+    if (ret == FALSE) {
+        failed = TRUE;
+    }
+
+    free(audit.mask);
+    pthread_mutex_destroy(&audit.lock);
+    return ret;
+}
+
+
+/*
+*   Position of a surface in its input dataset (surface may be a window of it)
+*   - Cell size and orientation must be the same, origin on a cell corner of the input
+*   - Returns FALSE if the surface is not inside the input grid
+*/
+char locateAuditWindow(GDALDatasetH dataset, const struct FloatSurface *surf, int *first_row, int *first_col) {
+    double geotransform[6];
+    GDALGetGeoTransform(dataset, geotransform);
+
+    const int steps[4] = {1, 2, 4, 5};
+    for (int i = 0; i < 4; i++) {
+        if (fabs(geotransform[steps[i]] - surf->geotransform[steps[i]]) > 1e-6 * fabs(geotransform[1])) {
+            return FALSE;
+        }
+    }
+
+    const double col = (surf->geotransform[0] - geotransform[0]) / geotransform[1];
+    const double row = (surf->geotransform[3] - geotransform[3]) / geotransform[5];
+    *first_col = (int)lround(col);
+    *first_row = (int)lround(row);
+
+    return (fabs(col - *first_col) < 0.001 && fabs(row - *first_row) < 0.001 && *first_col >= 0 && *first_row >= 0
+            && *first_col + surf->cols <= GDALGetRasterXSize(dataset) && *first_row + surf->rows <= GDALGetRasterYSize(dataset)) ? TRUE : FALSE;
+}
+
+
+/*
+*   Audit worker thread: reads strips of input rows (or takes them from the mapped input)
+*   and compares them to the surface, results are added to the audit when all strips are taken
+*/
+void *auditWorker(void *arg) {
+    struct SafetyAudit *audit = arg;
+    struct FloatSurface *surf = audit->surf;
+    GDALDatasetH dataset = (audit->reference == NULL) ? GDALOpen(audit->path, GA_ReadOnly) : NULL;
+    GDALRasterBandH band = (dataset != NULL) ? GDALGetRasterBand(dataset, 1) : NULL;
+    float *strip = (audit->reference == NULL) ? malloc((size_t)audit->striprows * surf->cols * sizeof(float)) : NULL;
+    struct SafetyAudit local = {NULL, surf, NULL, 0, 0, audit->tolerance, audit->mask, 0, 0, FALSE, 0, 0, 0, {{0, 0, 0.0f, 0.0f}}, 0, PTHREAD_MUTEX_INITIALIZER};
+
+    while (1) {
+        pthread_mutex_lock(&audit->lock);
+        const int first_row = audit->next * audit->striprows;
+        audit->next++;
+        pthread_mutex_unlock(&audit->lock);
+
+        if (first_row >= surf->rows) {
+            break;
+        }
+
+        const int rows = (first_row + audit->striprows < surf->rows) ? audit->striprows : surf->rows - first_row;
+
+        if (audit->reference == NULL && (band == NULL || GDALRasterIO(band, GF_Read, audit->first_col, audit->first_row + first_row, surf->cols, rows,
+                                                                      strip, surf->cols, rows, GDT_Float32, 0, 0) != CE_None)) {
+            local.failed = TRUE;
+            continue;
+        }
+
+        for (int row = first_row; row < first_row + rows; row++) {
+            const float *input = (audit->reference != NULL) ? audit->reference->array[row] : &strip[(size_t)(row - first_row) * surf->cols];
+            int checked;
+            const int problems = simd.auditRow(input, surf->array[row], surf->cols, audit->tolerance, surf->nodata, &checked);
+
+            local.checked += checked;
+            if (problems > 0) {
+                recordAuditRow(&local, input, row);
+            }
+        }
+    }
+
+    // Results of the worker:
+    pthread_mutex_lock(&audit->lock);
+    audit->failed |= local.failed;
+    audit->checked += local.checked;
+    audit->violations += local.violations;
+    audit->lost += local.lost;
+    for (int i = 0; i < local.worstcount; i++) {
+        addWorstAuditCell(audit, &local.worst[i]);
+    }
+    pthread_mutex_unlock(&audit->lock);
+
+    free(strip);
+    if (dataset != NULL) {
+        GDALClose(dataset);
+    }
+
+    return NULL;
+}
+
+
+/*
+*   Records the violations of a row (row has violations, found by the row kernel)
+*   - Counts, worst cells and mask of the row
+*/
+void recordAuditRow(struct SafetyAudit *audit, const float *input, const int row) {
+    const struct FloatSurface *surf = audit->surf;
+    const float *output = surf->array[row];
+
+    for (int col = 0; col < surf->cols; col++) {
+        if (fabs(input[col] - surf->nodata) < EPSILON) {
+            continue;
+        }
+
+        char type = 0;
+        if (fabs(output[col] - surf->nodata) < EPSILON) {
+            audit->lost++;
+            type = 2;
+        }   else if (output[col] - input[col] < -audit->tolerance) {
+            const struct AuditCell cell = {row, col, input[col], output[col]};
+            audit->violations++;
+            addWorstAuditCell(audit, &cell);
+            type = 1;
+        }
+
+        if (type != 0 && audit->mask != NULL) {
+            audit->mask[(size_t)row * surf->cols + col] = type;
+        }
+    }
+}
+
+
+/*
+*   Adds a cell to the worst cells of an audit (AUDIT_WORST_CELLS deepest below input, sorted)
+*   - Equally deep cells are in row and column order (same report with any number of workers)
+*/
+void addWorstAuditCell(struct SafetyAudit *audit, const struct AuditCell *cell) {
+    int i = audit->worstcount;
+
+    if (i == AUDIT_WORST_CELLS) {
+        if (worseAuditCell(cell, &audit->worst[i - 1]) == FALSE) {
+            return;
+        }
+        i--;
+    }   else {
+        audit->worstcount++;
+    }
+
+    while (i > 0 && worseAuditCell(cell, &audit->worst[i - 1]) == TRUE) {
+        audit->worst[i] = audit->worst[i - 1];
+        i--;
+    }
+    audit->worst[i] = *cell;
+}
+
+
+/*
+*   Returns TRUE if a cell is deeper below the input than another (or as deep and before it)
+*/
+char worseAuditCell(const struct AuditCell *a, const struct AuditCell *b) {
+    const float depth_a = a->output - a->input;
+    const float depth_b = b->output - b->input;
+
+    if (depth_a < depth_b || depth_a > depth_b) {
+        return (depth_a < depth_b) ? TRUE : FALSE;
+    }
+    return (a->row < b->row || (a->row == b->row && a->col < b->col)) ? TRUE : FALSE;
+}
+
+
+/*
+*   Writes the violation mask of an audit (byte GeoTIFF of the surface grid)
+*/
+void writeAuditMask(const struct FloatSurface *surf, unsigned char *mask, const char *maskfp) {
+    char **options = outputOptions(maskfp);
+    GDALDatasetH dataset = GDALCreate(GDALGetDriverByName("GTiff"), maskfp, surf->cols, surf->rows, 1, GDT_Byte, options);
+    CSLDestroy(options);
+
+    if (dataset == NULL) {
+        printf("Violation mask can't be written: %s\n", maskfp);
+        return;
+    }
+    GDALSetGeoTransform(dataset, surf->geotransform);
+    GDALSetProjection(dataset, surf->projection);
+
+    if (GDALRasterIO(GDALGetRasterBand(dataset, 1), GF_Write, 0, 0, surf->cols, surf->rows, mask, surf->cols, surf->rows, GDT_Byte, 0, 0) != CE_None) {
+        printf("Violation mask can't be written: %s\n", maskfp);
+    }
+    GDALClose(dataset);
+}
+
+
+/*
+*   Prints the report of an audit: cells checked, violations, lost cells and the worst cells
+*/
+void printAuditReport(const struct SafetyAudit *audit) {
+    const struct FloatSurface *surf = audit->surf;
+
+    if (audit->failed == TRUE) {
+        printf("Audit: input rows could not be read, audit is incomplete.\n");
+    }
+    printf("Audit: %llu cells checked, %llu deeper than input (tolerance %.3f m), %llu lost their data: %s\n",
+           (unsigned long long)audit->checked, (unsigned long long)audit->violations, audit->tolerance, (unsigned long long)audit->lost,
+           (audit->violations == 0 && audit->lost == 0 && audit->failed == FALSE) ? "PASSED" : "FAILED");
+
+    for (int i = 0; i < audit->worstcount; i++) {
+        const struct AuditCell *cell = &audit->worst[i];
+        const double x = surf->geotransform[0] + (cell->col + 0.5) * surf->geotransform[1] + (cell->row + 0.5) * surf->geotransform[2];
+        const double y = surf->geotransform[3] + (cell->col + 0.5) * surf->geotransform[4] + (cell->row + 0.5) * surf->geotransform[5];
+
+        printf("  row %d, col %d (x %.3f, y %.3f): input %.3f, surface %.3f, %.3f m deeper\n",
+               cell->row, cell->col, x, y, cell->input, cell->output, cell->input - cell->output);
+    }
+}
+
+
+/*
+*   Returns TRUE if an audit of this process found violations (or couldn't be done)
+*/
+char safetyAuditFailed(void) {
+    return failed;
+}
@@ -0,0 +1,164 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Pool of scratch arrays: temporary surface size arrays of operators (Rolling Coin,
+*     Laplacian smoothing, shoal buffering, range indexes) are taken from the pool and
+*     returned to it, so the next step (or the next file of a batch) reuses memory that is
+*     already allocated, placed and faulted in, instead of mapping, zeroing and unmapping it
+*   - Blocks are allocated in size classes (at most 1/8 larger than asked), any pooled block
+*     with enough room is laid out again for the array asked (rows and columns may differ)
+*   - Pool is shared by all threads (mosaic workers, daemon requests), it holds at most
+*     SCRATCH_POOL_BLOCKS blocks, the block returned first is freed first
+*   - Cells of a scratch array taken from the pool are not zeroed: operators write every
+*     cell they read
+*
+*   Pool can be disabled with an environment variable (every step allocates and frees its arrays):
+*       BATHYTOOLS_SCRATCH = off
+*/
+
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static struct ScratchBlock pooled[SCRATCH_POOL_BLOCKS];        // Returned blocks
+static int pooledCount = 0;
+static unsigned long poolClock = 0;                             // Number of returned blocks (oldest is freed first)
+static char poolEnabled = TRUE;
+static pthread_once_t poolSettingRead = PTHREAD_ONCE_INIT;
+
+
+/*
+*   Takes a scratch array of given size from the pool, or allocates a new one in a size class
+*   - Cells are undefined (zero if the array is new)
+*   - Returns a pointer to array, NULL if memory can't be allocated
+*/
+float **acquireScratchArray(const int cols, const int rows) {
+    pthread_once(&poolSettingRead, readScratchSetting);
+    if (poolEnabled == FALSE) {
+        return createFloatArray(cols, rows);
+    }
+
+    const size_t cells = (size_t)rows * floatRowStride(cols) * sizeof(float);
+    const size_t header = sizeof(struct ArrayAllocation) + (size_t)rows * sizeof(float *);
+    struct ScratchBlock block;
+    int best = -1;
+
+    // Smallest pooled block with room for the header and cells:
+    pthread_mutex_lock(&poolLock);
+    for (int i = 0; i < pooledCount; i++) {
+        if (scratchBlockRoom(&pooled[i]) >= header && scratchBlockCapacity(&pooled[i]) >= cells
+            && (best < 0 || scratchBlockCapacity(&pooled[i]) < scratchBlockCapacity(&pooled[best]))) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        block = pooled[best];
+        pooled[best] = pooled[--pooledCount];
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    if (best >= 0) {
+        return layoutFloatArray(block.data, cols, rows, &block.allocation);
+    }
+
+    return createFloatArrayBlock(cols, rows, scratchSizeClass(cells), scratchSizeClass(header));
+}
+
+
+/*
+*   Returns a scratch array to the pool (or frees it, if the pool is disabled)
+*   - Pool is full: the block returned first is freed
+*/
+void releaseScratchArray(float **array, const int rows) {
+    if (array == NULL) {
+        return;
+    }
+    pthread_once(&poolSettingRead, readScratchSetting);
+    if (poolEnabled == FALSE) {
+        freeFloatArray(array, rows);
+        return;
+    }
+
+    // Cells start after the row pointers:
+    struct ScratchBlock block = {*((struct ArrayAllocation *)array - 1), (char *)(array + rows), 0};
+    struct ScratchBlock evicted = {{NULL, 0, 0, FALSE, HUGEPAGES_OFF}, NULL, 0};
+
+    pthread_mutex_lock(&poolLock);
+    block.released = ++poolClock;
+    if (pooledCount < SCRATCH_POOL_BLOCKS) {
+        pooled[pooledCount++] = block;
+    }   else {
+        int oldest = 0;
+        for (int i = 1; i < pooledCount; i++) {
+            if (pooled[i].released < pooled[oldest].released) {
+                oldest = i;
+            }
+        }
+        evicted = pooled[oldest];
+        pooled[oldest] = block;
+    }
+    pthread_mutex_unlock(&poolLock);
+
+    if (evicted.data != NULL) {
+        freeArrayAllocation(&evicted.allocation);
+    }
+}
+
+
+/*
+*   Frees all pooled blocks (memory is given back, e.g. before placement is changed)
+*/
+void drainScratchPool(void) {
+    struct ScratchBlock blocks[SCRATCH_POOL_BLOCKS];
+
+    pthread_mutex_lock(&poolLock);
+    const int count = pooledCount;
+    memcpy(blocks, pooled, count * sizeof(struct ScratchBlock));
+    pooledCount = 0;
+    pthread_mutex_unlock(&poolLock);
+
+    for (int i = 0; i < count; i++) {
+        freeArrayAllocation(&blocks[i].allocation);
+    }
+}
+
+
+/*
+*   Reads the pool setting from the environment (BATHYTOOLS_SCRATCH = off disables the pool)
+*/
+void readScratchSetting(void) {
+    const char *setting = getenv("BATHYTOOLS_SCRATCH");
+
+    if (setting != NULL && strcmp(setting, "off") == 0) {
+        poolEnabled = FALSE;
+    }
+}
+
+
+/*
+*   Size class of a block part: bytes rounded up to 1/8 - 1/16 of the highest power of two below them
+*/
+size_t scratchSizeClass(const size_t bytes) {
+    size_t step = 1;
+
+    while (step * 16 <= bytes) {
+        step *= 2;
+    }
+
+    return (bytes + step - 1) / step * step;
+}
+
+
+/*
+*   Bytes before the first cell of a pooled block (room for allocation record and row pointers)
+*/
+size_t scratchBlockRoom(const struct ScratchBlock *block) {
+    return block->data - (char *)block->allocation.base;
+}
+
+
+/*
+*   Bytes of cells of a pooled block (from the first cell to the end of the block)
+*/
+size_t scratchBlockCapacity(const struct ScratchBlock *block) {
+    return (char *)block->allocation.base + block->allocation.size - block->data;
+}
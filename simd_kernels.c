@@ -0,0 +1,227 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Row kernels of the 3 x 3 cell operators (Laplacian smoothing, shoal buffering, offset)
+*     and of the separation surface offset (bilinear sampling, gathers of grid columns)
+*   - Row reduction of the navigational safety audit (counts of violations)
+*   - Runtime selection of kernel variants by CPU features (SIMD instruction sets)
+*
+*   Every kernel is written once and compiled for each instruction set:
+*   - SSE2 (baseline of all x86-64 CPUs, and the only variant on other platforms)
+*   - AVX2
+*   - AVX-512
+*   The best variant supported by the CPU is selected at start-up, so the same binary
+*   runs on every host (no -march=native builds needed). All variants give identical results.
+*
+*   Row kernels handle cells that have all 8 neighbors (no surface edges),
+*   cells on surface edges are handled by the per cell functions of each operator.
+*
+*   Kernels select values with masks instead of branches, which GCC does only when
+*   floating point exceptions (never checked here) need not be preserved. Results are unaffected.
+*/
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("no-trapping-math")
+#endif
+
+
+/*
+*   Laplacian smoothing of a row (see laplacian_smoothing.c)
+*   - Same arithmetic as getSafeSmoothDepth, missing (nodata) neighbors add 0 to sums
+*/
+KERNEL_INLINE void smoothLaplacianRowBody(const float *above, const float *row, const float *below, float *out, const int cols, const double xWeight, const double yWeight, const double nodata) {
+    for (int col = 0; col < cols; col++) {
+        const float z = row[col];
+        const int up = fabs(above[col] - nodata) > EPSILON;         // != NO DATA
+        const int down = fabs(below[col] - nodata) > EPSILON;
+        const int left = fabs(row[col - 1] - nodata) > EPSILON;
+        const int right = fabs(row[col + 1] - nodata) > EPSILON;
+        const int count = up + down + left + right;
+
+        // Weighted sum in the same order as getInterpolatedDepth (up, down, left, right):
+        double sum = 0.0;
+        double weightSum = 0.0;
+        sum += up ? above[col] * yWeight : 0.0;
+        sum += down ? below[col] * yWeight : 0.0;
+        sum += left ? row[col - 1] * xWeight : 0.0;
+        sum += right ? row[col + 1] * xWeight : 0.0;
+        weightSum += up ? yWeight : 0.0;
+        weightSum += down ? yWeight : 0.0;
+        weightSum += left ? xWeight : 0.0;
+        weightSum += right ? xWeight : 0.0;
+
+        // Interpolate only if at least 2 valid neighbors (always divide, no branches), return safer value:
+        const float interpolated = (float)(sum / ((count >= 2) ? weightSum : 1.0));
+        const float estimate = (count >= 2) ? interpolated : z;
+        const float safe = (fabs(estimate) < fabs(z)) ? estimate : z;
+
+        out[col] = (fabs(z - nodata) > EPSILON) ? safe : (float)nodata;
+    }
+}
+
+
+/*
+*   Shoal buffering (3 x 3 cell focal maximum) of a row (see focalmaxfilter.c)
+*   - Rows above, row and below are the original depths, out is the buffered row
+*/
+KERNEL_INLINE void maxFilterRowBody(const float *above, const float *row, const float *below, float *out, const int cols, const float nodata) {
+    for (int col = 0; col < cols; col++) {
+        float max_elev = -15000.0;
+
+        max_elev = (above[col - 1] > max_elev) ? above[col - 1] : max_elev;
+        max_elev = (above[col] > max_elev) ? above[col] : max_elev;
+        max_elev = (above[col + 1] > max_elev) ? above[col + 1] : max_elev;
+        max_elev = (row[col - 1] > max_elev) ? row[col - 1] : max_elev;
+        max_elev = (row[col + 1] > max_elev) ? row[col + 1] : max_elev;
+        max_elev = (below[col - 1] > max_elev) ? below[col - 1] : max_elev;
+        max_elev = (below[col] > max_elev) ? below[col] : max_elev;
+        max_elev = (below[col + 1] > max_elev) ? below[col + 1] : max_elev;
+
+        // Update if max_elev is shoaler and neither is nodata (no branches):
+        const int update = (max_elev > row[col]) & (fabs(max_elev - nodata) > EPSILON) & (fabs(row[col] - nodata) > EPSILON);
+        out[col] = update ? max_elev : row[col];
+    }
+}
+
+
+/*
+*   Offset of a row (see offset.c), skips NoData cells
+*/
+KERNEL_INLINE void offsetRowBody(float *row, const int cols, const float offset, const float nodata) {
+    for (int col = 0; col < cols; col++) {
+        const float z = row[col];
+        const float depth = z + offset;
+        row[col] = (fabs(z - nodata) < EPSILON) ? z : depth;
+    }
+}
+
+
+/*
+*   Separation surface offset of a row (see offset.c), skips NoData cells
+*   - Sum and weightsum are the grid rows blended for this row (nodata grid cells have no weight),
+*     index and weight the grid columns of the surface columns
+*   - Cells without separation (zero weight) become NoData
+*   - Constant offset is added after the separation (same result as a separate -offset step)
+*   - Arrays never overlap (restrict), grid columns are read with vector gathers
+*/
+KERNEL_INLINE void offsetGridRowBody(float *restrict row, const int cols, const int *restrict index, const float *restrict weight, const float *restrict sum, const float *restrict weightsum, const float offset, const float nodata) {
+    for (int col = 0; col < cols; col++) {
+        const float z = row[col];
+        const int left = index[col];
+        const float numerator = sum[left] + (sum[left + 1] - sum[left]) * weight[col];
+        const float denominator = weightsum[left] + (weightsum[left + 1] - weightsum[left]) * weight[col];
+        const float depth = (z + numerator / ((denominator > 0.0f) ? denominator : 1.0f)) + offset;
+        const float shifted = (denominator > 0.0f) ? depth : nodata;
+        row[col] = (fabs(z - nodata) < EPSILON) ? z : shifted;
+    }
+}
+
+
+/*
+*   Safety audit of a row (see safety_audit.c), counts the cells of the input with data (checked)
+*   and returns the number of them that are deeper than the input beyond the tolerance or lost their data
+*   - Counts are kept in masks of the lanes (no branches), so the row is reduced with vectors
+*/
+KERNEL_INLINE int auditRowBody(const float *restrict input, const float *restrict output, const int cols, const float tolerance, const float nodata, int *checked) {
+    int valid = 0;
+    int problems = 0;
+
+    for (int col = 0; col < cols; col++) {
+        const float in = input[col];
+        const float out = output[col];
+        const int has_input = (fabs(in - nodata) < EPSILON) ? 0 : 1;
+        const int lost = (fabs(out - nodata) < EPSILON) ? 1 : 0;
+        const int deeper = (out - in < -tolerance) ? 1 : 0;
+        valid += has_input;
+        problems += has_input & (lost | deeper);
+    }
+
+    *checked = valid;
+    return problems;
+}
+
+
+// Kernel variants for every instruction set:
+#define SIMD_ROW_KERNELS(SUFFIX, TARGET) \
+    TARGET static void smoothLaplacianRow##SUFFIX(const float *above, const float *row, const float *below, float *out, const int cols, const double xWeight, const double yWeight, const double nodata) { \
+        smoothLaplacianRowBody(above, row, below, out, cols, xWeight, yWeight, nodata); } \
+    TARGET static void maxFilterRow##SUFFIX(const float *above, const float *row, const float *below, float *out, const int cols, const float nodata) { \
+        maxFilterRowBody(above, row, below, out, cols, nodata); } \
+    TARGET static void offsetRow##SUFFIX(float *row, const int cols, const float offset, const float nodata) { \
+        offsetRowBody(row, cols, offset, nodata); } \
+    TARGET static void offsetGridRow##SUFFIX(float *row, const int cols, const int *index, const float *weight, const float *sum, const float *weightsum, const float offset, const float nodata) { \
+        offsetGridRowBody(row, cols, index, weight, sum, weightsum, offset, nodata); } \
+    TARGET static int auditRow##SUFFIX(const float *input, const float *output, const int cols, const float tolerance, const float nodata, int *checked) { \
+        return auditRowBody(input, output, cols, tolerance, nodata, checked); }
+
+SIMD_ROW_KERNELS(Generic, )
+#if SIMD_X86
+SIMD_ROW_KERNELS(Avx2, TARGET_AVX2)
+SIMD_ROW_KERNELS(Avx512, TARGET_AVX512)
+#endif
+
+
+// Selected kernel variant, generic variant until selectSimdKernels is called:
+struct SimdKernels simd = {SIMD_GENERIC, "generic", smoothLaplacianRowGeneric, maxFilterRowGeneric, offsetRowGeneric, offsetGridRowGeneric, auditRowGeneric};
+
+
+/*
+*   Selects kernel variant
+*   - Name: "sse2" (or "generic"), "avx2", "avx512" or NULL for the best variant of the CPU
+*   - Returns FALSE if the variant is unknown or not supported by the CPU
+*/
+char selectSimdKernels(const char *name) {
+    char level = SIMD_GENERIC;
+
+#if SIMD_X86
+    __builtin_cpu_init();
+    const char avx2 = __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+    const char avx512 = __builtin_cpu_supports("avx512f") ? TRUE : FALSE;
+
+    if (name == NULL) {                                                 // Best supported variant
+        level = avx512 ? SIMD_AVX512 : (avx2 ? SIMD_AVX2 : SIMD_GENERIC);
+    }   else if (strcmp(name, "sse2") == 0 || strcmp(name, "generic") == 0) {
+        level = SIMD_GENERIC;
+    }   else if (strcmp(name, "avx2") == 0 && avx2) {
+        level = SIMD_AVX2;
+    }   else if (strcmp(name, "avx512") == 0 && avx512) {
+        level = SIMD_AVX512;
+    }   else {
+        return FALSE;
+    }
+#else
+    if (name != NULL && strcmp(name, "generic") != 0) {
+        return FALSE;
+    }
+#endif
+
+    simd.level = level;
+
+    if (level == SIMD_GENERIC) {
+        simd.name = SIMD_X86 ? "sse2" : "generic";
+        simd.smoothLaplacianRow = smoothLaplacianRowGeneric;
+        simd.maxFilterRow = maxFilterRowGeneric;
+        simd.offsetRow = offsetRowGeneric;
+        simd.offsetGridRow = offsetGridRowGeneric;
+        simd.auditRow = auditRowGeneric;
+    }
+#if SIMD_X86
+    else if (level == SIMD_AVX2) {
+        simd.name = "avx2";
+        simd.smoothLaplacianRow = smoothLaplacianRowAvx2;
+        simd.maxFilterRow = maxFilterRowAvx2;
+        simd.offsetRow = offsetRowAvx2;
+        simd.offsetGridRow = offsetGridRowAvx2;
+        simd.auditRow = auditRowAvx2;
+    }   else {
+        simd.name = "avx512";
+        simd.smoothLaplacianRow = smoothLaplacianRowAvx512;
+        simd.maxFilterRow = maxFilterRowAvx512;
+        simd.offsetRow = offsetRowAvx512;
+        simd.offsetGridRow = offsetGridRowAvx512;
+        simd.auditRow = auditRowAvx512;
+    }
+#endif
+
+    return TRUE;
+}
@@ -0,0 +1,670 @@
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Stack mode: co-registered epochs of the same area (repeat surveys with identical
+*     grids) are processed together with the same process chain, one output per epoch
+*   - Stacked surface storage: epochs of a cell are interleaved (cell by cell, epochs of
+*     a cell are consecutive floats), so every operator visits each cell once for all epochs
+*   - Surface operators for stacked surfaces (shoal buffering, offset, Laplacian, Rolling Coin)
+*
+*   Index computations (neighbours, edge cases, coin chords clipped to the surface) are done
+*   once per cell, the inner loops run over the epochs of the cell (contiguous, vectorised).
+*   Results are identical to processing each epoch on its own.
+*
+*   Input is a text file with one epoch path per line (as tile lists of mosaic mode),
+*   outputs are written to the output directory with the names of the epochs:
+*
+*       surfacetools -stack [epochs.txt] [outputdirectory] [process steps]
+*/
+
+
+/*
+*   Stack mode: reads the epochs, checks process steps, processes all epochs in one stack
+*   - Exits on faulty parameters or if an epoch can't be read or written
+*/
+void runStack(int argc, const char *argv[]) {
+    char inputflag = 1;         // Inputs assumed to be ok
+    struct stat st;
+
+    // Check input process commands and parameters:
+    printf("Process steps:\n");
+    for (int i = 4; i < argc; i++) {
+        // Stacks have operators of their own, steps with outputs of their own are not available:
+        const char unavailable = (strcmp(argv[i], "-compact") == 0 || strcmp(argv[i], "-rollcoin-sweep") == 0 || strcmp(argv[i], "-contours") == 0
+                                  || strcmp(argv[i], "-offset-grid") == 0 || strcmp(argv[i], "-audit") == 0);
+        int last = unavailable ? -1 : checkProcessStep(argc, argv, i);
+
+        if (unavailable) {
+            printf("  -Not available in stack mode: %s\n", argv[i]);
+        }
+        if (last < 0) {
+            inputflag = 0;
+            continue;
+        }
+        i = last;
+    }
+
+    // Output directory is created if it doesn't exist:
+    if (isVirtualPath(argv[3]) == TRUE || (stat(argv[3], &st) != 0 && mkdir(argv[3], 0777) != 0) || stat(argv[3], &st) != 0 || !S_ISDIR(st.st_mode)) {
+        printf("Output directory can't be used: %s\n", argv[3]);
+        inputflag = 0;
+    }
+
+    if (inputflag != 1) {
+        printf("Faulty parameters detected. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char **epochfps = mosaicTileList(argv[2]);
+    const int count = CSLCount(epochfps);
+
+    if (count == 0) {
+        printf("No epochs found in: %s\nExiting.\n", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Outputs: epoch file names as GeoTIFFs in output directory:
+    char **outputfps = calloc(count, sizeof(char *));
+    for (int i = 0; i < count; i++) {
+        const char *filename = CPLGetFilename(epochfps[i]);
+        const char *extension = strrchr(filename, '.');
+        const int stem = (extension != NULL) ? (int)(extension - filename) : (int)strlen(filename);
+
+        outputfps[i] = calloc(strlen(argv[3]) + stem + 6, 1);
+        sprintf(outputfps[i], "%s/%.*s.tif", argv[3], stem, filename);
+
+        for (int j = 0; j < i; j++) {
+            if (strcmp(outputfps[j], outputfps[i]) == 0) {
+                printf("Epochs %s and %s have the same output file name.\nExiting.\n", epochfps[j], epochfps[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    struct StackSurface *stack = inputStackDepthModel(epochfps, count);
+
+    for (int i = 4; i < argc; i++) {
+        i = applyStackStep(stack, argc, argv, i);
+        if (i < 0) {
+            printf("Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const int written = writeStackSurfaceToFiles(stack, (const char **)outputfps);
+    if (written < 0) {
+        printf("Memory allocation failed: epoch output\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("Done. %d of %d epochs exported to directory: %s\n\n", written, count, argv[3]);
+
+    freeStackSurface(stack);
+    for (int i = 0; i < count; i++) {
+        free(outputfps[i]);
+    }
+    free(outputfps);
+    CSLDestroy(epochfps);
+
+    if (written < count) {
+        printf("Export was not successful.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/*
+*   Applies a single (checked) process step to a stacked surface, starting from argv[i]
+*   - Returns the index of the last argument used by the step, -1 if memory can't be allocated
+*/
+int applyStackStep(struct StackSurface *stack, int argc, const char *argv[], int i) {
+    if (strcmp(argv[i], "-buffer") == 0) {
+        if (maxFilterStack(stack) == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+    }   else if (strcmp(argv[i], "-offset") == 0 && argc > i+1) {
+        offsetStack(stack, atof(argv[i+1]));
+        i++;
+    }   else if (strcmp(argv[i], "-laplacian") == 0 && argc > i+1) {
+        if (smoothLaplacianStack(atoi(argv[i+1]), stack) == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+        i++;
+    }   else if (strcmp(argv[i], "-compress") == 0 && argc > i+1) {
+        setOutputCompression(argv[i+1]);
+        i++;
+    }   else if (strcmp(argv[i], "-stats") == 0) {
+        setStatisticsPrinting(TRUE);
+    }   else if (strcmp(argv[i], "-simd") == 0 && argc > i+1) {
+        selectSimdKernels(argv[i+1]);
+        i++;
+    }   else if (strcmp(argv[i], "-rollcoin") == 0 && argc > i+2) {
+        char trimflag = (strcmp(argv[i+2], "trim") == 0) ? TRUE : FALSE;
+        struct Coin *penny = createCoin(atoi(argv[i+1]), trimflag);
+        const char rolled = (penny != NULL) ? coinRollStack(stack, penny) : FALSE;
+        if (penny != NULL) {
+            freeCoin(penny);
+        }
+        if (rolled == FALSE) {
+            printf("Memory allocation failed: %s\n", argv[i]);
+            return -1;
+        }
+        i+=2;
+    }
+
+    return i;
+}
+
+
+/*
+*   Builds a stacked surface from epoch files
+*   - Epochs are read one at a time (see inputDepthModel) and interleaved into the stack
+*   - All epochs must have the size, georeferencing and nodata of the first epoch
+*   - Exits if an epoch can't be read or doesn't match, or if memory can't be allocated
+*/
+struct StackSurface *inputStackDepthModel(char **epochfps, const int count) {
+    struct StackSurface *ret = calloc(1, sizeof(struct StackSurface));
+    if (ret == NULL || (ret->inputfp = calloc(count, sizeof(char *))) == NULL) {
+        printf("Memory allocation failed.\nExiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    ret->bands = count;
+
+    for (int i = 0; i < count; i++) {
+        struct FloatSurface *epoch = inputDepthModel(epochfps[i]);
+
+        if (i == 0) {
+            ret->projection = calloc(strlen(epoch->projection) + 1, 1);
+            strcpy(ret->projection, epoch->projection);
+            ret->geotransform = calloc(6, sizeof(double));
+            memcpy(ret->geotransform, epoch->geotransform, 6 * sizeof(double));
+            ret->nodata = epoch->nodata;
+            ret->rows = epoch->rows;
+            ret->cols = epoch->cols;
+            ret->array = createFloatArray(ret->cols * ret->bands, ret->rows);
+            if (ret->array == NULL) {
+                printf("Memory allocation failed: stack of %d epochs\nExiting.\n", ret->bands);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        char same = (epoch->rows == ret->rows && epoch->cols == ret->cols && fabs(epoch->nodata - ret->nodata) < EPSILON) ? TRUE : FALSE;
+        for (int j = 0; j < 6; j++) {
+            if (fabs(epoch->geotransform[j] - ret->geotransform[j]) > 1e-6 * fabs(ret->geotransform[1])) {
+                same = FALSE;
+            }
+        }
+        if (same == FALSE) {
+            printf("Epoch is not on the grid of the first epoch (size, georeferencing and nodata must match): %s\nExiting.\n", epochfps[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        ret->inputfp[i] = calloc(strlen(epochfps[i]) + 1, 1);
+        strcpy(ret->inputfp[i], epochfps[i]);
+
+        // Epoch is copied to its place in every cell of the stack:
+        struct BandOperands operands = {epoch, NULL, i, 0.0, NULL, NULL, NULL, NULL, ret, NULL, NULL, NULL};
+        runRowBands(ret->rows, ret->cols * ret->bands, interleaveEpochBand, &operands);
+        freeFloatSurface(epoch);
+    }
+
+    printf("Stack: %d epochs, %d x %d cells\n", ret->bands, ret->cols, ret->rows);
+    return ret;
+}
+
+
+/*
+*   Copies the rows of a row band of an epoch surface into the stack (epoch index: iterations)
+*/
+void interleaveEpochBand(struct RowBand *band) {
+    const struct FloatSurface *epoch = band->operands->src;
+    struct StackSurface *stack = band->operands->stack;
+    const int k = band->operands->iterations;
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        float *cells = stack->array[row];
+        for (int col = 0; col < stack->cols; col++) {
+            cells[(size_t)col * stack->bands + k] = epoch->array[row][col];
+        }
+    }
+}
+
+
+/*
+*   Copies the rows of a row band of an epoch from the stack into an epoch surface (epoch index: iterations)
+*/
+void extractEpochBand(struct RowBand *band) {
+    struct FloatSurface *epoch = band->operands->src;
+    const struct StackSurface *stack = band->operands->stack;
+    const int k = band->operands->iterations;
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        const float *cells = stack->array[row];
+        for (int col = 0; col < stack->cols; col++) {
+            epoch->array[row][col] = cells[(size_t)col * stack->bands + k];
+        }
+    }
+}
+
+
+/*
+*   Writes every epoch of a stacked surface to its output file
+*   - Epochs are copied one at a time into a surface of one epoch (see writeSurfaceToFile)
+*   - Returns the number of epochs written, -1 if memory can't be allocated
+*/
+int writeStackSurfaceToFiles(struct StackSurface *stack, const char **outputfps) {
+    float **array = createFloatArray(stack->cols, stack->rows);
+    int ret = 0;
+
+    if (array == NULL) {
+        return -1;
+    }
+
+    for (int i = 0; i < stack->bands; i++) {
+        struct FloatSurface epoch = {stack->inputfp[i], stack->projection, stack->geotransform, array, stack->nodata, stack->rows, stack->cols};
+        struct BandOperands operands = {&epoch, NULL, i, 0.0, NULL, NULL, NULL, NULL, stack, NULL, NULL, NULL};
+        runRowBands(stack->rows, stack->cols * stack->bands, extractEpochBand, &operands);
+
+        struct SurfaceStatistics statistics;
+        printf("Epoch %d/%d: %s --> ", i + 1, stack->bands, stack->inputfp[i]);
+        if (exportSurface(&epoch, outputfps[i], &statistics) == TRUE) {
+            printf("%s\n", outputfps[i]);
+            if (statisticsPrinting() == TRUE) {
+                printStatisticsJson(&statistics, outputfps[i]);
+            }
+            ret++;
+        }   else {
+            printf("FAILED\n");
+        }
+        free(statistics.histogram);
+    }
+
+    freeFloatArray(array, stack->rows);
+    fflush(stdout);
+    return ret;
+}
+
+
+/*
+*   Shoal buffering of all epochs (3 x 3 cell focal maximum, see maxFilterSurface)
+*   - Returns FALSE if memory can't be allocated (stack is not changed)
+*/
+char maxFilterStack(struct StackSurface *stack) {
+    const int count = rowBandCount(stack->rows, stack->cols * stack->bands);
+    float **temp = acquireScratchArray(stack->cols * stack->bands, stack->rows);
+    float **bandcells = createFloatArray(stack->bands, count);
+
+    if (temp == NULL || bandcells == NULL) {
+        releaseScratchArray(temp, stack->rows);
+        freeFloatArray(bandcells, count);
+        return FALSE;
+    }
+    printStepStart("Buffering shoals");
+
+    struct BandOperands operands = {NULL, temp, 0, 0.0, NULL, NULL, NULL, NULL, stack, NULL, NULL, bandcells};
+    runRowBands(stack->rows, stack->cols * stack->bands, maxFilterStackBand, &operands);
+
+    releaseScratchArray(temp, stack->rows);
+    freeFloatArray(bandcells, count);
+    printStepDone();
+    return TRUE;
+}
+
+
+/*
+*   Filters the rows of a row band for all epochs
+*   - Original depths of the band are copied first, bands wait for each other before filtering
+*   - Neighbours outside the surface are left out (as in maxFilterCell)
+*/
+void maxFilterStackBand(struct RowBand *band) {
+    struct StackSurface *stack = band->operands->stack;
+    float **temp = band->operands->temp;
+    const int bands = stack->bands;
+    const float nodata = stack->nodata;
+    const float placeholder = -15000.0;
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        memcpy(temp[row], stack->array[row], (size_t)stack->cols * bands * sizeof(float));
+    }
+    waitRowBands(band);
+
+    float *shoalest = band->operands->bandcells[band->index];
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        const int first_row = (row > 0) ? row - 1 : row;
+        const int last_row = (row < stack->rows - 1) ? row + 1 : row;
+
+        for (int col = 0; col < stack->cols; col++) {
+            const int first_col = (col > 0) ? col - 1 : col;
+            const int last_col = (col < stack->cols - 1) ? col + 1 : col;
+
+            for (int k = 0; k < bands; k++) {
+                shoalest[k] = placeholder;
+            }
+            for (int r = first_row; r <= last_row; r++) {
+                for (int c = first_col; c <= last_col; c++) {
+                    if (r == row && c == col) {
+                        continue;
+                    }
+                    const float *depths = &temp[r][(size_t)c * bands];
+                    for (int k = 0; k < bands; k++) {
+                        shoalest[k] = (depths[k] > shoalest[k]) ? depths[k] : shoalest[k];
+                    }
+                }
+            }
+
+            // Cell gets the shoalest neighbour if it is shoaler and neither is nodata:
+            float *cells = &stack->array[row][(size_t)col * bands];
+            for (int k = 0; k < bands; k++) {
+                const char update = shoalest[k] > cells[k] && fabs(shoalest[k] - nodata) > EPSILON && fabs(cells[k] - nodata) > EPSILON;
+                cells[k] = update ? shoalest[k] : cells[k];
+            }
+        }
+    }
+}
+
+
+/*
+*   Offset of all epochs, skips NoData cells (see offset)
+*/
+void offsetStack(struct StackSurface *stack, const float offset) {
+    printStepStart("Offsetting surface");
+
+    // Offset is the same for every cell, rows of the stack are offset as rows of a surface:
+    struct BandOperands operands = {NULL, NULL, 0, offset, NULL, NULL, NULL, NULL, stack, NULL, NULL, NULL};
+    runRowBands(stack->rows, stack->cols * stack->bands, offsetStackBand, &operands);
+
+    printStepDone();
+}
+
+
+/*
+*   Offsets the rows of a row band (row kernel, see simd_kernels.c)
+*/
+void offsetStackBand(struct RowBand *band) {
+    struct StackSurface *stack = band->operands->stack;
+
+    for (int row = band->first_row; row < band->last_row; row++) {
+        simd.offsetRow(stack->array[row], stack->cols * stack->bands, band->operands->value, stack->nodata);
+    }
+}
+
+
+/*
+*   Laplacian smoothing of all epochs, N iterations (see smoothLaplacian)
+*   - Returns FALSE if memory can't be allocated (stack is not changed)
+*/
+char smoothLaplacianStack(const int iterations, struct StackSurface *stack) {
+    float **temp = acquireScratchArray(stack->cols * stack->bands, stack->rows);
+
+    if (temp == NULL) {
+        return FALSE;
+    }
+    printStepStart("Laplacian smoothing");
+
+    struct BandOperands operands = {NULL, temp, iterations, 0.0, NULL, NULL, NULL, NULL, stack, NULL, NULL, NULL};
+    runRowBands(stack->rows, stack->cols * stack->bands, smoothLaplacianStackBand, &operands);
+
+    releaseScratchArray(temp, stack->rows);
+    printStepDone();
+    return TRUE;
+}
+
+
+/*
+*   Smooths the rows of a row band N times for all epochs
+*   - Bands wait for each other after every iteration, data arrays are swapped
+*     in a copy of the stack, result is copied to the original data array
+*/
+void smoothLaplacianStackBand(struct RowBand *band) {
+    struct StackSurface *stack = band->operands->stack;
+    struct StackSurface surf = *stack;
+    const int iterations = band->operands->iterations;
+    float **smooth_array = band->operands->temp;
+    float **holder = NULL;
+
+    for (int i = 0; i < iterations; i++) {
+        for (int row = band->first_row; row < band->last_row; row++) {
+            for (int col = 0; col < surf.cols; col++) {
+                smoothLaplacianStackCell(&surf, smooth_array, row, col);
+            }
+        }
+        waitRowBands(band);
+
+        holder = surf.array;
+        surf.array = smooth_array;
+        smooth_array = holder;
+        printStepProgress((i + 1.0) / iterations);
+    }
+
+    // Result must be in the original data array (odd number of swaps):
+    if (surf.array != stack->array) {
+        for (int row = band->first_row; row < band->last_row; row++) {
+            memcpy(stack->array[row], surf.array[row], (size_t)surf.cols * surf.bands * sizeof(float));
+        }
+    }
+}
+
+
+/*
+*   Smooths a cell of all epochs, result is written to smooth array
+*   - Same arithmetic and order of neighbours as getSafeSmoothDepth (and the row kernel),
+*     so results are identical to smoothing each epoch on its own:
+*       - cells between edges: up, down, left, right
+*       - corners: left or right, up or down
+*       - left and right edges: left or right, up, down
+*       - top and bottom rows: down or up, left, right
+*/
+void smoothLaplacianStackCell(struct StackSurface *stack, float **smooth_array, const int row, const int col) {
+    const double xWeight = fabs(stack->geotransform[5]) / fabs(stack->geotransform[1]);
+    const double yWeight = fabs(stack->geotransform[1]) / fabs(stack->geotransform[5]);
+    const double nodata = stack->nodata;
+    const size_t bands = stack->bands;
+    const float *neighbours[4];
+    double weights[4];
+    int count = 0;
+
+    const char top = (row == 0);
+    const char bottom = (row == stack->rows - 1);
+    const char left = (col == 0);
+    const char right = (col == stack->cols - 1);
+    const float *up = (top == FALSE) ? &stack->array[row - 1][col * bands] : NULL;
+    const float *down = (bottom == FALSE) ? &stack->array[row + 1][col * bands] : NULL;
+    const float *west = (left == FALSE) ? &stack->array[row][(col - 1) * bands] : NULL;
+    const float *east = (right == FALSE) ? &stack->array[row][(col + 1) * bands] : NULL;
+
+    if ((top || bottom) && (left || right)) {           // Corners
+        neighbours[count] = left ? east : west;
+        weights[count++] = xWeight;
+        neighbours[count] = top ? down : up;
+        weights[count++] = yWeight;
+    }   else if (left || right) {                       // Left and right edges
+        neighbours[count] = left ? east : west;
+        weights[count++] = xWeight;
+        neighbours[count] = up;
+        weights[count++] = yWeight;
+        neighbours[count] = down;
+        weights[count++] = yWeight;
+    }   else if (top || bottom) {                       // Top and bottom rows
+        neighbours[count] = top ? down : up;
+        weights[count++] = yWeight;
+        neighbours[count] = west;
+        weights[count++] = xWeight;
+        neighbours[count] = east;
+        weights[count++] = xWeight;
+    }   else {                                          // Cells between edges
+        neighbours[count] = up;
+        weights[count++] = yWeight;
+        neighbours[count] = down;
+        weights[count++] = yWeight;
+        neighbours[count] = west;
+        weights[count++] = xWeight;
+        neighbours[count] = east;
+        weights[count++] = xWeight;
+    }
+
+    const float *cells = &stack->array[row][col * bands];
+    float *out = &smooth_array[row][col * bands];
+
+    for (size_t k = 0; k < bands; k++) {
+        const float z = cells[k];
+        double sum = 0.0;
+        double weightSum = 0.0;
+        int valid = 0;
+
+        for (int i = 0; i < count; i++) {
+            const int data = fabs(neighbours[i][k] - nodata) > EPSILON;
+            sum += data ? neighbours[i][k] * weights[i] : 0.0;
+            weightSum += data ? weights[i] : 0.0;
+            valid += data;
+        }
+
+        // Interpolate only if at least 2 valid neighbors, return safer value:
+        const float interpolated = (float)(sum / ((valid >= 2) ? weightSum : 1.0));
+        const float estimate = (valid >= 2) ? interpolated : z;
+        const float safe = (fabs(estimate) < fabs(z)) ? estimate : z;
+
+        out[k] = (fabs(z - nodata) > EPSILON) ? safe : (float)nodata;
+    }
+}
+
+
+/*
+*   Rolling Coin of all epochs (see coinRollSurface and coin_kernels.c)
+*   - Coin is described by its chords (half widths of coin rows), any radius
+*   - Two passes: shoalest depth on the coin of every cell, then every cell gets
+*     the deepest shoalest depth of the coins covering it
+*   - Returns FALSE if memory can't be allocated (stack is not changed)
+*/
+char coinRollStack(struct StackSurface *stack, struct Coin *penny) {
+    const int count = rowBandCount(stack->rows, stack->cols * stack->bands);
+    float **temp = acquireScratchArray(stack->cols * stack->bands, stack->rows);
+    float **bandcells = createFloatArray(stack->bands, count);
+    int *chords = calloc(penny->diameter, sizeof(int));
+
+    if (temp == NULL || bandcells == NULL || chords == NULL) {
+        releaseScratchArray(temp, stack->rows);
+        freeFloatArray(bandcells, count);
+        free(chords);
+        return FALSE;
+    }
+    printStepStart("Rolling Coin");
+    getCoinChords(penny, chords);
+
+    struct BandOperands operands = {NULL, temp, 0, 0.0, NULL, NULL, NULL, NULL, stack, penny, chords, bandcells};
+    runRowBands(stack->rows, stack->cols * stack->bands, coinRollStackBand, &operands);
+
+    releaseScratchArray(temp, stack->rows);
+    freeFloatArray(bandcells, count);
+    free(chords);
+    printStepDone();
+    return TRUE;
+}
+
+
+/*
+*   Rolls the coin over the rows of a row band for all epochs
+*   - Nodata is masked first, bands wait for each other between passes
+*     (coins of the edge rows of a band reach rows of the neighbouring bands)
+*   - Modifies the stack
+*/
+void coinRollStackBand(struct RowBand *band) {
+    struct StackSurface *stack = band->operands->stack;
+    const struct Coin *penny = band->operands->coin;
+    float **shoalest = band->operands->temp;
+    const size_t bands = stack->bands;
+    const int radius = penny->radius;
+    const float nodata = stack->nodata;
+    const float placeholder = -999999.0;        // Masked nodata, never the shoalest depth
+    const float unpressed = 10000.0;            // Cells not on any coin (with depths)
+    const int bandrows = band->last_row - band->first_row;
+    const int *chords = band->operands->chords;              // Coin rows are continuous and centred
+    float *extreme = band->operands->bandcells[band->index];
+
+    // Mask nodata:
+    for (int row = band->first_row; row < band->last_row; row++) {
+        float *cells = stack->array[row];
+        for (size_t i = 0; i < (size_t)stack->cols * bands; i++) {
+            cells[i] = (fabs(cells[i] - nodata) < EPSILON) ? placeholder : cells[i];
+        }
+    }
+    waitRowBands(band);
+
+    // 1. Shoalest depth on coin (maximum elevation):
+    for (int row = band->first_row; row < band->last_row; row++) {
+        for (int col = 0; col < stack->cols; col++) {
+            for (size_t k = 0; k < bands; k++) {
+                extreme[k] = placeholder;
+            }
+            for (int row_coin = -radius; row_coin <= radius; row_coin++) {
+                const int chord = chords[row_coin + radius];
+                if (row + row_coin < 0 || row + row_coin >= stack->rows || chord < 0) {    // Partial coin on surface edges
+                    continue;
+                }
+                const int first_col = (col - chord > 0) ? col - chord : 0;
+                const int last_col = (col + chord < stack->cols - 1) ? col + chord : stack->cols - 1;
+                const float *depths = stack->array[row + row_coin];
+
+                for (size_t i = first_col * bands; i < (last_col + 1) * bands; i += bands) {
+                    for (size_t k = 0; k < bands; k++) {
+                        extreme[k] = (depths[i + k] > extreme[k]) ? depths[i + k] : extreme[k];
+                    }
+                }
+            }
+
+            float *shoals = &shoalest[row][col * bands];
+            for (size_t k = 0; k < bands; k++) {
+                shoals[k] = (extreme[k] > placeholder) ? extreme[k] : unpressed;     // Coins without depths press nothing
+            }
+        }
+        printStepProgress(0.5 * (row + 1.0 - band->first_row) / bandrows);
+    }
+    waitRowBands(band);
+
+    // 2. Press shoalest depths to coin areas, restore nodata (safety first):
+    for (int row = band->first_row; row < band->last_row; row++) {
+        for (int col = 0; col < stack->cols; col++) {
+            for (size_t k = 0; k < bands; k++) {
+                extreme[k] = unpressed;
+            }
+            for (int row_coin = -radius; row_coin <= radius; row_coin++) {
+                const int chord = chords[row_coin + radius];
+                if (row + row_coin < 0 || row + row_coin >= stack->rows || chord < 0) {
+                    continue;
+                }
+                const int first_col = (col - chord > 0) ? col - chord : 0;
+                const int last_col = (col + chord < stack->cols - 1) ? col + chord : stack->cols - 1;
+                const float *shoals = shoalest[row + row_coin];
+
+                for (size_t i = first_col * bands; i < (last_col + 1) * bands; i += bands) {
+                    for (size_t k = 0; k < bands; k++) {
+                        extreme[k] = (shoals[i + k] < extreme[k]) ? shoals[i + k] : extreme[k];
+                    }
+                }
+            }
+
+            float *cells = &stack->array[row][col * bands];
+            for (size_t k = 0; k < bands; k++) {
+                cells[k] = (cells[k] <= placeholder) ? nodata : extreme[k];        // Masked nodata
+            }
+        }
+        printStepProgress(0.5 + 0.5 * (row + 1.0 - band->first_row) / bandrows);
+    }
+}
+
+
+/*
+*   Frees a stacked surface
+*/
+void freeStackSurface(struct StackSurface *stack) {
+    for (int i = 0; i < stack->bands; i++) {
+        free(stack->inputfp[i]);
+    }
+    free(stack->inputfp);
+    free(stack->projection);
+    free(stack->geotransform);
+    freeFloatArray(stack->array, stack->rows);
+    free(stack);
+}
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE     // Nanosecond modification times and read-ahead advice are not declared in strict C17
+#include "bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Sidecar cache of decoded input surfaces: the first load of an input writes the
+*     cells as a raw float array ([inputfile].btcache), later loads memory map it
+*     instead of decoding the (compressed) raster again
+*   - Cache file holds projection, geotransform and nodata value (nodata cells are
+*     the validity mask), cells are in the layout of createFloatArray (aligned rows),
+*     so the mapping is used as the data array without copying
+*   - Cache is used only if size, modification time and inode of the input are the
+*     ones it was made from, otherwise it is written again
+*   - Mapping is private: pages are read from the page cache on first use, pages an
+*     operator writes to are copied, the cache file itself is never changed
+*
+*   Caching is enabled with an environment variable:
+*       BATHYTOOLS_CACHE = on (cache file next to the input) / directory (cache files in the directory)
+*
+*   Cache file layout (allocation record and row pointers are filled in the mapping, see freeFloatArray):
+*
+*       [SurfaceCacheHeader][projection]...[ArrayAllocation][row pointers][row 0 | pad] ... [row N-1 | pad]
+*/
+
+
+/*
+*   Cache file path of an input
+*   - Caching is enabled with BATHYTOOLS_CACHE, only local files are cached (not virtual paths or standard input)
+*   - Returns TRUE if the input is cached, path is written to cachefp
+*/
+char surfaceCachePath(const char *inputfp, char *cachefp, const size_t size) {
+    const char *setting = getenv("BATHYTOOLS_CACHE");
+    struct stat st;
+
+    if (setting == NULL || setting[0] == '\0' || strcmp(setting, "off") == 0) {
+        return FALSE;
+    }
+    if (isVirtualPath(inputfp) == TRUE || stat(inputfp, &st) != 0 || S_ISREG(st.st_mode) == 0) {
+        return FALSE;
+    }
+
+    int len;
+    if (strcmp(setting, "on") == 0) {
+        len = snprintf(cachefp, size, "%s%s", inputfp, SURFACE_CACHE_SUFFIX);
+    }   else {
+        // Cache directory: file name of the input (inode check tells inputs of other directories apart):
+        const char *name = strrchr(inputfp, '/');
+        len = snprintf(cachefp, size, "%s/%s%s", setting, (name != NULL) ? name + 1 : inputfp, SURFACE_CACHE_SUFFIX);
+    }
+
+    return (len > 0 && (size_t)len < size) ? TRUE : FALSE;
+}
+
+
+/*
+*   Memory maps a cache file as a new surface
+*   - Cache must be made from the input as it is now (size, modification time, inode)
+*   - Data array of the surface is the mapping, it is unmapped by freeFloatArray
+*   - Returns NULL if there is no usable cache (input is read and the cache written again)
+*/
+struct FloatSurface *readSurfaceCache(const char *cachefp, const char *inputfp) {
+    struct stat input;
+    struct stat st;
+
+    if (stat(inputfp, &input) != 0) {
+        return NULL;
+    }
+
+    int fd = open(cachefp, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct SurfaceCacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    // Writable private mapping: row pointers are written into it, operators change cells in place:
+    const size_t size = st.st_size;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const struct SurfaceCacheHeader *header = (const struct SurfaceCacheHeader *)map;
+
+    if (memcmp(header->magic, SURFACE_CACHE_MAGIC, sizeof(header->magic)) != 0 || header->projection_length < 1
+        || header->rows < 1 || header->cols < 1 || header->stride < (uint64_t)header->cols
+        || header->dataoffset != surfaceCacheDataOffset(header->projection_length, header->rows)
+        || size != header->dataoffset + header->rows * header->stride * sizeof(float)
+        || map[sizeof(struct SurfaceCacheHeader) + header->projection_length - 1] != '\0'
+        || header->source_size != (uint64_t)input.st_size || header->source_inode != (uint64_t)input.st_ino
+        || header->source_mtime != (int64_t)input.st_mtim.tv_sec * 1000000000 + input.st_mtim.tv_nsec) {
+        munmap(map, size);
+        return NULL;
+    }
+
+    struct FloatSurface *ret = calloc(1, sizeof(struct FloatSurface));
+    ret->inputfp = calloc(strlen(inputfp) + 1, 1);
+    strcpy(ret->inputfp, inputfp);
+    ret->projection = calloc(header->projection_length, 1);
+    memcpy(ret->projection, map + sizeof(struct SurfaceCacheHeader), header->projection_length);
+    ret->geotransform = calloc(6, sizeof(double));
+    memcpy(ret->geotransform, header->geotransform, 6 * sizeof(double));
+    ret->nodata = header->nodata;
+    ret->rows = header->rows;
+    ret->cols = header->cols;
+
+    // Allocation record and row pointers end at the first cell, like in arrays of createFloatArray:
+    char *data = map + header->dataoffset;
+    struct ArrayAllocation *record = (struct ArrayAllocation *)(data - sizeof(struct ArrayAllocation) - (size_t)ret->rows * sizeof(float *));
+    *record = (struct ArrayAllocation){map, size, header->stride, TRUE, HUGEPAGES_OFF};
+    ret->array = (float **)(record + 1);
+
+    for (int row = 0; row < ret->rows; row++) {
+        ret->array[row] = (float *)data + (size_t)row * record->stride;
+    }
+
+    // Pages are read ahead in the background, first process step doesn't wait for every fault:
+    madvise(data, size - header->dataoffset, MADV_WILLNEED);
+
+    return ret;
+}
+
+
+/*
+*   Writes the cache file of a surface read from an input
+*   - Written to [cache].[pid].tmp and renamed: processes mapping the previous
+*     cache keep their (unchanged) file, an interrupted write leaves no cache
+*   - Returns TRUE if the cache was written
+*/
+char writeSurfaceCache(const char *cachefp, const struct FloatSurface *surf) {
+    char tmpfp[1110];
+    struct stat input;
+
+    snprintf(tmpfp, sizeof(tmpfp), "%s.%d.tmp", cachefp, (int)getpid());
+    if (stat(surf->inputfp, &input) != 0) {
+        return FALSE;
+    }
+
+    const size_t projection = strlen(surf->projection) + 1;
+    const size_t stride = floatArrayStride(surf->array);
+    const size_t dataoffset = surfaceCacheDataOffset(projection, surf->rows);
+    const size_t size = dataoffset + (size_t)surf->rows * stride * sizeof(float);
+
+    int fd = open(tmpfp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return FALSE;
+    }
+
+    // File size is set by writing its last byte (padding and row pointer space stay zero):
+    if (lseek(fd, size - 1, SEEK_SET) < 0 || write(fd, "", 1) != 1) {
+        close(fd);
+        unlink(tmpfp);
+        return FALSE;
+    }
+
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        unlink(tmpfp);
+        return FALSE;
+    }
+
+    struct SurfaceCacheHeader *header = (struct SurfaceCacheHeader *)map;
+    memcpy(header->magic, SURFACE_CACHE_MAGIC, sizeof(header->magic));
+    header->source_size = input.st_size;
+    header->source_mtime = (int64_t)input.st_mtim.tv_sec * 1000000000 + input.st_mtim.tv_nsec;
+    header->source_inode = input.st_ino;
+    header->rows = surf->rows;
+    header->cols = surf->cols;
+    header->stride = stride;
+    header->dataoffset = dataoffset;
+    header->projection_length = (int32_t)projection;
+    header->nodata = surf->nodata;
+    memcpy(header->geotransform, surf->geotransform, 6 * sizeof(double));
+    memcpy(map + sizeof(struct SurfaceCacheHeader), surf->projection, projection);
+
+    float *cells = (float *)(map + dataoffset);
+    for (int row = 0; row < surf->rows; row++) {
+        memcpy(&cells[(size_t)row * stride], surf->array[row], surf->cols * sizeof(float));
+    }
+
+    const int synced = msync(map, size, MS_SYNC);
+    munmap(map, size);
+    close(fd);
+
+    if (synced != 0 || rename(tmpfp, cachefp) != 0) {
+        unlink(tmpfp);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/*
+*   Offset of the cells in a cache file: header, projection, allocation record and
+*   row pointers, rounded up to SURFACE_CACHE_ALIGNMENT (cells start at a page boundary)
+*/
+size_t surfaceCacheDataOffset(const size_t projection, const size_t rows) {
+    const size_t header = sizeof(struct SurfaceCacheHeader) + projection + sizeof(struct ArrayAllocation) + rows * sizeof(float *);
+
+    return (header + SURFACE_CACHE_ALIGNMENT - 1) / SURFACE_CACHE_ALIGNMENT * SURFACE_CACHE_ALIGNMENT;
+}
@@ -0,0 +1,92 @@
+#include "../bathymetrictools.h"
+
+/*
+*   This file contains:
+*   - Test of compact Laplacian smoothing against float32 smoothing
+*   - Many iterations on a surface of several row bands: every compact depth
+*     must be at most one centimetre shoaler than the float32 depth, never deeper,
+*     and nodata cells must be the same
+*
+*       make check
+*/
+
+#define TEST_ROWS       700
+#define TEST_COLS       90
+#define TEST_ITERATIONS 100
+#define TEST_NODATA     -9999.0
+
+
+int main(int argc, const char *argv[]) {
+    (void)argc;
+    (void)argv;
+    double geotransform[6] = {100000.0, 2.0, 0.0, 7000000.0, 0.0, -2.0};
+    struct FloatSurface *surf = calloc(1, sizeof(struct FloatSurface));
+    struct CompactSurface *csurf = calloc(1, sizeof(struct CompactSurface));
+    float *line = calloc(TEST_COLS, sizeof(float));
+    int failed = 0;
+    double maxdiff = 0.0;
+
+    selectSimdKernels(NULL);
+
+    // Centimetre precise depths (stored exactly in both storages), a nodata hole and edge cells:
+    surf->inputfp = "test";
+    surf->projection = "";
+    surf->geotransform = geotransform;
+    surf->nodata = TEST_NODATA;
+    surf->rows = TEST_ROWS;
+    surf->cols = TEST_COLS;
+    surf->array = createFloatArray(TEST_COLS, TEST_ROWS);
+    for (int row = 0; row < TEST_ROWS; row++) {
+        for (int col = 0; col < TEST_COLS; col++) {
+            const double depth = -20.0 - 10.0 * sin(row / 7.0) * cos(col / 9.0) - ((row * 31 + col * 17) % 200) / 100.0;
+
+            surf->array[row][col] = (float)(round(depth * 100.0) / 100.0);
+            if (((row - 300) * (row - 300) + (col - 45) * (col - 45) < 400) || (row < 5 && col < 3)) {
+                surf->array[row][col] = TEST_NODATA;
+            }
+        }
+    }
+
+    csurf->inputfp = surf->inputfp;
+    csurf->projection = surf->projection;
+    csurf->geotransform = geotransform;
+    csurf->nodata = TEST_NODATA;
+    csurf->nodatacode = COMPACT_LOW;
+    csurf->basecm = -2500;
+    csurf->rows = TEST_ROWS;
+    csurf->cols = TEST_COLS;
+    csurf->array = createCompactArray(TEST_COLS, TEST_ROWS);
+    for (int row = 0; row < TEST_ROWS; row++) {
+        encodeCompactRow(csurf, surf->array[row], csurf->array[row]);
+    }
+
+    if (smoothLaplacian(TEST_ITERATIONS, surf) == FALSE || smoothLaplacianCompact(TEST_ITERATIONS, csurf) == FALSE) {
+        printf("Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+
+    for (int row = 0; row < TEST_ROWS; row++) {
+        decodeCompactRow(csurf, row, line);
+
+        for (int col = 0; col < TEST_COLS; col++) {
+            const char nodata = (fabs(surf->array[row][col] - TEST_NODATA) < EPSILON);
+            const double diff = (double)line[col] - (double)surf->array[row][col];
+
+            if (nodata != (fabs(line[col] - TEST_NODATA) < EPSILON)) {
+                failed++;
+            }   else if (!nodata && (diff < -1e-4 || diff > 0.01 + 1e-4)) {     // Float32 resolution of ~30 m depths
+                failed++;
+            }
+            maxdiff = (!nodata && diff > maxdiff) ? diff : maxdiff;
+        }
+    }
+
+    printf("Compact vs float32 Laplacian (%d iterations): max difference %.4f m, %d faulty cells\n", TEST_ITERATIONS, maxdiff, failed);
+
+    freeFloatArray(surf->array, TEST_ROWS);
+    freeCompactArray(csurf->array, TEST_ROWS);
+    free(surf);
+    free(csurf);
+    free(line);
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}